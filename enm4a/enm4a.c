@@ -4,11 +4,19 @@
 
 #include "enm4a.h"
 #include "enm4a_http_header.h"
+#include "enm4a_internal.h"
+#include "enm4a_cover.h"
+#include "enm4a_fanout.h"
+#include "enm4a_io.h"
+#include "enm4a_pipeline.h"
+#include "enm4a_readahead.h"
+#include "enm4a_segment.h"
 
 #include <stdint.h>
 #include <string.h>
 #include <malloc.h>
 #include <stdio.h>
+#include <math.h>
 #include <time.h>
 
 #include "cstr_util.h"
@@ -20,18 +28,14 @@
 #include "libavutil/timestamp.h"
 #include "libavutil/audio_fifo.h"
 #include "libavutil/channel_layout.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
 #include "libswresample/swresample.h"
 
-#if LIBAVCODEC_VERSION_MAJOR < 59 || LIBAVCODEC_VERSION_MINOR < 23 || LIBAVCODEC_VERSION_MICRO < 100
-#define OLD_CHANNEL_LAYOUT 1
-#else
-#define NEW_CHANNEL_LAYOUT 1
-#endif
-
-#if NEW_CHANNEL_LAYOUT
-#define GET_AV_CODEC_CHANNELS(context) (context->ch_layout.nb_channels)
+#ifdef _WIN32
+#include <io.h>
 #else
-#define GET_AV_CODEC_CHANNELS(context) (context->channels)
+#include <unistd.h>
 #endif
 
 #ifdef _WIN32
@@ -47,15 +51,39 @@
 #define ts2ts(t) (t.tv_sec * 1000000000ll + t.tv_nsec)
 #endif
 
-const AVCodec* find_aac_codec_encoder() {
-    const AVCodec* c = avcodec_find_encoder(AV_CODEC_ID_AAC);
-    return c;
+/// AAC encoders tried in order when encoder is not specified
+static const char* const aac_encoder_preference[] = { "libfdk_aac", "aac_at", "aac", NULL };
+
+const AVCodec* find_aac_codec_encoder(const char* name) {
+    if (!name) {
+        for (int i = 0; aac_encoder_preference[i]; i++) {
+            const AVCodec* c = find_aac_codec_encoder(aac_encoder_preference[i]);
+            if (c) return c;
+        }
+        return avcodec_find_encoder(AV_CODEC_ID_AAC);
+    }
+    const AVCodec* c = avcodec_find_encoder_by_name(strcmp(name, "native") ? name : "aac");
+    return c && c->id == AV_CODEC_ID_AAC ? c : NULL;
+}
+
+const char* enm4a_aac_encoder_name(const char* name) {
+    const AVCodec* c = find_aac_codec_encoder(name);
+    return c ? c->name : NULL;
 }
 
 ENM4A_ERROR enm4a_is_supported_sample_rates(int sample_rate, int* result) {
+    return enm4a_encoder_supports_sample_rate(NULL, sample_rate, result);
+}
+
+ENM4A_ERROR enm4a_encoder_supports_sample_rate(const char* encoder, int sample_rate, int* result) {
     if (!result) return ENM4A_NULL_POINTER;
-    const AVCodec* c = find_aac_codec_encoder();
+    const AVCodec* c = find_aac_codec_encoder(encoder);
     if (!c) return ENM4A_NO_ENCODER;
+    // Encoders without the list accept any sample rate, e.g. aac_at.
+    if (!c->supported_samplerates) {
+        *result = sample_rate > 0;
+        return ENM4A_OK;
+    }
     int i = 0;
     while (c->supported_samplerates[i] != 0) {
         if (sample_rate == c->supported_samplerates[i]) {
@@ -82,6 +110,11 @@ void set_audio_samplerate(const AVCodecContext* in, AVCodecContext* out, const A
     }
     int sr = in->sample_rate;
     int i = 0;
+    if (!oc->supported_samplerates) {
+        out->sample_rate = sr;
+        if (err) *err = ENM4A_OK;
+        return;
+    }
     while (oc->supported_samplerates[i] != 0) {
         if (sr == oc->supported_samplerates[i]) {
             out->sample_rate = sr;
@@ -96,13 +129,81 @@ void set_audio_samplerate(const AVCodecContext* in, AVCodecContext* out, const A
 
 void log_packet(const AVFormatContext* fmt_ctx, const AVPacket* pkt, const char* tag) {
     AVRational* time_base = &fmt_ctx->streams[pkt->stream_index]->time_base;
+    if (enm4a_trace_enabled()) {
+        ENM4A_TRACE_RECORD r;
+        memset(&r, 0, sizeof(r));
+        r.type = strcmp(tag, "in") ? ENM4A_TRACE_PACKET_OUT : ENM4A_TRACE_PACKET_IN;
+        r.pts = pkt->pts;
+        r.dts = pkt->dts;
+        r.duration = pkt->duration;
+        r.time_base_num = time_base->num;
+        r.time_base_den = time_base->den;
+        r.stream_index = pkt->stream_index;
+        r.size = pkt->size;
+        enm4a_trace_push(&r);
+        return;
+    }
     printf("%s: pts:%s pts_time:%s dts:%s dts_time:%s duration:%s duration_time:%s stream_index:%d\n",
-        tag, av_ts2str(pkt->pts), av_ts2timestr(pkt->dts, time_base),
+        tag, av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, time_base),
         av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, time_base),
         av_ts2str(pkt->duration), av_ts2timestr(pkt->duration, time_base),
         pkt->stream_index);
 }
 
+void log_fifo_size(int size) {
+    if (enm4a_trace_enabled()) {
+        ENM4A_TRACE_RECORD r;
+        memset(&r, 0, sizeof(r));
+        r.type = ENM4A_TRACE_FIFO_SIZE;
+        r.value = size;
+        enm4a_trace_push(&r);
+        return;
+    }
+    printf("the size of fifo: %d\n", size);
+}
+
+void init_progress_timer(ENM4A_PROGRESS_TIMER* t) {
+    if (!t) return;
+#ifdef _WIN32
+    t->last.dwHighDateTime = 0;
+    t->last.dwLowDateTime = 0;
+#elif defined(HAVE_CLOCK_GETTIME)
+    t->last.tv_sec = LLONG_MIN;
+    t->last.tv_nsec = 0;
+#else
+    t->last = LLONG_MIN;
+#endif
+}
+
+int progress_timer_check(ENM4A_PROGRESS_TIMER* t) {
+    if (!t) return 0;
+#ifdef _WIN32
+    FILETIME tnow;
+    GetSystemTimePreciseAsFileTime(&tnow);
+    size_t ts = ft2ts(tnow) - ft2ts(t->last);
+    if (ts >= 2000000ull) {
+        t->last = tnow;
+        return 1;
+    }
+#elif defined(HAVE_CLOCK_GETTIME)
+    struct timespec tnow;
+    if (!clock_gettime(CLOCK_REALTIME, &tnow)) {
+        time_t ts = ts2ts(tnow) - ts2ts(t->last);
+        if (ts >= 200000000ll) {
+            t->last = tnow;
+            return 1;
+        }
+    }
+#else
+    time_t tnow = time(NULL);
+    if (t->last < tnow) {
+        t->last = tnow;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
 #define LOG_PROGRESS_BUFSIZE 256
 
 void log_progress(const AVFormatContext* ctx, int64_t pts, AVRational base) {
@@ -141,6 +242,117 @@ void log_progress(const AVFormatContext* ctx, int64_t pts, AVRational base) {
     fflush(stdout);
 }
 
+void init_progress_sink(ENM4A_PROGRESS_SINK* sink, const ENM4A_ARGS* args) {
+    if (!sink || !args) return;
+    memset(sink, 0, sizeof(ENM4A_PROGRESS_SINK));
+    init_progress_timer(&sink->timer);
+    sink->print = args->level <= ENM4A_LOG_DEBUG && !args->quiet;
+    sink->callback = args->progress;
+    sink->opaque = args->progress_opaque;
+    sink->timing = sink->callback && !enm4a_mutex_init(&sink->lock);
+    sink->start = av_gettime_relative();
+    sink->first_packet = -1;
+    sink->duration = -1;
+}
+
+void free_progress_sink(ENM4A_PROGRESS_SINK* sink) {
+    if (!sink) return;
+    if (sink->timing) enm4a_mutex_destroy(&sink->lock);
+    sink->timing = 0;
+}
+
+int64_t stage_start(const ENM4A_PROGRESS_SINK* sink) {
+    return sink && sink->timing ? av_gettime_relative() : 0;
+}
+
+void stage_end(ENM4A_PROGRESS_SINK* sink, ENM4A_STAGE stage, int64_t start) {
+    if (!sink || !sink->timing || !start) return;
+    int64_t elapsed = av_gettime_relative() - start;
+    enm4a_mutex_lock(&sink->lock);
+    sink->stage_time[stage] += elapsed;
+    enm4a_mutex_unlock(&sink->lock);
+}
+
+void mark_first_packet(ENM4A_PROGRESS_SINK* sink) {
+    if (!sink || sink->first_packet >= 0) return;
+    int64_t now = av_gettime_relative() - sink->start;
+    if (sink->timing) enm4a_mutex_lock(&sink->lock);
+    sink->first_packet = now;
+    if (sink->timing) enm4a_mutex_unlock(&sink->lock);
+}
+
+static void call_progress(ENM4A_PROGRESS_SINK* sink, const AVFormatContext* oc, int64_t time, char finished) {
+    ENM4A_PROGRESS progress;
+    progress.input_size = sink->ic && sink->ic->pb ? avio_tell(sink->ic->pb) : -1;
+    progress.output_size = oc->pb ? avio_size(oc->pb) : -1;
+    if (progress.output_size <= 0 && oc->pb) progress.output_size = avio_tell(oc->pb);
+    progress.time = time;
+    if (sink->duration >= 0) {
+        progress.duration = sink->duration;
+    } else {
+        progress.duration = sink->ic && sink->ic->duration != AV_NOPTS_VALUE ? sink->ic->duration : -1;
+    }
+    progress.elapsed = av_gettime_relative() - sink->start;
+    enm4a_mutex_lock(&sink->lock);
+    memcpy(progress.stage_time, sink->stage_time, sizeof(progress.stage_time));
+    progress.first_packet = sink->first_packet;
+    enm4a_mutex_unlock(&sink->lock);
+    progress.finished = finished;
+    sink->callback(sink->opaque, &progress);
+}
+
+void update_progress(ENM4A_PROGRESS_SINK* sink, const AVFormatContext* oc, int64_t pts, AVRational base) {
+    if (!sink || (!sink->print && !sink->timing)) return;
+    if (!progress_timer_check(&sink->timer)) return;
+    if (sink->print) log_progress(oc, pts, base);
+    if (sink->timing) call_progress(sink, oc, pts < 0 ? 0 : av_rescale_q(pts, base, AV_TIME_BASE_Q), 0);
+}
+
+void finish_progress(ENM4A_PROGRESS_SINK* sink, const AVFormatContext* oc, int64_t time) {
+    if (!sink || !sink->timing) return;
+    call_progress(sink, oc, time, 1);
+}
+
+/**
+ * @brief Check whether codec parameters from container headers are enough to convert without avformat_find_stream_info.
+ * Fill duration of input from streams if it is unknown.
+ * @return 1 if complete.
+*/
+int stream_info_complete(AVFormatContext* ic) {
+    char has_audio = 0;
+    // Streams of these formats are only known after reading packets.
+    if (!ic->nb_streams || ic->iformat->flags & AVFMT_NOHEADER) return 0;
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        const AVCodecParameters* par = ic->streams[i]->codecpar;
+        if (par->codec_id == AV_CODEC_ID_NONE) return 0;
+        if (par->codec_type != AVMEDIA_TYPE_AUDIO) continue;
+        if (par->sample_rate <= 0 || GET_AV_CODEC_CHANNELS(par) <= 0) return 0;
+        // Copied AAC stream needs AudioSpecificConfig for mp4.
+        if (par->codec_id == AV_CODEC_ID_AAC && !par->extradata_size) return 0;
+        has_audio = 1;
+    }
+    if (!has_audio) return 0;
+    if (ic->duration == AV_NOPTS_VALUE) {
+        for (unsigned int i = 0; i < ic->nb_streams; i++) {
+            const AVStream* is = ic->streams[i];
+            if (is->duration == AV_NOPTS_VALUE) continue;
+            int64_t duration = av_rescale_q(is->duration, is->time_base, AV_TIME_BASE_Q);
+            if (ic->duration == AV_NOPTS_VALUE || duration > ic->duration) ic->duration = duration;
+        }
+    }
+    return 1;
+}
+
+void discard_unused_streams(AVFormatContext* ic, unsigned int audio_stream_index, int img_stream_index, ENM4A_LOG level) {
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        if (i == audio_stream_index || (img_stream_index >= 0 && i == (unsigned int)img_stream_index)) continue;
+        ic->streams[i]->discard = AVDISCARD_ALL;
+        if (level >= ENM4A_LOG_VERBOSE) {
+            printf("Discard stream %u (%s).\n", i, avcodec_get_name(ic->streams[i]->codecpar->codec_id));
+        }
+    }
+}
+
 void set_ctx_metadata(AVFormatContext *ctx, const AVFormatContext *in, const char* key, const char* argu) {
     if (!argu || !strlen(argu)) {
         if (in->metadata) {
@@ -154,48 +366,264 @@ void set_ctx_metadata(AVFormatContext *ctx, const AVFormatContext *in, const cha
     }
 }
 
-ENM4A_ERROR convert_samples_and_add_to_fifo(int* ret, AVCodecContext* out, SwrContext* sw, AVFrame* frame, AVAudioFifo* fifo) {
-    if (!ret || !out || !sw || !frame || !fifo) return ENM4A_NULL_POINTER;
-    uint8_t** converted_input_samples = NULL;
+void free_convert_buffer(ENM4A_CONVERT_BUFFER* buf) {
+    if (!buf) return;
+    if (buf->data) {
+        av_freep(&buf->data[0]);
+        free(buf->data);
+        buf->data = NULL;
+    }
+    buf->nb_samples = 0;
+}
+
+/**
+ * @brief Make sure convert buffer can hold nb_samples samples. Buffer grows geometrically.
+ * @param allocations Increased when a new buffer is allocated.
+*/
+ENM4A_ERROR reserve_convert_buffer(int* ret, ENM4A_CONVERT_BUFFER* buf, AVCodecContext* out, int nb_samples, int64_t* allocations) {
+    if (!ret || !buf || !out || !allocations) return ENM4A_NULL_POINTER;
+    if (buf->data && buf->nb_samples >= nb_samples) return ENM4A_OK;
+    int size = FFMAX(nb_samples, buf->nb_samples * 2);
+    if (!buf->data) {
+        if (!(buf->data = calloc(GET_AV_CODEC_CHANNELS(out), sizeof(void*)))) {
+            return ENM4A_NO_MEMORY;
+        }
+    } else {
+        av_freep(&buf->data[0]);
+    }
+    buf->nb_samples = 0;
+    if ((*ret = av_samples_alloc(buf->data, NULL, GET_AV_CODEC_CHANNELS(out), size, out->sample_fmt, 0)) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    buf->nb_samples = size;
+    (*allocations)++;
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Make sure FIFO have space for nb_samples samples. FIFO grows geometrically.
+ * @param allocations Increased when FIFO is reallocated.
+*/
+ENM4A_ERROR reserve_fifo(int* ret, AVAudioFifo* fifo, int nb_samples, int64_t* allocations) {
+    if (!ret || !fifo || !allocations) return ENM4A_NULL_POINTER;
+    if (av_audio_fifo_space(fifo) >= nb_samples) return ENM4A_OK;
+    int size = av_audio_fifo_size(fifo);
+    if ((*ret = av_audio_fifo_realloc(fifo, FFMAX(size + nb_samples, (size + av_audio_fifo_space(fifo)) * 2))) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    (*allocations)++;
+    return ENM4A_OK;
+}
+
+/// @return 1 if decoded samples can not be sent to encoder directly.
+int need_resample(const AVCodecContext* in, const AVCodecContext* out) {
+    if (!in || !out) return 1;
+    if (in->sample_fmt != out->sample_fmt || in->sample_rate != out->sample_rate) return 1;
+    if (GET_AV_CODEC_CHANNELS(in) != GET_AV_CODEC_CHANNELS(out)) return 1;
+#if NEW_CHANNEL_LAYOUT
+    if (in->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC) return 0;
+    return av_channel_layout_compare(&in->ch_layout, &out->ch_layout) != 0;
+#else
+    return in->channel_layout && in->channel_layout != out->channel_layout;
+#endif
+}
+
+/**
+ * @brief Apply resampler profile and initialize resampler.
+ * High quality profile uses soxr if libswresample is built with it.
+*/
+ENM4A_ERROR init_resample_context(int* ret, SwrContext* sw, ENM4A_RESAMPLER profile, ENM4A_LOG level) {
+    if (!ret || !sw) return ENM4A_NULL_POINTER;
+    switch (profile) {
+    case ENM4A_RESAMPLER_FAST:
+        av_opt_set_int(sw, "filter_size", 8, 0);
+        av_opt_set_int(sw, "phase_shift", 6, 0);
+        break;
+    case ENM4A_RESAMPLER_HIGH:
+        av_opt_set_int(sw, "resampler", SWR_ENGINE_SOXR, 0);
+        av_opt_set_double(sw, "precision", 28, 0);
+        if ((*ret = swr_init(sw)) >= 0) {
+            if (level >= ENM4A_LOG_VERBOSE) {
+                printf("Use soxr resampler.\n");
+            }
+            return ENM4A_OK;
+        }
+        if (level >= ENM4A_LOG_VERBOSE) {
+            printf("soxr resampler is not available, use high quality settings of swr resampler instead.\n");
+        }
+        av_opt_set_int(sw, "resampler", SWR_ENGINE_SWR, 0);
+        av_opt_set_int(sw, "filter_size", 64, 0);
+        av_opt_set_int(sw, "phase_shift", 14, 0);
+        break;
+    default:
+        break;
+    }
+    if ((*ret = swr_init(sw)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    return ENM4A_OK;
+}
+
+static ENM4A_ERROR convert_samples(int* ret, AVCodecContext* out, SwrContext* sw, AVFrame* frame, AVAudioFifo* fifo, ENM4A_CONVERT_BUFFER* buf, int64_t* allocations) {
     ENM4A_ERROR re = ENM4A_OK;
-    if (!(converted_input_samples = malloc(sizeof(void*) * GET_AV_CODEC_CHANNELS(out)))) {
-        re = ENM4A_NO_MEMORY;
-        goto end;
+    int nb_samples = frame ? frame->nb_samples : 0, converted;
+    if (!sw) {
+        if (!frame) return ENM4A_OK;
+        if (frame->format != out->sample_fmt || frame->sample_rate != out->sample_rate || GET_AV_CODEC_CHANNELS(frame) != GET_AV_CODEC_CHANNELS(out)) {
+            av_log(NULL, AV_LOG_ERROR, "Audio format of decoded frame is changed.\n");
+            *ret = AVERROR_INVALIDDATA;
+            return ENM4A_FFMPEG_ERR;
+        }
+        if ((re = reserve_fifo(ret, fifo, nb_samples, allocations)) != ENM4A_OK) {
+            return re;
+        }
+        if (av_audio_fifo_write(fifo, (void**)frame->extended_data, nb_samples) < nb_samples) {
+            return ENM4A_FIFO_WRITE_ERR;
+        }
+        return ENM4A_OK;
     }
-    if ((*ret = av_samples_alloc(converted_input_samples, NULL, GET_AV_CODEC_CHANNELS(out), frame->nb_samples, out->sample_fmt, 0)) < 0) {
-        re = ENM4A_NO_MEMORY;
-        goto end;
+    if ((*ret = swr_get_out_samples(sw, nb_samples)) < 0) {
+        return ENM4A_FFMPEG_ERR;
     }
-    if ((*ret = swr_convert(sw, converted_input_samples, frame->nb_samples, (const uint8_t**)frame->extended_data, frame->nb_samples)) < 0) {
-        re = ENM4A_FFMPEG_ERR;
-        goto end;
+    if ((re = reserve_convert_buffer(ret, buf, out, *ret, allocations)) != ENM4A_OK) {
+        return re;
     }
-    if ((*ret = av_audio_fifo_realloc(fifo, av_audio_fifo_size(fifo) + frame->nb_samples)) < 0) {
-        re = ENM4A_NO_MEMORY;
-        goto end;
+    if ((*ret = swr_convert(sw, buf->data, buf->nb_samples, frame ? (const uint8_t**)frame->extended_data : NULL, nb_samples)) < 0) {
+        return ENM4A_FFMPEG_ERR;
     }
-    if (av_audio_fifo_write(fifo, (void**)converted_input_samples, frame->nb_samples) < frame->nb_samples) {
-        re = ENM4A_FIFO_WRITE_ERR;
-        goto end;
+    converted = *ret;
+    if (!converted) return ENM4A_OK;
+    if ((re = reserve_fifo(ret, fifo, converted, allocations)) != ENM4A_OK) {
+        return re;
     }
-end:
-    if (converted_input_samples) {
-        av_freep(&converted_input_samples[0]);
-        free(converted_input_samples);
+    if (av_audio_fifo_write(fifo, (void**)buf->data, converted) < converted) {
+        return ENM4A_FIFO_WRITE_ERR;
     }
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Convert samples and add them to FIFO.
+ * @param sw Resampler. If NULL, samples of frame are added to FIFO directly.
+ * @param frame Decoded frame. NULL to flush samples buffered in resampler.
+ * @param buf Convert buffer.
+ * @param allocations Increased when buffer or FIFO is reallocated.
+ * @param progress Resample time is added to it. Can be NULL.
+*/
+ENM4A_ERROR convert_samples_and_add_to_fifo(int* ret, AVCodecContext* out, SwrContext* sw, AVFrame* frame, AVAudioFifo* fifo, ENM4A_CONVERT_BUFFER* buf, int64_t* allocations, ENM4A_PROGRESS_SINK* progress) {
+    if (!ret || !out || !fifo || !buf || !allocations) return ENM4A_NULL_POINTER;
+    int64_t start = stage_start(progress);
+    ENM4A_ERROR re = convert_samples(ret, out, sw, frame, fifo, buf, allocations);
+    stage_end(progress, ENM4A_STAGE_RESAMPLE, start);
     return re;
 }
 
-ENM4A_ERROR encode_audio_frame(int* ret, AVFrame* frame, AVFormatContext* oc, AVCodecContext* occ, char* writed_data, int64_t* pts, ENM4A_LOG level, unsigned int stream_index) {
-    if (!oc || !occ || !ret) return ENM4A_NULL_POINTER;
+int trim_frame(ENM4A_TRIM* trim, AVFrame* frame) {
+    if (!trim || !frame || frame->sample_rate <= 0) return 1;
+    AVRational sr = { 1, frame->sample_rate };
+    int64_t first;
+    if (frame->pts != AV_NOPTS_VALUE) {
+        first = av_rescale_q(frame->pts, trim->time_base, sr);
+    } else if (trim->next != INT64_MIN) {
+        first = trim->next;
+    } else {
+        return 1;
+    }
+    trim->next = first + frame->nb_samples;
+    int64_t skip = 0, keep = frame->nb_samples;
+    if (trim->start != INT64_MIN) {
+        int64_t start = av_rescale_q(trim->start, trim->time_base, sr);
+        if (start > first) skip = FFMIN(start - first, (int64_t)frame->nb_samples);
+    }
+    if (trim->end != INT64_MAX) {
+        int64_t end = av_rescale_q(trim->end, trim->time_base, sr);
+        if (end < first + keep) keep = end - first;
+    }
+    keep -= skip;
+    if (keep <= 0) return 0;
+    if (skip) {
+        int channels = GET_AV_CODEC_CHANNELS(frame);
+        int planar = av_sample_fmt_is_planar(frame->format);
+        int offset = (int)skip * av_get_bytes_per_sample(frame->format) * (planar ? 1 : channels);
+        for (int i = 0; i < (planar ? channels : 1); i++) {
+            frame->extended_data[i] += offset;
+            if (frame->extended_data != frame->data && i < AV_NUM_DATA_POINTERS) frame->data[i] = frame->extended_data[i];
+        }
+        if (frame->pts != AV_NOPTS_VALUE) frame->pts += av_rescale_q(skip, sr, trim->time_base);
+    }
+    frame->nb_samples = (int)keep;
+    return 1;
+}
+
+int trim_packet_after_end(const ENM4A_TRIM* trim, const AVPacket* pkt) {
+    if (!trim || !pkt || trim->end == INT64_MAX || pkt->pts == AV_NOPTS_VALUE) return 0;
+    return pkt->pts >= trim->end;
+}
+
+/**
+ * @brief Send a packet to decoder, then convert all decoded samples and add them to FIFO.
+ * @param pkt Packet. NULL to flush decoder and resampler.
+ * @param frame Frame used to receive data from decoder.
+ * @param out Encoder. If NULL, decoded frames are only measured by meter and fingerprint.
+ * @param meter Loudness meter. Can be NULL.
+ * @param fingerprint Can be NULL.
+ * @param trim Samples outside of range are dropped. Can be NULL.
+ * @param progress Decode and resample time is added to it. Can be NULL.
+*/
+ENM4A_ERROR decode_audio_packet(int* ret, AVCodecContext* dec, const AVPacket* pkt, AVFrame* frame, AVCodecContext* out, SwrContext* sw, AVAudioFifo* fifo, ENM4A_CONVERT_BUFFER* buf, int64_t* allocations, ENM4A_LOUDNESS* meter, ENM4A_FINGERPRINT* fingerprint, ENM4A_TRIM* trim, ENM4A_PROGRESS_SINK* progress) {
+    if (!ret || !dec || !frame) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    int64_t start = stage_start(progress);
+    if ((*ret = avcodec_send_packet(dec, pkt)) < 0 && *ret != AVERROR_EOF) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    while (1) {
+        *ret = avcodec_receive_frame(dec, frame);
+        stage_end(progress, ENM4A_STAGE_DECODE, start);
+        if (*ret == AVERROR(EAGAIN) || *ret == AVERROR_EOF) {
+            *ret = 0;
+            break;
+        } else if (*ret < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+        if (!trim_frame(trim, frame)) {
+            av_frame_unref(frame);
+            start = stage_start(progress);
+            continue;
+        }
+        if (meter && (re = enm4a_loudness_add_frame(meter, frame)) != ENM4A_OK) {
+            if (re == ENM4A_FFMPEG_ERR) *ret = AVERROR_INVALIDDATA;
+            av_frame_unref(frame);
+            return re;
+        }
+        if (fingerprint && (re = enm4a_fingerprint_add_frame(fingerprint, frame)) != ENM4A_OK) {
+            if (re == ENM4A_FFMPEG_ERR) *ret = AVERROR_INVALIDDATA;
+            av_frame_unref(frame);
+            return re;
+        }
+        if (out) re = convert_samples_and_add_to_fifo(ret, out, sw, frame, fifo, buf, allocations, progress);
+        av_frame_unref(frame);
+        if (re != ENM4A_OK) return re;
+        start = stage_start(progress);
+    }
+    if (!pkt && out) {
+        return convert_samples_and_add_to_fifo(ret, out, sw, NULL, fifo, buf, allocations, progress);
+    }
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Send a frame to encoder and write encoded packet to output.
+ * @param frame Frame. NULL to flush encoder.
+ * @param pkt Packet used to receive data from encoder. Reused between calls.
+ * @param progress Encode and mux time is added to it. Can be NULL.
+*/
+ENM4A_ERROR encode_audio_frame(int* ret, AVFrame* frame, AVFormatContext* oc, AVCodecContext* occ, AVPacket* pkt, char* writed_data, int64_t* pts, ENM4A_LOG level, unsigned int stream_index, ENM4A_PROGRESS_SINK* progress) {
+    if (!oc || !occ || !ret || !pkt) return ENM4A_NULL_POINTER;
     if (frame && !pts) return ENM4A_NULL_POINTER;
     ENM4A_ERROR re = ENM4A_OK;
+    int64_t start = stage_start(progress);
     *writed_data = 0;
-    AVPacket* pkt = av_packet_alloc();
-    if (!pkt) {
-        re = ENM4A_NO_MEMORY;
-        goto end;
-    }
     if (frame) {
         frame->pts = *pts;
         *pts += frame->nb_samples;
@@ -209,6 +637,7 @@ ENM4A_ERROR encode_audio_frame(int* ret, AVFrame* frame, AVFormatContext* oc, AV
         }
     }
     *ret = avcodec_receive_packet(occ, pkt);
+    stage_end(progress, ENM4A_STAGE_ENCODE, start);
     if (*ret >= 0) {
         *writed_data = 1;
     } else if (*ret == AVERROR_EOF || *ret == AVERROR(EAGAIN)) {
@@ -221,23 +650,368 @@ ENM4A_ERROR encode_audio_frame(int* ret, AVFrame* frame, AVFormatContext* oc, AV
     if (*writed_data && pkt) {
         pkt->stream_index = stream_index;
     }
+    start = stage_start(progress);
     if (*writed_data && (*ret = av_write_frame(oc, pkt)) < 0) {
         re = ENM4A_FFMPEG_ERR;
         goto end;
     }
-    if (level >= ENM4A_LOG_TRACE) {
+    stage_end(progress, ENM4A_STAGE_MUX, start);
+    if (log_packet_enabled(level)) {
         log_packet(oc, pkt, "out");
     }
 end:
-    if (pkt) {
-        av_packet_free(&pkt);
+    av_packet_unref(pkt);
+    return re;
+}
+
+/**
+ * @brief Encode samples in FIFO with the frame size of encoder.
+ * @param frame Frame which have buffers with the frame size of encoder.
+ * @param flush Encode all remaining samples and flush encoder.
+*/
+ENM4A_ERROR encode_fifo_frames(int* ret, AVAudioFifo* fifo, AVFrame* frame, AVFormatContext* oc, AVCodecContext* occ, AVPacket* pkt, int64_t* pts, char flush, ENM4A_LOG level, unsigned int stream_index, int64_t* allocations, ENM4A_PROGRESS_SINK* progress) {
+    if (!ret || !fifo || !frame || !occ || !allocations) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    char write_data = 0;
+    if (log_packet_enabled(level)) {
+        log_fifo_size(av_audio_fifo_size(fifo));
+    }
+    while (av_audio_fifo_size(fifo) >= occ->frame_size || (flush && av_audio_fifo_size(fifo) > 0)) {
+        frame->nb_samples = FFMIN(av_audio_fifo_size(fifo), occ->frame_size);
+        if (!av_frame_is_writable(frame)) {
+            // Encoder still holds a reference of the buffer.
+            if ((*ret = av_frame_make_writable(frame)) < 0) {
+                return ENM4A_NO_MEMORY;
+            }
+            (*allocations)++;
+        }
+        if ((*ret = av_audio_fifo_read(fifo, (void**)frame->data, frame->nb_samples)) < 0) {
+            return ENM4A_NO_MEMORY;
+        }
+        if ((re = encode_audio_frame(ret, frame, oc, occ, pkt, &write_data, pts, level, stream_index, progress)) != ENM4A_OK) {
+            return re;
+        }
+        if (log_packet_enabled(level)) {
+            log_fifo_size(av_audio_fifo_size(fifo));
+        }
+    }
+    if (flush) {
+        while (1) {
+            if ((re = encode_audio_frame(ret, NULL, oc, occ, pkt, &write_data, NULL, level, stream_index, progress)) != ENM4A_OK) {
+                return re;
+            }
+            if (!write_data) break;
+        }
+    }
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Ask user or follow overwrite option if output file already exists. Existing file will be removed if overwrite.
+ * @return ENM4A_OK if output file can be written.
+*/
+ENM4A_ERROR check_output_file(const char* out, ENM4A_OVERWRITE overwrite) {
+    if (!out) return ENM4A_NULL_POINTER;
+    if (!fileop_exists(out)) return ENM4A_OK;
+    int ok = 0;
+    if (overwrite != ENM4A_OVERWRITE_ASK) {
+        if (overwrite == ENM4A_OVERWRITE_YES) ok = 1;
+    } else {
+        printf("Output file already exists, do you want to overwrite it? (y/n)");
+        int c = getchar();
+        while (c != 'y' && c != 'n') {
+            c = getchar();
+        }
+        if (c == 'y') ok = 1;
+    }
+    if (!ok) return ENM4A_FILE_EXISTS;
+    if (!fileop_remove(out)) return ENM4A_ERR_REMOVE_FILE;
+    return ENM4A_OK;
+}
+
+ENM4A_OVERWRITE get_output_overwrite(const ENM4A_ARGS* args, const char* out) {
+    if (!args || !out) return ENM4A_OVERWRITE_NO;
+    for (size_t i = 0; i < args->replaceable_output_count; i++) {
+        if (args->replaceable_outputs[i] && !strcmp(args->replaceable_outputs[i], out)) return ENM4A_OVERWRITE_YES;
+    }
+    return args->overwrite;
+}
+
+ENM4A_ERROR write_cover_packet(int* ret, AVFormatContext* oc, unsigned int dest_index, const AVStream* is, const AVPacket* src, ENM4A_LOG level) {
+    if (!ret || !oc || !is || !src) return ENM4A_NULL_POINTER;
+    AVStream* os = oc->streams[dest_index];
+    AVPacket pkt;
+    memset(&pkt, 0, sizeof(AVPacket));
+    if ((*ret = av_packet_ref(&pkt, src)) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    pkt.pts = av_rescale_q_rnd(pkt.pts, is->time_base, os->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+    pkt.dts = av_rescale_q_rnd(pkt.dts, is->time_base, os->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+    pkt.duration = av_rescale_q(pkt.duration, is->time_base, os->time_base);
+    pkt.pos = -1;
+    pkt.stream_index = dest_index;
+    if (log_packet_enabled(level)) {
+        log_packet(oc, &pkt, "out");
+    }
+    *ret = av_interleaved_write_frame(oc, &pkt);
+    av_packet_unref(&pkt);
+    return *ret < 0 ? ENM4A_FFMPEG_ERR : ENM4A_OK;
+}
+
+/// Set threading of a codec context which is not opened yet.
+static void set_codec_threads(AVCodecContext* ctx, int threads, ENM4A_THREAD_TYPE type) {
+    if (threads == ENM4A_THREADS_AUTO) {
+        ctx->thread_count = 0;
+    } else if (threads > 0) {
+        ctx->thread_count = threads;
+    }
+    if (type == ENM4A_THREAD_TYPE_FRAME) {
+        ctx->thread_type = FF_THREAD_FRAME;
+    } else if (type == ENM4A_THREAD_TYPE_SLICE) {
+        ctx->thread_type = FF_THREAD_SLICE;
+    }
+}
+
+/**
+ * @brief Open decoder of a audio stream.
+ * @param args decoder_threads and thread_type are used.
+ * @param dec Result. Should be freed by avcodec_free_context even if failed.
+*/
+ENM4A_ERROR open_audio_decoder(int* ret, const AVStream* is, const ENM4A_ARGS* args, AVCodecContext** dec) {
+    const AVCodec* input_codec = avcodec_find_decoder(is->codecpar->codec_id);
+    if (!input_codec) {
+        return ENM4A_NO_DECODER;
+    }
+    if (!(*dec = avcodec_alloc_context3(input_codec))) {
+        return ENM4A_NO_MEMORY;
+    }
+    if ((*ret = avcodec_parameters_to_context(*dec, is->codecpar)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    // Timestamps of decoded frames are used to trim samples.
+    (*dec)->pkt_timebase = is->time_base;
+    set_codec_threads(*dec, args->decoder_threads, args->thread_type);
+    if ((*ret = avcodec_open2(*dec, input_codec, NULL)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Open AAC encoder and set parameters of output stream.
+ * @param in Decoder
+ * @param os Output stream
+ * @param sample_rate Output sample rate. 0 means choose from the sample rate of input.
+ * @param args default_sample_rate, encoder, encoder_threads and thread_type are used.
+ * @param out Opened encoder
+*/
+ENM4A_ERROR open_audio_encoder(int* ret, AVCodecContext* in, AVFormatContext* oc, AVStream* os, int sample_rate, int64_t bitrate, const ENM4A_ARGS* args, AVCodecContext** out) {
+    if (!ret || !in || !oc || !os || !args || !out) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    const AVCodec* output_codec = NULL;
+    AVCodecContext* enc = NULL;
+    if (!(output_codec = find_aac_codec_encoder(args->encoder))) {
+        return ENM4A_NO_ENCODER;
+    }
+    if (!(enc = avcodec_alloc_context3(output_codec))) {
+        return ENM4A_NO_MEMORY;
+    }
+    set_codec_threads(enc, args->encoder_threads, args->thread_type);
+#if NEW_CHANNEL_LAYOUT
+    av_channel_layout_default(&enc->ch_layout, in->ch_layout.nb_channels);
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+    DISABLE_DEPRECATION_WARNINGS
+    enc->channels = in->channels;
+    enc->channel_layout = av_get_default_channel_layout(enc->channels);
+    ENABLE_DEPRECATION_WARNINGS
+#endif
+    if (sample_rate) {
+        enc->sample_rate = sample_rate;
+    } else {
+        set_audio_samplerate(in, enc, output_codec, args->default_sample_rate, &rev);
+    }
+    if (rev != ENM4A_OK) {
+        goto end;
+    }
+    enc->sample_fmt = output_codec->sample_fmts[0];
+    enc->bit_rate = bitrate;
+    os->time_base.den = enc->sample_rate;
+    os->time_base.num = 1;
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
+        enc->flags |= AVFMT_GLOBALHEADER;
+    }
+    if ((*ret = avcodec_open2(enc, output_codec, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((*ret = avcodec_parameters_from_context(os->codecpar, enc)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+end:
+    if (rev != ENM4A_OK) {
+        avcodec_free_context(&enc);
+    } else {
+        *out = enc;
+    }
+    return rev;
+}
+
+/**
+ * @brief Allocate resampler, convert buffer and FIFO which convert decoded samples for encoder.
+ * @param sw Resampler. Set to NULL if decoded samples can be used by encoder directly.
+*/
+ENM4A_ERROR init_audio_converter(int* ret, AVCodecContext* in, AVCodecContext* out, ENM4A_RESAMPLER profile, ENM4A_LOG level, SwrContext** sw, ENM4A_CONVERT_BUFFER* buf, AVAudioFifo** fifo, int64_t* allocations) {
+    if (!ret || !in || !out || !sw || !buf || !fifo || !allocations) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    // Decoders without fixed frame size usually output less than 4096 samples per frame.
+    int fifo_samples = FFMAX(in->frame_size, 4096);
+    *sw = NULL;
+    if (need_resample(in, out)) {
+#if NEW_CHANNEL_LAYOUT
+        if ((*ret = swr_alloc_set_opts2(sw, &out->ch_layout, out->sample_fmt, out->sample_rate, &in->ch_layout, in->sample_fmt, in->sample_rate, 0, NULL)) < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+#else
+        *sw = swr_alloc_set_opts(NULL, av_get_default_channel_layout(out->channels), out->sample_fmt, out->sample_rate, av_get_default_channel_layout(in->channels), in->sample_fmt, in->sample_rate, 0, NULL);
+#endif
+        if (!*sw) {
+            return ENM4A_NO_MEMORY;
+        }
+        if ((rev = init_resample_context(ret, *sw, profile, level)) != ENM4A_OK) {
+            return rev;
+        }
+        if ((*ret = swr_get_out_samples(*sw, fifo_samples)) < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+        if ((rev = reserve_convert_buffer(ret, buf, out, *ret, allocations)) != ENM4A_OK) {
+            return rev;
+        }
+        fifo_samples = buf->nb_samples;
+    } else if (level >= ENM4A_LOG_VERBOSE) {
+        printf("Decoded samples match encoder input, resampler is not needed.\n");
     }
+    if (!(*fifo = av_audio_fifo_alloc(out->sample_fmt, GET_AV_CODEC_CHANNELS(out), fifo_samples + out->frame_size))) {
+        return ENM4A_NO_MEMORY;
+    }
+    (*allocations)++;
+    return ENM4A_OK;
+}
+
+/// Allocate a frame which can hold the frame size of encoder.
+ENM4A_ERROR alloc_encoder_frame(int* ret, AVCodecContext* out, AVFrame** frame) {
+    if (!ret || !out || !frame) return ENM4A_NULL_POINTER;
+    AVFrame* f = av_frame_alloc();
+    if (!f) return ENM4A_NO_MEMORY;
+#if NEW_CHANNEL_LAYOUT
+    if ((*ret = av_channel_layout_copy(&f->ch_layout, &out->ch_layout)) < 0) {
+        av_frame_free(&f);
+        return ENM4A_FFMPEG_ERR;
+    }
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+    DISABLE_DEPRECATION_WARNINGS
+    f->channel_layout = out->channel_layout;
+    ENABLE_DEPRECATION_WARNINGS
+#endif
+    f->format = out->sample_fmt;
+    f->sample_rate = out->sample_rate;
+    f->nb_samples = out->frame_size;
+    if ((*ret = av_frame_get_buffer(f, 0)) < 0) {
+        av_frame_free(&f);
+        return ENM4A_NO_MEMORY;
+    }
+    *frame = f;
+    return ENM4A_OK;
+}
+
+/// Held while stdout is redirected. Redirection affects the whole process, so conversions to stdout run one by one.
+static ENM4A_MUTEX stdout_lock = ENM4A_MUTEX_INITIALIZER;
+
+/**
+ * @brief Let stdout write to stderr, so messages will not mix with output data.
+ * Waits until other conversions restore stdout.
+ * @param fd File descriptor of original stdout. Output data should be written to it.
+ * @return 0 if successed.
+*/
+int redirect_stdout_to_stderr(int* fd) {
+    if (!fd) return 1;
+    enm4a_mutex_lock(&stdout_lock);
+    fflush(stdout);
+#ifdef _WIN32
+    if ((*fd = _dup(1)) >= 0) {
+        if (_dup2(2, 1) >= 0) return 0;
+        _close(*fd);
+    }
+#else
+    if ((*fd = dup(1)) >= 0) {
+        if (dup2(2, 1) >= 0) return 0;
+        close(*fd);
+    }
+#endif
+    *fd = -1;
+    enm4a_mutex_unlock(&stdout_lock);
+    return 1;
+}
+
+void restore_stdout(int fd) {
+    if (fd < 0) return;
+    fflush(stdout);
+#ifdef _WIN32
+    _dup2(fd, 1);
+    _close(fd);
+#else
+    dup2(fd, 1);
+    close(fd);
+#endif
+    enm4a_mutex_unlock(&stdout_lock);
+}
+
+/**
+ * @brief Estimate the size of moov box written by mov muxer.
+ * @param packets Audio packet count
+ * @param media_size Size of audio data
+ * @param extra Size of data stored in moov, such as metadata and cover
+ * @param constant_duration Whether all audio packets have same duration
+ * @return Estimated size with some margin
+*/
+int64_t estimate_moov_size(int64_t packets, int64_t media_size, int64_t extra, char constant_duration) {
+    // mov muxer merges contiguous samples into chunks up to 1 MiB
+    int64_t chunks = media_size / (1 << 20) + 2;
+    // stsz entry per packet; co64 and stsc entry per chunk
+    int64_t size = packets * 4 + chunks * 20;
+    // stts entry per run of same duration
+    size += constant_duration ? 16 : (packets / 16 + 2) * 8;
+    // Other boxes: mvhd, tkhd, mdhd, hdlr, stsd, elst, sgpd, ilst headers and so on.
+    size += 4096 + extra;
+    return size + size / 10;
+}
+
+/**
+ * @brief Write tags measured while converting to a finished output. All tags are saved at once.
+ * @param loudness NULL to skip loudness tags.
+ * @param fingerprint NULL or empty to skip fingerprint tag.
+ * @param faststart Keep moov box before media data. If muxer left moov box at the end, it is moved to the front.
+*/
+static ENM4A_ERROR write_measured_tags(int* ret, const char* path, const ENM4A_LOUDNESS_RESULT* loudness, const char* fingerprint, char faststart) {
+    ENM4A_ERROR re = ENM4A_OK;
+    ENM4A_MP4* mp4 = NULL;
+    if ((re = enm4a_mp4_open(ret, path, &mp4)) != ENM4A_OK) {
+        return re;
+    }
+    if (loudness) re = enm4a_set_loudness_tags(mp4, loudness);
+    if (re == ENM4A_OK && fingerprint && *fingerprint) re = enm4a_set_fingerprint_tag(mp4, fingerprint);
+    if (re == ENM4A_OK) re = faststart ? enm4a_mp4_save_faststart(ret, mp4) : enm4a_mp4_save(ret, mp4);
+    enm4a_mp4_free(&mp4);
     return re;
 }
 
-ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
-    if (!input) return ENM4A_NULL_POINTER;
-    switch (args.level) {
+ENM4A_ERROR check_conversion_args(const ENM4A_ARGS* args) {
+    if (!args) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    int is_supported = 0;
+    switch (args->level) {
     case ENM4A_LOG_VERBOSE:
         av_log_set_level(AV_LOG_VERBOSE);
         break;
@@ -247,78 +1021,191 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
     case ENM4A_LOG_TRACE:
         av_log_set_level(AV_LOG_TRACE);
         break;
+    default:
+        break;
     }
-    if (args.print_level) {
+    if (args->print_level) {
         av_log_set_flags(AV_LOG_PRINT_LEVEL);
     }
-    int is_supported;
-    AVFormatContext* ic = NULL, * oc = NULL, * imgc = NULL;
+    if ((re = enm4a_encoder_supports_sample_rate(args->encoder, args->default_sample_rate, &is_supported)) != ENM4A_OK) {
+        return re;
+    }
+    if (!is_supported) return ENM4A_INVALID_DEFUALE_SAMPLE_RATE;
+    if (args->sample_rate) {
+        if ((re = enm4a_encoder_supports_sample_rate(args->encoder, *(args->sample_rate), &is_supported)) != ENM4A_OK) {
+            return re;
+        }
+        if (!is_supported) return ENM4A_INVALID_SAMPLE_RATE;
+    }
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR open_input(int* ret, const char* input, const ENM4A_IO* input_io, const ENM4A_ARGS* args, ENM4A_INPUT* in) {
+    if (!ret || !input || !args || !in) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVDictionary* demux_option = NULL;
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+    const AVInputFormat* ifmt = NULL;
+#else
+    AVInputFormat* ifmt = NULL;
+#endif
+    char* headers = NULL;
+    memset(in, 0, sizeof(ENM4A_INPUT));
+    if (input_io) {
+        if (!(in->input_pb = enm4a_alloc_avio(input_io, 0))) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        if (!(in->ic = avformat_alloc_context())) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        in->ic->pb = in->input_pb;
+        in->ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } else if (args->http_headers && args->http_header_size) {
+        ENM4A_ERROR err;
+        headers = enm4a_generate_http_header(args->http_headers, args->http_header_size, &err);
+        if (!headers) {
+            rev = err;
+            goto end;
+        }
+        if ((*ret = av_dict_set(&demux_option, "headers", headers, 0)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+    }
+    if (!input_io && args->readahead > 0 && enm4a_is_http_url(input)) {
+        if ((rev = enm4a_readahead_open(ret, input, demux_option, args->readahead, &in->readahead_pb)) != ENM4A_OK) {
+            goto end;
+        }
+        if (!(in->ic = avformat_alloc_context())) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        in->ic->pb = in->readahead_pb;
+        in->ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    if (args->input_format && !(ifmt = av_find_input_format(args->input_format))) {
+        rev = ENM4A_UNKNOWN_INPUT_FORMAT;
+        goto end;
+    }
+    if (args->probesize > 0 && (*ret = av_dict_set_int(&demux_option, "probesize", args->probesize, 0)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (args->analyzeduration > 0 && (*ret = av_dict_set_int(&demux_option, "analyzeduration", args->analyzeduration, 0)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((*ret = avformat_open_input(&in->ic, input, ifmt, &demux_option)) != 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (args->trust_headers && stream_info_complete(in->ic)) {
+        if (args->level >= ENM4A_LOG_VERBOSE) {
+            printf("%s\n", "Stream information is complete in container headers, skip analyzing packets.");
+        }
+    } else if ((*ret = avformat_find_stream_info(in->ic, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+end:
+    if (headers) free(headers);
+    if (demux_option) av_dict_free(&demux_option);
+    return rev;
+}
+
+void close_input(ENM4A_INPUT* in) {
+    if (!in) return;
+    if (in->ic) avformat_close_input(&in->ic);
+    enm4a_free_avio(&in->input_pb);
+    enm4a_readahead_close(&in->readahead_pb);
+}
+
+/**
+ * @brief Convert input to m4a.
+ * @param input Input file or URL. Only used as name if input_io is not NULL.
+ * @param input_io Custom input. Can be NULL.
+ * @param output_io Custom output. Can be NULL.
+*/
+static ENM4A_ERROR encode_m4a_internal(const char* input, const ENM4A_IO* input_io, const ENM4A_IO* output_io, ENM4A_ARGS args) {
+    if (!input) return ENM4A_NULL_POINTER;
+    AVFormatContext* ic = NULL, * oc = NULL;
     int ret = 0;
     ENM4A_ERROR rev = ENM4A_OK;
-    char* title = NULL, * out = NULL, * headers = NULL;
+    char* title = NULL, * out = NULL;
+    ENM4A_INPUT in;
+    ENM4A_COVER cover;
     char has_img = 0, img_extra_file = 0, has_audio = 0, audio_need_encode = 0;
     unsigned int img_stream_index = 0, audio_stream_index = 0, img_dest_index = 0, audio_dest_index = 0, map_index = 0;
     AVPacket pkt;
-    int64_t audio_dts, audio_pts = 0;
-    AVDictionary* demux_option = NULL;
+    int64_t audio_dts, audio_pts = 0, audio_end = 0, output_duration = 0;
+    AVDictionary* mux_option = NULL;
+    char retry_faststart = 0, tags_after_trailer = 0, to_stdout = !output_io && args.output && !strcmp(args.output, "-");
+    // Extra outputs which are created
+    size_t fanout_outputs = 0;
+    int64_t reserved_moov_size = 0;
+    int stdout_fd = -1;
+    AVIOContext* output_pb = NULL;
     AVCodecContext* audio_input = NULL, * audio_output = NULL;
     SwrContext* resample_context = NULL;
     AVAudioFifo* afifo = NULL;
     AVFrame* audio_input_frame = NULL, * audio_output_frame = NULL;
-#ifdef _WIN32
-    FILETIME pgtime = { 0, 0 }, tnow = { 0, 0 };
-#elif defined(HAVE_CLOCK_GETTIME)
-    struct timespec pgtime = { LLONG_MIN, 0 }, tnow = { 0, 0 };
-#else
-    time_t pgtime = LLONG_MIN, tnow = 0;
-#endif
-    if ((rev = enm4a_is_supported_sample_rates(args.default_sample_rate, &is_supported)) != ENM4A_OK) {
+    AVPacket* audio_output_pkt = NULL;
+    ENM4A_CONVERT_BUFFER convert_buffer = { NULL, 0 };
+    ENM4A_LOUDNESS* meter = NULL;
+    ENM4A_LOUDNESS_RESULT loudness;
+    ENM4A_FINGERPRINT* fingerprint = NULL;
+    char* fingerprint_result = NULL;
+    int64_t allocations = 0;
+    ENM4A_PROGRESS_SINK progress;
+    ENM4A_FANOUT fanout;
+    ENM4A_TRIM trim, * ptrim = NULL;
+    /// Subtracted from timestamps of copied audio packets, so trimmed output starts at 0.
+    int64_t copy_offset = AV_NOPTS_VALUE;
+    init_progress_sink(&progress, &args);
+    memset(&fanout, 0, sizeof(ENM4A_FANOUT));
+    memset(&loudness, 0, sizeof(ENM4A_LOUDNESS_RESULT));
+    memset(&cover, 0, sizeof(ENM4A_COVER));
+    memset(&in, 0, sizeof(ENM4A_INPUT));
+    if (args.output_count && !args.outputs) {
+        rev = ENM4A_NULL_POINTER;
         goto end;
     }
-    if (!is_supported) {
-        rev = ENM4A_INVALID_DEFUALE_SAMPLE_RATE;
+    if ((rev = check_conversion_args(&args)) != ENM4A_OK) {
         goto end;
     }
-    if (args.sample_rate) {
-        if ((rev = enm4a_is_supported_sample_rates(*(args.sample_rate), &is_supported)) != ENM4A_OK) {
+    if (to_stdout) {
+        if (redirect_stdout_to_stderr(&stdout_fd)) {
+            rev = ENM4A_ERR_OPEN_FILE;
             goto end;
         }
-        if (!is_supported) {
-            rev = ENM4A_INVALID_SAMPLE_RATE;
-            goto end;
+        if (args.fragment_duration <= 0) {
+            args.fragment_duration = ENM4A_DEFAULT_FRAGMENT_DURATION;
         }
     }
-    if (args.http_headers && args.http_header_size) {
-        ENM4A_ERROR err;
-        headers = enm4a_generate_http_header(args.http_headers, args.http_header_size, &err);
-        if (!headers) {
-            rev = err;
+    if (output_io) {
+        if (!(output_pb = enm4a_alloc_avio(output_io, 1))) {
+            rev = ENM4A_NO_MEMORY;
             goto end;
         }
-        if ((ret = av_dict_set(&demux_option, "headers", headers, 0)) < 0) {
-            rev = ENM4A_FFMPEG_ERR;
-            goto end;
+        // Output can not be reopened to move moov box, and mov muxer need seek to write mdat size.
+        if (!output_io->seek || args.faststart != ENM4A_FASTSTART_NONE) {
+            if (args.fragment_duration <= 0) {
+                args.fragment_duration = ENM4A_DEFAULT_FRAGMENT_DURATION;
+            }
         }
     }
-    if ((ret = avformat_open_input(&ic, input, NULL, &demux_option)) != 0) {
-        rev = ENM4A_FFMPEG_ERR;
-        goto end;
-    }
-    if ((ret = avformat_find_stream_info(ic, NULL)) < 0) {
-        rev = ENM4A_FFMPEG_ERR;
+    if ((rev = open_input(&ret, input, input_io, &args, &in)) != ENM4A_OK) {
         goto end;
     }
-    av_dump_format(ic, 0, input, 0);
+    ic = in.ic;
+    progress.ic = ic;
+    if (!args.quiet) av_dump_format(ic, 0, input, 0);
     if (args.cover && strlen(args.cover)) {
-        if ((ret = avformat_open_input(&imgc, args.cover, NULL, NULL)) < 0) {
-            rev = ENM4A_FFMPEG_ERR;
-            goto end;
-        }
-        if ((ret = avformat_find_stream_info(imgc, NULL)) < 0) {
-            rev = ENM4A_FFMPEG_ERR;
+        if ((rev = enm4a_load_cover(&ret, args.cover, &args, &cover)) != ENM4A_OK) {
             goto end;
         }
-        av_dump_format(imgc, 1, args.cover, 0);
     }
     if (!args.title || !strlen(args.title)) {
         if (ic->metadata) {
@@ -344,7 +1231,21 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
             printf("Get title from input argument: %s\n", title);
         }
     }
-    if (!args.output || !strlen(args.output)) {
+    if (output_io) {
+        int re = cstr_util_copy_str(&out, "custom output");
+        if (re) {
+            rev = re == 2 ? ENM4A_NO_MEMORY : ENM4A_NULL_POINTER;
+            goto end;
+        }
+    } else if (to_stdout) {
+        char pipe_url[32];
+        snprintf(pipe_url, sizeof(pipe_url), "pipe:%d", stdout_fd);
+        int re = cstr_util_copy_str(&out, pipe_url);
+        if (re) {
+            rev = re == 2 ? ENM4A_NO_MEMORY : ENM4A_NULL_POINTER;
+            goto end;
+        }
+    } else if (!args.output || !strlen(args.output)) {
         if (title) {
             int is_url = 0;
             if (!fileop_is_url(input, &is_url)) {
@@ -432,62 +1333,25 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
             printf("Get output filename from input argument: %s\n", out);
         }
     }
-    if (fileop_exists(out)) {
-        int overwrite = 0;
-        if (args.overwrite != ENM4A_OVERWRITE_ASK) {
-            if (args.overwrite == ENM4A_OVERWRITE_YES) overwrite = 1;
-        } else {
-            printf("Output file already exists, do you want to overwrite it? (y/n)");
-            int c = getchar();
-            while (c != 'y' && c != 'n') {
-                c = getchar();
-            }
-            if (c == 'y') overwrite = 1;
-        }
-        if (!overwrite) {
-            rev = ENM4A_FILE_EXISTS;
-            goto end;
-        } else {
-            if (!fileop_remove(out)) {
-                rev = ENM4A_ERR_REMOVE_FILE;
-                goto end;
-            }
-        }
+    if (!output_io && !to_stdout && (rev = check_output_file(out, get_output_overwrite(&args, out))) != ENM4A_OK) {
+        goto end;
     }
     if ((ret = avformat_alloc_output_context2(&oc, NULL, "ipod", out)) < 0) {
         rev = ENM4A_FFMPEG_ERR;
         goto end;
     }
-    if (imgc) {
-        for (unsigned int i = 0; i < imgc->nb_streams; i++) {
-            AVStream* is = imgc->streams[i], * os = NULL;
-            if (is->codecpar->codec_id == AV_CODEC_ID_MJPEG && !has_img) {
-                os = avformat_new_stream(oc, NULL);
-                if (!os) {
-                    rev = ENM4A_NO_MEMORY;
-                    goto end;
-                }
-                if ((ret = avcodec_parameters_copy(os->codecpar, is->codecpar)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-                os->disposition |= AV_DISPOSITION_ATTACHED_PIC;
-                os->codecpar->codec_tag = 0;
-                has_img = 1;
-                img_extra_file = 1;
-                img_stream_index = i;
-                img_dest_index = map_index++;
-                break;
-            }
-        }
-        if (!has_img) {
-            avformat_close_input(&imgc);
-            imgc = NULL;
+    if (cover.buf) {
+        if ((rev = enm4a_add_cover_stream(oc, &cover)) != ENM4A_OK) {
+            goto end;
         }
+        has_img = 1;
+        img_extra_file = 1;
+        img_dest_index = map_index++;
     }
     for (unsigned int i = 0; i < ic->nb_streams; i++) {
         AVStream* is = ic->streams[i], * os = NULL;
-        if (is->codecpar->codec_id == AV_CODEC_ID_AAC && !has_audio) {
+        // Every output of fan-out needs encoding.
+        if (is->codecpar->codec_id == AV_CODEC_ID_AAC && !has_audio && !args.output_count) {
             os = avformat_new_stream(oc, NULL);
             if (!os) {
                 rev = ENM4A_NO_MEMORY;
@@ -498,6 +1362,10 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
                 goto end;
             }
             os->codecpar->codec_tag = 0;
+            // Copied stream is decoded only for loudness measurement and fingerprint.
+            if ((args.loudness || args.fingerprint) && (rev = open_audio_decoder(&ret, is, &args, &audio_input)) != ENM4A_OK) {
+                goto end;
+            }
             has_audio = 1;
             audio_stream_index = i;
             audio_dest_index = map_index++;
@@ -524,86 +1392,17 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
         for (unsigned int i = 0; i < ic->nb_streams; i++) {
             AVStream* is = ic->streams[i], * os = NULL;
             if (is->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && !has_audio) {
-                const AVCodec* input_codec = avcodec_find_decoder(is->codecpar->codec_id), * output_codec = NULL;
-                if (!input_codec) {
-                    rev = ENM4A_NO_DECODER;
-                    goto end;
-                }
-                audio_input = avcodec_alloc_context3(input_codec);
-                if (!audio_input) {
-                    rev = ENM4A_NO_MEMORY;
-                    goto end;
-                }
-                if ((ret = avcodec_parameters_to_context(audio_input, is->codecpar)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-                if ((ret = avcodec_open2(audio_input, input_codec, NULL)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-                if (!(output_codec = find_aac_codec_encoder())) {
-                    rev = ENM4A_NO_ENCODER;
+                if ((rev = open_audio_decoder(&ret, is, &args, &audio_input)) != ENM4A_OK) {
                     goto end;
                 }
                 if (!(os = avformat_new_stream(oc, NULL))) {
                     rev = ENM4A_NO_MEMORY;
                     goto end;
                 }
-                if (!(audio_output = avcodec_alloc_context3(output_codec))) {
-                    rev = ENM4A_NO_MEMORY;
-                    goto end;
-                }
-#if NEW_CHANNEL_LAYOUT
-                av_channel_layout_default(&audio_output->ch_layout, audio_input->ch_layout.nb_channels);
-#endif
-#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
-                DISABLE_DEPRECATION_WARNINGS
-                audio_output->channels = audio_input->channels;
-                audio_output->channel_layout = av_get_default_channel_layout(audio_output->channels);
-                ENABLE_DEPRECATION_WARNINGS
-#endif
-                if (args.sample_rate) {
-                    audio_output->sample_rate = *(args.sample_rate);
-                } else {
-                    set_audio_samplerate(audio_input, audio_output, output_codec, args.default_sample_rate, &rev);
-                }
-                if (rev != ENM4A_OK) {
-                    goto end;
-                }
-                audio_output->sample_fmt = output_codec->sample_fmts[0];
-                audio_output->bit_rate = args.bitrate;
-                os->time_base.den = audio_output->sample_rate;
-                os->time_base.num = 1;
-                if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
-                    audio_output->flags |= AVFMT_GLOBALHEADER;
-                }
-                if ((ret = avcodec_open2(audio_output, output_codec, NULL)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-                if ((ret = avcodec_parameters_from_context(os->codecpar, audio_output)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-#if NEW_CHANNEL_LAYOUT
-                if ((ret = swr_alloc_set_opts2(&resample_context, &audio_output->ch_layout, audio_output->sample_fmt, audio_output->sample_rate, &audio_input->ch_layout, audio_input->sample_fmt, audio_input->sample_rate, 0, NULL)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-#else
-                resample_context = swr_alloc_set_opts(NULL, av_get_default_channel_layout(audio_output->channels), audio_output->sample_fmt, audio_output->sample_rate, av_get_default_channel_layout(audio_input->channels), audio_input->sample_fmt, audio_input->sample_rate, 0, NULL);
-#endif
-                if (!resample_context) {
-                    rev = ENM4A_NO_MEMORY;
-                    goto end;
-                }
-                if ((ret = swr_init(resample_context)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
+                if ((rev = open_audio_encoder(&ret, audio_input, oc, os, args.sample_rate ? *(args.sample_rate) : 0, args.bitrate, &args, &audio_output)) != ENM4A_OK) {
                     goto end;
                 }
-                if (!(afifo = av_audio_fifo_alloc(audio_output->sample_fmt, GET_AV_CODEC_CHANNELS(audio_output), 1))) {
-                    rev = ENM4A_NO_MEMORY;
+                if ((rev = init_audio_converter(&ret, audio_input, audio_output, args.resampler, args.level, &resample_context, &convert_buffer, &afifo, &allocations)) != ENM4A_OK) {
                     goto end;
                 }
                 has_audio = 1;
@@ -618,6 +1417,10 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
         rev = ENM4A_NO_AUDIO;
         goto end;
     }
+    discard_unused_streams(ic, audio_stream_index, has_img && !img_extra_file ? (int)img_stream_index : -1, args.level);
+    if (in.readahead_pb && (rev = enm4a_readahead_skip_discarded(in.readahead_pb, ic)) != ENM4A_OK) {
+        goto end;
+    }
     if (title) av_dict_set(&oc->metadata, "title", title, 0);
     set_ctx_metadata(oc, ic, "artist", args.artist);
     set_ctx_metadata(oc, ic, "album", args.album);
@@ -625,78 +1428,260 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
     set_ctx_metadata(oc, ic, "disc", args.disc);
     set_ctx_metadata(oc, ic, "track", args.track);
     set_ctx_metadata(oc, ic, "date", args.date);
+    if (args.loudness) {
+        if (audio_input->sample_rate <= 0 || GET_AV_CODEC_CHANNELS(audio_input) <= 0) {
+            av_log(NULL, AV_LOG_WARNING, "Unknown audio format, skip loudness measurement.\n");
+        } else if (!(meter = enm4a_loudness_alloc(audio_input->sample_rate, GET_AV_CODEC_CHANNELS(audio_input)))) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+    }
+    if (args.fingerprint) {
+        if (audio_input->sample_rate <= 0 || GET_AV_CODEC_CHANNELS(audio_input) <= 0) {
+            av_log(NULL, AV_LOG_WARNING, "Unknown audio format, skip fingerprint.\n");
+        } else if (!(fingerprint = enm4a_fingerprint_alloc(audio_input->sample_rate, GET_AV_CODEC_CHANNELS(audio_input)))) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+    }
+    if ((meter || fingerprint) && !audio_need_encode && !(audio_input_frame = av_frame_alloc())) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
     if (audio_need_encode) {
         if (!(audio_input_frame = av_frame_alloc())) {
             rev = ENM4A_NO_MEMORY;
             goto end;
         }
-        if (!(audio_output_frame = av_frame_alloc())) {
-            rev = ENM4A_NO_MEMORY;
+        if ((rev = alloc_encoder_frame(&ret, audio_output, &audio_output_frame)) != ENM4A_OK) {
             goto end;
         }
-#if NEW_CHANNEL_LAYOUT
-        if ((ret = av_channel_layout_copy(&audio_output_frame->ch_layout, &audio_output->ch_layout)) < 0) {
-            rev = ENM4A_FFMPEG_ERR;
+        if (!(audio_output_pkt = av_packet_alloc())) {
+            rev = ENM4A_NO_MEMORY;
             goto end;
         }
-#endif
-#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
-        DISABLE_DEPRECATION_WARNINGS
-        audio_output_frame->channel_layout = audio_output->channel_layout;
-        ENABLE_DEPRECATION_WARNINGS
-#endif
-        audio_output_frame->format = audio_output->sample_fmt;
-        audio_output_frame->sample_rate = audio_output->sample_rate;
+        allocations += 2;
     }
-    av_dump_format(oc, 0, out, 1);
-    if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+    if (!args.quiet) av_dump_format(oc, 0, out, 1);
+    if (output_pb) {
+        oc->pb = output_pb;
+        oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } else if (!(oc->oformat->flags & AVFMT_NOFILE)) {
         if ((ret = avio_open(&oc->pb, out, AVIO_FLAG_WRITE)) < 0) {
             rev = ENM4A_ERR_OPEN_FILE;
             goto end;
         }
     }
-    if ((ret = avformat_write_header(oc, NULL)) < 0) {
-        rev = ENM4A_FFMPEG_ERR;
-        goto end;
+    if (args.fragment_duration > 0) {
+        if (args.faststart != ENM4A_FASTSTART_NONE && args.level >= ENM4A_LOG_VERBOSE) {
+            printf("Fragmented output already starts with moov box, ignore faststart.\n");
+        }
+        args.faststart = ENM4A_FASTSTART_NONE;
+        // Delay moov until first fragment is ready, so cover and codec extradata are included.
+        if ((ret = av_dict_set(&mux_option, "movflags", "+empty_moov+delay_moov+default_base_moof", 0)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if ((ret = av_dict_set_int(&mux_option, "frag_duration", args.fragment_duration, 0)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
     }
-    if (imgc && has_img && img_extra_file) {
-        while (1) {
-            AVStream* is = NULL, * os = NULL;
-            if ((ret = av_read_frame(imgc, &pkt)) < 0) {
-                if (ret == AVERROR_EOF) break;
-                rev = ENM4A_FFMPEG_ERR;
-                goto end;
+    if (args.faststart == ENM4A_FASTSTART_RESERVE) {
+        AVStream* is = ic->streams[audio_stream_index];
+        int64_t duration = is->duration != AV_NOPTS_VALUE ? av_rescale_q(is->duration, is->time_base, AV_TIME_BASE_Q) : ic->duration;
+        if (duration != AV_NOPTS_VALUE && args.start_time > 0) duration -= args.start_time;
+        if (args.duration > 0 && (duration == AV_NOPTS_VALUE || duration > args.duration)) duration = args.duration;
+        if (duration == AV_NOPTS_VALUE || duration <= 0) {
+            if (args.level >= ENM4A_LOG_VERBOSE) {
+                printf("Can not get duration of input, move moov box after writing.\n");
             }
-            if (pkt.data == NULL) break;
-            is = imgc->streams[pkt.stream_index];
-            if (pkt.stream_index != img_stream_index) {
-                av_packet_unref(&pkt);
-                continue;
+            args.faststart = ENM4A_FASTSTART_REWRITE;
+        } else {
+            int64_t packets, media_size, extra = 0;
+            AVDictionaryEntry* en = NULL;
+            while ((en = av_dict_get(oc->metadata, "", en, AV_DICT_IGNORE_SUFFIX))) {
+                extra += strlen(en->key) + strlen(en->value) + 32;
             }
-            os = oc->streams[img_dest_index];
-            if (args.level >= ENM4A_LOG_TRACE) {
-                log_packet(imgc, &pkt, "in");
+            if (img_extra_file) {
+                extra += cover.size + 64;
+            } else if (has_img) {
+                AVStream* imgs = ic->streams[img_stream_index];
+                extra += (imgs->attached_pic.size ? imgs->attached_pic.size : (1 << 20)) + 64;
             }
-            pkt.pts = av_rescale_q_rnd(pkt.pts, is->time_base, os->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-            pkt.dts = av_rescale_q_rnd(pkt.dts, is->time_base, os->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-            pkt.duration = av_rescale_q(pkt.duration, is->time_base, os->time_base);
-            pkt.pos = -1;
-            pkt.stream_index = img_dest_index;
-            if (args.level >= ENM4A_LOG_TRACE) {
-                log_packet(oc, &pkt, "out");
+            // Tags added after muxing should fit in reserved space too.
+            if (meter) extra += ENM4A_LOUDNESS_TAGS_SIZE;
+            if (fingerprint) extra += enm4a_fingerprint_tag_size(fingerprint);
+            if (audio_need_encode) {
+                packets = av_rescale_rnd(duration, audio_output->sample_rate, (int64_t)AV_TIME_BASE * audio_output->frame_size, AV_ROUND_UP) + 2;
+                media_size = av_rescale(duration, audio_output->bit_rate, (int64_t)AV_TIME_BASE * 8);
+            } else {
+                int frame_size = is->codecpar->frame_size > 0 ? is->codecpar->frame_size : 1024;
+                packets = is->nb_frames > 0 ? is->nb_frames : av_rescale_rnd(duration, is->codecpar->sample_rate, (int64_t)AV_TIME_BASE * frame_size, AV_ROUND_UP) + 2;
+                int64_t bit_rate = is->codecpar->bit_rate > 0 ? is->codecpar->bit_rate : ic->bit_rate;
+                media_size = bit_rate > 0 ? av_rescale(duration, bit_rate, (int64_t)AV_TIME_BASE * 8) : avio_size(ic->pb);
             }
-            if ((ret = av_interleaved_write_frame(oc, &pkt)) < 0) {
-                rev = ENM4A_FFMPEG_ERR;
+            // Duration in header may be inaccurate.
+            packets += packets / 20;
+            reserved_moov_size = estimate_moov_size(packets, media_size, extra, audio_need_encode);
+            if (reserved_moov_size > INT_MAX) {
+                args.faststart = ENM4A_FASTSTART_REWRITE;
+            } else {
+                if (args.level >= ENM4A_LOG_VERBOSE) {
+                    printf("Reserve %" PRId64 " bytes for moov box.\n", reserved_moov_size);
+                }
+                if ((ret = av_dict_set_int(&mux_option, "moov_size", reserved_moov_size, 0)) < 0) {
+                    rev = ENM4A_FFMPEG_ERR;
+                    goto end;
+                }
+            }
+        }
+    }
+    // Tags measured while converting are added before moov box is moved to the front, so media data is moved only once.
+    tags_after_trailer = (meter || fingerprint) && !output_io && !to_stdout && args.fragment_duration <= 0;
+    if (args.faststart == ENM4A_FASTSTART_REWRITE && !tags_after_trailer) {
+        if ((ret = av_dict_set(&mux_option, "movflags", "+faststart", 0)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+    }
+    if ((ret = avformat_write_header(oc, &mux_option)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((rev = enm4a_init_fanout(&fanout, (unsigned int)args.output_count + 1, oc, audio_output, resample_context, afifo, &convert_buffer, audio_output_frame, audio_output_pkt)) != ENM4A_OK) {
+        goto end;
+    }
+    fanout.ic = ic;
+    fanout.audio_stream_index = audio_stream_index;
+    fanout.audio_input = audio_input;
+    fanout.audio_input_frame = audio_input_frame;
+    fanout.meter = meter;
+    fanout.fingerprint = fingerprint;
+    fanout.audio_dest_index = audio_dest_index;
+    fanout.allocations = &allocations;
+    fanout.level = args.level;
+    fanout.progress = &progress;
+    fanout.tags_after_trailer = tags_after_trailer;
+    for (size_t i = 0; i < args.output_count && audio_need_encode; i++) {
+        if ((rev = enm4a_add_fanout_output(&ret, &fanout, &args.outputs[i], &args)) != ENM4A_OK) {
+            goto end;
+        }
+        fanout_outputs = i + 1;
+    }
+    if (img_extra_file) {
+        for (unsigned int j = 0; j < fanout.nb_outputs; j++) {
+            if ((rev = enm4a_write_cover(&ret, fanout.outputs[j].oc, img_dest_index, &cover, args.level)) != ENM4A_OK) {
                 goto end;
             }
-            av_packet_unref(&pkt);
         }
     }
-    char cn_img = has_img && !img_extra_file, finished = 0, write_data = 1;
+    if (args.start_time > 0 || args.duration > 0) {
+        AVStream* is = ic->streams[audio_stream_index];
+        int64_t origin = is->start_time != AV_NOPTS_VALUE ? is->start_time : 0;
+        trim.time_base = is->time_base;
+        trim.start = args.start_time > 0 ? origin + av_rescale_q(args.start_time, AV_TIME_BASE_Q, is->time_base) : INT64_MIN;
+        trim.end = args.duration > 0 ? (args.start_time > 0 ? trim.start : origin) + av_rescale_q(args.duration, AV_TIME_BASE_Q, is->time_base) : INT64_MAX;
+        trim.next = INT64_MIN;
+        ptrim = &trim;
+        fanout.trim = ptrim;
+        if (args.start_time > 0 && (ret = avformat_seek_file(ic, audio_stream_index, INT64_MIN, trim.start, trim.start, 0)) < 0) {
+            // Packets before start are still dropped after reading.
+            if (args.level >= ENM4A_LOG_VERBOSE) {
+                printf("Can not seek input, read it from the beginning.\n");
+            }
+            ret = 0;
+        }
+        if (ic->duration != AV_NOPTS_VALUE) {
+            progress.duration = FFMAX(ic->duration - FFMAX(args.start_time, 0), 0);
+            if (args.duration > 0) progress.duration = FFMIN(progress.duration, args.duration);
+        } else if (args.duration > 0) {
+            progress.duration = args.duration;
+        }
+    }
+    char cn_img = has_img && !img_extra_file, finished = 0, use_fanout = fanout.nb_outputs > 1;
+    char use_segmented = args.segment_threads > 0 && audio_need_encode && !use_fanout;
+    char use_pipeline = args.pipeline && audio_need_encode && !use_fanout && !use_segmented;
+    char read_audio_only = use_pipeline || use_segmented || use_fanout;
+    if (use_fanout && (args.segment_threads || args.pipeline) && args.level >= ENM4A_LOG_VERBOSE) {
+        printf("Multiple outputs are encoded in current thread, ignore pipeline and segment threads.\n");
+    }
     audio_dts = INT64_MIN;
-    while (1) {
+    if (read_audio_only && cn_img) {
+        // These modes only read audio packets, write attached picture directly.
+        AVStream* is = ic->streams[img_stream_index];
+        if (is->attached_pic.data) {
+            for (unsigned int j = 0; j < fanout.nb_outputs; j++) {
+                if ((rev = write_cover_packet(&ret, fanout.outputs[j].oc, img_dest_index, is, &is->attached_pic, args.level)) != ENM4A_OK) {
+                    goto end;
+                }
+            }
+        } else {
+            av_log(NULL, AV_LOG_WARNING, "Image stream %u is not an attached picture, skip it.\n", img_stream_index);
+        }
+    }
+    if (use_fanout) {
+        rev = enm4a_run_fanout(&ret, &fanout);
+        audio_pts = fanout.outputs[0].pts;
+        if (rev != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if (use_segmented) {
+        ENM4A_SEGMENTED segmented;
+        segmented.ic = ic;
+        segmented.audio_stream_index = audio_stream_index;
+        segmented.audio_input = audio_input;
+        segmented.audio_input_frame = audio_input_frame;
+        segmented.meter = meter;
+        segmented.fingerprint = fingerprint;
+        segmented.resample_context = resample_context;
+        segmented.afifo = afifo;
+        segmented.convert_buffer = &convert_buffer;
+        segmented.oc = oc;
+        segmented.audio_output = audio_output;
+        segmented.audio_dest_index = audio_dest_index;
+        segmented.audio_pts = &audio_pts;
+        segmented.allocations = &allocations;
+        segmented.level = args.level;
+        segmented.progress = &progress;
+        segmented.trim = ptrim;
+        segmented.threads = args.segment_threads;
+        if ((rev = enm4a_run_segmented(&ret, &segmented)) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if (use_pipeline) {
+        ENM4A_PIPELINE pipeline;
+        pipeline.ic = ic;
+        pipeline.audio_stream_index = audio_stream_index;
+        pipeline.audio_input = audio_input;
+        pipeline.audio_input_frame = audio_input_frame;
+        pipeline.meter = meter;
+        pipeline.fingerprint = fingerprint;
+        pipeline.resample_context = resample_context;
+        pipeline.afifo = afifo;
+        pipeline.convert_buffer = &convert_buffer;
+        pipeline.oc = oc;
+        pipeline.audio_output = audio_output;
+        pipeline.audio_output_pkt = audio_output_pkt;
+        pipeline.audio_dest_index = audio_dest_index;
+        pipeline.audio_pts = &audio_pts;
+        pipeline.allocations = &allocations;
+        pipeline.level = args.level;
+        pipeline.progress = &progress;
+        pipeline.trim = ptrim;
+        if ((rev = enm4a_run_pipeline(&ret, &pipeline)) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    while (!read_audio_only) {
         AVStream* is = NULL, * os = NULL;
-        if ((ret = av_read_frame(ic, &pkt)) < 0) {
+        int64_t start = stage_start(&progress);
+        ret = av_read_frame(ic, &pkt);
+        stage_end(&progress, ENM4A_STAGE_DEMUX, start);
+        if (ret >= 0) mark_first_packet(&progress);
+        if (ret < 0) {
             if (ret == AVERROR_EOF) {
                 finished = 1;
                 if (!audio_need_encode) break;
@@ -709,6 +1694,12 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
             finished = 1;
             if (!audio_need_encode) break;
         }
+        if (!finished && pkt.stream_index == audio_stream_index && trim_packet_after_end(ptrim, &pkt)) {
+            // Rest of input is not needed.
+            av_packet_unref(&pkt);
+            finished = 1;
+            if (!audio_need_encode) break;
+        }
         if (!finished) is = ic->streams[pkt.stream_index];
         if (!finished && pkt.stream_index != audio_stream_index) {
             if (!cn_img || pkt.stream_index != img_stream_index) {
@@ -719,58 +1710,33 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
         char is_audio = !finished ? pkt.stream_index == audio_stream_index : 0;
         unsigned int ind = is_audio ? audio_dest_index : img_dest_index;
         if (!finished) os = oc->streams[ind];
-        if (args.level >= ENM4A_LOG_TRACE && !finished) {
+        if (log_packet_enabled(args.level) && !finished) {
             log_packet(ic, &pkt, "in");
         }
         if ((is_audio && audio_need_encode) || finished) {
             ind = audio_dest_index;
-            if (!finished) {
-                if ((ret = avcodec_send_packet(audio_input, &pkt)) < 0) {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
-                ret = avcodec_receive_frame(audio_input, audio_input_frame);
-                if (ret >= 0) {
-                    if ((rev = convert_samples_and_add_to_fifo(&ret, audio_output, resample_context, audio_input_frame, afifo)) != ENM4A_OK) {
-                        goto end;
-                    }
-                }
-                else if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                    ret = 0;
-                } else {
-                    rev = ENM4A_FFMPEG_ERR;
-                    goto end;
-                }
+            if ((rev = decode_audio_packet(&ret, audio_input, finished ? NULL : &pkt, audio_input_frame, audio_output, resample_context, afifo, &convert_buffer, &allocations, meter, fingerprint, ptrim, &progress)) != ENM4A_OK) {
+                goto end;
             }
-            if (args.level >= ENM4A_LOG_TRACE) {
-                printf("the size of fifo: %d\n", av_audio_fifo_size(afifo));
+            if ((rev = encode_fifo_frames(&ret, afifo, audio_output_frame, oc, audio_output, audio_output_pkt, &audio_pts, finished, args.level, ind, &allocations, &progress)) != ENM4A_OK) {
+                goto end;
             }
-            while (av_audio_fifo_size(afifo) >= audio_output->frame_size || (finished && av_audio_fifo_size(afifo) > 0)) {
-                audio_output_frame->nb_samples = FFMIN(av_audio_fifo_size(afifo), audio_output->frame_size);
-                if ((ret = av_frame_get_buffer(audio_output_frame, 0)) < 0) {
-                    rev = ENM4A_NO_MEMORY;
-                    goto end;
-                }
-                if ((ret = av_audio_fifo_read(afifo, (void**)audio_output_frame->data, audio_output_frame->nb_samples)) < 0) {
-                    rev = ENM4A_NO_MEMORY;
-                    goto end;
-                }
-                if ((rev = encode_audio_frame(&ret, audio_output_frame, oc, audio_output, &write_data, &audio_pts, args.level, ind)) != ENM4A_OK) {
-                    goto end;
+        } else {
+            if (is_audio && ptrim && trim.start != INT64_MIN) {
+                // Copied stream is cut at packet boundaries.
+                if (pkt.pts != AV_NOPTS_VALUE && pkt.pts + pkt.duration <= trim.start) {
+                    av_packet_unref(&pkt);
+                    continue;
                 }
-                if (args.level >= ENM4A_LOG_TRACE) {
-                    printf("the size of fifo: %d\n", av_audio_fifo_size(afifo));
+                if (copy_offset == AV_NOPTS_VALUE) copy_offset = pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+                if (copy_offset != AV_NOPTS_VALUE) {
+                    if (pkt.pts != AV_NOPTS_VALUE) pkt.pts -= copy_offset;
+                    if (pkt.dts != AV_NOPTS_VALUE) pkt.dts -= copy_offset;
                 }
             }
-            if (finished) {
-                while (1) {
-                    if ((rev = encode_audio_frame(&ret, NULL, oc, audio_output, &write_data, NULL, args.level, ind)) != ENM4A_OK) {
-                        goto end;
-                    }
-                    if (!write_data) break;
-                }
+            if (is_audio && (meter || fingerprint) && (rev = decode_audio_packet(&ret, audio_input, &pkt, audio_input_frame, NULL, NULL, NULL, NULL, &allocations, meter, fingerprint, NULL, &progress)) != ENM4A_OK) {
+                goto end;
             }
-        } else {
             pkt.pts = av_rescale_q_rnd(pkt.pts, is->time_base, os->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
             pkt.dts = av_rescale_q_rnd(pkt.dts, is->time_base, os->time_base, AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
             if (pkt.stream_index == audio_stream_index) {
@@ -784,50 +1750,94 @@ ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
             pkt.duration = av_rescale_q(pkt.duration, is->time_base, os->time_base);
             pkt.pos = -1;
             pkt.stream_index = ind;
-            write_data = 1;
-            if (args.level >= ENM4A_LOG_TRACE) {
+            if (is_audio && pkt.pts != AV_NOPTS_VALUE && pkt.pts + pkt.duration > audio_end) {
+                audio_end = pkt.pts + pkt.duration;
+            }
+            if (log_packet_enabled(args.level)) {
                 log_packet(oc, &pkt, "out");
             }
+            start = stage_start(&progress);
             if ((ret = av_interleaved_write_frame(oc, &pkt)) < 0) {
                 rev = ENM4A_FFMPEG_ERR;
                 goto end;
             }
+            stage_end(&progress, ENM4A_STAGE_MUX, start);
         }
-        if (args.level <= ENM4A_LOG_DEBUG) {
-#ifdef _WIN32
-            GetSystemTimePreciseAsFileTime(&tnow);
-            size_t ts = ft2ts(tnow) - ft2ts(pgtime);
-            if (ts >= 2000000ull) {
-                if (os) log_progress(oc, pkt.pts, os->time_base);
-                pgtime = tnow;
-            }
-#elif defined(HAVE_CLOCK_GETTIME)
-            if (!clock_gettime(CLOCK_REALTIME, &tnow)) {
-                time_t ts = ts2ts(tnow) - ts2ts(pgtime);
-                if (ts >= 200000000ll) {
-                    log_progress(oc, pkt.pts, os->time_base);
-                    pgtime = tnow;
-                }
-            }
-#else
-            tnow = time(NULL);
-            if (pgtime < tnow) {
-                log_progress(oc, pkt.pts, os->time_base);
-                pgtime = tnow;
-            }
-#endif
+        if (is_audio && audio_need_encode) {
+            update_progress(&progress, oc, audio_pts, oc->streams[audio_dest_index]->time_base);
+        } else if (os) {
+            // pkt is reset after written.
+            update_progress(&progress, oc, audio_end, oc->streams[audio_dest_index]->time_base);
         }
         if (!finished) av_packet_unref(&pkt);
         if (finished) break;
     }
-    av_write_trailer(oc);
+    if ((meter || fingerprint) && !audio_need_encode) {
+        if ((rev = decode_audio_packet(&ret, audio_input, NULL, audio_input_frame, NULL, NULL, NULL, NULL, &allocations, meter, fingerprint, NULL, &progress)) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if ((ret = av_write_trailer(oc)) < 0) {
+        if (ret == AVERROR(EINVAL) && reserved_moov_size > 0) {
+            // Reserved space is too small and moov box is already written over media data.
+            retry_faststart = 1;
+            ret = 0;
+        }
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((rev = enm4a_write_fanout_trailers(&ret, &fanout)) != ENM4A_OK) {
+        goto end;
+    }
+    if (meter) {
+        if ((rev = enm4a_loudness_result(meter, &loudness)) != ENM4A_OK) {
+            goto end;
+        }
+        if (!args.quiet) {
+            printf("Integrated loudness: %.2f LUFS, loudness range: %.2f LU, true peak: %.2f dBTP, track gain: %+.2f dB\n", loudness.integrated, loudness.range, loudness.true_peak > 0 ? 20.0 * log10(loudness.true_peak) : -HUGE_VAL, loudness.track_gain);
+        }
+    }
+    if (fingerprint) {
+        if ((rev = enm4a_fingerprint_result(fingerprint, &fingerprint_result)) != ENM4A_OK) {
+            goto end;
+        }
+        if (!args.quiet) {
+            printf("Fingerprint: %s\n", fingerprint_result);
+        }
+    }
+    if (audio_need_encode) {
+        output_duration = av_rescale(audio_pts, AV_TIME_BASE, audio_output->sample_rate);
+    } else {
+        output_duration = av_rescale_q(audio_end, oc->streams[audio_dest_index]->time_base, AV_TIME_BASE_Q);
+    }
+    finish_progress(&progress, oc, output_duration);
+    if (args.stats) {
+        args.stats->input_size = ic->pb ? ic->pb->bytes_read : 0;
+        args.stats->output_size = oc->pb ? avio_size(oc->pb) : 0;
+        if (args.stats->output_size <= 0 && oc->pb) args.stats->output_size = avio_tell(oc->pb);
+        args.stats->duration = output_duration;
+        args.stats->allocations = allocations;
+        args.stats->first_packet = progress.first_packet;
+        if (!output_io && !to_stdout && (args.stats->output = malloc(strlen(out) + 1))) {
+            memcpy(args.stats->output, out, strlen(out) + 1);
+        }
+        if (fingerprint_result && (args.stats->fingerprint = malloc(strlen(fingerprint_result) + 1))) {
+            memcpy(args.stats->fingerprint, fingerprint_result, strlen(fingerprint_result) + 1);
+        }
+    }
 end:
+    free_progress_sink(&progress);
+    enm4a_free_fanout(&fanout);
     if (audio_output_frame) {
         av_frame_free(&audio_output_frame);
     }
     if (audio_input_frame) {
         av_frame_free(&audio_input_frame);
     }
+    if (audio_output_pkt) {
+        av_packet_free(&audio_output_pkt);
+    }
+    free_convert_buffer(&convert_buffer);
     if (afifo) {
         av_audio_fifo_free(afifo);
     }
@@ -841,24 +1851,63 @@ end:
         avcodec_free_context(&audio_output);
     }
     if (oc) {
-        if (!(oc->oformat->flags & AVFMT_NOFILE)) avio_closep(&oc->pb);
+        if (output_pb) {
+            avio_flush(output_pb);
+            oc->pb = NULL;
+        } else if (!(oc->oformat->flags & AVFMT_NOFILE)) avio_closep(&oc->pb);
         avformat_free_context(oc);
     }
-    if (ic) avformat_close_input(&ic);
-    if (imgc) avformat_close_input(&imgc);
+    if (rev == ENM4A_OK && meter && !tags_after_trailer && args.level >= ENM4A_LOG_VERBOSE) {
+        printf("Can not rewrite fragmented or streamed output, loudness tags are not written.\n");
+    }
+    if (rev == ENM4A_OK && meter && tags_after_trailer && !isfinite(loudness.integrated) && args.level >= ENM4A_LOG_VERBOSE) {
+        printf("Audio is too short or silent, loudness tags are not written.\n");
+    }
+    if (rev == ENM4A_OK && tags_after_trailer) {
+        // Output files are closed, so moov box can be rewritten.
+        const ENM4A_LOUDNESS_RESULT* measured = meter && isfinite(loudness.integrated) ? &loudness : NULL;
+        char faststart = args.faststart != ENM4A_FASTSTART_NONE;
+        rev = write_measured_tags(&ret, out, measured, fingerprint_result, faststart);
+        for (size_t i = 0; i < fanout_outputs && rev == ENM4A_OK; i++) {
+            rev = write_measured_tags(&ret, args.outputs[i].output, measured, fingerprint_result, faststart);
+        }
+    }
+    enm4a_loudness_free(&meter);
+    enm4a_fingerprint_free(&fingerprint);
+    if (fingerprint_result) free(fingerprint_result);
+    close_input(&in);
+    enm4a_free_cover(&cover);
+    enm4a_free_avio(&output_pb);
+    restore_stdout(stdout_fd);
     if (ret < 0 && ret != AVERROR_EOF) {
         char err[AV_ERROR_MAX_STRING_SIZE];
         printf("Error occurred: %s\n", av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret));
     }
     if (title) free(title);
     if (out) free(out);
-    if (headers) free(headers);
-    if (demux_option) {
-        av_dict_free(&demux_option);
+    if (mux_option) {
+        av_dict_free(&mux_option);
+    }
+    if (retry_faststart) {
+        if (!args.quiet) {
+            printf("Reserved space for moov box is too small, convert again and move moov box after writing.\n");
+        }
+        args.faststart = ENM4A_FASTSTART_REWRITE;
+        args.overwrite = ENM4A_OVERWRITE_YES;
+        return encode_m4a_internal(input, input_io, output_io, args);
     }
     return rev;
 }
 
+ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args) {
+    return encode_m4a_internal(input, NULL, NULL, args);
+}
+
+ENM4A_ERROR encode_m4a_io(const ENM4A_IO* input, const ENM4A_IO* output, ENM4A_ARGS args) {
+    if (!input || !output || !input->read || !output->write) return ENM4A_NULL_POINTER;
+    return encode_m4a_internal("custom input", input, output, args);
+}
+
 const char* enm4a_error_msg(ENM4A_ERROR err) {
     switch (err)
     {
@@ -892,6 +1941,22 @@ const char* enm4a_error_msg(ENM4A_ERROR err) {
         return "Unsupported sample rate.";
     case ENM4A_FIFO_WRITE_ERR:
         return "Can not write data to FIFO.";
+    case ENM4A_INVALID_MP4:
+        return "Invalid or unsupported mp4 file.";
+    case ENM4A_UNSUPPORTED_COVER:
+        return "Cover image should be a JPEG or PNG file smaller than 64MiB.";
+    case ENM4A_INVALID_TAG_VALUE:
+        return "Invalid tag value.";
+    case ENM4A_INVALID_TRACE:
+        return "Invalid or unsupported trace dump.";
+    case ENM4A_UNKNOWN_INPUT_FORMAT:
+        return "Unknown input format.";
+    case ENM4A_INVALID_TRACKS:
+        return "Tracks should be ordered by start time and start before the end of input.";
+    case ENM4A_INVALID_COVER:
+        return "Can not find a decodable image in cover file.";
+    case ENM4A_INVALID_DURATION:
+        return "Duration should be positive.";
     default:
         return "Unknown error";
     }
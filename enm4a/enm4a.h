@@ -18,6 +18,11 @@ extern "C" {
 #define ENABLE_DEPRECATION_WARNINGS  _Pragma("GCC diagnostic pop")
 #endif
 
+/// Default fragment duration in microseconds when output is stdout
+#define ENM4A_DEFAULT_FRAGMENT_DURATION 2000000
+/// Default JPEG quality scale of encoded cover
+#define ENM4A_DEFAULT_COVER_QUALITY 3
+
 typedef enum ENM4A_ERROR {
     ENM4A_OK,
     ENM4A_NULL_POINTER,
@@ -34,6 +39,14 @@ typedef enum ENM4A_ERROR {
     ENM4A_INVALID_DEFUALE_SAMPLE_RATE,
     ENM4A_INVALID_SAMPLE_RATE,
     ENM4A_FIFO_WRITE_ERR,
+    ENM4A_INVALID_MP4,
+    ENM4A_UNSUPPORTED_COVER,
+    ENM4A_INVALID_TAG_VALUE,
+    ENM4A_INVALID_TRACE,
+    ENM4A_UNKNOWN_INPUT_FORMAT,
+    ENM4A_INVALID_TRACKS,
+    ENM4A_INVALID_COVER,
+    ENM4A_INVALID_DURATION,
 } ENM4A_ERROR;
 
 typedef enum ENM4A_LOG {
@@ -49,12 +62,125 @@ typedef enum ENM4A_OVERWRITE {
     ENM4A_OVERWRITE_NO,
 } ENM4A_OVERWRITE;
 
+typedef enum ENM4A_RESAMPLER {
+    ENM4A_RESAMPLER_DEFAULT,
+    /// Shorter filter. Faster but lower quality.
+    ENM4A_RESAMPLER_FAST,
+    /// Use soxr if available, otherwise use longer filter of swr.
+    ENM4A_RESAMPLER_HIGH,
+} ENM4A_RESAMPLER;
+
+typedef enum ENM4A_FASTSTART {
+    /// moov box is placed at the end of file
+    ENM4A_FASTSTART_NONE,
+    /// Reserve space for moov box at the begin of file. Size is estimated from input.
+    /// If reserved space is too small, will convert again with ENM4A_FASTSTART_REWRITE.
+    ENM4A_FASTSTART_RESERVE,
+    /// Move moov box to the begin of file after writing. Need read and write the whole file again.
+    ENM4A_FASTSTART_REWRITE,
+} ENM4A_FASTSTART;
+
+typedef enum ENM4A_THREAD_TYPE {
+    /// Let FFmpeg choose frame or slice threading
+    ENM4A_THREAD_TYPE_DEFAULT,
+    /// Process multiple frames at once. Adds delay of one frame per thread.
+    ENM4A_THREAD_TYPE_FRAME,
+    /// Split a frame into slices processed at once
+    ENM4A_THREAD_TYPE_SLICE,
+} ENM4A_THREAD_TYPE;
+
+/// Used as thread count of codec to use the number of CPU cores
+#define ENM4A_THREADS_AUTO -1
+
 typedef struct ENM4A_HTTP_HEADER ENM4A_HTTP_HEADER;
+/// Processed cover images shared by conversions. Thread safe.
+typedef struct ENM4A_COVER_CACHE ENM4A_COVER_CACHE;
+
+/// Used as whence of ENM4A_IO::seek to get the total size of stream
+#define ENM4A_SEEK_SIZE 0x10000
+
+/// Custom I/O callbacks
+typedef struct ENM4A_IO {
+    /// Passed to every callback
+    void* opaque;
+    /// Read at most size bytes. Return bytes read, 0 at end of stream or negative if error occured. Needed by input.
+    int (*read)(void* opaque, uint8_t* buf, int size);
+    /// Write size bytes. Return negative if error occured. Needed by output.
+    int (*write)(void* opaque, const uint8_t* buf, int size);
+    /**
+     * Optional. whence is SEEK_SET, SEEK_CUR, SEEK_END or ENM4A_SEEK_SIZE.
+     * Return new position, or total size if whence is ENM4A_SEEK_SIZE. Return negative if not supported.
+     * Output without seek will be written as fragmented mp4.
+    */
+    int64_t (*seek)(void* opaque, int64_t offset, int whence);
+} ENM4A_IO;
+
+/// Statistics of a finished conversion
+typedef struct ENM4A_STATS {
+    /// Bytes read from input
+    int64_t input_size;
+    /// Bytes written to output
+    int64_t output_size;
+    /// Duration of output audio stream in AV_TIME_BASE units
+    int64_t duration;
+    /// Buffer allocations in audio conversion path. Should not grow with input duration.
+    int64_t allocations;
+    /// Output file path. NULL if output is stdout or custom output. Should be freed by free().
+    char* output;
+    /// Microseconds from start of conversion to the first packet read from input
+    int64_t first_packet;
+    /// Fingerprint if ENM4A_ARGS::fingerprint is set. Should be freed by free().
+    char* fingerprint;
+} ENM4A_STATS;
+
+/// Additional output which is encoded from the same decoded audio
+typedef struct ENM4A_OUTPUT {
+    char* output;
+    /// Target bitrate. 0 means use the bitrate of main output.
+    int64_t bitrate;
+    /// Output sample rate. 0 means use the sample rate of main output.
+    int sample_rate;
+} ENM4A_OUTPUT;
+
+/// Stages of conversion which are timed separately
+typedef enum ENM4A_STAGE {
+    ENM4A_STAGE_DEMUX,
+    ENM4A_STAGE_DECODE,
+    ENM4A_STAGE_RESAMPLE,
+    ENM4A_STAGE_ENCODE,
+    ENM4A_STAGE_MUX,
+    ENM4A_STAGE_COUNT,
+} ENM4A_STAGE;
+
+typedef struct ENM4A_PROGRESS {
+    /// Bytes read from input. -1 if unknown.
+    int64_t input_size;
+    /// Bytes written to output. -1 if unknown.
+    int64_t output_size;
+    /// Written duration in AV_TIME_BASE
+    int64_t time;
+    /// Input duration in AV_TIME_BASE. -1 if unknown.
+    int64_t duration;
+    /// Time since conversion started in microseconds
+    int64_t elapsed;
+    /// Time spent in every stage in microseconds. Time of stages run in parallel threads is summed.
+    int64_t stage_time[ENM4A_STAGE_COUNT];
+    /// Microseconds from start of conversion to the first packet read from input, including
+    /// opening and probing input. -1 if no packet is read yet.
+    int64_t first_packet;
+    /// 1 if output is finished. This is the last call.
+    char finished;
+} ENM4A_PROGRESS;
+
+/// Called periodically from the thread which writes output, and once more when output is finished.
+typedef void(*ENM4A_PROGRESS_CALLBACK)(void* opaque, const ENM4A_PROGRESS* progress);
 
 /// Call init_enm4a_args to initialize
 typedef struct ENM4A_ARGS {
     ENM4A_LOG level;
     ENM4A_OVERWRITE overwrite;
+    /// Output file. "-" means stdout. While writing to stdout, stdout of the process is redirected to stderr,
+    /// so only one conversion can write to stdout at a time. Others wait for it to finish.
     char* output;
     char* title;
     char* artist;
@@ -74,6 +200,77 @@ typedef struct ENM4A_ARGS {
     int64_t bitrate;
     /// Print log level
     char print_level;
+    /// Don't print progress and stream information. Used when multiple conversions run at the same time.
+    char quiet;
+    /// If not NULL, will be filled with statistics when conversion is successed.
+    ENM4A_STATS* stats;
+    /// Demux, decode and encode in separate threads. Only used when need encoding.
+    char pipeline;
+    /// Resampler profile. Resampler is only used when decoded samples are not suitable for encoder.
+    ENM4A_RESAMPLER resampler;
+    /// Place moov box at the begin of file, so output can be played before fully downloaded.
+    ENM4A_FASTSTART faststart;
+    /// If greater than 0, write fragmented mp4 with fragments of this duration in microseconds.
+    /// Fragmented mp4 can be written to non-seekable output. Output "-" means stdout and
+    /// uses ENM4A_DEFAULT_FRAGMENT_DURATION if not set.
+    int64_t fragment_duration;
+    /// If greater than 0, cut decoded audio into segments and encode them in parallel with this number of threads.
+    /// Only used when need encoding. pipeline is ignored if set.
+    unsigned int segment_threads;
+    /// Additional outputs. Audio is decoded and resampled once and encoded for every output,
+    /// so AAC stream is also encoded. pipeline and segment_threads are ignored if set.
+    ENM4A_OUTPUT* outputs;
+    size_t output_count;
+    /// Measure EBU R128 loudness and true peak of decoded audio, then write them and ReplayGain as tags.
+    /// AAC stream is decoded only for measurement if it is copied.
+    /// Tags are not written to fragmented output, stdout and custom output.
+    char loudness;
+    /// If greater than 0 and input is a HTTP(S) URL, input is read by a background thread into a ring buffer of
+    /// this size. Dropped connections are resumed with Range requests.
+    size_t readahead;
+    /// If not NULL, called with progress about 5 times per second. Not affected by quiet.
+    ENM4A_PROGRESS_CALLBACK progress;
+    void* progress_opaque;
+    /// Maximum bytes read to detect input format and streams. 0 means FFmpeg default.
+    int64_t probesize;
+    /// Maximum duration of input analyzed to get stream information in microseconds. 0 means FFmpeg default.
+    int64_t analyzeduration;
+    /// Short name of input format, such as flac or mp3. NULL means detect automatically.
+    const char* input_format;
+    /// Skip analyzing packets to get stream information if container headers already have
+    /// complete codec parameters of all streams. Input duration may be less accurate.
+    char trust_headers;
+    /// Start of input to convert in microseconds. Input is seeked to the nearest preceding packet.
+    /// Copied AAC stream is cut at packet boundaries, encoded audio is cut at the exact sample.
+    int64_t start_time;
+    /// Duration of input to convert in microseconds. 0 means until the end. Input is not read after it.
+    int64_t duration;
+    /// If greater than 0, cover larger than this width or height is downscaled and encoded as JPEG.
+    int cover_max_size;
+    /// JPEG quality scale of encoded cover, from 2 (best) to 31. 0 means ENM4A_DEFAULT_COVER_QUALITY.
+    int cover_quality;
+    /// Always encode cover as JPEG. Cover which is not JPEG or PNG is always encoded.
+    char cover_recompress;
+    /// If not NULL, loaded covers are kept in it and reused by other conversions.
+    ENM4A_COVER_CACHE* cover_cache;
+    /// Compute chroma fingerprint of the first ENM4A_FINGERPRINT_DURATION seconds of decoded audio, then store it in
+    /// stats and as a tag. AAC stream is decoded only for fingerprint if it is copied.
+    /// Tag is not written to fragmented output, stdout and custom output.
+    char fingerprint;
+    /// Name of AAC encoder, such as aac or libfdk_aac. "native" means aac.
+    /// NULL means the first available one of libfdk_aac, aac_at and aac.
+    const char* encoder;
+    /// Threads of decoder. 0 means single thread. ENM4A_THREADS_AUTO means the number of CPU cores.
+    /// Ignored if decoder does not support threading.
+    int decoder_threads;
+    /// Threads of every encoder. Same as decoder_threads.
+    int encoder_threads;
+    /// Threading method of decoder and encoder
+    ENM4A_THREAD_TYPE thread_type;
+    /// Existing files which are replaced without asking even if overwrite is not ENM4A_OVERWRITE_YES,
+    /// such as outputs written by a previous run. Compared with output paths as is.
+    const char* const* replaceable_outputs;
+    size_t replaceable_output_count;
 } ENM4A_ARGS;
 
 /**
@@ -83,8 +280,45 @@ typedef struct ENM4A_ARGS {
  * @return ENM4A_OK if successed. If error occured. result will not set
 */
 ENM4A_ERROR enm4a_is_supported_sample_rates(int sample_rate, int* result);
+/**
+ * @brief Check sample rate is supported by specified AAC encoder
+ * @param encoder Same as ENM4A_ARGS::encoder
+ * @return ENM4A_NO_ENCODER if encoder is not available.
+*/
+ENM4A_ERROR enm4a_encoder_supports_sample_rate(const char* encoder, int sample_rate, int* result);
+/**
+ * @brief Get the name of AAC encoder which would be used
+ * @param name Same as ENM4A_ARGS::encoder
+ * @return NULL if encoder is not available or is not an AAC encoder.
+*/
+const char* enm4a_aac_encoder_name(const char* name);
 void init_enm4a_args(ENM4A_ARGS* args);
 ENM4A_ERROR encode_m4a(const char* input, ENM4A_ARGS args);
+/**
+ * @brief Convert with custom I/O callbacks. args.output, args.overwrite and args.http_headers are ignored.
+ * faststart is done by writing fragmented mp4 because output can not be reopened.
+ * @param input Input callbacks. read is needed.
+ * @param output Output callbacks. write is needed.
+ * @param args Arguments
+*/
+ENM4A_ERROR encode_m4a_io(const ENM4A_IO* input, const ENM4A_IO* output, ENM4A_ARGS args);
+/**
+ * @brief Convert from memory to memory.
+ * @param data Input data
+ * @param size Size of input data
+ * @param output Output data. Should be freed by enm4a_free_memory.
+ * @param output_size Size of output data
+ * @param args Arguments. Same as encode_m4a_io.
+*/
+ENM4A_ERROR encode_m4a_memory(const uint8_t* data, size_t size, uint8_t** output, size_t* output_size, ENM4A_ARGS args);
+void enm4a_free_memory(uint8_t* data);
+/**
+ * @brief Change metadata of an existing m4a file in place. Only moov box is rewritten, media data is not touched.
+ * title, artist, album, album_artist, date, track, disc and cover of args are used.
+ * NULL means keep the tag, empty string means remove the tag. Other fields are ignored.
+ * @param path m4a file
+*/
+ENM4A_ERROR retag_m4a(const char* path, ENM4A_ARGS args);
 const char* enm4a_error_msg(ENM4A_ERROR err);
 void enm4a_print_ffmpeg_version();
 void enm4a_print_ffmpeg_configuration();
@@ -98,6 +332,15 @@ void enm4a_free_http_header(ENM4A_HTTP_HEADER* h);
  * @return NULL if error occured. See err to get detailed information.
 */
 ENM4A_HTTP_HEADER* enm4a_parse_http_header(const char* inp, ENM4A_ERROR* err);
+/**
+ * @brief Create a cover cache.
+ * Covers kept in memory are limited to ENM4A_COVER_CACHE_MEMORY bytes.
+ * @param dir Directory where encoded covers are also stored, so they are reused by later runs. NULL means only keep them in memory.
+ * @return NULL if out of memory.
+*/
+ENM4A_COVER_CACHE* enm4a_cover_cache_alloc(const char* dir);
+/// Free cache. Covers already used by running conversions are still valid.
+void enm4a_cover_cache_free(ENM4A_COVER_CACHE** cache);
 #ifdef __cplusplus
 }
 #endif
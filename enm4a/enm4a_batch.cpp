@@ -0,0 +1,291 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_batch.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cpp2c.h"
+#include "fileop.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+#if HAVE_SSCANF_S
+#define sscanf sscanf_s
+#endif
+
+bool enm4a_set_job_field(Enm4aJob& job, std::string key, std::string value, std::string& err) {
+    if (key == "input") {
+        job.input = value;
+    } else if (key == "output") {
+        if (value == "-") {
+            err = "Can not write to stdout in batch mode.";
+            return false;
+        }
+        job.output = value;
+    } else if (key == "title") {
+        job.title = value;
+    } else if (key == "artist") {
+        job.artist = value;
+    } else if (key == "album") {
+        job.album = value;
+    } else if (key == "album_artist" || key == "album-artist") {
+        job.album_artist = value;
+    } else if (key == "cover") {
+        job.cover = value;
+    } else if (key == "disc") {
+        job.disc = value;
+    } else if (key == "track") {
+        job.track = value;
+    } else if (key == "date") {
+        job.date = value;
+    } else if (key == "sample_rate" || key == "sample-rate") {
+        int sample_rate;
+        if (sscanf(value.c_str(), "%d", &sample_rate) != 1) {
+            err = "Sample rate should be a integer.";
+            return false;
+        }
+        job.sample_rate = sample_rate;
+    } else if (key == "bitrate") {
+        size_t bits;
+        if (!fileop::parse_size(value, bits, false)) {
+            err = "Can not parse size string.";
+            return false;
+        }
+        job.bitrate = bits;
+    } else {
+        err = "Unknown field: " + key;
+        return false;
+    }
+    return true;
+}
+
+bool enm4a_parse_job_line(std::string line, const Enm4aJob& defaults, Enm4aJob& job, std::string& err) {
+    job = defaults;
+    size_t start = 0;
+    bool first = true;
+    while (start <= line.length()) {
+        size_t pos = line.find('\t', start);
+        std::string field = line.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+        start = pos == std::string::npos ? line.length() + 1 : pos + 1;
+        if (first) {
+            job.input = field;
+            first = false;
+            continue;
+        }
+        if (!field.length()) continue;
+        size_t eq = field.find('=');
+        if (eq == std::string::npos) {
+            err = "Field should be in key=value form: " + field;
+            return false;
+        }
+        if (!enm4a_set_job_field(job, field.substr(0, eq), field.substr(eq + 1), err)) return false;
+    }
+    if (!job.input.length()) {
+        err = "An input file is needed.";
+        return false;
+    }
+    return true;
+}
+
+bool enm4a_read_batch_manifest(std::string path, const Enm4aJob& defaults, std::list<Enm4aJob>& jobs) {
+    FILE* f = path == "-" ? stdin : fopen(path.c_str(), "r");
+    if (!f) {
+        printf("Can not open manifest file: %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    size_t line_no = 0;
+    bool ok = true;
+    char buf[1024];
+    bool eof = false;
+    while (!eof) {
+        line.clear();
+        while (1) {
+            if (!fgets(buf, sizeof(buf), f)) {
+                eof = true;
+                break;
+            }
+            line += buf;
+            if (line.length() && line[line.length() - 1] == '\n') break;
+        }
+        if (eof && !line.length()) break;
+        line_no++;
+        while (line.length() && (line[line.length() - 1] == '\n' || line[line.length() - 1] == '\r')) {
+            line.erase(line.length() - 1);
+        }
+        if (!line.length() || line[0] == '#') continue;
+        Enm4aJob job;
+        std::string err;
+        if (!enm4a_parse_job_line(line, defaults, job, err)) {
+            printf("%s:%zu: %s\n", path.c_str(), line_no, err.c_str());
+            ok = false;
+            break;
+        }
+        jobs.push_back(job);
+    }
+    if (f != stdin) fclose(f);
+    return ok;
+}
+
+bool enm4a_fill_job_args(Enm4aJob& job, ENM4A_ARGS& args) {
+    if (job.output.length() && !cpp2c::string2char(job.output, args.output)) return false;
+    if (job.title.length() && !cpp2c::string2char(job.title, args.title)) return false;
+    if (job.cover.length() && !cpp2c::string2char(job.cover, args.cover)) return false;
+    if (job.artist.length() && !cpp2c::string2char(job.artist, args.artist)) return false;
+    if (job.album.length() && !cpp2c::string2char(job.album, args.album)) return false;
+    if (job.album_artist.length() && !cpp2c::string2char(job.album_artist, args.album_artist)) return false;
+    if (job.disc.length() && !cpp2c::string2char(job.disc, args.disc)) return false;
+    if (job.track.length() && !cpp2c::string2char(job.track, args.track)) return false;
+    if (job.date.length() && !cpp2c::string2char(job.date, args.date)) return false;
+    if (job.sample_rate > -1) args.sample_rate = &job.sample_rate;
+    if (job.bitrate > -1) args.bitrate = job.bitrate;
+    return true;
+}
+
+void enm4a_free_job_args(ENM4A_ARGS& args) {
+    if (args.output) free(args.output);
+    if (args.title) free(args.title);
+    if (args.cover) free(args.cover);
+    if (args.artist) free(args.artist);
+    if (args.album) free(args.album);
+    if (args.album_artist) free(args.album_artist);
+    if (args.disc) free(args.disc);
+    if (args.track) free(args.track);
+    if (args.date) free(args.date);
+    args.output = args.title = args.cover = args.artist = args.album = args.album_artist = args.disc = args.track = args.date = nullptr;
+}
+
+size_t enm4a_run_batch(std::list<Enm4aJob>& jobs, ENM4A_ARGS base, unsigned int threads, Enm4aIncremental* incremental, Enm4aTelemetry* telemetry) {
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    if (threads > jobs.size()) threads = (unsigned int)jobs.size();
+    std::vector<Enm4aJob*> queue;
+    for (auto i = jobs.begin(); i != jobs.end(); i++) {
+        queue.push_back(&(*i));
+    }
+    std::atomic<size_t> next(0);
+    std::mutex lock;
+    size_t finished = 0, succeeded = 0, skipped = 0, failed = 0;
+    int64_t input_size = 0, output_size = 0, duration = 0;
+    // JSON lines on stdout must not be mixed with text.
+    bool text = !telemetry || !telemetry->is_stdout();
+    auto start = std::chrono::steady_clock::now();
+    auto worker = [&]() {
+        size_t index;
+        while ((index = next++) < queue.size()) {
+            Enm4aJob* job = queue[index];
+            ENM4A_ARGS args = base;
+            ENM4A_STATS stats;
+            memset(&stats, 0, sizeof(ENM4A_STATS));
+            args.stats = &stats;
+            args.quiet = 1;
+            Enm4aTelemetryJob telemetry_job;
+            if (telemetry) telemetry->attach(telemetry_job, job->input, args);
+            auto job_start = std::chrono::steady_clock::now();
+            ENM4A_ERROR re = ENM4A_NO_MEMORY;
+            bool up_to_date = false;
+            Enm4aFileId input_id;
+            uint64_t args_hash = 0;
+            std::vector<std::string> previous_outputs;
+            std::vector<const char*> replaceable;
+            if (enm4a_fill_job_args(*job, args)) {
+                if (incremental) {
+                    args_hash = enm4a_hash_args(args);
+                    ENM4A_INCREMENTAL_STATE state = incremental->check(job->input, args_hash, input_id, previous_outputs);
+                    up_to_date = state == ENM4A_INCREMENTAL_UP_TO_DATE;
+                    // Only files written by previous run are safe to replace. Output path may be changed.
+                    if (state == ENM4A_INCREMENTAL_OUTDATED) enm4a_set_replaceable_outputs(args, previous_outputs, replaceable);
+                }
+                if (!up_to_date) re = encode_m4a(job->input.c_str(), args);
+            }
+            enm4a_free_job_args(args);
+            if (re == ENM4A_OK && incremental && stats.output) {
+                incremental->update(job->input, input_id, args_hash, stats.output, enm4a_extra_outputs(base));
+            }
+            if (telemetry) telemetry->write_summary(telemetry_job, re, stats.output ? stats.output : "", up_to_date, stats.fingerprint);
+            if (stats.output) free(stats.output);
+            if (stats.fingerprint) free(stats.fingerprint);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - job_start).count();
+            std::lock_guard<std::mutex> guard(lock);
+            finished++;
+            if (up_to_date) {
+                skipped++;
+                if (text) printf("[%zu/%zu] Up to date %s\n", finished, queue.size(), job->input.c_str());
+            } else if (re == ENM4A_OK) {
+                succeeded++;
+                input_size += stats.input_size;
+                output_size += stats.output_size;
+                duration += stats.duration;
+                if (text) printf("[%zu/%zu] OK %s (%.2fs, %.2fx)\n", finished, queue.size(), job->input.c_str(), elapsed, elapsed > 0 ? stats.duration / 1000000.0 / elapsed : 0.0);
+            } else if (re == ENM4A_FILE_EXISTS) {
+                skipped++;
+                if (text) printf("[%zu/%zu] Skipped %s: %s\n", finished, queue.size(), job->input.c_str(), enm4a_error_msg(re));
+            } else {
+                failed++;
+                if (text) printf("[%zu/%zu] Failed %s: %s\n", finished, queue.size(), job->input.c_str(), enm4a_error_msg(re));
+            }
+            fflush(stdout);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; i++) {
+        pool.push_back(std::thread(worker));
+    }
+    for (auto i = pool.begin(); i != pool.end(); i++) {
+        i->join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (telemetry) telemetry->write_batch(finished, succeeded, skipped, failed, elapsed, duration, input_size, output_size);
+    if (!text) return failed;
+    printf("Finished %zu jobs with %u threads in %.2fs: %zu succeeded, %zu skipped, %zu failed.\n", finished, threads, elapsed, succeeded, skipped, failed);
+    if (elapsed > 0) {
+        printf("Throughput: %.2f jobs/s, %.2fx realtime, input %.2f MiB/s, output %.2f MiB/s\n", finished / elapsed, duration / 1000000.0 / elapsed, input_size / 1048576.0 / elapsed, output_size / 1048576.0 / elapsed);
+    }
+    return failed;
+}
+
+size_t enm4a_plan_batch(std::list<Enm4aJob>& jobs, ENM4A_ARGS base, unsigned int threads, Enm4aTelemetry& telemetry) {
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    if (threads > jobs.size()) threads = (unsigned int)jobs.size();
+    std::vector<Enm4aJob*> queue;
+    for (auto i = jobs.begin(); i != jobs.end(); i++) {
+        queue.push_back(&(*i));
+    }
+    std::vector<ENM4A_PLAN> plans(queue.size());
+    std::vector<ENM4A_ERROR> results(queue.size(), ENM4A_NO_MEMORY);
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        size_t index;
+        while ((index = next++) < queue.size()) {
+            ENM4A_ARGS args = base;
+            args.quiet = 1;
+            if (enm4a_fill_job_args(*queue[index], args)) {
+                results[index] = enm4a_plan(queue[index]->input.c_str(), args, &plans[index]);
+            }
+            enm4a_free_job_args(args);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; i++) {
+        pool.push_back(std::thread(worker));
+    }
+    for (auto i = pool.begin(); i != pool.end(); i++) {
+        i->join();
+    }
+    size_t failed = 0;
+    for (size_t i = 0; i < queue.size(); i++) {
+        telemetry.write_plan(queue[i]->input, results[i], plans[i]);
+        if (results[i] != ENM4A_OK) failed++;
+    }
+    return failed;
+}
@@ -0,0 +1,80 @@
+#ifndef _ENM4A_ENM4A_BATCH_H
+#define _ENM4A_ENM4A_BATCH_H
+#include <stdint.h>
+#include <list>
+#include <string>
+#include "enm4a.h"
+#include "enm4a_incremental.h"
+#include "enm4a_telemetry.h"
+
+/// A conversion job. Empty strings and negative numbers mean not set.
+typedef struct Enm4aJob {
+    std::string input;
+    std::string output;
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::string album_artist;
+    std::string cover;
+    std::string disc;
+    std::string track;
+    std::string date;
+    int sample_rate = -1;
+    int64_t bitrate = -1;
+} Enm4aJob;
+
+/**
+ * @brief Set a field of job by the name of the field in ENM4A_ARGS
+ * @param job Job
+ * @param key Field name. eg. title, album_artist, sample_rate
+ * Sample rate is not checked here, because it depends on the encoder of conversion.
+ * @param value Value
+ * @param err Error message if failed.
+ * @return true if successed.
+*/
+bool enm4a_set_job_field(Enm4aJob& job, std::string key, std::string value, std::string& err);
+/**
+ * @brief Parse a line of manifest file.
+ * @param line Input file and key=value overrides separated by tab.
+ * @param defaults Default values of job.
+ * @param err Error message if failed.
+ * @return true if successed.
+*/
+bool enm4a_parse_job_line(std::string line, const Enm4aJob& defaults, Enm4aJob& job, std::string& err);
+/**
+ * @brief Read jobs from a manifest file.
+ * Every non-empty line which not starts with # is a job. Fields are separated by tab.
+ * The first field is the input file, other fields are overrides in key=value form.
+ * @param path Manifest file path. "-" means stdin.
+ * @param defaults Default values of every job.
+ * @param jobs Jobs will be appended to this list.
+ * @return true if successed.
+*/
+bool enm4a_read_batch_manifest(std::string path, const Enm4aJob& defaults, std::list<Enm4aJob>& jobs);
+/**
+ * @brief Fill arguments from job. Strings are copied and should be freed by enm4a_free_job_args.
+ * @param job Job
+ * @param args Arguments which already initialized.
+ * @return true if successed.
+*/
+bool enm4a_fill_job_args(Enm4aJob& job, ENM4A_ARGS& args);
+void enm4a_free_job_args(ENM4A_ARGS& args);
+/**
+ * @brief Run jobs on a bounded worker pool.
+ * @param jobs Jobs
+ * @param base Shared arguments. Fields set by job will be overrided.
+ * @param threads Number of worker threads. 0 means the number of CPU cores.
+ * @param incremental If not NULL, jobs which are up to date are skipped and succeeded jobs are recorded.
+ * @param telemetry If not NULL, progress and results are written to it.
+ * @return The number of failed jobs.
+*/
+size_t enm4a_run_batch(std::list<Enm4aJob>& jobs, ENM4A_ARGS base, unsigned int threads, Enm4aIncremental* incremental = nullptr, Enm4aTelemetry* telemetry = nullptr);
+/**
+ * @brief Plan jobs without converting them. Plans are written to telemetry in job order.
+ * @param jobs Jobs
+ * @param base Shared arguments. Fields set by job will be overrided.
+ * @param threads Number of worker threads which probe inputs. 0 means the number of CPU cores.
+ * @return The number of jobs which can not be planned.
+*/
+size_t enm4a_plan_batch(std::list<Enm4aJob>& jobs, ENM4A_ARGS base, unsigned int threads, Enm4aTelemetry& telemetry);
+#endif
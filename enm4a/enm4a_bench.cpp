@@ -0,0 +1,346 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "getopt.h"
+#include <stdio.h>
+#include <string.h>
+#include <cinttypes>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "enm4a.h"
+#include "enm4a_corpus.h"
+#include "fileop.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+#if HAVE_SSCANF_S
+#define sscanf sscanf_s
+#endif
+
+/// AAC encoders compared when they are available
+static const char* const bench_encoders[] = { "aac", "libfdk_aac", "aac_at" };
+
+/// Inputs of suite. Inputs whose muxer or encoder is not built in FFmpeg are skipped.
+static const ENM4A_CORPUS_SPEC suite_corpus[] = {
+    { "wav_s16_44100_stereo", "wav", "pcm_s16le", 44100, 2 },
+    { "wav_s16_22050_mono", "wav", "pcm_s16le", 22050, 1 },
+    { "wav_f32_48000_5.1", "wav", "pcm_f32le", 48000, 6 },
+    { "flac_44100_stereo", "flac", "flac", 44100, 2 },
+    { "flac_96000_stereo", "flac", "flac", 96000, 2 },
+    { "mkv_flac_48000_5.1", "matroska", "flac", 48000, 6 },
+    { "m4a_alac_44100_stereo", "ipod", "alac", 44100, 2 },
+    { "mp3_44100_stereo", "mp3", "libmp3lame", 44100, 2 },
+    { "ogg_opus_48000_stereo", "ogg", "libopus", 48000, 2 },
+    // AAC stream is copied without encoding.
+    { "m4a_aac_44100_stereo_copy", "ipod", "aac", 44100, 2 },
+    { "adts_aac_48000_stereo_copy", "adts", "aac", 48000, 2 },
+};
+
+static const char* stage_names[ENM4A_STAGE_COUNT] = { "demux", "decode", "resample", "encode", "mux" };
+
+/// A way to run conversion
+typedef struct BenchMode {
+    std::string name;
+    std::function<void(ENM4A_ARGS&)> setup;
+} BenchMode;
+
+void print_help() {
+    printf("%s", "Usage: enm4a_bench [options] [FILE]\n\
+Compare wall-clock time of encoding modes and AAC encoders. Input is read into memory and output is\n\
+written to memory. Input should not contain AAC stream, otherwise it is copied without encoding.\n\
+If FILE is not specified, a synthetic 16-bit PCM WAV of tones and noise is generated in memory.\n\
+\n\
+Options:\n\
+    -h, --help              Print help message.\n\
+    -j, --threads <num>     Threads used by parallel modes. Default: the number of CPU cores.\n\
+    -r, --runs <num>        Run every mode specified times and report the best time. Default: 3.\n\
+    -b, --bitrate <size>    Specify output bitrate.\n\
+    -l, --length <seconds>  Duration of synthetic input. Default: 60.\n\
+    -s, --suite             Generate synthetic inputs in several containers, codecs, sample rates\n\
+                            and channel layouts, including AAC streams which are copied, and\n\
+                            convert every input with default options. Results are written as\n\
+                            JSON lines with realtime factor, peak RSS, allocations and time of\n\
+                            every stage. FILE is not used.\n\
+    -o, --output <FILE>     Write results of suite to FILE. Default: stdout.\n");
+}
+
+/// Reset peak RSS of process, so it is measured for every input. Only supported on Linux.
+static void reset_peak_rss() {
+#ifdef __linux__
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+/// @return Peak RSS of process in bytes. -1 if unknown.
+static int64_t peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return -1;
+    return (int64_t)pmc.PeakWorkingSetSize;
+#elif defined(__linux__)
+    // VmHWM is reset by reset_peak_rss, ru_maxrss is not.
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    char line[256];
+    int64_t kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmHWM: %" SCNd64 " kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return -1;
+#ifdef __APPLE__
+    return (int64_t)usage.ru_maxrss;
+#else
+    return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static void keep_final_progress(void* opaque, const ENM4A_PROGRESS* progress) {
+    if (progress->finished) *(ENM4A_PROGRESS*)opaque = *progress;
+}
+
+/**
+ * @brief Convert every input of suite_corpus and write results as JSON lines.
+ * @param length Duration of every input in seconds
+ * @param runs Every input is converted specified times, the fastest run is reported.
+ * @return The number of failed inputs.
+*/
+size_t run_suite(FILE* out, double length, int runs, int64_t bitrate) {
+    size_t failed = 0;
+    const char* encoder = enm4a_aac_encoder_name(nullptr);
+    fprintf(out, "{\"type\":\"bench_info\",\"encoder\":\"%s\",\"length\":%.3f,\"runs\":%d}\n", encoder ? encoder : "", length, runs);
+    for (auto& spec : suite_corpus) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "{\"type\":\"bench\",\"name\":\"%s\",\"format\":\"%s\",\"codec\":\"%s\",\"sample_rate\":%d,\"channels\":%d", spec.name, spec.format, spec.codec, spec.sample_rate, spec.channels);
+        std::string line = buf;
+        if (!enm4a_corpus_available(&spec)) {
+            fprintf(out, "%s,\"skipped\":\"muxer or encoder is not available\"}\n", line.c_str());
+            continue;
+        }
+        uint8_t* input = nullptr;
+        size_t input_size = 0;
+        int ret = 0;
+        ENM4A_ERROR re = enm4a_make_corpus_input(&ret, &spec, length, &input, &input_size);
+        if (re != ENM4A_OK) {
+            fprintf(out, "%s,\"error\":\"Can not generate input: %s\"}\n", line.c_str(), enm4a_error_msg(re));
+            failed++;
+            continue;
+        }
+        double best = -1;
+        ENM4A_STATS stats, best_stats;
+        ENM4A_PROGRESS progress, best_progress;
+        memset(&best_stats, 0, sizeof(best_stats));
+        memset(&best_progress, 0, sizeof(best_progress));
+        reset_peak_rss();
+        for (int i = 0; i < runs && re == ENM4A_OK; i++) {
+            ENM4A_ARGS args;
+            init_enm4a_args(&args);
+            args.quiet = 1;
+            if (bitrate > 0) args.bitrate = bitrate;
+            args.stats = &stats;
+            // Stages are only timed if progress callback is set.
+            memset(&progress, 0, sizeof(progress));
+            args.progress = keep_final_progress;
+            args.progress_opaque = &progress;
+            uint8_t* output = nullptr;
+            size_t output_size = 0;
+            auto start = std::chrono::steady_clock::now();
+            re = encode_m4a_memory(input, input_size, &output, &output_size, args);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            enm4a_free_memory(output);
+            if (re == ENM4A_OK && (best < 0 || elapsed < best)) {
+                best = elapsed;
+                best_stats = stats;
+                best_progress = progress;
+            }
+        }
+        int64_t rss = peak_rss();
+        free(input);
+        if (re != ENM4A_OK) {
+            fprintf(out, "%s,\"error\":\"%s\"}\n", line.c_str(), enm4a_error_msg(re));
+            failed++;
+            continue;
+        }
+        snprintf(buf, sizeof(buf), ",\"input_size\":%zu,\"output_size\":%" PRId64 ",\"duration\":%.3f,\"elapsed\":%.3f,\"realtime\":%.3f,\"peak_rss\":%" PRId64 ",\"allocations\":%" PRId64, input_size, best_stats.output_size, best_stats.duration / 1000000.0, best, best > 0 ? best_stats.duration / 1000000.0 / best : 0.0, rss, best_stats.allocations);
+        line += buf;
+        line += ",\"stages\":{";
+        for (int i = 0; i < ENM4A_STAGE_COUNT; i++) {
+            snprintf(buf, sizeof(buf), "%s\"%s\":%.3f", i ? "," : "", stage_names[i], best_progress.stage_time[i] / 1000000.0);
+            line += buf;
+        }
+        fprintf(out, "%s}}\n", line.c_str());
+        fflush(out);
+    }
+    return failed;
+}
+
+bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        printf("Can not open file: %s\n", path);
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t le;
+    while ((le = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + le);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) printf("Can not read file: %s\n", path);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    struct option opts[] = {
+        {"help", 0, nullptr, 'h'},
+        {"threads", 1, nullptr, 'j'},
+        {"runs", 1, nullptr, 'r'},
+        {"bitrate", 1, nullptr, 'b'},
+        {"length", 1, nullptr, 'l'},
+        {"suite", 0, nullptr, 's'},
+        {"output", 1, nullptr, 'o'},
+        nullptr,
+    };
+    int c;
+    const char* shortopts = "hj:r:b:l:so:";
+    bool suite = false;
+    const char* output_path = nullptr;
+    unsigned int threads = std::thread::hardware_concurrency();
+    int runs = 3;
+    int64_t bitrate = -1;
+    double length = 60;
+    while ((c = getopt_long(argc, argv, shortopts, opts, nullptr)) != -1) {
+        switch (c) {
+        case 'h':
+            print_help();
+            return 0;
+        case 'j':
+            if (sscanf(optarg, "%u", &threads) != 1) {
+                printf("Threads should be a non-negative integer.\n");
+                return 1;
+            }
+            break;
+        case 'r':
+            if (sscanf(optarg, "%d", &runs) != 1 || runs < 1) {
+                printf("Runs should be a positive integer.\n");
+                return 1;
+            }
+            break;
+        case 'b': {
+            size_t bits;
+            if (!fileop::parse_size(optarg, bits, false)) {
+                printf("Can not parse size string.\n");
+                return 1;
+            }
+            bitrate = bits;
+            break;
+        }
+        case 'l':
+            if (sscanf(optarg, "%lf", &length) != 1 || length <= 0) {
+                printf("Length should be a positive number.\n");
+                return 1;
+            }
+            break;
+        case 's':
+            suite = true;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case '?':
+        default:
+            return 1;
+        }
+    }
+    if (!threads) threads = 1;
+    if (suite) {
+        FILE* out = output_path ? fopen(output_path, "w") : stdout;
+        if (!out) {
+            printf("Can not open file: %s\n", output_path);
+            return 1;
+        }
+        size_t failed = run_suite(out, length, runs, bitrate);
+        if (out != stdout) fclose(out);
+        return failed ? 1 : 0;
+    }
+    std::vector<uint8_t> input;
+    if (optind < argc) {
+        if (!read_file(argv[optind], input)) return 1;
+    } else {
+        ENM4A_CORPUS_SPEC spec = { "wav_s16_44100_stereo", "wav", "pcm_s16le", 44100, 2 };
+        uint8_t* data = nullptr;
+        size_t size = 0;
+        int ret = 0;
+        ENM4A_ERROR re = enm4a_make_corpus_input(&ret, &spec, length, &data, &size);
+        if (re != ENM4A_OK) {
+            printf("Can not generate input: %s\n", enm4a_error_msg(re));
+            return 1;
+        }
+        input.assign(data, data + size);
+        free(data);
+    }
+    std::vector<BenchMode> modes;
+    // Modes which do not name an encoder use the native one, so they are comparable on every build.
+    modes.push_back({ "serial", [](ENM4A_ARGS& args) { args.encoder = "aac"; } });
+    modes.push_back({ "segmented", [threads](ENM4A_ARGS& args) { args.encoder = "aac"; args.segment_threads = threads; } });
+    modes.push_back({ "codec-threads", [threads](ENM4A_ARGS& args) {
+        args.encoder = "aac";
+        args.decoder_threads = threads;
+        args.encoder_threads = threads;
+    } });
+    for (auto name : bench_encoders) {
+        if (!strcmp(name, "aac") || !enm4a_aac_encoder_name(name)) continue;
+        modes.push_back({ name, [name](ENM4A_ARGS& args) { args.encoder = name; } });
+        modes.push_back({ std::string(name) + "-segmented", [name, threads](ENM4A_ARGS& args) { args.encoder = name; args.segment_threads = threads; } });
+    }
+    printf("Default AAC encoder: %s\n", enm4a_aac_encoder_name(nullptr) ? enm4a_aac_encoder_name(nullptr) : "none");
+    double baseline = 0;
+    printf("%-24s %10s %10s %10s %12s\n", "mode", "time(s)", "realtime", "speedup", "output");
+    for (auto& mode : modes) {
+        double best = -1;
+        ENM4A_STATS stats;
+        for (int i = 0; i < runs; i++) {
+            ENM4A_ARGS args;
+            init_enm4a_args(&args);
+            args.quiet = 1;
+            if (bitrate > 0) args.bitrate = bitrate;
+            args.stats = &stats;
+            mode.setup(args);
+            uint8_t* output = nullptr;
+            size_t output_size = 0;
+            auto start = std::chrono::steady_clock::now();
+            ENM4A_ERROR re = encode_m4a_memory(input.data(), input.size(), &output, &output_size, args);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            enm4a_free_memory(output);
+            if (re != ENM4A_OK) {
+                printf("%s failed: %s\n", mode.name.c_str(), enm4a_error_msg(re));
+                return 1;
+            }
+            if (best < 0 || elapsed < best) best = elapsed;
+        }
+        if (!baseline) baseline = best;
+        printf("%-24s %10.3f %9.2fx %9.2fx %12" PRId64 "\n", mode.name.c_str(), best, best > 0 ? stats.duration / 1000000.0 / best : 0.0, best > 0 ? baseline / best : 0.0, stats.output_size);
+    }
+    return 0;
+}
@@ -0,0 +1,241 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_corpus.h"
+#include "enm4a_internal.h"
+#include "enm4a_io.h"
+
+#include <malloc.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/samplefmt.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/// Samples per frame of encoders without fixed frame size
+#define CORPUS_FRAME_SIZE 1024
+
+int enm4a_corpus_available(const ENM4A_CORPUS_SPEC* spec) {
+    if (!spec || !spec->format || !spec->codec) return 0;
+    return avcodec_find_encoder_by_name(spec->codec) && av_guess_format(spec->format, NULL, NULL);
+}
+
+/// @return 1 if samples of this format can be generated.
+static int supported_sample_fmt(enum AVSampleFormat fmt) {
+    switch (av_get_packed_sample_fmt(fmt)) {
+    case AV_SAMPLE_FMT_U8:
+    case AV_SAMPLE_FMT_S16:
+    case AV_SAMPLE_FMT_S32:
+    case AV_SAMPLE_FMT_FLT:
+    case AV_SAMPLE_FMT_DBL:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/// Chord of every channel is a bit higher than the previous one, so channels are not identical.
+static float synth_sample(int64_t i, int c, int sample_rate, uint32_t* seed) {
+    double t = (double)i / sample_rate;
+    double base = 220.0 * (1 + 0.125 * c);
+    double chord = sin(2 * M_PI * base * t) + 0.5 * sin(2 * M_PI * base * 1.26 * t) + 0.5 * sin(2 * M_PI * base * 1.5 * t);
+    double sweep = 0.3 * sin(2 * M_PI * (200 + 1900 * fmod(t, 10.0)) * t);
+    *seed = *seed * 1664525u + 1013904223u;
+    double noise = ((double)(*seed >> 8) / (1 << 24) - 0.5) * 0.2;
+    return (float)((chord + sweep + noise) * 0.3);
+}
+
+static void put_sample(AVFrame* frame, int channels, int c, int i, float v) {
+    enum AVSampleFormat fmt = (enum AVSampleFormat)frame->format;
+    int bps = av_get_bytes_per_sample(fmt);
+    uint8_t* p = av_sample_fmt_is_planar(fmt) ? frame->extended_data[c] + (size_t)i * bps : frame->extended_data[0] + ((size_t)i * channels + c) * bps;
+    switch (av_get_packed_sample_fmt(fmt)) {
+    case AV_SAMPLE_FMT_U8:
+        *p = (uint8_t)(v * 127 + 128);
+        break;
+    case AV_SAMPLE_FMT_S16:
+        *(int16_t*)p = (int16_t)(v * 32767);
+        break;
+    case AV_SAMPLE_FMT_S32:
+        *(int32_t*)p = (int32_t)(v * 2147483647.0);
+        break;
+    case AV_SAMPLE_FMT_FLT:
+        *(float*)p = v;
+        break;
+    case AV_SAMPLE_FMT_DBL:
+        *(double*)p = v;
+        break;
+    default:
+        break;
+    }
+}
+
+/// Write all packets which encoder can output now.
+static ENM4A_ERROR write_packets(int* ret, AVCodecContext* enc, AVFormatContext* oc, AVStream* st, AVPacket* pkt) {
+    while ((*ret = avcodec_receive_packet(enc, pkt)) >= 0) {
+        av_packet_rescale_ts(pkt, enc->time_base, st->time_base);
+        pkt->stream_index = st->index;
+        if ((*ret = av_interleaved_write_frame(oc, pkt)) < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+    }
+    if (*ret == AVERROR(EAGAIN) || *ret == AVERROR_EOF) {
+        *ret = 0;
+        return ENM4A_OK;
+    }
+    return ENM4A_FFMPEG_ERR;
+}
+
+ENM4A_ERROR enm4a_make_corpus_input(int* ret, const ENM4A_CORPUS_SPEC* spec, double duration, uint8_t** data, size_t* size) {
+    if (!ret || !spec || !spec->format || !spec->codec || !data || !size) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    ENM4A_MEMORY out = { NULL, 0, 0, 0 };
+    ENM4A_IO io;
+    const AVCodec* codec = NULL;
+    AVCodecContext* enc = NULL;
+    AVFormatContext* oc = NULL;
+    AVStream* st = NULL;
+    AVFrame* frame = NULL;
+    AVPacket* pkt = NULL;
+    uint32_t seed = 1;
+    int frame_size = CORPUS_FRAME_SIZE, header_written = 0;
+    int64_t total, pts = 0;
+    if (spec->sample_rate <= 0 || spec->channels <= 0) return ENM4A_INVALID_SAMPLE_RATE;
+    if (duration <= 0) return ENM4A_INVALID_DURATION;
+    if (!(codec = avcodec_find_encoder_by_name(spec->codec)) || !codec->sample_fmts) {
+        return ENM4A_NO_ENCODER;
+    }
+    if (!(enc = avcodec_alloc_context3(codec))) {
+        return ENM4A_NO_MEMORY;
+    }
+    enc->sample_fmt = AV_SAMPLE_FMT_NONE;
+    for (int i = 0; codec->sample_fmts[i] != AV_SAMPLE_FMT_NONE; i++) {
+        if (supported_sample_fmt(codec->sample_fmts[i])) {
+            enc->sample_fmt = codec->sample_fmts[i];
+            break;
+        }
+    }
+    if (enc->sample_fmt == AV_SAMPLE_FMT_NONE) {
+        rev = ENM4A_NO_ENCODER;
+        goto end;
+    }
+#if NEW_CHANNEL_LAYOUT
+    av_channel_layout_default(&enc->ch_layout, spec->channels);
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+    DISABLE_DEPRECATION_WARNINGS
+    enc->channels = spec->channels;
+    enc->channel_layout = av_get_default_channel_layout(spec->channels);
+    ENABLE_DEPRECATION_WARNINGS
+#endif
+    enc->sample_rate = spec->sample_rate;
+    enc->time_base.num = 1;
+    enc->time_base.den = spec->sample_rate;
+    if ((*ret = avformat_alloc_output_context2(&oc, NULL, spec->format, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if ((*ret = avcodec_open2(enc, codec, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (enc->frame_size > 0 && !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)) {
+        frame_size = enc->frame_size;
+    }
+    if (!(st = avformat_new_stream(oc, NULL)) || !(frame = av_frame_alloc()) || !(pkt = av_packet_alloc())) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    st->time_base = enc->time_base;
+    if ((*ret = avcodec_parameters_from_context(st->codecpar, enc)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+#if NEW_CHANNEL_LAYOUT
+    if ((*ret = av_channel_layout_copy(&frame->ch_layout, &enc->ch_layout)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+    DISABLE_DEPRECATION_WARNINGS
+    frame->channel_layout = enc->channel_layout;
+    ENABLE_DEPRECATION_WARNINGS
+#endif
+    frame->format = enc->sample_fmt;
+    frame->sample_rate = enc->sample_rate;
+    frame->nb_samples = frame_size;
+    if ((*ret = av_frame_get_buffer(frame, 0)) < 0) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    enm4a_memory_io(&out, &io);
+    if (!(oc->pb = enm4a_alloc_avio(&io, 1))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+    if ((*ret = avformat_write_header(oc, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    header_written = 1;
+    total = (int64_t)ceil(duration * spec->sample_rate / frame_size) * frame_size;
+    while (pts < total) {
+        if ((*ret = av_frame_make_writable(frame)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        for (int i = 0; i < frame_size; i++) {
+            for (int c = 0; c < spec->channels; c++) {
+                put_sample(frame, spec->channels, c, i, synth_sample(pts + i, c, spec->sample_rate, &seed));
+            }
+        }
+        frame->pts = pts;
+        pts += frame_size;
+        if ((*ret = avcodec_send_frame(enc, frame)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if ((rev = write_packets(ret, enc, oc, st, pkt)) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if ((*ret = avcodec_send_frame(enc, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((rev = write_packets(ret, enc, oc, st, pkt)) != ENM4A_OK) {
+        goto end;
+    }
+    header_written = 0;
+    if ((*ret = av_write_trailer(oc)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    avio_flush(oc->pb);
+end:
+    if (header_written) av_write_trailer(oc);
+    if (oc) {
+        if (oc->pb) enm4a_free_avio(&oc->pb);
+        avformat_free_context(oc);
+    }
+    if (pkt) av_packet_free(&pkt);
+    if (frame) av_frame_free(&frame);
+    if (enc) avcodec_free_context(&enc);
+    if (rev == ENM4A_OK) {
+        *data = out.data;
+        *size = out.size;
+    } else if (out.data) {
+        free(out.data);
+    }
+    return rev;
+}
@@ -0,0 +1,34 @@
+#ifndef _ENM4A_ENM4A_CORPUS_H
+#define _ENM4A_ENM4A_CORPUS_H
+#include "enm4a.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Synthetic input used by benchmarks
+typedef struct ENM4A_CORPUS_SPEC {
+    /// Unique name of input
+    const char* name;
+    /// Short name of muxer, eg. wav, flac, ipod
+    const char* format;
+    /// Name of encoder, eg. pcm_s16le, flac, aac
+    const char* codec;
+    int sample_rate;
+    int channels;
+} ENM4A_CORPUS_SPEC;
+
+/// @return 1 if muxer and encoder of spec are built in FFmpeg.
+int enm4a_corpus_available(const ENM4A_CORPUS_SPEC* spec);
+/**
+ * @brief Generate input in memory. Audio is a chord, a sweep and noise, and is the same for the same spec and duration.
+ * @param duration Duration in seconds. Rounded up to whole frames of encoder. ENM4A_INVALID_DURATION if not positive.
+ * @param data Result. Should be freed by free().
+*/
+ENM4A_ERROR enm4a_make_corpus_input(int* ret, const ENM4A_CORPUS_SPEC* spec, double duration, uint8_t** data, size_t* size);
+#ifdef __cplusplus
+}
+#endif
+#endif
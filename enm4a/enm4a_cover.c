@@ -0,0 +1,539 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_cover.h"
+#include "enm4a_internal.h"
+#include "enm4a_thread.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cfileop.h"
+#include "libavutil/hash.h"
+#include "libavutil/intreadwrite.h"
+#include "libswscale/swscale.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+typedef struct COVER_ENTRY {
+    /// Content hash of cover file and encoding settings
+    char key[80];
+    ENM4A_COVER cover;
+    struct COVER_ENTRY* next;
+} COVER_ENTRY;
+
+struct ENM4A_COVER_CACHE {
+    ENM4A_MUTEX lock;
+    /// NULL if covers are not stored on disk
+    char* dir;
+    /// Most recently used first
+    COVER_ENTRY* entries;
+    /// Bytes of covers in entries
+    size_t size;
+};
+
+ENM4A_COVER_CACHE* enm4a_cover_cache_alloc(const char* dir) {
+    ENM4A_COVER_CACHE* cache = calloc(1, sizeof(ENM4A_COVER_CACHE));
+    if (!cache) return NULL;
+    if (dir && *dir) {
+        if (!(cache->dir = malloc(strlen(dir) + 1))) {
+            free(cache);
+            return NULL;
+        }
+        memcpy(cache->dir, dir, strlen(dir) + 1);
+    }
+    if (enm4a_mutex_init(&cache->lock)) {
+        if (cache->dir) free(cache->dir);
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void enm4a_cover_cache_free(ENM4A_COVER_CACHE** cache) {
+    if (!cache || !*cache) return;
+    ENM4A_COVER_CACHE* c = *cache;
+    while (c->entries) {
+        COVER_ENTRY* e = c->entries;
+        c->entries = e->next;
+        enm4a_free_cover(&e->cover);
+        free(e);
+    }
+    enm4a_mutex_destroy(&c->lock);
+    if (c->dir) free(c->dir);
+    free(c);
+    *cache = NULL;
+}
+
+/// @return 1 if entry is found and cover is set. Found entry becomes the most recently used.
+static int cache_lookup(ENM4A_COVER_CACHE* cache, const char* key, ENM4A_COVER* cover) {
+    int found = 0;
+    enm4a_mutex_lock(&cache->lock);
+    for (COVER_ENTRY* e = cache->entries, * prev = NULL; e; prev = e, e = e->next) {
+        if (strcmp(e->key, key)) continue;
+        if ((cover->buf = av_buffer_ref(e->cover.buf))) {
+            cover->codec_id = e->cover.codec_id;
+            cover->width = e->cover.width;
+            cover->height = e->cover.height;
+            cover->size = e->cover.size;
+            found = 1;
+        }
+        if (prev) {
+            prev->next = e->next;
+            e->next = cache->entries;
+            cache->entries = e;
+        }
+        break;
+    }
+    enm4a_mutex_unlock(&cache->lock);
+    return found;
+}
+
+static void cache_insert(ENM4A_COVER_CACHE* cache, const char* key, const ENM4A_COVER* cover) {
+    // Cache is only an optimization, ignore errors.
+    if ((size_t)cover->size > ENM4A_COVER_CACHE_MEMORY) return;
+    COVER_ENTRY* e = calloc(1, sizeof(COVER_ENTRY));
+    if (!e) return;
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->cover = *cover;
+    if (!(e->cover.buf = av_buffer_ref(cover->buf))) {
+        free(e);
+        return;
+    }
+    enm4a_mutex_lock(&cache->lock);
+    // Another conversion may have loaded the same cover meanwhile.
+    for (COVER_ENTRY* o = cache->entries; o; o = o->next) {
+        if (strcmp(o->key, key)) continue;
+        enm4a_mutex_unlock(&cache->lock);
+        enm4a_free_cover(&e->cover);
+        free(e);
+        return;
+    }
+    e->next = cache->entries;
+    cache->entries = e;
+    cache->size += e->cover.size;
+    while (cache->size > ENM4A_COVER_CACHE_MEMORY) {
+        // Drop the least recently used entry. New entry fits, so it is never dropped.
+        COVER_ENTRY** last = &cache->entries;
+        while ((*last)->next) last = &(*last)->next;
+        cache->size -= (*last)->cover.size;
+        enm4a_free_cover(&(*last)->cover);
+        free(*last);
+        *last = NULL;
+    }
+    enm4a_mutex_unlock(&cache->lock);
+}
+
+ENM4A_ERROR enm4a_read_cover_file(int* ret, const char* path, uint8_t** data, size_t* size) {
+    if (!ret || !path || !data || !size) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVIOContext* pb = NULL;
+    size_t capacity = 0;
+    *data = NULL;
+    *size = 0;
+    if ((*ret = avio_open(&pb, path, AVIO_FLAG_READ)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    while (1) {
+        if (*size == capacity) {
+            uint8_t* tmp;
+            if (capacity >= ENM4A_MAX_COVER_SIZE) {
+                rev = ENM4A_UNSUPPORTED_COVER;
+                break;
+            }
+            capacity = capacity ? capacity * 2 : 65536;
+            if (!(tmp = realloc(*data, capacity))) {
+                rev = ENM4A_NO_MEMORY;
+                break;
+            }
+            *data = tmp;
+        }
+        int readed = avio_read(pb, *data + *size, (int)(capacity - *size));
+        if (readed == AVERROR_EOF || readed == 0) break;
+        if (readed < 0) {
+            *ret = readed;
+            rev = ENM4A_FFMPEG_ERR;
+            break;
+        }
+        *size += readed;
+    }
+    avio_closep(&pb);
+    if (rev != ENM4A_OK && *data) {
+        free(*data);
+        *data = NULL;
+    }
+    return rev;
+}
+
+/// Get image size from SOF marker of JPEG. @return 0 if not found.
+static int jpeg_size(const uint8_t* data, size_t size, int* width, int* height) {
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return 0;
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            // Fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            pos += 2;
+            continue;
+        }
+        // Image data starts before frame header.
+        if (marker == 0xD9 || marker == 0xDA) return 0;
+        size_t len = AV_RB16(data + pos + 2);
+        if (len < 2) return 0;
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > size) return 0;
+            *height = AV_RB16(data + pos + 5);
+            *width = AV_RB16(data + pos + 7);
+            return 1;
+        }
+        pos += 2 + len;
+    }
+    return 0;
+}
+
+/// Detect JPEG and PNG. width and height are 0 if unknown.
+static enum AVCodecID probe_image(const uint8_t* data, size_t size, int* width, int* height) {
+    *width = *height = 0;
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        if (!jpeg_size(data, size, width, height)) *width = *height = 0;
+        return AV_CODEC_ID_MJPEG;
+    }
+    if (size >= 8 && !memcmp(data, "\x89PNG\r\n\x1a\n", 8)) {
+        if (size >= 24 && !memcmp(data + 12, "IHDR", 4)) {
+            *width = (int)AV_RB32(data + 16);
+            *height = (int)AV_RB32(data + 20);
+        }
+        return AV_CODEC_ID_PNG;
+    }
+    return AV_CODEC_ID_NONE;
+}
+
+static void free_cover_data(void* opaque, uint8_t* data) {
+    free(data);
+}
+
+/// Wrap data allocated by malloc. Data is owned by cover if successed.
+static ENM4A_ERROR set_cover_data(ENM4A_COVER* cover, uint8_t* data, size_t size) {
+    if (!(cover->buf = av_buffer_create(data, size, free_cover_data, NULL, AV_BUFFER_FLAG_READONLY))) {
+        return ENM4A_NO_MEMORY;
+    }
+    cover->size = (int)size;
+    cover->codec_id = probe_image(data, size, &cover->width, &cover->height);
+    return ENM4A_OK;
+}
+
+static ENM4A_ERROR hash_cover(int* ret, const uint8_t* data, size_t size, char* hex, int hex_size) {
+    struct AVHashContext* ctx = NULL;
+    if ((*ret = av_hash_alloc(&ctx, "SHA1")) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    av_hash_init(ctx);
+    av_hash_update(ctx, data, (int)size);
+    av_hash_final_hex(ctx, (uint8_t*)hex, hex_size);
+    av_hash_freep(&ctx);
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Decode the first image in file, downscale it and encode it as JPEG.
+ * @param max_size Maximum width and height. 0 means keep size.
+ * @param quality JPEG quality scale
+*/
+static ENM4A_ERROR encode_cover(int* ret, const char* path, int max_size, int quality, ENM4A_COVER* cover) {
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVFormatContext* ic = NULL;
+    AVCodecContext* dec = NULL, * enc = NULL;
+    const AVCodec* codec = NULL;
+    struct SwsContext* sws = NULL;
+    AVFrame* frame = NULL, * scaled = NULL;
+    AVPacket* pkt = NULL;
+    int stream_index = -1, got_frame = 0;
+    if ((*ret = avformat_open_input(&ic, path, NULL, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((*ret = avformat_find_stream_info(ic, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        if (ic->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            stream_index = (int)i;
+            break;
+        }
+    }
+    if (stream_index < 0) {
+        rev = ENM4A_INVALID_COVER;
+        goto end;
+    }
+    if (!(codec = avcodec_find_decoder(ic->streams[stream_index]->codecpar->codec_id))) {
+        rev = ENM4A_NO_DECODER;
+        goto end;
+    }
+    if (!(dec = avcodec_alloc_context3(codec)) || !(frame = av_frame_alloc()) || !(scaled = av_frame_alloc()) || !(pkt = av_packet_alloc())) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if ((*ret = avcodec_parameters_to_context(dec, ic->streams[stream_index]->codecpar)) < 0 || (*ret = avcodec_open2(dec, codec, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    while (!got_frame) {
+        *ret = av_read_frame(ic, pkt);
+        if (*ret < 0 && *ret != AVERROR_EOF) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if (*ret >= 0 && pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        char eof = *ret == AVERROR_EOF;
+        *ret = avcodec_send_packet(dec, eof ? NULL : pkt);
+        av_packet_unref(pkt);
+        if (*ret < 0 && *ret != AVERROR_EOF) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        *ret = avcodec_receive_frame(dec, frame);
+        if (*ret >= 0) {
+            got_frame = 1;
+        } else if (*ret == AVERROR(EAGAIN) && !eof) {
+            continue;
+        } else if (*ret == AVERROR_EOF || *ret == AVERROR(EAGAIN)) {
+            *ret = 0;
+            rev = ENM4A_INVALID_COVER;
+            goto end;
+        } else {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+    }
+    scaled->width = frame->width;
+    scaled->height = frame->height;
+    if (max_size > 0 && (frame->width > max_size || frame->height > max_size)) {
+        if (frame->width >= frame->height) {
+            scaled->width = max_size;
+            scaled->height = (int)FFMAX(av_rescale(frame->height, max_size, frame->width), 1);
+        } else {
+            scaled->width = (int)FFMAX(av_rescale(frame->width, max_size, frame->height), 1);
+            scaled->height = max_size;
+        }
+    }
+    scaled->format = AV_PIX_FMT_YUVJ420P;
+    if ((*ret = av_frame_get_buffer(scaled, 0)) < 0) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if (!(sws = sws_getContext(frame->width, frame->height, (enum AVPixelFormat)frame->format, scaled->width, scaled->height, AV_PIX_FMT_YUVJ420P, SWS_BICUBIC, NULL, NULL, NULL))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if ((*ret = sws_scale(sws, (const uint8_t* const*)frame->data, frame->linesize, 0, frame->height, scaled->data, scaled->linesize)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (!(codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG))) {
+        rev = ENM4A_NO_ENCODER;
+        goto end;
+    }
+    if (!(enc = avcodec_alloc_context3(codec))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    enc->width = scaled->width;
+    enc->height = scaled->height;
+    enc->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    enc->color_range = AVCOL_RANGE_JPEG;
+    enc->time_base = (AVRational){ 1, 1 };
+    enc->flags |= AV_CODEC_FLAG_QSCALE;
+    enc->global_quality = FF_QP2LAMBDA * quality;
+    if ((*ret = avcodec_open2(enc, codec, NULL)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    scaled->quality = enc->global_quality;
+    scaled->pts = 0;
+    if ((*ret = avcodec_send_frame(enc, scaled)) < 0 || (*ret = avcodec_send_frame(enc, NULL)) < 0 || (*ret = avcodec_receive_packet(enc, pkt)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (!(cover->buf = av_buffer_alloc(pkt->size))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    memcpy(cover->buf->data, pkt->data, pkt->size);
+    cover->size = pkt->size;
+    cover->codec_id = AV_CODEC_ID_MJPEG;
+    cover->width = scaled->width;
+    cover->height = scaled->height;
+end:
+    if (pkt) av_packet_free(&pkt);
+    if (frame) av_frame_free(&frame);
+    if (scaled) av_frame_free(&scaled);
+    if (sws) sws_freeContext(sws);
+    if (dec) avcodec_free_context(&dec);
+    if (enc) avcodec_free_context(&enc);
+    if (ic) avformat_close_input(&ic);
+    return rev;
+}
+
+/// @return Path of cover in cache directory. NULL if out of memory.
+static char* cache_file_path(const char* dir, const char* key) {
+    size_t dle = strlen(dir), kle = strlen(key);
+    char* path = malloc(dle + kle + 6);
+    if (!path) return NULL;
+    memcpy(path, dir, dle);
+#ifdef _WIN32
+    path[dle] = '\\';
+#else
+    path[dle] = '/';
+#endif
+    memcpy(path + dle + 1, key, kle);
+    memcpy(path + dle + 1 + kle, ".jpg", 5);
+    return path;
+}
+
+/// Read cover from cache directory. @return 1 if found.
+static int read_cache_file(const char* path, ENM4A_COVER* cover) {
+    uint8_t* data = NULL;
+    size_t size = 0;
+    int ret = 0;
+    if (!fileop_exists(path) || enm4a_read_cover_file(&ret, path, &data, &size) != ENM4A_OK) return 0;
+    // Partially written file does not end with EOI marker.
+    if (size < 4 || data[size - 2] != 0xFF || data[size - 1] != 0xD9 || set_cover_data(cover, data, size) != ENM4A_OK) {
+        free(data);
+        return 0;
+    }
+    if (cover->codec_id != AV_CODEC_ID_MJPEG) {
+        enm4a_free_cover(cover);
+        return 0;
+    }
+    return 1;
+}
+
+static void write_cache_file(const char* path, const ENM4A_COVER* cover, ENM4A_LOG level) {
+    AVIOContext* pb = NULL;
+    int ret = avio_open(&pb, path, AVIO_FLAG_WRITE);
+    if (ret >= 0) {
+        avio_write(pb, cover->buf->data, cover->size);
+        ret = avio_closep(&pb);
+    }
+    if (ret < 0 && level >= ENM4A_LOG_VERBOSE) {
+        char err[AV_ERROR_MAX_STRING_SIZE];
+        printf("Can not write cover cache %s: %s\n", path, av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret));
+    }
+}
+
+ENM4A_ERROR enm4a_load_cover(int* ret, const char* path, const ENM4A_ARGS* args, ENM4A_COVER* cover) {
+    if (!ret || !path || !args || !cover) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    uint8_t* data = NULL;
+    size_t size = 0;
+    int width, height;
+    int max_size = FFMAX(args->cover_max_size, 0);
+    int quality = args->cover_quality > 0 ? av_clip(args->cover_quality, 2, 31) : ENM4A_DEFAULT_COVER_QUALITY;
+    char hex[41], key[80];
+    char* cache_path = NULL;
+    ENM4A_COVER_CACHE* cache = args->cover_cache;
+    memset(cover, 0, sizeof(ENM4A_COVER));
+    if ((rev = enm4a_read_cover_file(ret, path, &data, &size)) != ENM4A_OK) {
+        goto end;
+    }
+    enum AVCodecID codec_id = probe_image(data, size, &width, &height);
+    char need_encode = codec_id == AV_CODEC_ID_NONE || args->cover_recompress || (max_size && (width > max_size || height > max_size || !width));
+    if (cache) {
+        if ((rev = hash_cover(ret, data, size, hex, sizeof(hex))) != ENM4A_OK) {
+            goto end;
+        }
+        // Covers written as is are shared too, so parallel conversions do not keep their own copies.
+        if (need_encode) {
+            snprintf(key, sizeof(key), "%s-%d-%d", hex, max_size, quality);
+        } else {
+            snprintf(key, sizeof(key), "%s-copy", hex);
+        }
+        if (cache_lookup(cache, key, cover)) {
+            if (args->level >= ENM4A_LOG_VERBOSE) printf("Use cached cover of %s.\n", path);
+            goto end;
+        }
+    }
+    if (!need_encode) {
+        if ((rev = set_cover_data(cover, data, size)) == ENM4A_OK) {
+            data = NULL;
+            if (cache) cache_insert(cache, key, cover);
+        }
+        goto end;
+    }
+    if (cache && cache->dir) {
+        if (!(cache_path = cache_file_path(cache->dir, key))) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        if (read_cache_file(cache_path, cover)) {
+            if (args->level >= ENM4A_LOG_VERBOSE) printf("Use cached cover %s.\n", cache_path);
+            cache_insert(cache, key, cover);
+            goto end;
+        }
+    }
+    if ((rev = encode_cover(ret, path, max_size, quality, cover)) != ENM4A_OK) {
+        goto end;
+    }
+    if (args->level >= ENM4A_LOG_VERBOSE) {
+        printf("Cover %s is encoded as %dx%d JPEG of %d bytes, original size: %zu bytes.\n", path, cover->width, cover->height, cover->size, size);
+    }
+    if (cache_path) write_cache_file(cache_path, cover, args->level);
+    if (cache) cache_insert(cache, key, cover);
+end:
+    if (data) free(data);
+    if (cache_path) free(cache_path);
+    if (rev != ENM4A_OK) enm4a_free_cover(cover);
+    return rev;
+}
+
+void enm4a_free_cover(ENM4A_COVER* cover) {
+    if (!cover) return;
+    if (cover->buf) av_buffer_unref(&cover->buf);
+    cover->size = 0;
+}
+
+ENM4A_ERROR enm4a_add_cover_stream(AVFormatContext* oc, const ENM4A_COVER* cover) {
+    if (!oc || !cover) return ENM4A_NULL_POINTER;
+    AVStream* os = avformat_new_stream(oc, NULL);
+    if (!os) return ENM4A_NO_MEMORY;
+    os->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    os->codecpar->codec_id = cover->codec_id;
+    os->codecpar->width = cover->width;
+    os->codecpar->height = cover->height;
+    os->codecpar->codec_tag = 0;
+    os->disposition |= AV_DISPOSITION_ATTACHED_PIC;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_write_cover(int* ret, AVFormatContext* oc, unsigned int dest_index, const ENM4A_COVER* cover, ENM4A_LOG level) {
+    if (!ret || !oc || !cover || !cover->buf) return ENM4A_NULL_POINTER;
+    AVPacket pkt;
+    memset(&pkt, 0, sizeof(AVPacket));
+    if (!(pkt.buf = av_buffer_ref(cover->buf))) {
+        return ENM4A_NO_MEMORY;
+    }
+    pkt.data = pkt.buf->data;
+    pkt.size = cover->size;
+    pkt.pts = pkt.dts = 0;
+    pkt.pos = -1;
+    pkt.flags |= AV_PKT_FLAG_KEY;
+    pkt.stream_index = dest_index;
+    if (log_packet_enabled(level)) {
+        log_packet(oc, &pkt, "out");
+    }
+    *ret = av_interleaved_write_frame(oc, &pkt);
+    av_packet_unref(&pkt);
+    return *ret < 0 ? ENM4A_FFMPEG_ERR : ENM4A_OK;
+}
@@ -0,0 +1,50 @@
+#ifndef _ENM4A_ENM4A_COVER_H
+#define _ENM4A_ENM4A_COVER_H
+#include "enm4a.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Cover file larger than this is not supported.
+#define ENM4A_MAX_COVER_SIZE (64 << 20)
+/// Bytes of covers kept in memory by cover cache. Least recently used covers are dropped first.
+#define ENM4A_COVER_CACHE_MEMORY (128 << 20)
+
+/// Cover image which is written to outputs as is.
+typedef struct ENM4A_COVER {
+    /// AV_CODEC_ID_MJPEG or AV_CODEC_ID_PNG
+    enum AVCodecID codec_id;
+    /// 0 if unknown
+    int width;
+    int height;
+    /// Image data. Shared with cache, should not be modified.
+    AVBufferRef* buf;
+    int size;
+} ENM4A_COVER;
+
+/**
+ * @brief Read whole cover file. Both local files and URLs are supported.
+ * @param data Should be freed by free().
+*/
+ENM4A_ERROR enm4a_read_cover_file(int* ret, const char* path, uint8_t** data, size_t* size);
+/**
+ * @brief Load cover file. JPEG and PNG are used as is unless cover_max_size or cover_recompress of args requires encoding.
+ * Other images are decoded and encoded as JPEG. Covers are looked up in cover_cache of args by content first.
+ * @param cover Result. Should be freed by enm4a_free_cover.
+*/
+ENM4A_ERROR enm4a_load_cover(int* ret, const char* path, const ENM4A_ARGS* args, ENM4A_COVER* cover);
+void enm4a_free_cover(ENM4A_COVER* cover);
+/// Add an attached picture stream for cover to output.
+ENM4A_ERROR enm4a_add_cover_stream(AVFormatContext* oc, const ENM4A_COVER* cover);
+/// Write cover to the attached picture stream of output.
+ENM4A_ERROR enm4a_write_cover(int* ret, AVFormatContext* oc, unsigned int dest_index, const ENM4A_COVER* cover, ENM4A_LOG level);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,186 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_cue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+#if HAVE_SSCANF_S
+#define sscanf sscanf_s
+#endif
+
+/// Split line into words. Quoted words can contain spaces.
+static bool split_words(std::string line, std::vector<std::string>& words, std::string& err) {
+    size_t i = 0, len = line.length();
+    while (i < len) {
+        while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+        if (i >= len) break;
+        if (line[i] == '"') {
+            size_t end = line.find('"', i + 1);
+            if (end == std::string::npos) {
+                err = "Unterminated quoted string.";
+                return false;
+            }
+            words.push_back(line.substr(i + 1, end - i - 1));
+            i = end + 1;
+        } else {
+            size_t start = i;
+            while (i < len && line[i] != ' ' && line[i] != '\t') i++;
+            words.push_back(line.substr(start, i - start));
+        }
+    }
+    return true;
+}
+
+/// Parse mm:ss:ff. There are 75 frames per second.
+static bool parse_cue_time(std::string s, int64_t& us) {
+    unsigned int m, sec, f;
+    int n = 0;
+    // %n instead of a trailing %c, which needs a buffer size with sscanf_s.
+    if (sscanf(s.c_str(), "%u:%u:%u%n", &m, &sec, &f, &n) != 3 || (size_t)n != s.length() || sec >= 60 || f >= 75) return false;
+    us = (((int64_t)m * 60 + sec) * 75 + f) * 1000000 / 75;
+    return true;
+}
+
+bool enm4a_parse_cue_line(std::string line, Enm4aCueSheet& sheet, std::string& err) {
+    std::vector<std::string> words;
+    if (!split_words(line, words, err)) return false;
+    if (!words.size()) return true;
+    std::string cmd = words[0];
+    Enm4aCueTrack* track = sheet.tracks.size() ? &sheet.tracks.back() : nullptr;
+    if (cmd == "REM") {
+        if (words.size() < 3) return true;
+        if (words[1] == "DATE") {
+            sheet.date = words[2];
+        } else if (words[1] == "GENRE") {
+            sheet.genre = words[2];
+        }
+    } else if (cmd == "TITLE" || cmd == "PERFORMER") {
+        if (words.size() < 2) {
+            err = cmd + " needs a value.";
+            return false;
+        }
+        bool title = cmd == "TITLE";
+        if (track) {
+            (title ? track->title : track->performer) = words[1];
+        } else {
+            (title ? sheet.title : sheet.performer) = words[1];
+        }
+    } else if (cmd == "FILE") {
+        if (words.size() < 2) {
+            err = "FILE needs a file name.";
+            return false;
+        }
+        if (sheet.file.length()) {
+            err = "CUE sheets with more than one FILE are not supported.";
+            return false;
+        }
+        sheet.file = words[1];
+    } else if (cmd == "TRACK") {
+        Enm4aCueTrack t;
+        if (words.size() < 3 || sscanf(words[1].c_str(), "%d", &t.number) != 1 || t.number <= 0) {
+            err = "TRACK should be in TRACK <number> <type> form.";
+            return false;
+        }
+        if (!sheet.file.length()) {
+            err = "TRACK should be after FILE.";
+            return false;
+        }
+        if (words[2] != "AUDIO") {
+            err = "Only AUDIO tracks are supported.";
+            return false;
+        }
+        sheet.tracks.push_back(t);
+    } else if (cmd == "INDEX") {
+        int number;
+        int64_t us;
+        if (!track) {
+            err = "INDEX should be after TRACK.";
+            return false;
+        }
+        if (words.size() < 3 || sscanf(words[1].c_str(), "%d", &number) != 1 || !parse_cue_time(words[2], us)) {
+            err = "INDEX should be in INDEX <number> <mm:ss:ff> form.";
+            return false;
+        }
+        if (number == 1) track->start = us;
+    }
+    return true;
+}
+
+bool enm4a_read_cue_sheet(std::string path, Enm4aCueSheet& sheet) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) {
+        printf("Can not open CUE sheet: %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    size_t line_no = 0;
+    bool ok = true;
+    char buf[1024];
+    bool eof = false;
+    while (!eof) {
+        line.clear();
+        while (1) {
+            if (!fgets(buf, sizeof(buf), f)) {
+                eof = true;
+                break;
+            }
+            line += buf;
+            if (line.length() && line[line.length() - 1] == '\n') break;
+        }
+        if (eof && !line.length()) break;
+        line_no++;
+        while (line.length() && (line[line.length() - 1] == '\n' || line[line.length() - 1] == '\r')) {
+            line.erase(line.length() - 1);
+        }
+        // UTF-8 BOM
+        if (line_no == 1 && line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3);
+        std::string err;
+        if (!enm4a_parse_cue_line(line, sheet, err)) {
+            printf("%s:%zu: %s\n", path.c_str(), line_no, err.c_str());
+            ok = false;
+            break;
+        }
+    }
+    fclose(f);
+    if (!ok) return false;
+    if (!sheet.tracks.size()) {
+        printf("%s: No tracks found.\n", path.c_str());
+        return false;
+    }
+    for (size_t i = 0; i < sheet.tracks.size(); i++) {
+        const Enm4aCueTrack& t = sheet.tracks[i];
+        if (t.start < 0) {
+            printf("%s: Track %d does not have INDEX 01.\n", path.c_str(), t.number);
+            return false;
+        }
+        if (i && t.start <= sheet.tracks[i - 1].start) {
+            printf("%s: Track %d starts before the previous track.\n", path.c_str(), t.number);
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string enm4a_cue_track_filename(const Enm4aCueTrack& track) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%02d", track.number);
+    std::string name = buf;
+    if (track.title.length()) {
+        name += " - ";
+        for (auto i = track.title.begin(); i != track.title.end(); i++) {
+            unsigned char c = (unsigned char)*i;
+            name += (c < 0x20 || strchr("<>:\"/\\|?*", c)) ? '_' : (char)c;
+        }
+        // Windows does not allow file names end with dot or space.
+        while (name.length() && (name[name.length() - 1] == '.' || name[name.length() - 1] == ' ')) {
+            name.erase(name.length() - 1);
+        }
+    }
+    return name + ".m4a";
+}
@@ -0,0 +1,44 @@
+#ifndef _ENM4A_ENM4A_CUE_H
+#define _ENM4A_ENM4A_CUE_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// A track of CUE sheet. Empty strings mean not set.
+typedef struct Enm4aCueTrack {
+    int number = 0;
+    std::string title;
+    std::string performer;
+    /// Time of INDEX 01 in microseconds. -1 if not set.
+    int64_t start = -1;
+} Enm4aCueTrack;
+
+typedef struct Enm4aCueSheet {
+    /// Audio file referenced by FILE command
+    std::string file;
+    std::string title;
+    std::string performer;
+    std::string date;
+    std::string genre;
+    std::vector<Enm4aCueTrack> tracks;
+} Enm4aCueSheet;
+
+/**
+ * @brief Parse a line of CUE sheet.
+ * @param line Line without line break.
+ * @param sheet Commands are applied to it.
+ * @param err Error message if failed.
+ * @return true if successed.
+*/
+bool enm4a_parse_cue_line(std::string line, Enm4aCueSheet& sheet, std::string& err);
+/**
+ * @brief Read a CUE sheet with a single audio file.
+ * Pregap (INDEX 00) is kept at the end of previous track. Unknown commands are ignored.
+ * @param path CUE sheet path.
+ * @param sheet Result
+ * @return true if successed.
+*/
+bool enm4a_read_cue_sheet(std::string path, Enm4aCueSheet& sheet);
+/// Output file name of a track, eg. "01 - Title.m4a". Characters not allowed in file names are replaced.
+std::string enm4a_cue_track_filename(const Enm4aCueTrack& track);
+#endif
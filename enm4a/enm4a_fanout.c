@@ -0,0 +1,292 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_fanout.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/opt.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+ENM4A_ERROR enm4a_init_fanout(ENM4A_FANOUT* f, unsigned int max_outputs, AVFormatContext* oc, AVCodecContext* audio_output, SwrContext* resample_context, AVAudioFifo* afifo, ENM4A_CONVERT_BUFFER* convert_buffer, AVFrame* frame, AVPacket* pkt) {
+    if (!f || !max_outputs || !oc) return ENM4A_NULL_POINTER;
+    if (!(f->groups = calloc(max_outputs, sizeof(ENM4A_FANOUT_GROUP)))) return ENM4A_NO_MEMORY;
+    if (!(f->outputs = calloc(max_outputs, sizeof(ENM4A_FANOUT_OUTPUT)))) return ENM4A_NO_MEMORY;
+    f->groups[0].format = audio_output;
+    f->groups[0].resample_context = resample_context;
+    f->groups[0].afifo = afifo;
+    f->groups[0].convert_buffer = convert_buffer;
+    f->nb_groups = 1;
+    f->outputs[0].oc = oc;
+    f->outputs[0].audio_output = audio_output;
+    f->outputs[0].frame = frame;
+    f->outputs[0].pkt = pkt;
+    f->nb_outputs = 1;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_add_fanout_output(int* ret, ENM4A_FANOUT* f, const ENM4A_OUTPUT* spec, const ENM4A_ARGS* args) {
+    if (!ret || !f || !spec || !spec->output || !args || !f->nb_outputs) return ENM4A_NULL_POINTER;
+    AVFormatContext* main_oc = f->outputs[0].oc;
+    AVCodecContext* main_output = f->outputs[0].audio_output;
+    ENM4A_FANOUT_OUTPUT* o = &f->outputs[f->nb_outputs];
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVDictionary* mux_option = NULL;
+    int is_supported = 1;
+    unsigned int g = 0;
+    memset(o, 0, sizeof(ENM4A_FANOUT_OUTPUT));
+    // Count it first, so partially created output is freed by enm4a_free_fanout.
+    f->nb_outputs++;
+    if (spec->sample_rate && (rev = enm4a_encoder_supports_sample_rate(args->encoder, spec->sample_rate, &is_supported)) != ENM4A_OK) {
+        return rev;
+    }
+    if (!is_supported) return ENM4A_INVALID_SAMPLE_RATE;
+    if ((rev = check_output_file(spec->output, get_output_overwrite(args, spec->output))) != ENM4A_OK) {
+        return rev;
+    }
+    if ((*ret = avformat_alloc_output_context2(&o->oc, NULL, "ipod", spec->output)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    for (unsigned int i = 0; i < main_oc->nb_streams; i++) {
+        AVStream* ms = main_oc->streams[i], * os = avformat_new_stream(o->oc, NULL);
+        if (!os) return ENM4A_NO_MEMORY;
+        if (i == f->audio_dest_index) {
+            int sample_rate = spec->sample_rate ? spec->sample_rate : main_output->sample_rate;
+            int64_t bitrate = spec->bitrate > 0 ? spec->bitrate : args->bitrate;
+            if ((rev = open_audio_encoder(ret, f->audio_input, o->oc, os, sample_rate, bitrate, args, &o->audio_output)) != ENM4A_OK) {
+                return rev;
+            }
+        } else {
+            if ((*ret = avcodec_parameters_copy(os->codecpar, ms->codecpar)) < 0) {
+                return ENM4A_FFMPEG_ERR;
+            }
+            os->disposition = ms->disposition;
+        }
+    }
+    if ((*ret = av_dict_copy(&o->oc->metadata, main_oc->metadata, 0)) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    for (g = 0; g < f->nb_groups; g++) {
+        if (f->groups[g].format->sample_rate == o->audio_output->sample_rate) break;
+    }
+    if (g == f->nb_groups) {
+        ENM4A_FANOUT_GROUP* group = &f->groups[f->nb_groups++];
+        group->format = o->audio_output;
+        group->convert_buffer = &group->buffer;
+        if ((rev = init_audio_converter(ret, f->audio_input, o->audio_output, args->resampler, args->level, &group->resample_context, &group->buffer, &group->afifo, f->allocations)) != ENM4A_OK) {
+            return rev;
+        }
+    }
+    o->group = g;
+    if ((rev = alloc_encoder_frame(ret, o->audio_output, &o->frame)) != ENM4A_OK) {
+        return rev;
+    }
+    if (!(o->pkt = av_packet_alloc())) {
+        return ENM4A_NO_MEMORY;
+    }
+    *(f->allocations) += 2;
+    if (!args->quiet) av_dump_format(o->oc, f->nb_outputs - 1, spec->output, 1);
+    if ((*ret = avio_open(&o->oc->pb, spec->output, AVIO_FLAG_WRITE)) < 0) {
+        return ENM4A_ERR_OPEN_FILE;
+    }
+    if (args->fragment_duration > 0) {
+        if ((*ret = av_dict_set(&mux_option, "movflags", "+empty_moov+delay_moov+default_base_moof", 0)) < 0 || (*ret = av_dict_set_int(&mux_option, "frag_duration", args->fragment_duration, 0)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+    } else if (args->faststart != ENM4A_FASTSTART_NONE && !f->tags_after_trailer) {
+        // Size of moov box is only estimated for main output.
+        if ((*ret = av_dict_set(&mux_option, "movflags", "+faststart", 0)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+    }
+    if ((*ret = avformat_write_header(o->oc, &mux_option)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+end:
+    if (mux_option) av_dict_free(&mux_option);
+    return rev;
+}
+
+/// Send a packet to decoder and add decoded samples to FIFO of every group.
+static ENM4A_ERROR decode_to_groups(int* ret, ENM4A_FANOUT* f, const AVPacket* pkt) {
+    ENM4A_ERROR re = ENM4A_OK;
+    int64_t start = stage_start(f->progress);
+    if ((*ret = avcodec_send_packet(f->audio_input, pkt)) < 0 && *ret != AVERROR_EOF) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    while (1) {
+        *ret = avcodec_receive_frame(f->audio_input, f->audio_input_frame);
+        stage_end(f->progress, ENM4A_STAGE_DECODE, start);
+        if (*ret == AVERROR(EAGAIN) || *ret == AVERROR_EOF) {
+            *ret = 0;
+            break;
+        } else if (*ret < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+        if (!trim_frame(f->trim, f->audio_input_frame)) {
+            av_frame_unref(f->audio_input_frame);
+            start = stage_start(f->progress);
+            continue;
+        }
+        if (f->meter && (re = enm4a_loudness_add_frame(f->meter, f->audio_input_frame)) == ENM4A_FFMPEG_ERR) {
+            *ret = AVERROR_INVALIDDATA;
+        }
+        if (re == ENM4A_OK && f->fingerprint && (re = enm4a_fingerprint_add_frame(f->fingerprint, f->audio_input_frame)) == ENM4A_FFMPEG_ERR) {
+            *ret = AVERROR_INVALIDDATA;
+        }
+        for (unsigned int i = 0; i < f->nb_groups && re == ENM4A_OK; i++) {
+            ENM4A_FANOUT_GROUP* g = &f->groups[i];
+            re = convert_samples_and_add_to_fifo(ret, g->format, g->resample_context, f->audio_input_frame, g->afifo, g->convert_buffer, f->allocations, f->progress);
+        }
+        av_frame_unref(f->audio_input_frame);
+        if (re != ENM4A_OK) return re;
+        start = stage_start(f->progress);
+    }
+    if (!pkt) {
+        for (unsigned int i = 0; i < f->nb_groups; i++) {
+            ENM4A_FANOUT_GROUP* g = &f->groups[i];
+            if ((re = convert_samples_and_add_to_fifo(ret, g->format, g->resample_context, NULL, g->afifo, g->convert_buffer, f->allocations, f->progress)) != ENM4A_OK) {
+                return re;
+            }
+        }
+    }
+    return ENM4A_OK;
+}
+
+/// Encode samples in group FIFO which are not encoded by this output yet.
+static ENM4A_ERROR encode_group_frames(int* ret, ENM4A_FANOUT* f, ENM4A_FANOUT_OUTPUT* o, char flush) {
+    AVAudioFifo* fifo = f->groups[o->group].afifo;
+    AVFrame* frame = o->frame;
+    ENM4A_ERROR re = ENM4A_OK;
+    char write_data = 0;
+    while (av_audio_fifo_size(fifo) - o->consumed >= o->audio_output->frame_size || (flush && av_audio_fifo_size(fifo) > o->consumed)) {
+        frame->nb_samples = FFMIN(av_audio_fifo_size(fifo) - o->consumed, o->audio_output->frame_size);
+        if (!av_frame_is_writable(frame)) {
+            // Encoder still holds a reference of the buffer.
+            if ((*ret = av_frame_make_writable(frame)) < 0) {
+                return ENM4A_NO_MEMORY;
+            }
+            (*(f->allocations))++;
+        }
+        if ((*ret = av_audio_fifo_peek_at(fifo, (void**)frame->data, frame->nb_samples, o->consumed)) < 0) {
+            return ENM4A_NO_MEMORY;
+        }
+        o->consumed += frame->nb_samples;
+        if ((re = encode_audio_frame(ret, frame, o->oc, o->audio_output, o->pkt, &write_data, &o->pts, f->level, f->audio_dest_index, f->progress)) != ENM4A_OK) {
+            return re;
+        }
+    }
+    if (flush) {
+        while (1) {
+            if ((re = encode_audio_frame(ret, NULL, o->oc, o->audio_output, o->pkt, &write_data, NULL, f->level, f->audio_dest_index, f->progress)) != ENM4A_OK) {
+                return re;
+            }
+            if (!write_data) break;
+        }
+    }
+    return ENM4A_OK;
+}
+
+/// Remove samples which are encoded by all outputs of group.
+static void drain_groups(ENM4A_FANOUT* f) {
+    for (unsigned int i = 0; i < f->nb_groups; i++) {
+        int consumed = -1;
+        for (unsigned int j = 0; j < f->nb_outputs; j++) {
+            if (f->outputs[j].group == i && (consumed < 0 || f->outputs[j].consumed < consumed)) {
+                consumed = f->outputs[j].consumed;
+            }
+        }
+        if (consumed <= 0) continue;
+        av_audio_fifo_drain(f->groups[i].afifo, consumed);
+        for (unsigned int j = 0; j < f->nb_outputs; j++) {
+            if (f->outputs[j].group == i) f->outputs[j].consumed -= consumed;
+        }
+    }
+}
+
+ENM4A_ERROR enm4a_run_fanout(int* ret, ENM4A_FANOUT* f) {
+    if (!ret || !f || !f->nb_outputs) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVPacket pkt;
+    char finished = 0;
+    AVStream* os = f->outputs[0].oc->streams[f->audio_dest_index];
+    memset(&pkt, 0, sizeof(AVPacket));
+    while (!finished) {
+        int64_t start = stage_start(f->progress);
+        *ret = av_read_frame(f->ic, &pkt);
+        stage_end(f->progress, ENM4A_STAGE_DEMUX, start);
+        if (*ret >= 0) mark_first_packet(f->progress);
+        if (*ret < 0) {
+            if (*ret != AVERROR_EOF) {
+                return ENM4A_FFMPEG_ERR;
+            }
+            finished = 1;
+        } else if (pkt.stream_index != f->audio_stream_index) {
+            av_packet_unref(&pkt);
+            continue;
+        } else if (trim_packet_after_end(f->trim, &pkt)) {
+            // Rest of input is not needed.
+            av_packet_unref(&pkt);
+            finished = 1;
+        } else if (log_packet_enabled(f->level)) {
+            log_packet(f->ic, &pkt, "in");
+        }
+        rev = decode_to_groups(ret, f, finished ? NULL : &pkt);
+        if (!finished) av_packet_unref(&pkt);
+        if (rev != ENM4A_OK) return rev;
+        for (unsigned int i = 0; i < f->nb_outputs; i++) {
+            if ((rev = encode_group_frames(ret, f, &f->outputs[i], finished)) != ENM4A_OK) {
+                return rev;
+            }
+        }
+        drain_groups(f);
+        update_progress(f->progress, f->outputs[0].oc, f->outputs[0].pts, os->time_base);
+    }
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_write_fanout_trailers(int* ret, ENM4A_FANOUT* f) {
+    if (!ret || !f) return ENM4A_NULL_POINTER;
+    for (unsigned int i = 1; i < f->nb_outputs; i++) {
+        if ((*ret = av_write_trailer(f->outputs[i].oc)) < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+    }
+    return ENM4A_OK;
+}
+
+void enm4a_free_fanout(ENM4A_FANOUT* f) {
+    if (!f) return;
+    if (f->outputs) {
+        for (unsigned int i = 1; i < f->nb_outputs; i++) {
+            ENM4A_FANOUT_OUTPUT* o = &f->outputs[i];
+            if (o->frame) av_frame_free(&o->frame);
+            if (o->pkt) av_packet_free(&o->pkt);
+            if (o->audio_output) avcodec_free_context(&o->audio_output);
+            if (o->oc) {
+                if (!(o->oc->oformat->flags & AVFMT_NOFILE)) avio_closep(&o->oc->pb);
+                avformat_free_context(o->oc);
+            }
+        }
+        free(f->outputs);
+    }
+    if (f->groups) {
+        for (unsigned int i = 1; i < f->nb_groups; i++) {
+            ENM4A_FANOUT_GROUP* g = &f->groups[i];
+            free_convert_buffer(&g->buffer);
+            if (g->afifo) av_audio_fifo_free(g->afifo);
+            if (g->resample_context) swr_free(&g->resample_context);
+        }
+        free(f->groups);
+    }
+    memset(f, 0, sizeof(ENM4A_FANOUT));
+}
@@ -0,0 +1,84 @@
+#ifndef _ENM4A_ENM4A_FANOUT_H
+#define _ENM4A_ENM4A_FANOUT_H
+#include "enm4a_internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Converted samples shared by outputs with the same sample rate
+typedef struct ENM4A_FANOUT_GROUP {
+    /// Encoder of the first output in group. Describes the format of samples.
+    AVCodecContext* format;
+    SwrContext* resample_context;
+    AVAudioFifo* afifo;
+    ENM4A_CONVERT_BUFFER* convert_buffer;
+    /// Storage of convert_buffer if group is created by fan-out
+    ENM4A_CONVERT_BUFFER buffer;
+} ENM4A_FANOUT_GROUP;
+
+typedef struct ENM4A_FANOUT_OUTPUT {
+    AVFormatContext* oc;
+    AVCodecContext* audio_output;
+    AVFrame* frame;
+    AVPacket* pkt;
+    /// Next pts of encoder
+    int64_t pts;
+    unsigned int group;
+    /// Samples at the front of group FIFO which are already encoded by this output
+    int consumed;
+} ENM4A_FANOUT_OUTPUT;
+
+/// Decode audio once and encode it for several outputs
+typedef struct ENM4A_FANOUT {
+    AVFormatContext* ic;
+    unsigned int audio_stream_index;
+    AVCodecContext* audio_input;
+    AVFrame* audio_input_frame;
+    /// Measures decoded frames if not NULL
+    ENM4A_LOUDNESS* meter;
+    /// Fingerprints decoded frames if not NULL
+    ENM4A_FINGERPRINT* fingerprint;
+    /// The first group and output belong to main output and are owned by caller.
+    ENM4A_FANOUT_GROUP* groups;
+    unsigned int nb_groups;
+    ENM4A_FANOUT_OUTPUT* outputs;
+    unsigned int nb_outputs;
+    /// Audio stream index in every output
+    unsigned int audio_dest_index;
+    int64_t* allocations;
+    ENM4A_LOG level;
+    /// May be NULL
+    ENM4A_PROGRESS_SINK* progress;
+    /// Range of input to convert. May be NULL.
+    ENM4A_TRIM* trim;
+    /// Measured tags are written after trailer, and moov box is moved to the front then instead of by muxer.
+    char tags_after_trailer;
+} ENM4A_FANOUT;
+
+/**
+ * @brief Allocate groups and outputs, then set main output as the first one.
+ * @param max_outputs The number of outputs including main output
+ * @param afifo FIFO of main output
+*/
+ENM4A_ERROR enm4a_init_fanout(ENM4A_FANOUT* f, unsigned int max_outputs, AVFormatContext* oc, AVCodecContext* audio_output, SwrContext* resample_context, AVAudioFifo* afifo, ENM4A_CONVERT_BUFFER* convert_buffer, AVFrame* frame, AVPacket* pkt);
+/**
+ * @brief Create a output with the same streams and metadata as main output, and write its header.
+ * Main output header should be written.
+ * @param spec Output file, bitrate and sample rate
+ * @param args Arguments of main output
+*/
+ENM4A_ERROR enm4a_add_fanout_output(int* ret, ENM4A_FANOUT* f, const ENM4A_OUTPUT* spec, const ENM4A_ARGS* args);
+/**
+ * @brief Read all audio packets from input and write encoded packets to every output.
+ * @param ret FFmpeg error code
+*/
+ENM4A_ERROR enm4a_run_fanout(int* ret, ENM4A_FANOUT* f);
+/// Write trailers of outputs except main output.
+ENM4A_ERROR enm4a_write_fanout_trailers(int* ret, ENM4A_FANOUT* f);
+/// Free groups and outputs except which are owned by caller.
+void enm4a_free_fanout(ENM4A_FANOUT* f);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
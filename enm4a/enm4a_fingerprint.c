@@ -0,0 +1,230 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_fingerprint.h"
+#include "enm4a_internal.h"
+
+#include <malloc.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/base64.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/log.h"
+#include "libavutil/tx.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/// Sample rate which audio is decimated to
+#define FP_SAMPLE_RATE 11025
+/// Samples of FFT window
+#define FP_WINDOW 4096
+#define FP_HOP (FP_WINDOW / 3)
+/// Windows averaged before comparing pitch classes
+#define FP_SMOOTH 4
+/// Frequency range of pitch classes
+#define FP_MIN_FREQ 28.0
+#define FP_MAX_FREQ 3520.0
+/// Input samples converted at once
+#define FP_CHUNK 1024
+
+struct ENM4A_FINGERPRINT {
+    int channels;
+    /// Input samples averaged into an analysis sample
+    int decimation;
+    /// Analysis samples left to fingerprint
+    int64_t remaining;
+    /// Sum of input samples of current analysis sample
+    float acc;
+    int acc_count;
+    /// Input samples of a channel and mono downmix
+    float* samples;
+    float* mono;
+    /// Analysis samples of current window
+    float* window_samples;
+    int fill;
+    float* window;
+    /// Pitch class of every FFT bin. -1 if bin is out of range.
+    int8_t* bins;
+    AVTXContext* tx;
+    av_tx_fn fft;
+    AVComplexFloat* fft_in;
+    AVComplexFloat* fft_out;
+    /// Pitch class energies of the last FP_SMOOTH windows
+    float history[FP_SMOOTH][12];
+    int nb_windows;
+    uint32_t* codes;
+    size_t nb_codes;
+    size_t code_capacity;
+};
+
+ENM4A_FINGERPRINT* enm4a_fingerprint_alloc(int sample_rate, int channels) {
+    if (sample_rate <= 0 || channels <= 0) return NULL;
+    ENM4A_FINGERPRINT* fp = calloc(1, sizeof(ENM4A_FINGERPRINT));
+    float scale = 1.0f;
+    if (!fp) return NULL;
+    fp->channels = channels;
+    fp->decimation = FFMAX(1, (sample_rate + FP_SAMPLE_RATE / 2) / FP_SAMPLE_RATE);
+    int rate = sample_rate / fp->decimation;
+    fp->remaining = (int64_t)rate * ENM4A_FINGERPRINT_DURATION;
+    if (!(fp->samples = malloc(sizeof(float) * FP_CHUNK))) goto fail;
+    if (!(fp->mono = malloc(sizeof(float) * FP_CHUNK))) goto fail;
+    if (!(fp->window_samples = malloc(sizeof(float) * FP_WINDOW))) goto fail;
+    if (!(fp->window = malloc(sizeof(float) * FP_WINDOW))) goto fail;
+    if (!(fp->bins = malloc(FP_WINDOW / 2))) goto fail;
+    if (!(fp->fft_in = malloc(sizeof(AVComplexFloat) * FP_WINDOW))) goto fail;
+    if (!(fp->fft_out = malloc(sizeof(AVComplexFloat) * FP_WINDOW))) goto fail;
+    if (av_tx_init(&fp->tx, &fp->fft, AV_TX_FLOAT_FFT, 0, FP_WINDOW, &scale, 0) < 0) goto fail;
+    for (int i = 0; i < FP_WINDOW; i++) {
+        fp->window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / (FP_WINDOW - 1)));
+    }
+    for (int k = 0; k < FP_WINDOW / 2; k++) {
+        double freq = (double)k * rate / FP_WINDOW;
+        if (freq < FP_MIN_FREQ || freq > FP_MAX_FREQ) {
+            fp->bins[k] = -1;
+        } else {
+            // 0 is A.
+            int note = (int)floor(12.0 * log2(freq / 440.0) + 0.5);
+            fp->bins[k] = (int8_t)(((note % 12) + 12) % 12);
+        }
+    }
+    return fp;
+fail:
+    enm4a_fingerprint_free(&fp);
+    return NULL;
+}
+
+void enm4a_fingerprint_free(ENM4A_FINGERPRINT** fp) {
+    if (!fp || !*fp) return;
+    ENM4A_FINGERPRINT* f = *fp;
+    if (f->tx) av_tx_uninit(&f->tx);
+    if (f->samples) free(f->samples);
+    if (f->mono) free(f->mono);
+    if (f->window_samples) free(f->window_samples);
+    if (f->window) free(f->window);
+    if (f->bins) free(f->bins);
+    if (f->fft_in) free(f->fft_in);
+    if (f->fft_out) free(f->fft_out);
+    if (f->codes) free(f->codes);
+    free(f);
+    *fp = NULL;
+}
+
+/// Compare smoothed pitch classes: 12 bits with the next class, 12 bits with the major third, 8 bits with the fifth.
+static uint32_t chroma_code(const float* c) {
+    uint32_t code = 0;
+    for (int i = 0; i < 12; i++) {
+        if (c[i] > c[(i + 1) % 12]) code |= 1u << i;
+        if (c[i] > c[(i + 4) % 12]) code |= 1u << (12 + i);
+    }
+    for (int i = 0; i < 8; i++) {
+        if (c[i] > c[(i + 7) % 12]) code |= 1u << (24 + i);
+    }
+    return code;
+}
+
+/**
+ * @brief Fingerprint the full window, then drop the first hop of it.
+ * Loops are kept simple so that compilers can vectorize them. FFT is done by av_tx, which has SIMD versions.
+*/
+static ENM4A_ERROR process_window(ENM4A_FINGERPRINT* fp) {
+    const float* __restrict x = fp->window_samples, * __restrict w = fp->window;
+    AVComplexFloat* __restrict in = fp->fft_in, * __restrict out = fp->fft_out;
+    float* chroma = fp->history[fp->nb_windows % FP_SMOOTH], smoothed[12];
+    for (int i = 0; i < FP_WINDOW; i++) {
+        in[i].re = x[i] * w[i];
+        in[i].im = 0;
+    }
+    fp->fft(fp->tx, out, in, sizeof(AVComplexFloat));
+    memset(chroma, 0, sizeof(float) * 12);
+    for (int k = 1; k < FP_WINDOW / 2; k++) {
+        if (fp->bins[k] >= 0) chroma[fp->bins[k]] += out[k].re * out[k].re + out[k].im * out[k].im;
+    }
+    fp->nb_windows++;
+    memset(smoothed, 0, sizeof(smoothed));
+    for (int j = 0; j < FFMIN(fp->nb_windows, FP_SMOOTH); j++) {
+        for (int i = 0; i < 12; i++) smoothed[i] += fp->history[j][i];
+    }
+    if (fp->nb_codes == fp->code_capacity) {
+        size_t capacity = fp->code_capacity ? fp->code_capacity * 2 : 1024;
+        uint32_t* codes = realloc(fp->codes, sizeof(uint32_t) * capacity);
+        if (!codes) return ENM4A_NO_MEMORY;
+        fp->codes = codes;
+        fp->code_capacity = capacity;
+    }
+    fp->codes[fp->nb_codes++] = chroma_code(smoothed);
+    memmove(fp->window_samples, fp->window_samples + FP_HOP, sizeof(float) * (FP_WINDOW - FP_HOP));
+    fp->fill = FP_WINDOW - FP_HOP;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_fingerprint_add_frame(ENM4A_FINGERPRINT* fp, const AVFrame* frame) {
+    if (!fp || !frame) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    if (GET_AV_CODEC_CHANNELS(frame) != fp->channels) {
+        av_log(NULL, AV_LOG_ERROR, "Audio format of decoded frame is changed.\n");
+        return ENM4A_FFMPEG_ERR;
+    }
+    for (int offset = 0; offset < frame->nb_samples && fp->remaining > 0; offset += FP_CHUNK) {
+        int n = FFMIN(FP_CHUNK, frame->nb_samples - offset);
+        float* __restrict mono = fp->mono, * __restrict s = fp->samples;
+        const float gain = 1.0f / fp->channels;
+        for (int i = 0; i < n; i++) mono[i] = 0;
+        for (int c = 0; c < fp->channels; c++) {
+            load_samples(s, frame, c, fp->channels, offset, n);
+            for (int i = 0; i < n; i++) mono[i] += s[i] * gain;
+        }
+        for (int i = 0; i < n && fp->remaining > 0; i++) {
+            fp->acc += mono[i];
+            if (++fp->acc_count < fp->decimation) continue;
+            fp->window_samples[fp->fill++] = fp->acc / fp->decimation;
+            fp->acc = 0;
+            fp->acc_count = 0;
+            fp->remaining--;
+            if (fp->fill == FP_WINDOW && (re = process_window(fp)) != ENM4A_OK) {
+                return re;
+            }
+        }
+    }
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_fingerprint_result(const ENM4A_FINGERPRINT* fp, char** result) {
+    if (!fp || !result) return ENM4A_NULL_POINTER;
+    size_t size = fp->nb_codes * 4;
+    uint8_t* data = malloc(size + 1);
+    char* re = NULL;
+    if (!data) return ENM4A_NO_MEMORY;
+    for (size_t i = 0; i < fp->nb_codes; i++) {
+        AV_WL32(data + i * 4, fp->codes[i]);
+    }
+    if (!(re = malloc(AV_BASE64_SIZE(size)))) {
+        free(data);
+        return ENM4A_NO_MEMORY;
+    }
+    if (size) {
+        av_base64_encode(re, AV_BASE64_SIZE(size), data, (int)size);
+    } else {
+        re[0] = 0;
+    }
+    free(data);
+    *result = re;
+    return ENM4A_OK;
+}
+
+size_t enm4a_fingerprint_tag_size(const ENM4A_FINGERPRINT* fp) {
+    if (!fp) return 0;
+    // A code is added every hop once the first window is filled.
+    size_t codes = fp->nb_codes + (size_t)(fp->remaining / FP_HOP) + 1;
+    // Freeform item with mean ("com.apple.iTunes"), name and data boxes
+    return AV_BASE64_SIZE(codes * 4) + strlen(ENM4A_FINGERPRINT_TAG) + 96;
+}
+
+ENM4A_ERROR enm4a_set_fingerprint_tag(ENM4A_MP4* mp4, const char* fingerprint) {
+    if (!mp4 || !fingerprint) return ENM4A_NULL_POINTER;
+    return enm4a_mp4_set_freeform(mp4, ENM4A_FINGERPRINT_TAG, fingerprint);
+}
@@ -0,0 +1,52 @@
+#ifndef _ENM4A_ENM4A_FINGERPRINT_H
+#define _ENM4A_ENM4A_FINGERPRINT_H
+#include "enm4a.h"
+#include "enm4a_mp4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavutil/frame.h"
+
+/// Only the first seconds of audio are fingerprinted.
+#define ENM4A_FINGERPRINT_DURATION 120
+/// Name of iTunes freeform tag which stores fingerprint
+#define ENM4A_FINGERPRINT_TAG "enm4a_fingerprint"
+
+/**
+ * @brief Chroma fingerprint of decoded audio.
+ * Audio is downmixed to mono and decimated to about 11 kHz. Every 4096 samples window (hop 1/3 window) is
+ * transformed by FFT, its energy is folded into 12 pitch classes and smoothed over 4 windows. Every window
+ * becomes a 32-bit code of comparisons between pitch classes, so the same recording encoded differently
+ * gives mostly the same bits.
+*/
+typedef struct ENM4A_FINGERPRINT ENM4A_FINGERPRINT;
+
+/**
+ * @brief Create a fingerprinter
+ * @param sample_rate Sample rate of frames
+ * @param channels Channels of frames
+ * @return NULL if out of memory or FFT is not available.
+*/
+ENM4A_FINGERPRINT* enm4a_fingerprint_alloc(int sample_rate, int channels);
+void enm4a_fingerprint_free(ENM4A_FINGERPRINT** fp);
+/**
+ * @brief Add decoded samples. Samples after ENM4A_FINGERPRINT_DURATION are ignored.
+ * @param frame Frame with any sample format. Sample rate and channels should be same as fingerprinter.
+*/
+ENM4A_ERROR enm4a_fingerprint_add_frame(ENM4A_FINGERPRINT* fp, const AVFrame* frame);
+/**
+ * @brief Get fingerprint.
+ * @param result Base64 of little endian 32-bit codes. Empty string if audio is shorter than a window.
+ * Should be freed by free().
+*/
+ENM4A_ERROR enm4a_fingerprint_result(const ENM4A_FINGERPRINT* fp, char** result);
+/// @return Upper bound of bytes added to moov box by enm4a_set_fingerprint_tag.
+size_t enm4a_fingerprint_tag_size(const ENM4A_FINGERPRINT* fp);
+/// Set fingerprint as ENM4A_FINGERPRINT_TAG freeform tag. Changes are written by enm4a_mp4_save.
+ENM4A_ERROR enm4a_set_fingerprint_tag(ENM4A_MP4* mp4, const char* fingerprint);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,378 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_incremental.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+
+#if _WIN32
+#include <Windows.h>
+#endif
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+#define MANIFEST_HEADER "# enm4a incremental manifest v2"
+/// Paths of v1 manifest are not escaped.
+#define MANIFEST_HEADER_V1 "# enm4a incremental manifest v1"
+/// Bytes hashed at the begin, middle and end of file
+#define SAMPLE_SIZE 65536
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+#if _WIN32
+static bool to_wide(const std::string& s, std::wstring& out) {
+    int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
+    if (len <= 0) return false;
+    std::vector<wchar_t> buf(len);
+    if (!MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, buf.data(), len)) return false;
+    out = buf.data();
+    return true;
+}
+#endif
+
+static FILE* open_file(const std::string& path, const char* mode) {
+#if _WIN32
+    std::wstring wpath, wmode;
+    if (!to_wide(path, wpath) || !to_wide(mode, wmode)) return nullptr;
+    return _wfopen(wpath.c_str(), wmode.c_str());
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+static bool replace_file(const std::string& from, const std::string& to) {
+#if _WIN32
+    std::wstring wfrom, wto;
+    if (!to_wide(from, wfrom) || !to_wide(to, wto)) return false;
+    return MoveFileExW(wfrom.c_str(), wto.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return !rename(from.c_str(), to.c_str());
+#endif
+}
+
+static uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t hash_string(uint64_t h, const char* s) {
+    // Length prefix keeps NULL, "" and adjacent strings distinct.
+    int64_t len = s ? (int64_t)strlen(s) : -1;
+    h = fnv1a(h, &len, sizeof(len));
+    return s ? fnv1a(h, s, (size_t)len) : h;
+}
+
+static uint64_t hash_int(uint64_t h, int64_t v) {
+    return fnv1a(h, &v, sizeof(v));
+}
+
+/// Hash size and up to three blocks of content, so large files are identified without reading them.
+static bool hash_sampled_content(const std::string& path, int64_t size, uint64_t& hash) {
+    FILE* f = open_file(path, "rb");
+    if (!f) return false;
+    std::vector<uint8_t> buf(SAMPLE_SIZE);
+    int64_t offsets[3] = { 0, size / 2 - SAMPLE_SIZE / 2, size - SAMPLE_SIZE };
+    uint64_t h = hash_int(FNV_OFFSET, size);
+    bool ok = true;
+    for (int i = 0; i < 3 && ok; i++) {
+        int64_t offset = offsets[i] < 0 ? 0 : offsets[i];
+        if (i && size <= SAMPLE_SIZE) break;
+#if _WIN32
+        ok = !_fseeki64(f, offset, SEEK_SET);
+#else
+        ok = !fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+        if (!ok) break;
+        size_t readed = fread(buf.data(), 1, buf.size(), f);
+        h = fnv1a(h, buf.data(), readed);
+    }
+    fclose(f);
+    // 0 means not computed.
+    hash = h ? h : 1;
+    return ok;
+}
+
+bool enm4a_get_file_id(std::string path, Enm4aFileId& id, bool hash) {
+    id = Enm4aFileId();
+#if _WIN32
+    std::wstring wpath;
+    struct _stat64 st;
+    if (!to_wide(path, wpath) || _wstat64(wpath.c_str(), &st)) return false;
+    if (!(st.st_mode & _S_IFREG)) return false;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st)) return false;
+    if (!S_ISREG(st.st_mode)) return false;
+#endif
+    id.size = (int64_t)st.st_size;
+    id.mtime = (int64_t)st.st_mtime;
+    if (hash && !hash_sampled_content(path, id.size, id.hash)) {
+        id = Enm4aFileId();
+        return false;
+    }
+    return true;
+}
+
+uint64_t enm4a_hash_args(const ENM4A_ARGS& args) {
+    uint64_t h = FNV_OFFSET;
+    h = hash_string(h, args.output);
+    h = hash_string(h, args.title);
+    h = hash_string(h, args.artist);
+    h = hash_string(h, args.album);
+    h = hash_string(h, args.album_artist);
+    h = hash_string(h, args.disc);
+    h = hash_string(h, args.track);
+    h = hash_string(h, args.date);
+    h = hash_string(h, args.cover);
+    if (args.cover) {
+        // Changed cover file should also trigger conversion.
+        Enm4aFileId cover;
+        enm4a_get_file_id(args.cover, cover, false);
+        h = hash_int(h, cover.size);
+        h = hash_int(h, cover.mtime);
+    }
+    h = hash_int(h, args.cover_max_size);
+    h = hash_int(h, args.cover_quality);
+    h = hash_int(h, args.cover_recompress);
+    h = hash_int(h, args.default_sample_rate);
+    h = hash_int(h, args.sample_rate ? *args.sample_rate : -1);
+    h = hash_int(h, args.bitrate);
+    h = hash_int(h, args.resampler);
+    h = hash_int(h, args.faststart);
+    h = hash_int(h, args.fragment_duration);
+    h = hash_int(h, args.loudness);
+    h = hash_int(h, args.fingerprint);
+    // Hash the resolved encoder, so output is updated when the preferred encoder becomes available.
+    h = hash_string(h, enm4a_aac_encoder_name(args.encoder));
+    h = hash_int(h, args.start_time);
+    h = hash_int(h, args.duration);
+    h = hash_int(h, (int64_t)args.output_count);
+    for (size_t i = 0; i < args.output_count; i++) {
+        h = hash_string(h, args.outputs[i].output);
+        h = hash_int(h, args.outputs[i].bitrate);
+        h = hash_int(h, args.outputs[i].sample_rate);
+    }
+    return h;
+}
+
+std::vector<std::string> enm4a_extra_outputs(const ENM4A_ARGS& args) {
+    std::vector<std::string> outputs;
+    for (size_t i = 0; i < args.output_count; i++) {
+        if (args.outputs[i].output) outputs.push_back(args.outputs[i].output);
+    }
+    return outputs;
+}
+
+void enm4a_set_replaceable_outputs(ENM4A_ARGS& args, const std::vector<std::string>& outputs, std::vector<const char*>& list) {
+    list.clear();
+    for (auto i = outputs.begin(); i != outputs.end(); i++) {
+        list.push_back(i->c_str());
+    }
+    args.replaceable_outputs = list.data();
+    args.replaceable_output_count = list.size();
+}
+
+/// Escape backslash, tab and line breaks, so any path is kept in a single field.
+static std::string escape_field(const std::string& s) {
+    std::string out;
+    for (auto c : s) {
+        switch (c) {
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        default:
+            out += c;
+        }
+    }
+    return out;
+}
+
+/// @return false if field has invalid escape sequence.
+static bool unescape_field(const std::string& s, std::string& out) {
+    out.clear();
+    for (size_t i = 0; i < s.length(); i++) {
+        if (s[i] != '\\') {
+            out += s[i];
+            continue;
+        }
+        if (++i == s.length()) return false;
+        switch (s[i]) {
+        case '\\':
+            out += '\\';
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'r':
+            out += '\r';
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Enm4aIncremental::load(std::string path) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->path = path;
+    this->entries.clear();
+    this->changed = false;
+    FILE* f = open_file(path, "r");
+    if (!f) return true;
+    std::string line;
+    char buf[1024];
+    size_t line_no = 0;
+    bool ok = true, eof = false, escaped = true;
+    while (!eof) {
+        line.clear();
+        while (1) {
+            if (!fgets(buf, sizeof(buf), f)) {
+                eof = true;
+                break;
+            }
+            line += buf;
+            if (line.length() && line[line.length() - 1] == '\n') break;
+        }
+        if (eof && !line.length()) break;
+        line_no++;
+        while (line.length() && (line[line.length() - 1] == '\n' || line[line.length() - 1] == '\r')) {
+            line.erase(line.length() - 1);
+        }
+        if (line == MANIFEST_HEADER_V1) escaped = false;
+        if (!line.length() || line[0] == '#') continue;
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (start <= line.length()) {
+            size_t pos = line.find('\t', start);
+            std::string field = line.substr(start, pos == std::string::npos ? std::string::npos : pos - start), value;
+            start = pos == std::string::npos ? line.length() + 1 : pos + 1;
+            if (escaped && !unescape_field(field, value)) {
+                ok = false;
+                break;
+            }
+            fields.push_back(escaped ? value : field);
+        }
+        // input, input size, input mtime, input hash, args hash, output, output size, output mtime, extra outputs...
+        if (!ok || fields.size() < 8) {
+            printf("%s:%zu: Invalid record.\n", path.c_str(), line_no);
+            ok = false;
+            break;
+        }
+        Enm4aIncrementalEntry e;
+        e.input.size = strtoll(fields[1].c_str(), nullptr, 10);
+        e.input.mtime = strtoll(fields[2].c_str(), nullptr, 10);
+        e.input.hash = strtoull(fields[3].c_str(), nullptr, 16);
+        e.args_hash = strtoull(fields[4].c_str(), nullptr, 16);
+        e.output = fields[5];
+        e.output_id.size = strtoll(fields[6].c_str(), nullptr, 10);
+        e.output_id.mtime = strtoll(fields[7].c_str(), nullptr, 10);
+        e.extra_outputs.assign(fields.begin() + 8, fields.end());
+        this->entries[fields[0]] = e;
+    }
+    fclose(f);
+    return ok;
+}
+
+bool Enm4aIncremental::save() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (!this->changed) return true;
+    std::string tmp = this->path + ".tmp";
+    FILE* f = open_file(tmp, "w");
+    if (!f) {
+        printf("Can not open manifest file: %s\n", tmp.c_str());
+        return false;
+    }
+    fprintf(f, "%s\n", MANIFEST_HEADER);
+    for (auto i = this->entries.begin(); i != this->entries.end(); i++) {
+        const Enm4aIncrementalEntry& e = i->second;
+        fprintf(f, "%s\t%" PRId64 "\t%" PRId64 "\t%016" PRIx64 "\t%016" PRIx64 "\t%s\t%" PRId64 "\t%" PRId64, escape_field(i->first).c_str(), e.input.size, e.input.mtime, e.input.hash, e.args_hash, escape_field(e.output).c_str(), e.output_id.size, e.output_id.mtime);
+        for (auto o = e.extra_outputs.begin(); o != e.extra_outputs.end(); o++) {
+            fprintf(f, "\t%s", escape_field(*o).c_str());
+        }
+        fprintf(f, "\n");
+    }
+    bool ok = !ferror(f);
+    if (fclose(f)) ok = false;
+    if (!ok || !replace_file(tmp, this->path)) {
+        printf("Can not write manifest file: %s\n", this->path.c_str());
+        return false;
+    }
+    this->changed = false;
+    return true;
+}
+
+ENM4A_INCREMENTAL_STATE Enm4aIncremental::check(std::string input, uint64_t args_hash, Enm4aFileId& input_id, std::vector<std::string>& outputs) {
+    Enm4aFileId output_id;
+    if (!enm4a_get_file_id(input, input_id, false)) return ENM4A_INCREMENTAL_UNKNOWN;
+    std::unique_lock<std::mutex> guard(this->lock);
+    auto i = this->entries.find(input);
+    if (i == this->entries.end()) return ENM4A_INCREMENTAL_UNKNOWN;
+    Enm4aIncrementalEntry e = i->second;
+    guard.unlock();
+    if (!enm4a_get_file_id(e.output, output_id, false) || output_id.size != e.output_id.size || output_id.mtime != e.output_id.mtime) {
+        return ENM4A_INCREMENTAL_UNKNOWN;
+    }
+    bool same = input_id.size == e.input.size && input_id.mtime == e.input.mtime;
+    if (!same && input_id.size == e.input.size && e.input.hash) {
+        // Only modification time is changed, such as copied without preserving times.
+        if (enm4a_get_file_id(input, input_id, true) && input_id.hash == e.input.hash) {
+            same = true;
+            guard.lock();
+            this->entries[input].input = input_id;
+            this->changed = true;
+        }
+    }
+    bool extra_exist = true;
+    for (auto o = e.extra_outputs.begin(); o != e.extra_outputs.end() && extra_exist; o++) {
+        Enm4aFileId id;
+        extra_exist = enm4a_get_file_id(*o, id, false);
+    }
+    // Missing extra output is written again. Main output is still known, so outputs can be replaced.
+    if (same && e.args_hash == args_hash && extra_exist) return ENM4A_INCREMENTAL_UP_TO_DATE;
+    outputs = e.extra_outputs;
+    outputs.insert(outputs.begin(), e.output);
+    return ENM4A_INCREMENTAL_OUTDATED;
+}
+
+void Enm4aIncremental::update(std::string input, Enm4aFileId input_id, uint64_t args_hash, std::string output, std::vector<std::string> extra_outputs) {
+    Enm4aIncrementalEntry e;
+    if (input_id.size < 0) return;
+    if (!input_id.hash) {
+        int64_t mtime = input_id.mtime;
+        // Input is changed while converting.
+        if (!hash_sampled_content(input, input_id.size, input_id.hash) || !enm4a_get_file_id(input, e.input, false) || e.input.mtime != mtime) return;
+    }
+    if (!enm4a_get_file_id(output, e.output_id, false)) return;
+    e.input = input_id;
+    e.args_hash = args_hash;
+    e.output = output;
+    e.extra_outputs = extra_outputs;
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->entries[input] = e;
+    this->changed = true;
+}
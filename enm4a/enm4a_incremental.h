@@ -0,0 +1,76 @@
+#ifndef _ENM4A_ENM4A_INCREMENTAL_H
+#define _ENM4A_ENM4A_INCREMENTAL_H
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "enm4a.h"
+
+/// Identity of a file. size is -1 if file is not found.
+typedef struct Enm4aFileId {
+    int64_t size = -1;
+    int64_t mtime = 0;
+    /// Hash of size and sampled content. 0 if not computed.
+    uint64_t hash = 0;
+} Enm4aFileId;
+
+typedef struct Enm4aIncrementalEntry {
+    Enm4aFileId input;
+    uint64_t args_hash = 0;
+    std::string output;
+    Enm4aFileId output_id;
+    /// Additional outputs written by the same job
+    std::vector<std::string> extra_outputs;
+} Enm4aIncrementalEntry;
+
+typedef enum ENM4A_INCREMENTAL_STATE {
+    /// Input, options and output are unchanged, and extra outputs still exist. Job can be skipped.
+    ENM4A_INCREMENTAL_UP_TO_DATE,
+    /// Output is written by previous run, but input or options are changed. Recorded outputs can be overwritten.
+    ENM4A_INCREMENTAL_OUTDATED,
+    /// No valid record.
+    ENM4A_INCREMENTAL_UNKNOWN,
+} ENM4A_INCREMENTAL_STATE;
+
+/**
+ * @brief Get size and modification time of a file.
+ * @param hash Also compute hash of sampled content.
+ * @return false if file is not found or is not a local file.
+*/
+bool enm4a_get_file_id(std::string path, Enm4aFileId& id, bool hash);
+/// Hash of the fields of args which affect output.
+uint64_t enm4a_hash_args(const ENM4A_ARGS& args);
+/// Paths of additional outputs of args.
+std::vector<std::string> enm4a_extra_outputs(const ENM4A_ARGS& args);
+/**
+ * @brief Allow outputs written by previous run to be replaced. Other existing files still follow overwrite of args.
+ * @param list Storage of the list set to args. Should be alive until conversion is finished.
+*/
+void enm4a_set_replaceable_outputs(ENM4A_ARGS& args, const std::vector<std::string>& outputs, std::vector<const char*>& list);
+
+/// Records of finished jobs keyed by input path. Thread safe.
+class Enm4aIncremental {
+public:
+    /**
+     * @brief Load records from file. Not existing file is treated as empty.
+     * @return false if file can not be parsed.
+    */
+    bool load(std::string path);
+    /// Write records to file if changed.
+    bool save();
+    /**
+     * @brief Compare job with record.
+     * @param input_id Identity of input. Should be passed to update if job is converted.
+     * @param outputs Outputs recorded by previous run. Only set if job is outdated.
+    */
+    ENM4A_INCREMENTAL_STATE check(std::string input, uint64_t args_hash, Enm4aFileId& input_id, std::vector<std::string>& outputs);
+    /// Record a succeeded job.
+    void update(std::string input, Enm4aFileId input_id, uint64_t args_hash, std::string output, std::vector<std::string> extra_outputs);
+private:
+    std::string path;
+    std::map<std::string, Enm4aIncrementalEntry> entries;
+    std::mutex lock;
+    bool changed = false;
+};
+#endif
@@ -0,0 +1,204 @@
+#ifndef _ENM4A_ENM4A_INTERNAL_H
+#define _ENM4A_ENM4A_INTERNAL_H
+/// Helpers shared between enm4a modules. Not part of public API.
+
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+#include "enm4a.h"
+#include "enm4a_fingerprint.h"
+#include "enm4a_loudness.h"
+#include "enm4a_thread.h"
+#include "enm4a_trace.h"
+
+#include <stdint.h>
+#include <time.h>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/audio_fifo.h"
+#include "libavutil/channel_layout.h"
+#include "libswresample/swresample.h"
+
+#if LIBAVCODEC_VERSION_MAJOR < 59 || LIBAVCODEC_VERSION_MINOR < 23 || LIBAVCODEC_VERSION_MICRO < 100
+#define OLD_CHANNEL_LAYOUT 1
+#else
+#define NEW_CHANNEL_LAYOUT 1
+#endif
+
+#if NEW_CHANNEL_LAYOUT
+#define GET_AV_CODEC_CHANNELS(context) (context->ch_layout.nb_channels)
+#else
+#define GET_AV_CODEC_CHANNELS(context) (context->channels)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Samples converted by resampler. Reused between frames to avoid allocation.
+typedef struct ENM4A_CONVERT_BUFFER {
+    uint8_t** data;
+    /// Allocated samples per channel
+    int nb_samples;
+} ENM4A_CONVERT_BUFFER;
+
+/// Limit the frequency of progress output
+typedef struct ENM4A_PROGRESS_TIMER {
+#ifdef _WIN32
+    FILETIME last;
+#elif defined(HAVE_CLOCK_GETTIME)
+    struct timespec last;
+#else
+    time_t last;
+#endif
+} ENM4A_PROGRESS_TIMER;
+
+void init_progress_timer(ENM4A_PROGRESS_TIMER* t);
+/// @return 1 if progress should be printed now.
+int progress_timer_check(ENM4A_PROGRESS_TIMER* t);
+/// Where progress is reported. Printed to console and/or passed to ENM4A_ARGS::progress.
+typedef struct ENM4A_PROGRESS_SINK {
+    ENM4A_PROGRESS_TIMER timer;
+    char print;
+    ENM4A_PROGRESS_CALLBACK callback;
+    void* opaque;
+    /// Input. Used to get bytes read and duration. May be NULL.
+    const AVFormatContext* ic;
+    /// Stages are only timed if callback is set.
+    char timing;
+    int64_t start;
+    /// Protect stage_time. Stages may run in different threads.
+    ENM4A_MUTEX lock;
+    int64_t stage_time[ENM4A_STAGE_COUNT];
+    /// Time to the first packet. -1 if no packet is read yet.
+    int64_t first_packet;
+    /// Reported input duration. -1 means use duration of input.
+    int64_t duration;
+} ENM4A_PROGRESS_SINK;
+
+/// Time range of input to convert. Timestamps are in time base of input audio stream.
+typedef struct ENM4A_TRIM {
+    /// INT64_MIN if input is not trimmed at start
+    int64_t start;
+    /// INT64_MAX if input is not trimmed at end
+    int64_t end;
+    AVRational time_base;
+    /// Position of next decoded sample. Used when decoded frame has no timestamp. INT64_MIN if unknown.
+    int64_t next;
+} ENM4A_TRIM;
+
+void init_progress_sink(ENM4A_PROGRESS_SINK* sink, const ENM4A_ARGS* args);
+void free_progress_sink(ENM4A_PROGRESS_SINK* sink);
+/**
+ * @brief Get start time of a stage.
+ * @param sink May be NULL.
+ * @return 0 if stages are not timed.
+*/
+int64_t stage_start(const ENM4A_PROGRESS_SINK* sink);
+/// Add time since start to stage. Thread safe.
+void stage_end(ENM4A_PROGRESS_SINK* sink, ENM4A_STAGE stage, int64_t start);
+/**
+ * @brief Record time to the first packet. Should be called by demux thread after every packet is read.
+ * @param sink May be NULL.
+*/
+void mark_first_packet(ENM4A_PROGRESS_SINK* sink);
+/**
+ * @brief Report final progress.
+ * @param time Written duration of output in AV_TIME_BASE
+*/
+void finish_progress(ENM4A_PROGRESS_SINK* sink, const AVFormatContext* oc, int64_t time);
+/**
+ * @brief Report progress if enough time passed since last report.
+ * @param sink May be NULL.
+ * @param pts Written duration of output in base
+*/
+void update_progress(ENM4A_PROGRESS_SINK* sink, const AVFormatContext* oc, int64_t pts, AVRational base);
+/// Packet events are logged at trace level, or whenever background trace writer is running.
+#define log_packet_enabled(level) ((level) >= ENM4A_LOG_TRACE || enm4a_trace_enabled())
+/// Log packet. Recorded by background trace writer if it is running, otherwise printed.
+void log_packet(const AVFormatContext* fmt_ctx, const AVPacket* pkt, const char* tag);
+void log_fifo_size(int size);
+void log_progress(const AVFormatContext* ctx, int64_t pts, AVRational base);
+/**
+ * @brief Convert samples of a channel of frame to float.
+ * @param offset First sample of frame to convert
+ * @param n Number of samples
+*/
+void load_samples(float* dst, const AVFrame* frame, int channel, int channels, int offset, int n);
+void free_convert_buffer(ENM4A_CONVERT_BUFFER* buf);
+ENM4A_ERROR reserve_convert_buffer(int* ret, ENM4A_CONVERT_BUFFER* buf, AVCodecContext* out, int nb_samples, int64_t* allocations);
+ENM4A_ERROR reserve_fifo(int* ret, AVAudioFifo* fifo, int nb_samples, int64_t* allocations);
+ENM4A_ERROR convert_samples_and_add_to_fifo(int* ret, AVCodecContext* out, SwrContext* sw, AVFrame* frame, AVAudioFifo* fifo, ENM4A_CONVERT_BUFFER* buf, int64_t* allocations, ENM4A_PROGRESS_SINK* progress);
+ENM4A_ERROR decode_audio_packet(int* ret, AVCodecContext* dec, const AVPacket* pkt, AVFrame* frame, AVCodecContext* out, SwrContext* sw, AVAudioFifo* fifo, ENM4A_CONVERT_BUFFER* buf, int64_t* allocations, ENM4A_LOUDNESS* meter, ENM4A_FINGERPRINT* fingerprint, ENM4A_TRIM* trim, ENM4A_PROGRESS_SINK* progress);
+/**
+ * @brief Remove samples of decoded frame which are outside of trim range.
+ * @param trim May be NULL.
+ * @return 0 if no samples are left.
+*/
+int trim_frame(ENM4A_TRIM* trim, AVFrame* frame);
+/**
+ * @brief Check whether a packet starts at or after the end of trim range, so demuxing can stop.
+ * @param trim May be NULL.
+*/
+int trim_packet_after_end(const ENM4A_TRIM* trim, const AVPacket* pkt);
+ENM4A_ERROR encode_audio_frame(int* ret, AVFrame* frame, AVFormatContext* oc, AVCodecContext* occ, AVPacket* pkt, char* writed_data, int64_t* pts, ENM4A_LOG level, unsigned int stream_index, ENM4A_PROGRESS_SINK* progress);
+ENM4A_ERROR encode_fifo_frames(int* ret, AVAudioFifo* fifo, AVFrame* frame, AVFormatContext* oc, AVCodecContext* occ, AVPacket* pkt, int64_t* pts, char flush, ENM4A_LOG level, unsigned int stream_index, int64_t* allocations, ENM4A_PROGRESS_SINK* progress);
+ENM4A_ERROR check_output_file(const char* out, ENM4A_OVERWRITE overwrite);
+/// @return ENM4A_OVERWRITE_YES if out is one of replaceable outputs of args, otherwise overwrite of args.
+ENM4A_OVERWRITE get_output_overwrite(const ENM4A_ARGS* args, const char* out);
+/**
+ * @brief Check whether codec parameters in container headers are enough to convert without analyzing packets.
+ * Fill duration of input from streams if it is unknown.
+ * @return 1 if complete.
+*/
+int stream_info_complete(AVFormatContext* ic);
+/// Input opened by open_input
+typedef struct ENM4A_INPUT {
+    AVFormatContext* ic;
+    /// I/O of custom input. NULL if not used.
+    AVIOContext* input_pb;
+    /// Background reader of HTTP input. NULL if not used.
+    AVIOContext* readahead_pb;
+} ENM4A_INPUT;
+/**
+ * @brief Set FFmpeg log level and check sample rates of args. Shared by conversion, split and plan.
+*/
+ENM4A_ERROR check_conversion_args(const ENM4A_ARGS* args);
+/**
+ * @brief Open input and get stream information. Follows http_headers, readahead, input_format, probesize,
+ * analyzeduration and trust_headers of args, so conversion, split and plan read input in the same way.
+ * @param input_io Custom input. Can be NULL.
+ * @param in Result. Should be closed by close_input even if failed.
+*/
+ENM4A_ERROR open_input(int* ret, const char* input, const ENM4A_IO* input_io, const ENM4A_ARGS* args, ENM4A_INPUT* in);
+void close_input(ENM4A_INPUT* in);
+/// @return 1 if decoded samples can not be sent to encoder directly.
+int need_resample(const AVCodecContext* in, const AVCodecContext* out);
+/**
+ * @brief Let demuxer skip packets of streams which are not converted.
+ * @param img_stream_index Index of copied image stream. -1 if none.
+*/
+void discard_unused_streams(AVFormatContext* ic, unsigned int audio_stream_index, int img_stream_index, ENM4A_LOG level);
+/// Set tag from argument, or copy it from input if argument is empty.
+void set_ctx_metadata(AVFormatContext* ctx, const AVFormatContext* in, const char* key, const char* argu);
+/**
+ * @brief Open decoder of a audio stream.
+ * @param dec Result. Should be freed by avcodec_free_context even if failed.
+*/
+ENM4A_ERROR open_audio_decoder(int* ret, const AVStream* is, const ENM4A_ARGS* args, AVCodecContext** dec);
+ENM4A_ERROR open_audio_encoder(int* ret, AVCodecContext* in, AVFormatContext* oc, AVStream* os, int sample_rate, int64_t bitrate, const ENM4A_ARGS* args, AVCodecContext** out);
+ENM4A_ERROR init_audio_converter(int* ret, AVCodecContext* in, AVCodecContext* out, ENM4A_RESAMPLER profile, ENM4A_LOG level, SwrContext** sw, ENM4A_CONVERT_BUFFER* buf, AVAudioFifo** fifo, int64_t* allocations);
+ENM4A_ERROR alloc_encoder_frame(int* ret, AVCodecContext* out, AVFrame** frame);
+/**
+ * @brief Write a copy of cover packet to output.
+ * @param is Input stream of packet
+*/
+ENM4A_ERROR write_cover_packet(int* ret, AVFormatContext* oc, unsigned int dest_index, const AVStream* is, const AVPacket* src, ENM4A_LOG level);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_io.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+#define ENM4A_AVIO_WRITE_BUF const uint8_t*
+#else
+#define ENM4A_AVIO_WRITE_BUF uint8_t*
+#endif
+
+static int enm4a_io_read(void* opaque, uint8_t* buf, int size) {
+    const ENM4A_IO* io = (const ENM4A_IO*)opaque;
+    int re = io->read(io->opaque, buf, size);
+    if (re == 0 || re == AVERROR_EOF) return AVERROR_EOF;
+    return re < 0 ? AVERROR(EIO) : re;
+}
+
+static int enm4a_io_write(void* opaque, ENM4A_AVIO_WRITE_BUF buf, int size) {
+    const ENM4A_IO* io = (const ENM4A_IO*)opaque;
+    int re = io->write(io->opaque, buf, size);
+    return re < 0 ? AVERROR(EIO) : re;
+}
+
+static int64_t enm4a_io_seek(void* opaque, int64_t offset, int whence) {
+    const ENM4A_IO* io = (const ENM4A_IO*)opaque;
+    whence &= ~AVSEEK_FORCE;
+    int64_t re = io->seek(io->opaque, offset, whence == AVSEEK_SIZE ? ENM4A_SEEK_SIZE : whence);
+    return re < 0 ? AVERROR(ENOSYS) : re;
+}
+
+AVIOContext* enm4a_alloc_avio(const ENM4A_IO* io, int write_flag) {
+    if (!io) return NULL;
+    unsigned char* buf = av_malloc(ENM4A_IO_BUFFER_SIZE);
+    if (!buf) return NULL;
+    AVIOContext* pb = avio_alloc_context(buf, ENM4A_IO_BUFFER_SIZE, write_flag, (void*)io, write_flag ? NULL : enm4a_io_read, write_flag ? enm4a_io_write : NULL, io->seek ? enm4a_io_seek : NULL);
+    if (!pb) av_free(buf);
+    return pb;
+}
+
+void enm4a_free_avio(AVIOContext** pb) {
+    if (!pb || !*pb) return;
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
+
+static int enm4a_memory_read(void* opaque, uint8_t* buf, int size) {
+    ENM4A_MEMORY* m = (ENM4A_MEMORY*)opaque;
+    // Seek may move beyond the end of data.
+    if (m->pos >= m->size) return AVERROR_EOF;
+    size_t le = m->size - m->pos;
+    if ((size_t)size < le) le = size;
+    memcpy(buf, m->data + m->pos, le);
+    m->pos += le;
+    return (int)le;
+}
+
+static int enm4a_memory_write(void* opaque, const uint8_t* buf, int size) {
+    ENM4A_MEMORY* m = (ENM4A_MEMORY*)opaque;
+    if (m->pos + size > m->capacity) {
+        size_t capacity = m->capacity ? m->capacity : ENM4A_IO_BUFFER_SIZE;
+        while (capacity < m->pos + size) capacity *= 2;
+        uint8_t* data = realloc(m->data, capacity);
+        if (!data) return -1;
+        m->data = data;
+        m->capacity = capacity;
+    }
+    // Muxer may seek beyond the end of data.
+    if (m->pos > m->size) memset(m->data + m->size, 0, m->pos - m->size);
+    memcpy(m->data + m->pos, buf, size);
+    m->pos += size;
+    if (m->pos > m->size) m->size = m->pos;
+    return size;
+}
+
+static int64_t enm4a_memory_seek(void* opaque, int64_t offset, int whence) {
+    ENM4A_MEMORY* m = (ENM4A_MEMORY*)opaque;
+    int64_t pos;
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = m->pos + offset;
+        break;
+    case SEEK_END:
+        pos = m->size + offset;
+        break;
+    case ENM4A_SEEK_SIZE:
+        return m->size;
+    default:
+        return -1;
+    }
+    if (pos < 0) return -1;
+    m->pos = pos;
+    return pos;
+}
+
+void enm4a_memory_io(ENM4A_MEMORY* m, ENM4A_IO* io) {
+    if (!m || !io) return;
+    io->opaque = m;
+    io->read = enm4a_memory_read;
+    io->write = enm4a_memory_write;
+    io->seek = enm4a_memory_seek;
+}
+
+ENM4A_ERROR encode_m4a_memory(const uint8_t* data, size_t size, uint8_t** output, size_t* output_size, ENM4A_ARGS args) {
+    if (!data || !output || !output_size) return ENM4A_NULL_POINTER;
+    ENM4A_MEMORY in = { (uint8_t*)data, size, size, 0 }, out = { NULL, 0, 0, 0 };
+    ENM4A_IO input, output_io;
+    enm4a_memory_io(&in, &input);
+    enm4a_memory_io(&out, &output_io);
+    ENM4A_ERROR re = encode_m4a_io(&input, &output_io, args);
+    if (re != ENM4A_OK) {
+        if (out.data) free(out.data);
+        return re;
+    }
+    *output = out.data;
+    *output_size = out.size;
+    return ENM4A_OK;
+}
+
+void enm4a_free_memory(uint8_t* data) {
+    if (data) free(data);
+}
@@ -0,0 +1,38 @@
+#ifndef _ENM4A_ENM4A_IO_H
+#define _ENM4A_ENM4A_IO_H
+#include "enm4a.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavformat/avio.h"
+
+/// Buffer size of AVIOContext created from ENM4A_IO
+#define ENM4A_IO_BUFFER_SIZE 65536
+
+/// Growable memory buffer used by encode_m4a_memory
+typedef struct ENM4A_MEMORY {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    size_t pos;
+} ENM4A_MEMORY;
+
+/**
+ * @brief Create AVIOContext from custom I/O callbacks
+ * @param io Callbacks. Should be valid until AVIOContext is freed.
+ * @param write_flag 1 if used as output.
+ * @return NULL if out of memory.
+*/
+AVIOContext* enm4a_alloc_avio(const ENM4A_IO* io, int write_flag);
+/// Free AVIOContext created by enm4a_alloc_avio
+void enm4a_free_avio(AVIOContext** pb);
+/**
+ * @brief Fill callbacks which read, write and seek in memory buffer. Written data grows buffer.
+ * @param m Buffer. data should be freed by free() if it is written.
+*/
+void enm4a_memory_io(ENM4A_MEMORY* m, ENM4A_IO* io);
+#ifdef __cplusplus
+}
+#endif
+#endif
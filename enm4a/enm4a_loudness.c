@@ -0,0 +1,376 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_loudness.h"
+#include "enm4a_internal.h"
+#include "enm4a_mp4.h"
+
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/log.h"
+#include "libavutil/samplefmt.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/// Samples processed at once. Scratch buffers have this size.
+#define LOUDNESS_CHUNK 1024
+/// Taps of every phase of true peak interpolation filter
+#define TRUE_PEAK_TAPS 12
+
+struct ENM4A_LOUDNESS {
+    int sample_rate;
+    int channels;
+    /// Weight of every channel. 0 means ignored.
+    double* weights;
+    /// K-weighting filter. Two biquads: high shelf and high pass.
+    double b[2][3];
+    double a[2][3];
+    /// Two states of every biquad of every channel
+    double* states;
+    /// Sum of squared filtered samples of every channel in current 100ms block
+    double* sums;
+    int block_len;
+    int block_pos;
+    /// Mean square of every 100ms block, weighted by channel
+    double* energies;
+    size_t nb_energies;
+    size_t energy_capacity;
+    /// Oversampling factor of true peak. 1 means sample peak.
+    int oversample;
+    /// Interpolation filter. Phase p uses coeffs[p * TRUE_PEAK_TAPS] to coeffs[p * TRUE_PEAK_TAPS + TRUE_PEAK_TAPS - 1].
+    float* coeffs;
+    /// Samples of every channel. The first TRUE_PEAK_TAPS - 1 samples are the tail of previous chunk.
+    float** samples;
+    /// Interpolated samples
+    float* acc;
+    float peak;
+};
+
+static void init_k_weighting(ENM4A_LOUDNESS* m) {
+    // Coefficients from ITU-R BS.1770 analog prototypes, so every sample rate can be used.
+    double f0 = 1681.974450955533, g = 3.999843853973347, q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / m->sample_rate);
+    double vh = pow(10.0, g / 20.0), vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    m->b[0][0] = (vh + vb * k / q + k * k) / a0;
+    m->b[0][1] = 2.0 * (k * k - vh) / a0;
+    m->b[0][2] = (vh - vb * k / q + k * k) / a0;
+    m->a[0][0] = 1.0;
+    m->a[0][1] = 2.0 * (k * k - 1.0) / a0;
+    m->a[0][2] = (1.0 - k / q + k * k) / a0;
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / m->sample_rate);
+    a0 = 1.0 + k / q + k * k;
+    m->b[1][0] = 1.0;
+    m->b[1][1] = -2.0;
+    m->b[1][2] = 1.0;
+    m->a[1][0] = 1.0;
+    m->a[1][1] = 2.0 * (k * k - 1.0) / a0;
+    m->a[1][2] = (1.0 - k / q + k * k) / a0;
+}
+
+/// Windowed sinc interpolation filter. Every phase is normalized to unity gain.
+static void init_true_peak_filter(ENM4A_LOUDNESS* m) {
+    int n = TRUE_PEAK_TAPS * m->oversample;
+    double center = (n - 1) / 2.0;
+    for (int p = 0; p < m->oversample; p++) {
+        double sum = 0;
+        for (int k = 0; k < TRUE_PEAK_TAPS; k++) {
+            int i = k * m->oversample + p;
+            double x = (i - center) / m->oversample;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double window = 0.5 - 0.5 * cos(2 * M_PI * (i + 1) / (n + 1));
+            m->coeffs[p * TRUE_PEAK_TAPS + k] = (float)(sinc * window);
+            sum += sinc * window;
+        }
+        for (int k = 0; k < TRUE_PEAK_TAPS; k++) {
+            m->coeffs[p * TRUE_PEAK_TAPS + k] = (float)(m->coeffs[p * TRUE_PEAK_TAPS + k] / sum);
+        }
+    }
+}
+
+ENM4A_LOUDNESS* enm4a_loudness_alloc(int sample_rate, int channels) {
+    if (sample_rate <= 0 || channels <= 0) return NULL;
+    ENM4A_LOUDNESS* m = calloc(1, sizeof(ENM4A_LOUDNESS));
+    if (!m) return NULL;
+    m->sample_rate = sample_rate;
+    m->channels = channels;
+    m->block_len = sample_rate / 10;
+    m->oversample = sample_rate < 96000 ? 4 : sample_rate < 192000 ? 2 : 1;
+    if (!(m->weights = malloc(sizeof(double) * channels))) goto fail;
+    if (!(m->states = calloc((size_t)channels * 4, sizeof(double)))) goto fail;
+    if (!(m->sums = calloc(channels, sizeof(double)))) goto fail;
+    if (!(m->coeffs = malloc(sizeof(float) * TRUE_PEAK_TAPS * m->oversample))) goto fail;
+    if (!(m->samples = calloc(channels, sizeof(float*)))) goto fail;
+    for (int c = 0; c < channels; c++) {
+        if (!(m->samples[c] = calloc(TRUE_PEAK_TAPS - 1 + LOUDNESS_CHUNK, sizeof(float)))) goto fail;
+        m->weights[c] = 1.0;
+    }
+    if (!(m->acc = malloc(sizeof(float) * LOUDNESS_CHUNK))) goto fail;
+    if (channels == 6) {
+        // FL FR FC LFE BL BR
+        m->weights[3] = 0;
+        m->weights[4] = m->weights[5] = 1.41;
+    }
+    init_k_weighting(m);
+    init_true_peak_filter(m);
+    return m;
+fail:
+    enm4a_loudness_free(&m);
+    return NULL;
+}
+
+void enm4a_loudness_free(ENM4A_LOUDNESS** m) {
+    if (!m || !*m) return;
+    ENM4A_LOUDNESS* l = *m;
+    if (l->samples) {
+        for (int c = 0; c < l->channels; c++) {
+            if (l->samples[c]) free(l->samples[c]);
+        }
+        free(l->samples);
+    }
+    if (l->weights) free(l->weights);
+    if (l->states) free(l->states);
+    if (l->sums) free(l->sums);
+    if (l->energies) free(l->energies);
+    if (l->coeffs) free(l->coeffs);
+    if (l->acc) free(l->acc);
+    free(l);
+    *m = NULL;
+}
+
+/// Convert samples of a channel to float.
+void load_samples(float* __restrict dst, const AVFrame* frame, int channel, int channels, int offset, int n) {
+    enum AVSampleFormat fmt = frame->format;
+    int planar = av_sample_fmt_is_planar(fmt), stride = planar ? 1 : channels;
+    size_t start = planar ? offset : (size_t)offset * channels + channel;
+    const uint8_t* data = frame->extended_data[planar ? channel : 0];
+    switch (av_get_packed_sample_fmt(fmt)) {
+    case AV_SAMPLE_FMT_U8: {
+        const uint8_t* src = data + start;
+        for (int i = 0; i < n; i++) dst[i] = ((int)src[i * stride] - 128) * (1.0f / 128);
+        break;
+    }
+    case AV_SAMPLE_FMT_S16: {
+        const int16_t* src = (const int16_t*)data + start;
+        for (int i = 0; i < n; i++) dst[i] = src[i * stride] * (1.0f / 32768);
+        break;
+    }
+    case AV_SAMPLE_FMT_S32: {
+        const int32_t* src = (const int32_t*)data + start;
+        for (int i = 0; i < n; i++) dst[i] = src[i * stride] * (1.0f / 2147483648.0f);
+        break;
+    }
+    case AV_SAMPLE_FMT_S64: {
+        const int64_t* src = (const int64_t*)data + start;
+        for (int i = 0; i < n; i++) dst[i] = (float)(src[i * stride] * (1.0 / 9223372036854775808.0));
+        break;
+    }
+    case AV_SAMPLE_FMT_FLT: {
+        const float* src = (const float*)data + start;
+        for (int i = 0; i < n; i++) dst[i] = src[i * stride];
+        break;
+    }
+    case AV_SAMPLE_FMT_DBL: {
+        const double* src = (const double*)data + start;
+        for (int i = 0; i < n; i++) dst[i] = (float)src[i * stride];
+        break;
+    }
+    default:
+        memset(dst, 0, sizeof(float) * n);
+        break;
+    }
+}
+
+/**
+ * @brief Get the peak of interpolated samples.
+ * Loops are kept simple so that compilers can vectorize them.
+ * @param x Samples with TRUE_PEAK_TAPS - 1 history samples before them.
+*/
+static float chunk_peak(const ENM4A_LOUDNESS* m, const float* __restrict x, int n, float* __restrict acc) {
+    float peak = 0;
+    if (m->oversample == 1) {
+        for (int i = 0; i < n; i++) {
+            float v = fabsf(x[TRUE_PEAK_TAPS - 1 + i]);
+            peak = v > peak ? v : peak;
+        }
+        return peak;
+    }
+    for (int p = 0; p < m->oversample; p++) {
+        const float* h = m->coeffs + p * TRUE_PEAK_TAPS;
+        for (int i = 0; i < n; i++) acc[i] = 0;
+        for (int k = 0; k < TRUE_PEAK_TAPS; k++) {
+            const float hk = h[k], * xs = x + TRUE_PEAK_TAPS - 1 - k;
+            for (int i = 0; i < n; i++) acc[i] += hk * xs[i];
+        }
+        for (int i = 0; i < n; i++) {
+            float v = fabsf(acc[i]);
+            peak = v > peak ? v : peak;
+        }
+    }
+    return peak;
+}
+
+/// Apply K-weighting filter and return the sum of squared output.
+static double filter_samples(const ENM4A_LOUDNESS* m, double* __restrict state, const float* __restrict x, int n) {
+    double s0 = state[0], s1 = state[1], s2 = state[2], s3 = state[3], sum = 0;
+    const double* b0 = m->b[0], * a0 = m->a[0], * b1 = m->b[1], * a1 = m->a[1];
+    for (int i = 0; i < n; i++) {
+        double in = x[i];
+        double y = b0[0] * in + s0;
+        s0 = b0[1] * in - a0[1] * y + s1;
+        s1 = b0[2] * in - a0[2] * y;
+        double z = b1[0] * y + s2;
+        s2 = b1[1] * y - a1[1] * z + s3;
+        s3 = b1[2] * y - a1[2] * z;
+        sum += z * z;
+    }
+    state[0] = s0;
+    state[1] = s1;
+    state[2] = s2;
+    state[3] = s3;
+    return sum;
+}
+
+static ENM4A_ERROR push_energy(ENM4A_LOUDNESS* m) {
+    double e = 0;
+    if (m->nb_energies == m->energy_capacity) {
+        size_t capacity = m->energy_capacity ? m->energy_capacity * 2 : 1024;
+        double* energies = realloc(m->energies, sizeof(double) * capacity);
+        if (!energies) return ENM4A_NO_MEMORY;
+        m->energies = energies;
+        m->energy_capacity = capacity;
+    }
+    for (int c = 0; c < m->channels; c++) {
+        e += m->weights[c] * m->sums[c] / m->block_len;
+        m->sums[c] = 0;
+    }
+    m->energies[m->nb_energies++] = e;
+    m->block_pos = 0;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_loudness_add_frame(ENM4A_LOUDNESS* m, const AVFrame* frame) {
+    if (!m || !frame) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    if (GET_AV_CODEC_CHANNELS(frame) != m->channels) {
+        av_log(NULL, AV_LOG_ERROR, "Audio format of decoded frame is changed.\n");
+        return ENM4A_FFMPEG_ERR;
+    }
+    for (int offset = 0; offset < frame->nb_samples; offset += LOUDNESS_CHUNK) {
+        int n = FFMIN(LOUDNESS_CHUNK, frame->nb_samples - offset), pos = 0;
+        for (int c = 0; c < m->channels; c++) {
+            load_samples(m->samples[c] + TRUE_PEAK_TAPS - 1, frame, c, m->channels, offset, n);
+            float peak = chunk_peak(m, m->samples[c], n, m->acc);
+            if (peak > m->peak) m->peak = peak;
+        }
+        while (pos < n) {
+            int len = FFMIN(n - pos, m->block_len - m->block_pos);
+            for (int c = 0; c < m->channels; c++) {
+                if (m->weights[c] == 0) continue;
+                m->sums[c] += filter_samples(m, m->states + c * 4, m->samples[c] + TRUE_PEAK_TAPS - 1 + pos, len);
+            }
+            pos += len;
+            m->block_pos += len;
+            if (m->block_pos == m->block_len && (re = push_energy(m)) != ENM4A_OK) {
+                return re;
+            }
+        }
+        for (int c = 0; c < m->channels; c++) {
+            memmove(m->samples[c], m->samples[c] + n, sizeof(float) * (TRUE_PEAK_TAPS - 1));
+        }
+    }
+    return ENM4A_OK;
+}
+
+static double energy_to_loudness(double e) {
+    return -0.691 + 10.0 * log10(e);
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Mean energy of windows which pass absolute gate (-70 LUFS) and relative gate.
+ * @param windows Number of 100ms blocks in a window
+ * @param relative Relative gate in LU
+ * @param values If not NULL, energies which pass both gates are stored in it.
+ * @return 0 if no window pass the gates.
+*/
+static double gated_energy(const ENM4A_LOUDNESS* m, size_t windows, double relative, double* values, size_t* nb_values) {
+    double abs_gate = pow(10.0, (-70.0 + 0.691) / 10.0), sum = 0, rel_gate = 0, total = 0;
+    size_t count = 0, passed = 0;
+    if (m->nb_energies < windows) return 0;
+    for (int pass = 0; pass < 2; pass++) {
+        double window = 0;
+        for (size_t i = 0; i < m->nb_energies; i++) {
+            window += m->energies[i];
+            if (i >= windows) window -= m->energies[i - windows];
+            if (i + 1 < windows) continue;
+            double z = window / windows;
+            if (z <= abs_gate) continue;
+            if (!pass) {
+                sum += z;
+                count++;
+            } else if (z > rel_gate) {
+                total += z;
+                if (values) values[passed] = z;
+                passed++;
+            }
+        }
+        if (!count) return 0;
+        rel_gate = sum / count * pow(10.0, relative / 10.0);
+    }
+    if (nb_values) *nb_values = passed;
+    return passed ? total / passed : 0;
+}
+
+ENM4A_ERROR enm4a_loudness_result(const ENM4A_LOUDNESS* m, ENM4A_LOUDNESS_RESULT* result) {
+    if (!m || !result) return ENM4A_NULL_POINTER;
+    // Gating block is 400ms and short-term window is 3s.
+    double e = gated_energy(m, 4, -10.0, NULL, NULL);
+    result->integrated = e > 0 ? energy_to_loudness(e) : -HUGE_VAL;
+    result->track_gain = e > 0 ? ENM4A_REPLAYGAIN_REFERENCE - result->integrated : 0;
+    result->true_peak = m->peak;
+    result->range = 0;
+    if (m->nb_energies >= 30) {
+        size_t nb_values = 0;
+        double* values = malloc(sizeof(double) * (m->nb_energies - 29));
+        if (!values) return ENM4A_NO_MEMORY;
+        if (gated_energy(m, 30, -20.0, values, &nb_values) > 0 && nb_values) {
+            qsort(values, nb_values, sizeof(double), compare_double);
+            double low = values[(size_t)((nb_values - 1) * 0.10 + 0.5)], high = values[(size_t)((nb_values - 1) * 0.95 + 0.5)];
+            result->range = energy_to_loudness(high) - energy_to_loudness(low);
+        }
+        free(values);
+    }
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_set_loudness_tags(ENM4A_MP4* mp4, const ENM4A_LOUDNESS_RESULT* result) {
+    if (!mp4 || !result) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    char gain[32], peak[32], reference[32], integrated[32], range[32], true_peak[32];
+    snprintf(gain, sizeof(gain), "%+.2f dB", result->track_gain);
+    snprintf(peak, sizeof(peak), "%.6f", result->true_peak);
+    snprintf(reference, sizeof(reference), "%.2f LUFS", ENM4A_REPLAYGAIN_REFERENCE);
+    snprintf(integrated, sizeof(integrated), "%.2f LUFS", result->integrated);
+    snprintf(range, sizeof(range), "%.2f LU", result->range);
+    snprintf(true_peak, sizeof(true_peak), "%.2f dBTP", result->true_peak > 0 ? 20.0 * log10(result->true_peak) : -HUGE_VAL);
+    if ((re = enm4a_mp4_set_freeform(mp4, "replaygain_track_gain", gain)) != ENM4A_OK) return re;
+    if ((re = enm4a_mp4_set_freeform(mp4, "replaygain_track_peak", peak)) != ENM4A_OK) return re;
+    if ((re = enm4a_mp4_set_freeform(mp4, "replaygain_reference_loudness", reference)) != ENM4A_OK) return re;
+    if ((re = enm4a_mp4_set_freeform(mp4, "ebur128_integrated_loudness", integrated)) != ENM4A_OK) return re;
+    if ((re = enm4a_mp4_set_freeform(mp4, "ebur128_loudness_range", range)) != ENM4A_OK) return re;
+    return enm4a_mp4_set_freeform(mp4, "ebur128_true_peak", true_peak);
+}
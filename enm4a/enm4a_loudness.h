@@ -0,0 +1,50 @@
+#ifndef _ENM4A_ENM4A_LOUDNESS_H
+#define _ENM4A_ENM4A_LOUDNESS_H
+#include "enm4a.h"
+#include "enm4a_mp4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavutil/frame.h"
+
+/// Reference loudness of ReplayGain 2.0 in LUFS
+#define ENM4A_REPLAYGAIN_REFERENCE -18.0
+/// Upper bound of bytes added to moov box by enm4a_set_loudness_tags
+#define ENM4A_LOUDNESS_TAGS_SIZE 1024
+
+/// EBU R128 loudness meter. Measures integrated loudness, loudness range and true peak.
+typedef struct ENM4A_LOUDNESS ENM4A_LOUDNESS;
+
+typedef struct ENM4A_LOUDNESS_RESULT {
+    /// Integrated loudness in LUFS. -HUGE_VAL if audio is too short or silent.
+    double integrated;
+    /// Loudness range in LU
+    double range;
+    /// True peak in linear scale. Sample peak if sample rate is too high to oversample.
+    double true_peak;
+    /// ReplayGain track gain in dB
+    double track_gain;
+} ENM4A_LOUDNESS_RESULT;
+
+/**
+ * @brief Create a meter
+ * @param sample_rate Sample rate of frames
+ * @param channels Channels of frames. 6 channels are treated as 5.1 and LFE is ignored.
+ * @return NULL if out of memory.
+*/
+ENM4A_LOUDNESS* enm4a_loudness_alloc(int sample_rate, int channels);
+void enm4a_loudness_free(ENM4A_LOUDNESS** m);
+/**
+ * @brief Add decoded samples to meter.
+ * @param frame Frame with any sample format. Sample rate and channels should be same as meter.
+*/
+ENM4A_ERROR enm4a_loudness_add_frame(ENM4A_LOUDNESS* m, const AVFrame* frame);
+ENM4A_ERROR enm4a_loudness_result(const ENM4A_LOUDNESS* m, ENM4A_LOUDNESS_RESULT* result);
+/// Set ReplayGain and EBU R128 freeform tags. Changes are written by enm4a_mp4_save.
+ENM4A_ERROR enm4a_set_loudness_tags(ENM4A_MP4* mp4, const ENM4A_LOUDNESS_RESULT* result);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,804 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_mp4.h"
+#include "enm4a_cover.h"
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/dict.h"
+#include "libavutil/log.h"
+
+#define BOX_TYPE(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+#define BOX_MOOV BOX_TYPE('m', 'o', 'o', 'v')
+#define BOX_MOOF BOX_TYPE('m', 'o', 'o', 'f')
+#define BOX_MVEX BOX_TYPE('m', 'v', 'e', 'x')
+#define BOX_UDTA BOX_TYPE('u', 'd', 't', 'a')
+#define BOX_META BOX_TYPE('m', 'e', 't', 'a')
+#define BOX_HDLR BOX_TYPE('h', 'd', 'l', 'r')
+#define BOX_ILST BOX_TYPE('i', 'l', 's', 't')
+#define BOX_FREE BOX_TYPE('f', 'r', 'e', 'e')
+#define BOX_SKIP BOX_TYPE('s', 'k', 'i', 'p')
+#define BOX_FREEFORM BOX_TYPE('-', '-', '-', '-')
+#define BOX_MEAN BOX_TYPE('m', 'e', 'a', 'n')
+#define BOX_NAME BOX_TYPE('n', 'a', 'm', 'e')
+#define BOX_DATA BOX_TYPE('d', 'a', 't', 'a')
+#define BOX_COVR BOX_TYPE('c', 'o', 'v', 'r')
+#define BOX_DISK BOX_TYPE('d', 'i', 's', 'k')
+#define BOX_MDAT BOX_TYPE('m', 'd', 'a', 't')
+#define BOX_TRAK BOX_TYPE('t', 'r', 'a', 'k')
+#define BOX_MDIA BOX_TYPE('m', 'd', 'i', 'a')
+#define BOX_MINF BOX_TYPE('m', 'i', 'n', 'f')
+#define BOX_STBL BOX_TYPE('s', 't', 'b', 'l')
+#define BOX_STCO BOX_TYPE('s', 't', 'c', 'o')
+#define BOX_CO64 BOX_TYPE('c', 'o', '6', '4')
+/// moov box larger than this is treated as invalid.
+#define MAX_MOOV_SIZE (256 << 20)
+/// Well-known types of data box
+#define DATA_IMPLICIT 0
+#define DATA_UTF8 1
+#define DATA_JPEG 13
+#define DATA_PNG 14
+#define ITUNES_MEAN "com.apple.iTunes"
+/// Size of buffer used when media data is moved
+#define SHIFT_BUFFER_SIZE (1 << 20)
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+typedef struct MP4_BOX {
+    uint32_t type;
+    /// Payload of leaf box. For container box, the data before children, such as version and flags of meta box.
+    uint8_t* data;
+    size_t size;
+    char container;
+    struct MP4_BOX** children;
+    size_t nb_children;
+} MP4_BOX;
+
+struct ENM4A_MP4 {
+    char* path;
+    MP4_BOX* moov;
+    int64_t moov_offset;
+    /// Size of moov box and free boxes directly after it
+    int64_t space;
+    int64_t file_size;
+    /// Offset of the first mdat box. -1 if not found.
+    int64_t mdat_offset;
+};
+
+/// Ranges of file which are moved forward by enm4a_mp4_save_faststart
+typedef struct MP4_SHIFT {
+    int64_t start[2];
+    int64_t end[2];
+    int64_t delta[2];
+} MP4_SHIFT;
+
+static uint32_t rb32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t rb64(const uint8_t* p) {
+    return ((uint64_t)rb32(p) << 32) | rb32(p + 4);
+}
+
+static void wb32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void wb64(uint8_t* p, uint64_t v) {
+    wb32(p, (uint32_t)(v >> 32));
+    wb32(p + 4, (uint32_t)v);
+}
+
+static void free_box(MP4_BOX* box) {
+    if (!box) return;
+    for (size_t i = 0; i < box->nb_children; i++) {
+        free_box(box->children[i]);
+    }
+    if (box->children) free(box->children);
+    if (box->data) free(box->data);
+    free(box);
+}
+
+/**
+ * @brief Create a box and append it to parent.
+ * @param parent Parent box. Can be NULL.
+ * @param data Payload. Can be NULL if size is 0.
+ * @param str Appended to payload if not NULL.
+ * @return NULL if out of memory.
+*/
+static MP4_BOX* add_box(MP4_BOX* parent, uint32_t type, char container, const uint8_t* data, size_t size, const char* str) {
+    size_t len = str ? strlen(str) : 0;
+    MP4_BOX* box = calloc(1, sizeof(MP4_BOX));
+    if (!box) return NULL;
+    box->type = type;
+    box->container = container;
+    if (size + len) {
+        if (!(box->data = malloc(size + len))) goto fail;
+        if (size) memcpy(box->data, data, size);
+        if (len) memcpy(box->data + size, str, len);
+        box->size = size + len;
+    }
+    if (parent) {
+        MP4_BOX** children = realloc(parent->children, sizeof(MP4_BOX*) * (parent->nb_children + 1));
+        if (!children) goto fail;
+        parent->children = children;
+        children[parent->nb_children++] = box;
+    }
+    return box;
+fail:
+    free_box(box);
+    return NULL;
+}
+
+static MP4_BOX* find_box(const MP4_BOX* parent, uint32_t type) {
+    if (!parent) return NULL;
+    for (size_t i = 0; i < parent->nb_children; i++) {
+        if (parent->children[i]->type == type) return parent->children[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create a data box of a metadata item.
+ * @param type Well-known type, such as DATA_UTF8.
+*/
+static MP4_BOX* add_data_box(MP4_BOX* item, uint32_t type, const uint8_t* value, size_t size) {
+    uint8_t header[8] = { 0 }, * data;
+    wb32(header, type);
+    MP4_BOX* box = add_box(item, BOX_DATA, 0, header, sizeof(header), NULL);
+    if (!box || !size) return box;
+    // box is owned by item, so it is freed with item if failed.
+    if (!(data = realloc(box->data, box->size + size))) return NULL;
+    memcpy(data + box->size, value, size);
+    box->data = data;
+    box->size += size;
+    return box;
+}
+
+static void remove_box(MP4_BOX* parent, size_t index) {
+    free_box(parent->children[index]);
+    memmove(parent->children + index, parent->children + index + 1, sizeof(MP4_BOX*) * (parent->nb_children - index - 1));
+    parent->nb_children--;
+}
+
+/// Only boxes on the path to iTunes metadata are parsed, others are kept as raw data.
+static char is_container(uint32_t parent, uint32_t type) {
+    return (parent == BOX_MOOV && type == BOX_UDTA) || (parent == BOX_UDTA && type == BOX_META) || (parent == BOX_META && type == BOX_ILST) || parent == BOX_ILST;
+}
+
+static ENM4A_ERROR parse_boxes(MP4_BOX* parent, const uint8_t* buf, size_t size) {
+    ENM4A_ERROR re = ENM4A_OK;
+    size_t pos = 0;
+    // Some muxers end udta with 4 zero bytes.
+    while (size - pos >= 8) {
+        uint64_t box_size = rb32(buf + pos);
+        uint32_t type = rb32(buf + pos + 4);
+        size_t header = 8, prefix = 0;
+        if (box_size == 1) {
+            if (size - pos < 16) return ENM4A_INVALID_MP4;
+            box_size = rb64(buf + pos + 8);
+            header = 16;
+        } else if (box_size == 0) {
+            box_size = size - pos;
+        }
+        if (box_size < header || box_size > size - pos) return ENM4A_INVALID_MP4;
+        const uint8_t* payload = buf + pos + header;
+        size_t len = (size_t)box_size - header;
+        char container = is_container(parent->type, type);
+        // meta box of mp4 is a full box, but QuickTime one is not.
+        if (container && type == BOX_META && !(len >= 8 && rb32(payload + 4) == BOX_HDLR)) prefix = 4;
+        if (len < prefix) return ENM4A_INVALID_MP4;
+        MP4_BOX* box = add_box(parent, type, container, payload, container ? prefix : len, NULL);
+        if (!box) return ENM4A_NO_MEMORY;
+        if (container && (re = parse_boxes(box, payload + prefix, len - prefix)) != ENM4A_OK) {
+            return re;
+        }
+        pos += (size_t)box_size;
+    }
+    return ENM4A_OK;
+}
+
+static uint64_t get_box_size(const MP4_BOX* box) {
+    uint64_t size = 8 + box->size;
+    for (size_t i = 0; i < box->nb_children; i++) {
+        size += get_box_size(box->children[i]);
+    }
+    if (size > UINT32_MAX) size += 8;
+    return size;
+}
+
+static uint8_t* write_box(const MP4_BOX* box, uint8_t* dst) {
+    uint64_t size = get_box_size(box);
+    if (size > UINT32_MAX) {
+        wb32(dst, 1);
+        wb32(dst + 4, box->type);
+        wb64(dst + 8, size);
+        dst += 16;
+    } else {
+        wb32(dst, (uint32_t)size);
+        wb32(dst + 4, box->type);
+        dst += 8;
+    }
+    if (box->size) memcpy(dst, box->data, box->size);
+    dst += box->size;
+    for (size_t i = 0; i < box->nb_children; i++) {
+        dst = write_box(box->children[i], dst);
+    }
+    return dst;
+}
+
+/// Write a free box filled with zeros, so old metadata are not left in file.
+static void write_free_box(AVIOContext* pb, int64_t size) {
+    static const uint8_t zeros[4096] = { 0 };
+    uint8_t header[16];
+    int header_size = size > UINT32_MAX ? 16 : 8;
+    wb32(header, size > UINT32_MAX ? 1 : (uint32_t)size);
+    wb32(header + 4, BOX_FREE);
+    wb64(header + 8, (uint64_t)size);
+    avio_write(pb, header, header_size);
+    size -= header_size;
+    while (size > 0) {
+        int len = size > (int64_t)sizeof(zeros) ? (int)sizeof(zeros) : (int)size;
+        avio_write(pb, zeros, len);
+        size -= len;
+    }
+}
+
+ENM4A_ERROR enm4a_mp4_open(int* ret, const char* path, ENM4A_MP4** mp4) {
+    if (!ret || !path || !mp4) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVIOContext* pb = NULL;
+    ENM4A_MP4* m = NULL;
+    uint8_t* buf = NULL, header[16];
+    int64_t offset = 0, moov_size = 0, pos;
+    size_t moov_header = 8;
+    if (!(m = calloc(1, sizeof(ENM4A_MP4)))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    m->moov_offset = -1;
+    m->mdat_offset = -1;
+    if (!(m->path = malloc(strlen(path) + 1))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    memcpy(m->path, path, strlen(path) + 1);
+    if ((*ret = avio_open(&pb, path, AVIO_FLAG_READ)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((m->file_size = avio_size(pb)) < 0) {
+        *ret = (int)m->file_size;
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    while (m->file_size - offset >= 8) {
+        int64_t size;
+        size_t header_size = 8;
+        uint32_t type;
+        if ((pos = avio_seek(pb, offset, SEEK_SET)) < 0) {
+            *ret = (int)pos;
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if (avio_read(pb, header, 8) != 8) {
+            rev = ENM4A_INVALID_MP4;
+            goto end;
+        }
+        size = rb32(header);
+        type = rb32(header + 4);
+        if (size == 1) {
+            if (avio_read(pb, header + 8, 8) != 8) {
+                rev = ENM4A_INVALID_MP4;
+                goto end;
+            }
+            size = (int64_t)rb64(header + 8);
+            header_size = 16;
+        } else if (size == 0) {
+            size = m->file_size - offset;
+        }
+        if (size < (int64_t)header_size || size > m->file_size - offset) {
+            rev = ENM4A_INVALID_MP4;
+            goto end;
+        }
+        if (type == BOX_MOOF) {
+            av_log(NULL, AV_LOG_ERROR, "Fragmented mp4 file is not supported.\n");
+            rev = ENM4A_INVALID_MP4;
+            goto end;
+        }
+        if (type == BOX_MDAT && m->mdat_offset < 0) m->mdat_offset = offset;
+        if (type == BOX_MOOV) {
+            if (m->moov_offset >= 0) {
+                rev = ENM4A_INVALID_MP4;
+                goto end;
+            }
+            m->moov_offset = offset;
+            m->space = moov_size = size;
+            moov_header = header_size;
+        } else if ((type == BOX_FREE || type == BOX_SKIP) && m->moov_offset >= 0 && offset == m->moov_offset + m->space) {
+            m->space += size;
+        }
+        offset += size;
+    }
+    if (m->moov_offset < 0) {
+        av_log(NULL, AV_LOG_ERROR, "moov box is not found.\n");
+        rev = ENM4A_INVALID_MP4;
+        goto end;
+    }
+    if (moov_size - (int64_t)moov_header > MAX_MOOV_SIZE) {
+        rev = ENM4A_INVALID_MP4;
+        goto end;
+    }
+    moov_size -= moov_header;
+    if (!(buf = malloc(moov_size ? (size_t)moov_size : 1))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if ((pos = avio_seek(pb, m->moov_offset + moov_header, SEEK_SET)) < 0) {
+        *ret = (int)pos;
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (avio_read(pb, buf, (int)moov_size) != (int)moov_size) {
+        rev = ENM4A_INVALID_MP4;
+        goto end;
+    }
+    if (!(m->moov = add_box(NULL, BOX_MOOV, 1, NULL, 0, NULL))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if ((rev = parse_boxes(m->moov, buf, (size_t)moov_size)) != ENM4A_OK) {
+        goto end;
+    }
+    if (find_box(m->moov, BOX_MVEX)) {
+        av_log(NULL, AV_LOG_ERROR, "Fragmented mp4 file is not supported.\n");
+        rev = ENM4A_INVALID_MP4;
+        goto end;
+    }
+end:
+    if (pb) avio_closep(&pb);
+    if (buf) free(buf);
+    if (rev != ENM4A_OK) {
+        enm4a_mp4_free(&m);
+    } else {
+        *mp4 = m;
+    }
+    return rev;
+}
+
+/**
+ * @brief Get ilst box.
+ * @param create Create udta, meta and ilst boxes if not exists.
+ * @param ilst Result. NULL if not exists and create is 0.
+*/
+static ENM4A_ERROR get_ilst(ENM4A_MP4* mp4, char create, MP4_BOX** ilst) {
+    // Handler of iTunes metadata: version and flags, pre_defined, mdir, appl, reserved and empty name
+    static const uint8_t hdlr[25] = { 0, 0, 0, 0, 0, 0, 0, 0, 'm', 'd', 'i', 'r', 'a', 'p', 'p', 'l' };
+    static const uint8_t meta_header[4] = { 0 };
+    MP4_BOX* udta = find_box(mp4->moov, BOX_UDTA), * meta = find_box(udta, BOX_META);
+    *ilst = find_box(meta, BOX_ILST);
+    if (*ilst || !create) return ENM4A_OK;
+    if (!udta && !(udta = add_box(mp4->moov, BOX_UDTA, 1, NULL, 0, NULL))) return ENM4A_NO_MEMORY;
+    if (!meta) {
+        if (!(meta = add_box(udta, BOX_META, 1, meta_header, sizeof(meta_header), NULL))) return ENM4A_NO_MEMORY;
+        if (!add_box(meta, BOX_HDLR, 0, hdlr, sizeof(hdlr), NULL)) return ENM4A_NO_MEMORY;
+    }
+    if (!(*ilst = add_box(meta, BOX_ILST, 1, NULL, 0, NULL))) return ENM4A_NO_MEMORY;
+    return ENM4A_OK;
+}
+
+/// Compare payload of a full box with a string.
+static char full_box_equals(const MP4_BOX* box, const char* str, char ignore_case) {
+    size_t len = strlen(str);
+    if (!box || box->size != len + 4) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char a = (char)box->data[4 + i], b = str[i];
+        if (ignore_case) {
+            if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+            if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+        }
+        if (a != b) return 0;
+    }
+    return 1;
+}
+
+ENM4A_ERROR enm4a_mp4_set_freeform(ENM4A_MP4* mp4, const char* name, const char* value) {
+    if (!mp4 || !name) return ENM4A_NULL_POINTER;
+    static const uint8_t full_box_header[4] = { 0 };
+    ENM4A_ERROR re = ENM4A_OK;
+    MP4_BOX* ilst = NULL, * item = NULL;
+    if ((re = get_ilst(mp4, value != NULL, &ilst)) != ENM4A_OK) return re;
+    if (!ilst) return ENM4A_OK;
+    for (size_t i = ilst->nb_children; i > 0; i--) {
+        MP4_BOX* box = ilst->children[i - 1];
+        if (box->type == BOX_FREEFORM && full_box_equals(find_box(box, BOX_MEAN), ITUNES_MEAN, 0) && full_box_equals(find_box(box, BOX_NAME), name, 1)) {
+            remove_box(ilst, i - 1);
+        }
+    }
+    if (!value) return ENM4A_OK;
+    if (!(item = add_box(ilst, BOX_FREEFORM, 1, NULL, 0, NULL))) return ENM4A_NO_MEMORY;
+    if (!add_box(item, BOX_MEAN, 0, full_box_header, sizeof(full_box_header), ITUNES_MEAN)) return ENM4A_NO_MEMORY;
+    if (!add_box(item, BOX_NAME, 0, full_box_header, sizeof(full_box_header), name)) return ENM4A_NO_MEMORY;
+    if (!add_data_box(item, DATA_UTF8, (const uint8_t*)value, strlen(value))) return ENM4A_NO_MEMORY;
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Remove all items of type. If remove is 0, a empty item is created at the position of the first removed item.
+ * @param item New item. NULL if remove is set.
+*/
+static ENM4A_ERROR reset_item(ENM4A_MP4* mp4, uint32_t type, char remove, MP4_BOX** item) {
+    ENM4A_ERROR re = ENM4A_OK;
+    MP4_BOX* ilst = NULL;
+    size_t index;
+    *item = NULL;
+    if ((re = get_ilst(mp4, !remove, &ilst)) != ENM4A_OK) return re;
+    if (!ilst) return ENM4A_OK;
+    index = ilst->nb_children;
+    for (size_t i = ilst->nb_children; i > 0; i--) {
+        if (ilst->children[i - 1]->type == type) {
+            remove_box(ilst, i - 1);
+            index = i - 1;
+        }
+    }
+    if (remove) return ENM4A_OK;
+    if (!(*item = add_box(ilst, type, 1, NULL, 0, NULL))) return ENM4A_NO_MEMORY;
+    memmove(ilst->children + index + 1, ilst->children + index, sizeof(MP4_BOX*) * (ilst->nb_children - 1 - index));
+    ilst->children[index] = *item;
+    return ENM4A_OK;
+}
+
+static uint32_t item_type(const char* type) {
+    return BOX_TYPE((uint8_t)type[0], (uint8_t)type[1], (uint8_t)type[2], (uint8_t)type[3]);
+}
+
+ENM4A_ERROR enm4a_mp4_set_text(ENM4A_MP4* mp4, const char* type, const char* value) {
+    if (!mp4 || !type || strlen(type) != 4) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    MP4_BOX* item = NULL;
+    char remove = !value || !*value;
+    if ((re = reset_item(mp4, item_type(type), remove, &item)) != ENM4A_OK) return re;
+    if (!remove && !add_data_box(item, DATA_UTF8, (const uint8_t*)value, strlen(value))) return ENM4A_NO_MEMORY;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_mp4_set_number(ENM4A_MP4* mp4, const char* type, const char* value) {
+    if (!mp4 || !type || strlen(type) != 4) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    MP4_BOX* item = NULL;
+    char remove = !value || !*value, * end = NULL;
+    long number = 0, total = 0;
+    // Reserved, number, total and reserved (not present in disk).
+    uint8_t data[8] = { 0 };
+    if (!remove) {
+        number = strtol(value, &end, 10);
+        if (end == value || number < 0 || number > UINT16_MAX) return ENM4A_INVALID_TAG_VALUE;
+        if (*end == '/') {
+            const char* t = end + 1;
+            total = strtol(t, &end, 10);
+            if (end == t || total < 0 || total > UINT16_MAX) return ENM4A_INVALID_TAG_VALUE;
+        }
+        if (*end) return ENM4A_INVALID_TAG_VALUE;
+    }
+    if ((re = reset_item(mp4, item_type(type), remove, &item)) != ENM4A_OK) return re;
+    if (remove) return ENM4A_OK;
+    data[2] = (uint8_t)(number >> 8);
+    data[3] = (uint8_t)number;
+    data[4] = (uint8_t)(total >> 8);
+    data[5] = (uint8_t)total;
+    if (!add_data_box(item, DATA_IMPLICIT, data, item_type(type) == BOX_DISK ? 6 : 8)) return ENM4A_NO_MEMORY;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_mp4_set_cover(ENM4A_MP4* mp4, const uint8_t* data, size_t size) {
+    if (!mp4) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR re = ENM4A_OK;
+    MP4_BOX* item = NULL;
+    uint32_t type = DATA_JPEG;
+    if (data) {
+        if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+            type = DATA_JPEG;
+        } else if (size >= 8 && !memcmp(data, "\x89PNG\r\n\x1a\n", 8)) {
+            type = DATA_PNG;
+        } else {
+            return ENM4A_UNSUPPORTED_COVER;
+        }
+    }
+    if ((re = reset_item(mp4, BOX_COVR, !data, &item)) != ENM4A_OK) return re;
+    if (data && !add_data_box(item, type, data, size)) return ENM4A_NO_MEMORY;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_mp4_save(int* ret, ENM4A_MP4* mp4) {
+    if (!ret || !mp4) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVIOContext* pb = NULL;
+    AVDictionary* opts = NULL;
+    uint64_t size = get_box_size(mp4->moov);
+    int64_t offset = mp4->moov_offset, space, pos;
+    uint8_t* buf = NULL;
+    if (size > MAX_MOOV_SIZE) {
+        rev = ENM4A_INVALID_MP4;
+        goto end;
+    }
+    if (!(buf = malloc((size_t)size))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    write_box(mp4->moov, buf);
+    if ((*ret = av_dict_set(&opts, "truncate", "0", 0)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((*ret = avio_open2(&pb, mp4->path, AVIO_FLAG_WRITE, NULL, &opts)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((int64_t)size == mp4->space || (int64_t)size + 8 <= mp4->space) {
+        space = mp4->space;
+    } else if (mp4->moov_offset + mp4->space >= mp4->file_size) {
+        // moov box is the last box, just grow the file.
+        space = size + ENM4A_MP4_PADDING;
+    } else {
+        // Keep media data and chunk offsets untouched, move moov box to the end of file.
+        if ((pos = avio_seek(pb, mp4->moov_offset, SEEK_SET)) < 0) {
+            *ret = (int)pos;
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        write_free_box(pb, mp4->space);
+        offset = mp4->file_size;
+        space = size + ENM4A_MP4_PADDING;
+    }
+    if ((pos = avio_seek(pb, offset, SEEK_SET)) < 0) {
+        *ret = (int)pos;
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    avio_write(pb, buf, (int)size);
+    if (space > (int64_t)size) write_free_box(pb, space - size);
+    avio_flush(pb);
+    if (pb->error < 0) {
+        *ret = pb->error;
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    mp4->moov_offset = offset;
+    mp4->space = space;
+    if (offset + space > mp4->file_size) mp4->file_size = offset + space;
+end:
+    if (pb) {
+        int err = avio_closep(&pb);
+        if (err < 0 && rev == ENM4A_OK) {
+            *ret = err;
+            rev = ENM4A_FFMPEG_ERR;
+        }
+    }
+    if (opts) av_dict_free(&opts);
+    if (buf) free(buf);
+    return rev;
+}
+
+/**
+ * @brief Move chunk offsets in stco and co64 boxes under raw payload of trak box.
+ * @param apply 0 to only check that offsets are valid and do not overflow.
+*/
+static ENM4A_ERROR shift_chunk_offsets(uint8_t* buf, size_t size, const MP4_SHIFT* shift, char apply) {
+    ENM4A_ERROR re = ENM4A_OK;
+    size_t pos = 0;
+    while (size - pos >= 8) {
+        uint64_t box_size = rb32(buf + pos);
+        uint32_t type = rb32(buf + pos + 4);
+        size_t header = 8;
+        if (box_size == 1) {
+            if (size - pos < 16) return ENM4A_INVALID_MP4;
+            box_size = rb64(buf + pos + 8);
+            header = 16;
+        } else if (box_size == 0) {
+            box_size = size - pos;
+        }
+        if (box_size < header || box_size > size - pos) return ENM4A_INVALID_MP4;
+        uint8_t* payload = buf + pos + header;
+        size_t len = (size_t)box_size - header;
+        if (type == BOX_MDIA || type == BOX_MINF || type == BOX_STBL) {
+            if ((re = shift_chunk_offsets(payload, len, shift, apply)) != ENM4A_OK) return re;
+        } else if (type == BOX_STCO || type == BOX_CO64) {
+            size_t entry = type == BOX_STCO ? 4 : 8;
+            if (len < 8 || (len - 8) / entry < rb32(payload + 4)) return ENM4A_INVALID_MP4;
+            for (uint32_t i = 0, count = rb32(payload + 4); i < count; i++) {
+                uint8_t* p = payload + 8 + i * entry;
+                int64_t offset = entry == 4 ? (int64_t)rb32(p) : (int64_t)rb64(p);
+                for (int k = 0; k < 2; k++) {
+                    if (offset < shift->start[k] || offset >= shift->end[k]) continue;
+                    offset += shift->delta[k];
+                    if (entry == 4 && offset > UINT32_MAX) return ENM4A_INVALID_MP4;
+                    if (!apply) break;
+                    if (entry == 4) {
+                        wb32(p, (uint32_t)offset);
+                    } else {
+                        wb64(p, (uint64_t)offset);
+                    }
+                    break;
+                }
+            }
+        }
+        pos += (size_t)box_size;
+    }
+    return ENM4A_OK;
+}
+
+/// Move data in [start, end) of file forward by delta bytes. Data is copied from the end, so nothing is overwritten before it is read.
+static ENM4A_ERROR shift_data(int* ret, const char* path, AVIOContext* pb, int64_t start, int64_t end, int64_t delta) {
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVIOContext* in = NULL;
+    int64_t pos;
+    uint8_t* buf = NULL;
+    if (end <= start || delta <= 0) return ENM4A_OK;
+    if (!(buf = malloc(SHIFT_BUFFER_SIZE))) return ENM4A_NO_MEMORY;
+    if ((*ret = avio_open(&in, path, AVIO_FLAG_READ)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    while (end > start) {
+        int len = end - start > SHIFT_BUFFER_SIZE ? SHIFT_BUFFER_SIZE : (int)(end - start);
+        end -= len;
+        if ((pos = avio_seek(in, end, SEEK_SET)) < 0 || (pos = avio_seek(pb, end + delta, SEEK_SET)) < 0) {
+            *ret = (int)pos;
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if (avio_read(in, buf, len) != len) {
+            rev = ENM4A_INVALID_MP4;
+            goto end;
+        }
+        avio_write(pb, buf, len);
+        avio_flush(pb);
+        if (pb->error < 0) {
+            *ret = pb->error;
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+    }
+end:
+    if (in) avio_closep(&in);
+    free(buf);
+    return rev;
+}
+
+ENM4A_ERROR enm4a_mp4_save_faststart(int* ret, ENM4A_MP4* mp4) {
+    if (!ret || !mp4) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVIOContext* pb = NULL;
+    AVDictionary* opts = NULL;
+    uint64_t size = get_box_size(mp4->moov);
+    int64_t offset, space, pos;
+    uint8_t* buf = NULL;
+    MP4_SHIFT shift;
+    char fits = (int64_t)size == mp4->space || (int64_t)size + 8 <= mp4->space;
+    if (mp4->mdat_offset < 0 || (mp4->moov_offset < mp4->mdat_offset && fits)) {
+        return enm4a_mp4_save(ret, mp4);
+    }
+    if (size > MAX_MOOV_SIZE) return ENM4A_INVALID_MP4;
+    // New space is never smaller than old one, so file does not shrink and no data is moved backward.
+    offset = FFMIN(mp4->moov_offset, mp4->mdat_offset);
+    space = FFMAX((int64_t)size + ENM4A_MP4_PADDING, mp4->space);
+    // Boxes from the first mdat box to moov box, then boxes after old space.
+    shift.start[0] = offset;
+    shift.end[0] = mp4->moov_offset;
+    shift.delta[0] = space;
+    shift.start[1] = mp4->moov_offset + mp4->space;
+    shift.end[1] = mp4->file_size;
+    shift.delta[1] = space - mp4->space;
+    for (int apply = 0; apply < 2; apply++) {
+        for (size_t i = 0; i < mp4->moov->nb_children; i++) {
+            MP4_BOX* trak = mp4->moov->children[i];
+            if (trak->type == BOX_TRAK && (rev = shift_chunk_offsets(trak->data, trak->size, &shift, (char)apply)) != ENM4A_OK) {
+                av_log(NULL, AV_LOG_ERROR, "Can not move media data to place moov box before it.\n");
+                goto end;
+            }
+        }
+    }
+    if (!(buf = malloc((size_t)size))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    write_box(mp4->moov, buf);
+    if ((*ret = av_dict_set(&opts, "truncate", "0", 0)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if ((*ret = avio_open2(&pb, mp4->path, AVIO_FLAG_WRITE, NULL, &opts)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    // Later data is moved first, so it is not overwritten by earlier data.
+    if ((rev = shift_data(ret, mp4->path, pb, shift.start[1], shift.end[1], shift.delta[1])) != ENM4A_OK) goto end;
+    if ((rev = shift_data(ret, mp4->path, pb, shift.start[0], shift.end[0], shift.delta[0])) != ENM4A_OK) goto end;
+    if ((pos = avio_seek(pb, offset, SEEK_SET)) < 0) {
+        *ret = (int)pos;
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    avio_write(pb, buf, (int)size);
+    if (space > (int64_t)size) write_free_box(pb, space - size);
+    avio_flush(pb);
+    if (pb->error < 0) {
+        *ret = pb->error;
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    mp4->mdat_offset += mp4->mdat_offset < mp4->moov_offset ? shift.delta[0] : shift.delta[1];
+    mp4->file_size += shift.delta[1];
+    mp4->moov_offset = offset;
+    mp4->space = space;
+end:
+    if (pb) {
+        int err = avio_closep(&pb);
+        if (err < 0 && rev == ENM4A_OK) {
+            *ret = err;
+            rev = ENM4A_FFMPEG_ERR;
+        }
+    }
+    if (opts) av_dict_free(&opts);
+    if (buf) free(buf);
+    return rev;
+}
+
+void enm4a_mp4_free(ENM4A_MP4** mp4) {
+    if (!mp4 || !*mp4) return;
+    ENM4A_MP4* m = *mp4;
+    free_box(m->moov);
+    if (m->path) free(m->path);
+    free(m);
+    *mp4 = NULL;
+}
+
+ENM4A_ERROR retag_m4a(const char* path, ENM4A_ARGS args) {
+    if (!path) return ENM4A_NULL_POINTER;
+    ENM4A_ERROR rev = ENM4A_OK;
+    ENM4A_MP4* mp4 = NULL;
+    ENM4A_COVER cover;
+    int ret = 0;
+    memset(&cover, 0, sizeof(ENM4A_COVER));
+    if (args.cover && *args.cover && (rev = enm4a_load_cover(&ret, args.cover, &args, &cover)) != ENM4A_OK) {
+        goto end;
+    }
+    if ((rev = enm4a_mp4_open(&ret, path, &mp4)) != ENM4A_OK) {
+        goto end;
+    }
+    if (args.title && (rev = enm4a_mp4_set_text(mp4, "\xa9" "nam", args.title)) != ENM4A_OK) goto end;
+    if (args.artist && (rev = enm4a_mp4_set_text(mp4, "\xa9" "ART", args.artist)) != ENM4A_OK) goto end;
+    if (args.album && (rev = enm4a_mp4_set_text(mp4, "\xa9" "alb", args.album)) != ENM4A_OK) goto end;
+    if (args.album_artist && (rev = enm4a_mp4_set_text(mp4, "aART", args.album_artist)) != ENM4A_OK) goto end;
+    if (args.date && (rev = enm4a_mp4_set_text(mp4, "\xa9" "day", args.date)) != ENM4A_OK) goto end;
+    if (args.track && (rev = enm4a_mp4_set_number(mp4, "trkn", args.track)) != ENM4A_OK) goto end;
+    if (args.disc && (rev = enm4a_mp4_set_number(mp4, "disk", args.disc)) != ENM4A_OK) goto end;
+    if (args.cover && (rev = enm4a_mp4_set_cover(mp4, cover.buf ? cover.buf->data : NULL, cover.size)) != ENM4A_OK) goto end;
+    if ((rev = enm4a_mp4_save(&ret, mp4)) != ENM4A_OK) {
+        goto end;
+    }
+    if (args.level >= ENM4A_LOG_VERBOSE) {
+        printf("moov box is written at offset %" PRId64 ".\n", mp4->moov_offset);
+    }
+end:
+    enm4a_mp4_free(&mp4);
+    enm4a_free_cover(&cover);
+    if (ret < 0 && ret != AVERROR_EOF) {
+        char err[AV_ERROR_MAX_STRING_SIZE];
+        printf("Error occurred: %s\n", av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret));
+    }
+    return rev;
+}
@@ -0,0 +1,61 @@
+#ifndef _ENM4A_ENM4A_MP4_H
+#define _ENM4A_ENM4A_MP4_H
+#include "enm4a.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Padding appended after moov box when it is moved or grown, so later changes can be written in place.
+#define ENM4A_MP4_PADDING 2048
+
+/// Metadata of an existing mp4 file. Only moov box is loaded into memory.
+typedef struct ENM4A_MP4 ENM4A_MP4;
+
+/**
+ * @brief Load moov box of a mp4 file. Fragmented mp4 files are not supported.
+ * @param path File path
+ * @param mp4 Result. Should be freed by enm4a_mp4_free.
+*/
+ENM4A_ERROR enm4a_mp4_open(int* ret, const char* path, ENM4A_MP4** mp4);
+/**
+ * @brief Set a iTunes freeform tag (----:com.apple.iTunes:name).
+ * @param name Tag name. Case insensitive when matching existing tags.
+ * @param value UTF-8 value. NULL to remove the tag.
+*/
+ENM4A_ERROR enm4a_mp4_set_freeform(ENM4A_MP4* mp4, const char* name, const char* value);
+/**
+ * @brief Set a text tag, such as "\xa9" "nam" (title) and "aART" (album artist).
+ * @param type Type of item. Should be 4 bytes.
+ * @param value UTF-8 value. NULL or empty string to remove the tag.
+*/
+ENM4A_ERROR enm4a_mp4_set_text(ENM4A_MP4* mp4, const char* type, const char* value);
+/**
+ * @brief Set track number ("trkn") or disc number ("disk").
+ * @param value Number and optional total, such as "3" or "3/12". NULL or empty string to remove the tag.
+*/
+ENM4A_ERROR enm4a_mp4_set_number(ENM4A_MP4* mp4, const char* type, const char* value);
+/**
+ * @brief Replace cover images.
+ * @param data JPEG or PNG data. NULL to remove covers.
+*/
+ENM4A_ERROR enm4a_mp4_set_cover(ENM4A_MP4* mp4, const uint8_t* data, size_t size);
+/**
+ * @brief Write modified moov box back to file.
+ * moov box is written in place if it fits in the space of old moov box and following free box.
+ * Otherwise it is moved to the end of file and old space becomes a free box. Media data is never moved.
+*/
+ENM4A_ERROR enm4a_mp4_save(int* ret, ENM4A_MP4* mp4);
+/**
+ * @brief Write modified moov box back to file and keep it before media data.
+ * Same as enm4a_mp4_save if moov box is before media data and fits in its space. Otherwise moov box is placed
+ * before the first mdat box, boxes after it are moved and chunk offsets are updated, so the whole file is rewritten
+ * in place like faststart of FFmpeg. Used after converting, never used to retag existing files.
+*/
+ENM4A_ERROR enm4a_mp4_save_faststart(int* ret, ENM4A_MP4* mp4);
+void enm4a_mp4_free(ENM4A_MP4** mp4);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,241 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_pipeline.h"
+#include "enm4a_queue.h"
+#include "enm4a_thread.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+typedef struct PIPELINE_STATE {
+    ENM4A_PIPELINE* p;
+    /// Packets read by demuxer
+    ENM4A_QUEUE* packets;
+    /// Unused packets
+    ENM4A_QUEUE* free_packets;
+    /// Frames with the frame size of encoder
+    ENM4A_QUEUE* frames;
+    /// Unused frames
+    ENM4A_QUEUE* free_frames;
+    AVPacket* packet_pool[ENM4A_PIPELINE_PACKETS];
+    AVFrame* frame_pool[ENM4A_PIPELINE_FRAMES];
+    ENM4A_ERROR demux_err;
+    int demux_ret;
+    ENM4A_ERROR decode_err;
+    int decode_ret;
+    int64_t decode_allocations;
+} PIPELINE_STATE;
+
+static void abort_pipeline(PIPELINE_STATE* s) {
+    enm4a_queue_abort(s->packets);
+    enm4a_queue_abort(s->free_packets);
+    enm4a_queue_abort(s->frames);
+    enm4a_queue_abort(s->free_frames);
+}
+
+static void* demux_thread(void* arg) {
+    PIPELINE_STATE* s = (PIPELINE_STATE*)arg;
+    ENM4A_PIPELINE* p = s->p;
+    AVPacket* pkt = NULL;
+    while (1) {
+        if (enm4a_queue_pop(s->free_packets, (void**)&pkt) != ENM4A_QUEUE_OK) break;
+        int64_t start = stage_start(p->progress);
+        s->demux_ret = av_read_frame(p->ic, pkt);
+        stage_end(p->progress, ENM4A_STAGE_DEMUX, start);
+        if (s->demux_ret >= 0) mark_first_packet(p->progress);
+        if (s->demux_ret < 0) {
+            if (s->demux_ret == AVERROR_EOF) {
+                s->demux_ret = 0;
+                enm4a_queue_close(s->packets);
+            } else {
+                s->demux_err = ENM4A_FFMPEG_ERR;
+                abort_pipeline(s);
+            }
+            break;
+        }
+        if (pkt->stream_index != p->audio_stream_index) {
+            av_packet_unref(pkt);
+            enm4a_queue_push(s->free_packets, pkt);
+            continue;
+        }
+        if (trim_packet_after_end(p->trim, pkt)) {
+            // Rest of input is not needed.
+            av_packet_unref(pkt);
+            enm4a_queue_push(s->free_packets, pkt);
+            enm4a_queue_close(s->packets);
+            break;
+        }
+        if (log_packet_enabled(p->level)) {
+            log_packet(p->ic, pkt, "in");
+        }
+        if (enm4a_queue_push(s->packets, pkt) != ENM4A_QUEUE_OK) break;
+    }
+    return NULL;
+}
+
+/// Cut samples in FIFO into frames and send them to encode thread.
+static ENM4A_ERROR send_fifo_frames(PIPELINE_STATE* s, char flush) {
+    ENM4A_PIPELINE* p = s->p;
+    AVFrame* frame = NULL;
+    while (av_audio_fifo_size(p->afifo) >= p->audio_output->frame_size || (flush && av_audio_fifo_size(p->afifo) > 0)) {
+        if (enm4a_queue_pop(s->free_frames, (void**)&frame) != ENM4A_QUEUE_OK) return ENM4A_OK;
+        frame->nb_samples = FFMIN(av_audio_fifo_size(p->afifo), p->audio_output->frame_size);
+        if (!av_frame_is_writable(frame)) {
+            // Encoder still holds a reference of the buffer.
+            if ((s->decode_ret = av_frame_make_writable(frame)) < 0) {
+                return ENM4A_NO_MEMORY;
+            }
+            s->decode_allocations++;
+        }
+        if ((s->decode_ret = av_audio_fifo_read(p->afifo, (void**)frame->data, frame->nb_samples)) < 0) {
+            return ENM4A_NO_MEMORY;
+        }
+        if (enm4a_queue_push(s->frames, frame) != ENM4A_QUEUE_OK) return ENM4A_OK;
+    }
+    return ENM4A_OK;
+}
+
+static void* decode_thread(void* arg) {
+    PIPELINE_STATE* s = (PIPELINE_STATE*)arg;
+    ENM4A_PIPELINE* p = s->p;
+    AVPacket* pkt = NULL;
+    ENM4A_QUEUE_STATUS status;
+    while (1) {
+        status = enm4a_queue_pop(s->packets, (void**)&pkt);
+        if (status == ENM4A_QUEUE_ABORTED) break;
+        char flush = status == ENM4A_QUEUE_CLOSED;
+        s->decode_err = decode_audio_packet(&s->decode_ret, p->audio_input, flush ? NULL : pkt, p->audio_input_frame, p->audio_output, p->resample_context, p->afifo, p->convert_buffer, &s->decode_allocations, p->meter, p->fingerprint, p->trim, p->progress);
+        if (!flush) {
+            av_packet_unref(pkt);
+            enm4a_queue_push(s->free_packets, pkt);
+        }
+        if (s->decode_err == ENM4A_OK) {
+            s->decode_err = send_fifo_frames(s, flush);
+        }
+        if (s->decode_err != ENM4A_OK) {
+            abort_pipeline(s);
+            break;
+        }
+        if (flush) {
+            enm4a_queue_close(s->frames);
+            break;
+        }
+    }
+    return NULL;
+}
+
+ENM4A_ERROR enm4a_run_pipeline(int* ret, ENM4A_PIPELINE* p) {
+    if (!ret || !p) return ENM4A_NULL_POINTER;
+    PIPELINE_STATE s;
+    ENM4A_THREAD demux, decode;
+    char demux_started = 0, decode_started = 0, write_data = 0;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVFrame* frame = NULL;
+    ENM4A_QUEUE_STATUS status;
+    AVStream* os = p->oc->streams[p->audio_dest_index];
+    memset(&s, 0, sizeof(PIPELINE_STATE));
+    s.p = p;
+    if (!(s.packets = enm4a_queue_alloc(ENM4A_PIPELINE_PACKETS)) || !(s.free_packets = enm4a_queue_alloc(ENM4A_PIPELINE_PACKETS))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if (!(s.frames = enm4a_queue_alloc(ENM4A_PIPELINE_FRAMES)) || !(s.free_frames = enm4a_queue_alloc(ENM4A_PIPELINE_FRAMES))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    for (int i = 0; i < ENM4A_PIPELINE_PACKETS; i++) {
+        if (!(s.packet_pool[i] = av_packet_alloc())) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        enm4a_queue_push(s.free_packets, s.packet_pool[i]);
+    }
+    for (int i = 0; i < ENM4A_PIPELINE_FRAMES; i++) {
+        AVFrame* f = NULL;
+        if (!(f = s.frame_pool[i] = av_frame_alloc())) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+#if NEW_CHANNEL_LAYOUT
+        if ((*ret = av_channel_layout_copy(&f->ch_layout, &p->audio_output->ch_layout)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+        DISABLE_DEPRECATION_WARNINGS
+        f->channel_layout = p->audio_output->channel_layout;
+        ENABLE_DEPRECATION_WARNINGS
+#endif
+        f->format = p->audio_output->sample_fmt;
+        f->sample_rate = p->audio_output->sample_rate;
+        f->nb_samples = p->audio_output->frame_size;
+        if ((*ret = av_frame_get_buffer(f, 0)) < 0) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        enm4a_queue_push(s.free_frames, f);
+    }
+    *(p->allocations) += ENM4A_PIPELINE_PACKETS + ENM4A_PIPELINE_FRAMES;
+    if (enm4a_thread_create(&demux, demux_thread, &s)) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    demux_started = 1;
+    if (enm4a_thread_create(&decode, decode_thread, &s)) {
+        rev = ENM4A_NO_MEMORY;
+        abort_pipeline(&s);
+        goto end;
+    }
+    decode_started = 1;
+    while (1) {
+        status = enm4a_queue_pop(s.frames, (void**)&frame);
+        if (status == ENM4A_QUEUE_ABORTED) break;
+        if (status == ENM4A_QUEUE_CLOSED) {
+            while (1) {
+                if ((rev = encode_audio_frame(ret, NULL, p->oc, p->audio_output, p->audio_output_pkt, &write_data, NULL, p->level, p->audio_dest_index, p->progress)) != ENM4A_OK) {
+                    abort_pipeline(&s);
+                    break;
+                }
+                if (!write_data) break;
+            }
+            break;
+        }
+        rev = encode_audio_frame(ret, frame, p->oc, p->audio_output, p->audio_output_pkt, &write_data, p->audio_pts, p->level, p->audio_dest_index, p->progress);
+        enm4a_queue_push(s.free_frames, frame);
+        if (rev != ENM4A_OK) {
+            abort_pipeline(&s);
+            break;
+        }
+        update_progress(p->progress, p->oc, *(p->audio_pts), os->time_base);
+    }
+end:
+    if (demux_started) enm4a_thread_join(&demux);
+    if (decode_started) enm4a_thread_join(&decode);
+    *(p->allocations) += s.decode_allocations;
+    if (rev == ENM4A_OK && s.demux_err != ENM4A_OK) {
+        rev = s.demux_err;
+        *ret = s.demux_ret;
+    }
+    if (rev == ENM4A_OK && s.decode_err != ENM4A_OK) {
+        rev = s.decode_err;
+        *ret = s.decode_ret;
+    }
+    for (int i = 0; i < ENM4A_PIPELINE_PACKETS; i++) {
+        if (s.packet_pool[i]) av_packet_free(&s.packet_pool[i]);
+    }
+    for (int i = 0; i < ENM4A_PIPELINE_FRAMES; i++) {
+        if (s.frame_pool[i]) av_frame_free(&s.frame_pool[i]);
+    }
+    enm4a_queue_free(&s.packets);
+    enm4a_queue_free(&s.free_packets);
+    enm4a_queue_free(&s.frames);
+    enm4a_queue_free(&s.free_frames);
+    return rev;
+}
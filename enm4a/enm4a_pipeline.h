@@ -0,0 +1,51 @@
+#ifndef _ENM4A_ENM4A_PIPELINE_H
+#define _ENM4A_ENM4A_PIPELINE_H
+#include "enm4a_internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Packets queued between demux and decode threads
+#define ENM4A_PIPELINE_PACKETS 64
+/// Frames queued between decode and encode threads
+#define ENM4A_PIPELINE_FRAMES 32
+
+/// Contexts used by pipeline. All contexts should be opened and output header should be written.
+typedef struct ENM4A_PIPELINE {
+    AVFormatContext* ic;
+    unsigned int audio_stream_index;
+    AVCodecContext* audio_input;
+    AVFrame* audio_input_frame;
+    /// Measures decoded frames if not NULL
+    ENM4A_LOUDNESS* meter;
+    /// Fingerprints decoded frames if not NULL
+    ENM4A_FINGERPRINT* fingerprint;
+    SwrContext* resample_context;
+    AVAudioFifo* afifo;
+    ENM4A_CONVERT_BUFFER* convert_buffer;
+    AVFormatContext* oc;
+    AVCodecContext* audio_output;
+    AVPacket* audio_output_pkt;
+    unsigned int audio_dest_index;
+    /// Next pts of encoder
+    int64_t* audio_pts;
+    int64_t* allocations;
+    ENM4A_LOG level;
+    /// May be NULL
+    ENM4A_PROGRESS_SINK* progress;
+    /// Range of input to convert. May be NULL.
+    ENM4A_TRIM* trim;
+} ENM4A_PIPELINE;
+
+/**
+ * @brief Read all audio packets from input and write encoded packets to output.
+ * Demuxing, decoding and resampling run in their own threads. Encoding and muxing run in current thread.
+ * Stages are connected by bounded queues, so a slow stage blocks the stages before it.
+ * @param ret FFmpeg error code
+*/
+ENM4A_ERROR enm4a_run_pipeline(int* ret, ENM4A_PIPELINE* p);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_plan.h"
+#include "enm4a_cover.h"
+#include "enm4a_internal.h"
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+// Rough costs of FFmpeg components on a desktop x86-64 core.
+/// Demuxing and muxing per byte of input
+#define PLAN_IO_NS_PER_BYTE 1.0
+/// Decoding per sample of every channel
+#define PLAN_DECODE_NS_PER_SAMPLE 25.0
+/// Resampling per output sample of every channel
+#define PLAN_RESAMPLE_NS_PER_SAMPLE 15.0
+/// AAC encoding per sample of every channel
+#define PLAN_ENCODE_NS_PER_SAMPLE 120.0
+/// Samples per AAC packet
+#define PLAN_AAC_FRAME_SIZE 1024
+/// Sample table entries of a packet in moov box
+#define PLAN_INDEX_BYTES_PER_PACKET 8
+/// ftyp, moov headers and tags
+#define PLAN_HEADER_BYTES 4096
+
+/// Estimate output size of a stream with bitrate. -1 if unknown.
+static int64_t estimate_output_size(int64_t bitrate, int sample_rate, int64_t duration, int64_t cover_size) {
+    if (duration < 0 || bitrate <= 0 || sample_rate <= 0) return -1;
+    int64_t packets = av_rescale(duration, sample_rate, (int64_t)AV_TIME_BASE * PLAN_AAC_FRAME_SIZE) + 1;
+    return av_rescale(bitrate, duration, (int64_t)AV_TIME_BASE * 8) + packets * PLAN_INDEX_BYTES_PER_PACKET + PLAN_HEADER_BYTES + cover_size;
+}
+
+/// Samples of every channel in duration
+static double samples_of(int64_t duration, int sample_rate, int channels) {
+    return (double)duration / AV_TIME_BASE * sample_rate * channels;
+}
+
+ENM4A_ERROR enm4a_plan(const char* input, ENM4A_ARGS args, ENM4A_PLAN* plan) {
+    if (!input || !plan) return ENM4A_NULL_POINTER;
+    if (args.output_count && !args.outputs) return ENM4A_NULL_POINTER;
+    int ret = 0;
+    ENM4A_ERROR rev = ENM4A_OK;
+    ENM4A_INPUT in;
+    AVFormatContext* ic = NULL, * oc = NULL;
+    ENM4A_COVER cover;
+    AVStream* is = NULL;
+    AVCodecContext* audio_input = NULL;
+    AVCodecContext** audio_outputs = NULL;
+    int64_t input_duration = -1, cover_size = 0;
+    double cpu_time = 0;
+    memset(&in, 0, sizeof(ENM4A_INPUT));
+    memset(&cover, 0, sizeof(ENM4A_COVER));
+    memset(plan, 0, sizeof(ENM4A_PLAN));
+    plan->duration = plan->input_size = plan->output_size = -1;
+    plan->cpu_time = -1;
+    plan->output_count = args.output_count + 1;
+    if ((rev = check_conversion_args(&args)) != ENM4A_OK) {
+        goto end;
+    }
+    if ((rev = open_input(&ret, input, NULL, &args, &in)) != ENM4A_OK) {
+        goto end;
+    }
+    ic = in.ic;
+    if (!args.quiet) av_dump_format(ic, 0, input, 0);
+    // Same order as encode_m4a: AAC stream is copied unless there are extra outputs.
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        AVStream* s = ic->streams[i];
+        if (!is && s->codecpar->codec_id == AV_CODEC_ID_AAC && !args.output_count) {
+            is = s;
+            plan->mode = ENM4A_PLAN_COPY;
+        } else if (s->codecpar->codec_id == AV_CODEC_ID_MJPEG && s->attached_pic.size && !cover_size) {
+            cover_size = s->attached_pic.size;
+        }
+    }
+    if (!is) {
+        for (unsigned int i = 0; i < ic->nb_streams; i++) {
+            if (ic->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+                is = ic->streams[i];
+                plan->mode = ENM4A_PLAN_ENCODE;
+                break;
+            }
+        }
+    }
+    if (!is) {
+        rev = ENM4A_NO_AUDIO;
+        goto end;
+    }
+    if (args.cover && strlen(args.cover)) {
+        // Loaded in the same way as conversion, so resized covers are counted and kept in cover_cache for it.
+        if ((rev = enm4a_load_cover(&ret, args.cover, &args, &cover)) != ENM4A_OK) {
+            goto end;
+        }
+        cover_size = cover.size;
+    }
+    plan->stream_index = is->index;
+    av_strlcpy(plan->codec, avcodec_get_name(is->codecpar->codec_id), sizeof(plan->codec));
+    plan->input_sample_rate = is->codecpar->sample_rate;
+    plan->channels = GET_AV_CODEC_CHANNELS(is->codecpar);
+    if (ic->pb) plan->input_size = FFMAX(avio_size(ic->pb), -1);
+    if (ic->duration != AV_NOPTS_VALUE && ic->duration > 0) {
+        input_duration = ic->duration;
+    } else if (is->duration != AV_NOPTS_VALUE && is->duration > 0) {
+        input_duration = av_rescale_q(is->duration, is->time_base, AV_TIME_BASE_Q);
+    }
+    plan->duration = input_duration;
+    if (plan->duration >= 0 && args.start_time > 0) plan->duration = FFMAX(plan->duration - args.start_time, 0);
+    if (args.duration > 0) plan->duration = plan->duration >= 0 ? FFMIN(plan->duration, args.duration) : args.duration;
+    if (plan->input_size > 0 && input_duration > 0 && plan->duration >= 0) {
+        // Input after the end of trim range is not read.
+        cpu_time += PLAN_IO_NS_PER_BYTE * av_rescale(plan->input_size, plan->duration, input_duration);
+    }
+    if (plan->mode == ENM4A_PLAN_COPY) {
+        plan->sample_rate = plan->input_sample_rate;
+        plan->bitrate = is->codecpar->bit_rate;
+        if (plan->bitrate <= 0 && plan->input_size > 0 && input_duration > 0) {
+            plan->bitrate = av_rescale(plan->input_size, (int64_t)AV_TIME_BASE * 8, input_duration);
+        }
+        plan->output_size = estimate_output_size(plan->bitrate, plan->sample_rate, plan->duration, cover_size);
+        // Copied stream is only decoded for loudness measurement and fingerprint.
+        if ((args.loudness || args.fingerprint) && plan->duration >= 0) {
+            cpu_time += PLAN_DECODE_NS_PER_SAMPLE * samples_of(plan->duration, plan->input_sample_rate, plan->channels);
+        }
+    } else {
+        // Encoders are opened with the same arguments as conversion, so chosen sample rate and bitrate are exact.
+        if ((ret = avformat_alloc_output_context2(&oc, NULL, "ipod", NULL)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if (!(audio_outputs = calloc(plan->output_count, sizeof(AVCodecContext*)))) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        if ((rev = open_audio_decoder(&ret, is, &args, &audio_input)) != ENM4A_OK) {
+            goto end;
+        }
+        if (plan->duration >= 0) {
+            cpu_time += PLAN_DECODE_NS_PER_SAMPLE * samples_of(plan->duration, plan->input_sample_rate, plan->channels);
+        }
+        plan->output_size = 0;
+        for (size_t i = 0; i < plan->output_count; i++) {
+            AVStream* os = NULL;
+            int sample_rate = args.sample_rate ? *(args.sample_rate) : 0;
+            int64_t bitrate = args.bitrate, size;
+            if (i) {
+                const ENM4A_OUTPUT* o = &args.outputs[i - 1];
+                sample_rate = o->sample_rate ? o->sample_rate : audio_outputs[0]->sample_rate;
+                if (o->bitrate > 0) bitrate = o->bitrate;
+            }
+            if (!(os = avformat_new_stream(oc, NULL))) {
+                rev = ENM4A_NO_MEMORY;
+                goto end;
+            }
+            if ((rev = open_audio_encoder(&ret, audio_input, oc, os, sample_rate, bitrate, &args, &audio_outputs[i])) != ENM4A_OK) {
+                goto end;
+            }
+            AVCodecContext* enc = audio_outputs[i];
+            double samples = plan->duration >= 0 ? samples_of(plan->duration, enc->sample_rate, GET_AV_CODEC_CHANNELS(enc)) : 0;
+            if (need_resample(audio_input, enc)) {
+                cpu_time += PLAN_RESAMPLE_NS_PER_SAMPLE * samples;
+                if (!i) plan->resample = 1;
+            }
+            cpu_time += PLAN_ENCODE_NS_PER_SAMPLE * samples;
+            size = estimate_output_size(enc->bit_rate, enc->sample_rate, plan->duration, cover_size);
+            if (!i) {
+                av_strlcpy(plan->encoder, enc->codec->name, sizeof(plan->encoder));
+                plan->sample_rate = enc->sample_rate;
+                plan->bitrate = enc->bit_rate;
+            }
+            if (size < 0 || plan->output_size < 0) {
+                plan->output_size = -1;
+            } else {
+                plan->output_size += size;
+            }
+        }
+    }
+    if (plan->duration >= 0) plan->cpu_time = cpu_time / 1000000000.0;
+    if (args.level >= ENM4A_LOG_VERBOSE) {
+        printf("Plan: %s stream %u (%s), %d Hz, %" PRId64 " bps, estimated %" PRId64 " bytes, %.3f CPU seconds\n", plan->mode == ENM4A_PLAN_COPY ? "copy" : "encode", plan->stream_index, plan->codec, plan->sample_rate, plan->bitrate, plan->output_size, plan->cpu_time);
+    }
+end:
+    if (audio_outputs) {
+        for (size_t i = 0; i < plan->output_count; i++) {
+            if (audio_outputs[i]) avcodec_free_context(&audio_outputs[i]);
+        }
+        free(audio_outputs);
+    }
+    if (audio_input) avcodec_free_context(&audio_input);
+    if (oc) avformat_free_context(oc);
+    close_input(&in);
+    enm4a_free_cover(&cover);
+    if (ret < 0 && ret != AVERROR_EOF) {
+        char err[AV_ERROR_MAX_STRING_SIZE];
+        printf("Error occurred: %s\n", av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret));
+    }
+    return rev;
+}
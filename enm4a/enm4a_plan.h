@@ -0,0 +1,58 @@
+#ifndef _ENM4A_ENM4A_PLAN_H
+#define _ENM4A_ENM4A_PLAN_H
+#include "enm4a.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+typedef enum ENM4A_PLAN_MODE {
+    /// AAC stream is copied without decoding
+    ENM4A_PLAN_COPY,
+    /// Audio is decoded and encoded
+    ENM4A_PLAN_ENCODE,
+} ENM4A_PLAN_MODE;
+
+/// How a conversion would be done, and its estimated cost
+typedef struct ENM4A_PLAN {
+    ENM4A_PLAN_MODE mode;
+    /// Index of selected audio stream in input
+    unsigned int stream_index;
+    /// Codec name of selected audio stream
+    char codec[32];
+    /// Encoder name. Empty if stream is copied.
+    char encoder[32];
+    int input_sample_rate;
+    int channels;
+    /// Sample rate of main output
+    int sample_rate;
+    /// Bitrate of main output in bits per second. Bitrate of input stream if copied. 0 if unknown.
+    int64_t bitrate;
+    /// 1 if decoded samples of main output are resampled before encoding
+    char resample;
+    /// Number of outputs, including main output
+    size_t output_count;
+    /// Duration to convert in AV_TIME_BASE. -1 if unknown.
+    int64_t duration;
+    /// Size of input in bytes. -1 if unknown.
+    int64_t input_size;
+    /// Estimated bytes written to all outputs. -1 if unknown.
+    int64_t output_size;
+    /// Estimated CPU time of conversion in seconds. -1 if unknown.
+    double cpu_time;
+} ENM4A_PLAN;
+
+/**
+ * @brief Probe input and decide how encode_m4a would convert it, without writing anything.
+ * Stream selection, sample rate and bitrate are decided by the same code as conversion.
+ * Output size and CPU time are rough estimates for scheduling.
+ * Input is opened and cover is loaded in the same way as conversion.
+ * output, overwrite, pipeline, segment_threads, faststart and tags of args are ignored.
+ * @param plan Result
+*/
+ENM4A_ERROR enm4a_plan(const char* input, ENM4A_ARGS args, ENM4A_PLAN* plan);
+#ifdef __cplusplus
+}
+#endif
+#endif
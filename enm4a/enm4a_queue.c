@@ -0,0 +1,114 @@
+#include "enm4a_queue.h"
+#include "enm4a_thread.h"
+
+#include <malloc.h>
+#include <string.h>
+
+struct ENM4A_QUEUE {
+    void** items;
+    size_t capacity;
+    size_t head;
+    size_t size;
+    char closed;
+    char aborted;
+    ENM4A_MUTEX lock;
+    ENM4A_COND not_empty;
+    ENM4A_COND not_full;
+};
+
+ENM4A_QUEUE* enm4a_queue_alloc(size_t capacity) {
+    if (!capacity) return NULL;
+    ENM4A_QUEUE* q = malloc(sizeof(ENM4A_QUEUE));
+    if (!q) return NULL;
+    memset(q, 0, sizeof(ENM4A_QUEUE));
+    if (!(q->items = malloc(sizeof(void*) * capacity))) {
+        free(q);
+        return NULL;
+    }
+    q->capacity = capacity;
+    if (enm4a_mutex_init(&q->lock)) {
+        free(q->items);
+        free(q);
+        return NULL;
+    }
+    if (enm4a_cond_init(&q->not_empty)) {
+        enm4a_mutex_destroy(&q->lock);
+        free(q->items);
+        free(q);
+        return NULL;
+    }
+    if (enm4a_cond_init(&q->not_full)) {
+        enm4a_cond_destroy(&q->not_empty);
+        enm4a_mutex_destroy(&q->lock);
+        free(q->items);
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void enm4a_queue_free(ENM4A_QUEUE** q) {
+    if (!q || !*q) return;
+    enm4a_cond_destroy(&(*q)->not_full);
+    enm4a_cond_destroy(&(*q)->not_empty);
+    enm4a_mutex_destroy(&(*q)->lock);
+    free((*q)->items);
+    free(*q);
+    *q = NULL;
+}
+
+ENM4A_QUEUE_STATUS enm4a_queue_push(ENM4A_QUEUE* q, void* item) {
+    if (!q) return ENM4A_QUEUE_ABORTED;
+    enm4a_mutex_lock(&q->lock);
+    while (q->size == q->capacity && !q->aborted) {
+        enm4a_cond_wait(&q->not_full, &q->lock);
+    }
+    if (q->aborted) {
+        enm4a_mutex_unlock(&q->lock);
+        return ENM4A_QUEUE_ABORTED;
+    }
+    q->items[(q->head + q->size) % q->capacity] = item;
+    q->size++;
+    enm4a_cond_signal(&q->not_empty);
+    enm4a_mutex_unlock(&q->lock);
+    return ENM4A_QUEUE_OK;
+}
+
+ENM4A_QUEUE_STATUS enm4a_queue_pop(ENM4A_QUEUE* q, void** item) {
+    if (!q || !item) return ENM4A_QUEUE_ABORTED;
+    enm4a_mutex_lock(&q->lock);
+    while (!q->size && !q->closed && !q->aborted) {
+        enm4a_cond_wait(&q->not_empty, &q->lock);
+    }
+    if (q->aborted) {
+        enm4a_mutex_unlock(&q->lock);
+        return ENM4A_QUEUE_ABORTED;
+    }
+    if (!q->size) {
+        enm4a_mutex_unlock(&q->lock);
+        return ENM4A_QUEUE_CLOSED;
+    }
+    *item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->size--;
+    enm4a_cond_signal(&q->not_full);
+    enm4a_mutex_unlock(&q->lock);
+    return ENM4A_QUEUE_OK;
+}
+
+void enm4a_queue_close(ENM4A_QUEUE* q) {
+    if (!q) return;
+    enm4a_mutex_lock(&q->lock);
+    q->closed = 1;
+    enm4a_cond_broadcast(&q->not_empty);
+    enm4a_mutex_unlock(&q->lock);
+}
+
+void enm4a_queue_abort(ENM4A_QUEUE* q) {
+    if (!q) return;
+    enm4a_mutex_lock(&q->lock);
+    q->aborted = 1;
+    enm4a_cond_broadcast(&q->not_empty);
+    enm4a_cond_broadcast(&q->not_full);
+    enm4a_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,39 @@
+#ifndef _ENM4A_ENM4A_QUEUE_H
+#define _ENM4A_ENM4A_QUEUE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+
+typedef enum ENM4A_QUEUE_STATUS {
+    ENM4A_QUEUE_OK,
+    /// Queue is closed and all items are popped. Only returned by enm4a_queue_pop.
+    ENM4A_QUEUE_CLOSED,
+    ENM4A_QUEUE_ABORTED,
+} ENM4A_QUEUE_STATUS;
+
+/// A bounded blocking queue which is used to pass items between threads.
+typedef struct ENM4A_QUEUE ENM4A_QUEUE;
+
+ENM4A_QUEUE* enm4a_queue_alloc(size_t capacity);
+void enm4a_queue_free(ENM4A_QUEUE** q);
+/**
+ * @brief Add a item to the end of queue. Wait if queue is full.
+ * @return ENM4A_QUEUE_OK if successed. ENM4A_QUEUE_ABORTED if queue is aborted.
+*/
+ENM4A_QUEUE_STATUS enm4a_queue_push(ENM4A_QUEUE* q, void* item);
+/**
+ * @brief Remove a item from the front of queue. Wait if queue is empty.
+ * @param item The popped item. Not set if failed.
+*/
+ENM4A_QUEUE_STATUS enm4a_queue_pop(ENM4A_QUEUE* q, void** item);
+/// Mark that no more items will be pushed. Items already in queue still can be popped.
+void enm4a_queue_close(ENM4A_QUEUE* q);
+/// Wake up all waiting threads and let all future operations fail.
+void enm4a_queue_abort(ENM4A_QUEUE* q);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,475 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_readahead.h"
+#include "enm4a_io.h"
+#include "enm4a_thread.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+
+#if _WIN32
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+/// Maximum bytes requested from connection at once
+#define READ_CHUNK_SIZE 65536
+/// Buffer used to discard data when server ignores Range request
+#define SKIP_BUFFER_SIZE 4096
+/// Gaps between needed byte ranges smaller than this are fetched, because reading them is cheaper than a new request.
+#define MIN_SKIP_GAP (256 * 1024)
+
+#if LIBAVFORMAT_VERSION_MAJOR > 58 || (LIBAVFORMAT_VERSION_MAJOR == 58 && LIBAVFORMAT_VERSION_MINOR >= 78)
+#define HAVE_INDEX_ENTRY_API 1
+#endif
+
+/// Bytes from start to end (exclusive)
+typedef struct READAHEAD_RANGE {
+    int64_t start;
+    int64_t end;
+} READAHEAD_RANGE;
+
+typedef struct ENM4A_READAHEAD {
+    char* url;
+    AVDictionary* options;
+    /// Only used by fetch thread after it started
+    AVIOContext* src;
+    /// Generation of src. Connection is reopened if it is not equal to gen.
+    unsigned int src_gen;
+    uint8_t* ring;
+    size_t capacity;
+    /// Index of the first unread byte in ring
+    size_t head;
+    /// Bytes which are received but not read
+    size_t count;
+    /// Stream position of the first unread byte
+    int64_t read_pos;
+    /// Total size. -1 if unknown.
+    int64_t size;
+    /// Increased when buffered data is dropped by seeking
+    unsigned int gen;
+    /// Sorted byte ranges which are prefetched. Other bytes are only fetched when reader waits for them.
+    /// Bytes after the last range are always prefetched. NULL means prefetch all bytes.
+    READAHEAD_RANGE* ranges;
+    size_t nb_ranges;
+    /// 1 if reader is waiting for data
+    char waiting;
+    char eof;
+    char stop;
+    int err;
+    ENM4A_MUTEX lock;
+    /// Signaled when data is received or fetch thread is stopped
+    ENM4A_COND data_cond;
+    /// Signaled when data is read, seek is requested or thread should stop
+    ENM4A_COND space_cond;
+    ENM4A_THREAD thread;
+    char thread_started;
+} ENM4A_READAHEAD;
+
+int enm4a_is_http_url(const char* url) {
+    if (!url) return 0;
+    return !strncasecmp(url, "http://", 7) || !strncasecmp(url, "https://", 8);
+}
+
+static int check_interrupt(void* opaque) {
+    ENM4A_READAHEAD* ra = (ENM4A_READAHEAD*)opaque;
+    enm4a_mutex_lock(&ra->lock);
+    int re = ra->stop || ra->gen != ra->src_gen;
+    enm4a_mutex_unlock(&ra->lock);
+    return re;
+}
+
+static int skip_bytes(AVIOContext* src, int64_t size) {
+    uint8_t buf[SKIP_BUFFER_SIZE];
+    while (size > 0) {
+        int re = avio_read(src, buf, size < SKIP_BUFFER_SIZE ? (int)size : SKIP_BUFFER_SIZE);
+        if (re == AVERROR_EOF || re == 0) return AVERROR(EIO);
+        if (re < 0) return re;
+        size -= re;
+    }
+    return 0;
+}
+
+/// Open connection which starts at pos.
+static int open_source(ENM4A_READAHEAD* ra, int64_t pos, AVIOContext** src) {
+    AVDictionary* options = NULL;
+    AVIOInterruptCB cb = { check_interrupt, ra };
+    int64_t offset = 0;
+    int re;
+    if ((re = av_dict_copy(&options, ra->options, 0)) < 0) goto end;
+    if (pos > 0 && (re = av_dict_set_int(&options, "offset", pos, 0)) < 0) goto end;
+    if ((re = avio_open2(src, ra->url, AVIO_FLAG_READ, &cb, &options)) < 0) goto end;
+    // Server may ignore Range request and send from the begin.
+    if (pos > 0 && (av_opt_get_int(*src, "offset", AV_OPT_SEARCH_CHILDREN, &offset) < 0 || offset > pos)) {
+        offset = 0;
+    }
+    if (pos > offset && (re = skip_bytes(*src, pos - offset)) < 0) {
+        avio_closep(src);
+    }
+end:
+    av_dict_free(&options);
+    return re;
+}
+
+/// Wait before reconnecting. Returns early if stopped.
+static void wait_retry(ENM4A_READAHEAD* ra, int attempt) {
+    for (int i = 0; i < attempt * 5 && !check_interrupt(ra); i++) {
+        av_usleep(100000);
+    }
+}
+
+/// @return Position where prefetching stops. Equal to pos if pos is in a skipped gap.
+static int64_t prefetch_limit(const ENM4A_READAHEAD* ra, int64_t pos) {
+    if (!ra->nb_ranges || pos >= ra->ranges[ra->nb_ranges - 1].end) return INT64_MAX;
+    size_t lo = 0, hi = ra->nb_ranges - 1;
+    // Find the first range which ends after pos.
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (ra->ranges[mid].end > pos) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return ra->ranges[lo].start <= pos ? ra->ranges[lo].end : pos;
+}
+
+static void* fetch_thread(void* arg) {
+    ENM4A_READAHEAD* ra = (ENM4A_READAHEAD*)arg;
+    int retries = 0, last_err = 0;
+    enm4a_mutex_lock(&ra->lock);
+    while (!ra->stop) {
+        if (ra->src_gen != ra->gen) {
+            // Seeked outside of buffered data.
+            AVIOContext* src = ra->src;
+            ra->src = NULL;
+            ra->src_gen = ra->gen;
+            retries = 0;
+            enm4a_mutex_unlock(&ra->lock);
+            avio_closep(&src);
+            enm4a_mutex_lock(&ra->lock);
+            continue;
+        }
+        if (ra->eof || ra->err) {
+            enm4a_cond_wait(&ra->space_cond, &ra->lock);
+            continue;
+        }
+        int64_t pos = ra->read_pos + (int64_t)ra->count;
+        int64_t limit = ra->waiting ? INT64_MAX : prefetch_limit(ra, pos);
+        unsigned int gen = ra->gen;
+        if (pos >= limit) {
+            // Demuxer will seek over the gap, or wait for its bytes.
+            enm4a_cond_wait(&ra->space_cond, &ra->lock);
+            continue;
+        }
+        if (!ra->src) {
+            if (retries >= ENM4A_READAHEAD_RETRIES) {
+                ra->err = last_err < 0 ? last_err : AVERROR(EIO);
+                enm4a_cond_broadcast(&ra->data_cond);
+                continue;
+            }
+            int attempt = retries++;
+            enm4a_mutex_unlock(&ra->lock);
+            if (attempt) wait_retry(ra, attempt);
+            AVIOContext* src = NULL;
+            int re = open_source(ra, pos, &src);
+            enm4a_mutex_lock(&ra->lock);
+            if (re < 0) {
+                if (!ra->stop && gen == ra->gen) {
+                    char err[AV_ERROR_MAX_STRING_SIZE];
+                    av_log(NULL, AV_LOG_WARNING, "Failed to connect to %s (%d/%d): %s\n", ra->url, retries, ENM4A_READAHEAD_RETRIES, av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, re));
+                }
+                last_err = re;
+            } else if (gen != ra->gen || ra->stop) {
+                enm4a_mutex_unlock(&ra->lock);
+                avio_closep(&src);
+                enm4a_mutex_lock(&ra->lock);
+            } else {
+                ra->src = src;
+            }
+            continue;
+        }
+        if (ra->count == ra->capacity) {
+            enm4a_cond_wait(&ra->space_cond, &ra->lock);
+            continue;
+        }
+        // Free space after tail is not touched by reader, so it can be filled without lock.
+        size_t tail = (ra->head + ra->count) % ra->capacity;
+        size_t len = ra->capacity - ra->count;
+        if (len > ra->capacity - tail) len = ra->capacity - tail;
+        if (len > READ_CHUNK_SIZE) len = READ_CHUNK_SIZE;
+        if ((int64_t)len > limit - pos) len = (size_t)(limit - pos);
+        enm4a_mutex_unlock(&ra->lock);
+        int n = avio_read_partial(ra->src, ra->ring + tail, (int)len);
+        enm4a_mutex_lock(&ra->lock);
+        if (gen != ra->gen) continue;
+        if (n > 0) {
+            ra->count += n;
+            retries = 0;
+            enm4a_cond_broadcast(&ra->data_cond);
+        } else if ((n == 0 || n == AVERROR_EOF) && (ra->size < 0 || pos >= ra->size)) {
+            ra->eof = 1;
+            enm4a_cond_broadcast(&ra->data_cond);
+        } else if (!ra->stop) {
+            // Connection is dropped or ended before all data is received.
+            AVIOContext* src = ra->src;
+            ra->src = NULL;
+            last_err = n < 0 && n != AVERROR_EOF ? n : AVERROR(EIO);
+            enm4a_mutex_unlock(&ra->lock);
+            av_log(NULL, AV_LOG_WARNING, "Connection to %s is lost at byte %" PRId64 ", resuming.\n", ra->url, pos);
+            avio_closep(&src);
+            enm4a_mutex_lock(&ra->lock);
+        }
+    }
+    enm4a_mutex_unlock(&ra->lock);
+    avio_closep(&ra->src);
+    return NULL;
+}
+
+static int readahead_read(void* opaque, uint8_t* buf, int size) {
+    ENM4A_READAHEAD* ra = (ENM4A_READAHEAD*)opaque;
+    enm4a_mutex_lock(&ra->lock);
+    while (!ra->count && !ra->eof && !ra->err) {
+        if (!ra->waiting) {
+            // Fetch thread may be stopped at the end of a needed range.
+            ra->waiting = 1;
+            enm4a_cond_signal(&ra->space_cond);
+        }
+        enm4a_cond_wait(&ra->data_cond, &ra->lock);
+    }
+    ra->waiting = 0;
+    if (!ra->count) {
+        int re = ra->err ? ra->err : AVERROR_EOF;
+        enm4a_mutex_unlock(&ra->lock);
+        return re;
+    }
+    size_t len = (size_t)size < ra->count ? (size_t)size : ra->count;
+    size_t first = ra->capacity - ra->head;
+    if (first > len) first = len;
+    memcpy(buf, ra->ring + ra->head, first);
+    if (len > first) memcpy(buf + first, ra->ring, len - first);
+    ra->head = (ra->head + len) % ra->capacity;
+    ra->count -= len;
+    ra->read_pos += len;
+    enm4a_cond_signal(&ra->space_cond);
+    enm4a_mutex_unlock(&ra->lock);
+    return (int)len;
+}
+
+static int64_t readahead_seek(void* opaque, int64_t offset, int whence) {
+    ENM4A_READAHEAD* ra = (ENM4A_READAHEAD*)opaque;
+    int64_t pos;
+    whence &= ~AVSEEK_FORCE;
+    enm4a_mutex_lock(&ra->lock);
+    switch (whence) {
+    case AVSEEK_SIZE:
+        pos = ra->size >= 0 ? ra->size : AVERROR(ENOSYS);
+        goto end;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = ra->read_pos + offset;
+        break;
+    case SEEK_END:
+        if (ra->size < 0) {
+            pos = AVERROR(ENOSYS);
+            goto end;
+        }
+        pos = ra->size + offset;
+        break;
+    default:
+        pos = AVERROR(EINVAL);
+        goto end;
+    }
+    if (pos < 0) {
+        pos = AVERROR(EINVAL);
+    } else if (pos >= ra->read_pos && pos <= ra->read_pos + (int64_t)ra->count) {
+        size_t skip = (size_t)(pos - ra->read_pos);
+        ra->head = (ra->head + skip) % ra->capacity;
+        ra->count -= skip;
+        ra->read_pos = pos;
+        enm4a_cond_signal(&ra->space_cond);
+    } else if (ra->size < 0) {
+        pos = AVERROR(ENOSYS);
+    } else {
+        ra->head = 0;
+        ra->count = 0;
+        ra->read_pos = pos;
+        // Nothing to request at the end of stream.
+        ra->eof = pos >= ra->size;
+        ra->err = 0;
+        ra->gen++;
+        enm4a_cond_signal(&ra->space_cond);
+    }
+end:
+    enm4a_mutex_unlock(&ra->lock);
+    return pos;
+}
+
+static void free_readahead(ENM4A_READAHEAD* ra) {
+    if (!ra) return;
+    if (ra->thread_started) {
+        enm4a_mutex_lock(&ra->lock);
+        ra->stop = 1;
+        enm4a_cond_broadcast(&ra->space_cond);
+        enm4a_mutex_unlock(&ra->lock);
+        enm4a_thread_join(&ra->thread);
+        enm4a_cond_destroy(&ra->space_cond);
+        enm4a_cond_destroy(&ra->data_cond);
+        enm4a_mutex_destroy(&ra->lock);
+    }
+    avio_closep(&ra->src);
+    if (ra->ranges) free(ra->ranges);
+    if (ra->ring) free(ra->ring);
+    if (ra->url) free(ra->url);
+    av_dict_free(&ra->options);
+    free(ra);
+}
+
+ENM4A_ERROR enm4a_readahead_open(int* ret, const char* url, const AVDictionary* options, size_t buffer_size, AVIOContext** pb) {
+    if (!ret || !url || !pb) return ENM4A_NULL_POINTER;
+    *pb = NULL;
+    ENM4A_ERROR rev = ENM4A_OK;
+    ENM4A_READAHEAD* ra = NULL;
+    unsigned char* buf = NULL;
+    char lock_inited = 0, data_inited = 0, space_inited = 0;
+    if (!buffer_size) buffer_size = ENM4A_DEFAULT_READAHEAD_SIZE;
+    if (!(ra = malloc(sizeof(ENM4A_READAHEAD)))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    memset(ra, 0, sizeof(ENM4A_READAHEAD));
+    ra->capacity = buffer_size;
+    if (!(ra->url = malloc(strlen(url) + 1)) || !(ra->ring = malloc(buffer_size))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    memcpy(ra->url, url, strlen(url) + 1);
+    if ((*ret = av_dict_copy(&ra->options, options, 0)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    if (!(lock_inited = !enm4a_mutex_init(&ra->lock)) || !(data_inited = !enm4a_cond_init(&ra->data_cond)) || !(space_inited = !enm4a_cond_init(&ra->space_cond))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    // First connection is opened in current thread, so errors such as 404 are reported directly.
+    if ((*ret = open_source(ra, 0, &ra->src)) < 0) {
+        rev = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    ra->size = avio_size(ra->src);
+    if (ra->size < 0) ra->size = -1;
+    if (!(buf = av_malloc(ENM4A_IO_BUFFER_SIZE))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if (!(*pb = avio_alloc_context(buf, ENM4A_IO_BUFFER_SIZE, 0, ra, readahead_read, NULL, readahead_seek))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    buf = NULL;
+    // Streams without known size can not be resumed at other position.
+    if (ra->size < 0) (*pb)->seekable = 0;
+    if (enm4a_thread_create(&ra->thread, fetch_thread, ra)) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    ra->thread_started = 1;
+end:
+    if (rev != ENM4A_OK && ra) {
+        if (*pb) {
+            av_freep(&(*pb)->buffer);
+            avio_context_free(pb);
+        }
+        if (!ra->thread_started) {
+            if (space_inited) enm4a_cond_destroy(&ra->space_cond);
+            if (data_inited) enm4a_cond_destroy(&ra->data_cond);
+            if (lock_inited) enm4a_mutex_destroy(&ra->lock);
+        }
+        free_readahead(ra);
+    }
+    if (buf) av_free(buf);
+    return rev;
+}
+
+#if HAVE_INDEX_ENTRY_API
+static int compare_range(const void* a, const void* b) {
+    int64_t x = ((const READAHEAD_RANGE*)a)->start, y = ((const READAHEAD_RANGE*)b)->start;
+    return x < y ? -1 : x > y;
+}
+#endif
+
+ENM4A_ERROR enm4a_readahead_skip_discarded(AVIOContext* pb, AVFormatContext* ic) {
+    if (!pb || !ic) return ENM4A_NULL_POINTER;
+#if HAVE_INDEX_ENTRY_API
+    ENM4A_READAHEAD* ra = (ENM4A_READAHEAD*)pb->opaque;
+    READAHEAD_RANGE* ranges = NULL;
+    size_t count = 0, n = 0;
+    int64_t needed = 0;
+    // Only mov demuxer builds index of every packet from sample table before reading packets.
+    if (ra->size < 0 || !strstr(ic->iformat->name, "mp4")) return ENM4A_OK;
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        AVStream* st = ic->streams[i];
+        // Attached picture is read with header.
+        if (st->discard >= AVDISCARD_ALL || st->disposition & AV_DISPOSITION_ATTACHED_PIC) continue;
+        int entries = avformat_index_get_entries_count(st);
+        // Positions of packets are unknown, prefetch everything.
+        if (entries <= 0) return ENM4A_OK;
+        count += entries;
+    }
+    if (!count) return ENM4A_OK;
+    if (!(ranges = malloc(sizeof(READAHEAD_RANGE) * count))) return ENM4A_NO_MEMORY;
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        AVStream* st = ic->streams[i];
+        if (st->discard >= AVDISCARD_ALL || st->disposition & AV_DISPOSITION_ATTACHED_PIC) continue;
+        int entries = avformat_index_get_entries_count(st);
+        for (int j = 0; j < entries; j++) {
+            const AVIndexEntry* e = avformat_index_get_entry(st, j);
+            if (!e || e->pos < 0) continue;
+            ranges[n].start = e->pos;
+            ranges[n].end = e->pos + e->size;
+            n++;
+        }
+    }
+    qsort(ranges, n, sizeof(READAHEAD_RANGE), compare_range);
+    // Merge ranges separated by small gaps.
+    count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (count && ranges[i].start <= ranges[count - 1].end + MIN_SKIP_GAP) {
+            if (ranges[i].end > ranges[count - 1].end) ranges[count - 1].end = ranges[i].end;
+        } else {
+            ranges[count++] = ranges[i];
+        }
+    }
+    for (size_t i = 0; i < count; i++) needed += ranges[i].end - ranges[i].start;
+    av_log(NULL, AV_LOG_VERBOSE, "Prefetch %" PRId64 " of %" PRId64 " bytes in %zu ranges.\n", needed, ra->size, count);
+    enm4a_mutex_lock(&ra->lock);
+    if (ra->ranges) free(ra->ranges);
+    ra->ranges = ranges;
+    ra->nb_ranges = count;
+    enm4a_cond_signal(&ra->space_cond);
+    enm4a_mutex_unlock(&ra->lock);
+#endif
+    return ENM4A_OK;
+}
+
+void enm4a_readahead_close(AVIOContext** pb) {
+    if (!pb || !*pb) return;
+    free_readahead((ENM4A_READAHEAD*)(*pb)->opaque);
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
@@ -0,0 +1,43 @@
+#ifndef _ENM4A_ENM4A_READAHEAD_H
+#define _ENM4A_ENM4A_READAHEAD_H
+#include "enm4a.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavformat/avformat.h"
+#include "libavformat/avio.h"
+#include "libavutil/dict.h"
+
+/// Default ring buffer size of read-ahead input
+#define ENM4A_DEFAULT_READAHEAD_SIZE (8 * 1024 * 1024)
+/// Times to reconnect without receiving any data before giving up
+#define ENM4A_READAHEAD_RETRIES 5
+
+/// @return 1 if url is a HTTP or HTTPS URL.
+int enm4a_is_http_url(const char* url);
+/**
+ * @brief Open a remote input which is read by a background thread into a ring buffer.
+ * If connection is dropped, it is reopened from the last received byte with a Range request.
+ * Seeking outside of buffered data also reopens connection.
+ * @param ret FFmpeg error code
+ * @param url URL
+ * @param options Options of protocol, such as headers. Used every time connection is opened.
+ * @param buffer_size Size of ring buffer
+ * @param pb Result. Should be freed by enm4a_readahead_close.
+*/
+ENM4A_ERROR enm4a_readahead_open(int* ret, const char* url, const AVDictionary* options, size_t buffer_size, AVIOContext** pb);
+/**
+ * @brief Only prefetch bytes of streams which are not discarded. Other bytes are still fetched when they are read,
+ * and seeking over them reopens connection at the next needed byte. Only has effect on mov/mp4 input, whose index
+ * has the position of every packet.
+ * @param pb AVIOContext created by enm4a_readahead_open
+ * @param ic Input opened from pb. Streams which are not needed should be discarded.
+*/
+ENM4A_ERROR enm4a_readahead_skip_discarded(AVIOContext* pb, AVFormatContext* ic);
+/// Stop background thread and free AVIOContext created by enm4a_readahead_open
+void enm4a_readahead_close(AVIOContext** pb);
+#ifdef __cplusplus
+}
+#endif
+#endif
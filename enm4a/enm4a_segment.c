@@ -0,0 +1,434 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_segment.h"
+#include "enm4a_queue.h"
+#include "enm4a_thread.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/samplefmt.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+typedef struct SEGMENT_JOB {
+    /// Samples. The first ENM4A_SEGMENT_OVERLAP_FRAMES frames are reserved for overlap.
+    uint8_t** data;
+    /// data with offset of overlap
+    uint8_t** segment;
+    /// Overlap samples before segment
+    int overlap;
+    /// Samples in segment
+    int nb_samples;
+    /// pts of the first sample in segment
+    int64_t start;
+    char last;
+    /// Encoded packets which should be written
+    AVPacket** pkts;
+    int nb_pkts;
+    /// Allocated packets in pkts
+    int pkt_capacity;
+    char done;
+    ENM4A_ERROR err;
+    int ret;
+} SEGMENT_JOB;
+
+typedef struct SEGMENT_STATE {
+    ENM4A_SEGMENTED* p;
+    /// Jobs waiting for worker
+    ENM4A_QUEUE* jobs;
+    SEGMENT_JOB* pool;
+    unsigned int pool_size;
+    ENM4A_MUTEX lock;
+    /// Signaled when a job is done
+    ENM4A_COND cond;
+    int channels;
+    int max_overlap;
+    int segment_samples;
+} SEGMENT_STATE;
+
+typedef struct SEGMENT_WORKER {
+    SEGMENT_STATE* s;
+    ENM4A_THREAD thread;
+    AVFrame* frame;
+    int64_t allocations;
+} SEGMENT_WORKER;
+
+static void free_job(SEGMENT_JOB* job) {
+    if (job->data) {
+        av_freep(&job->data[0]);
+        av_freep(&job->data);
+    }
+    if (job->segment) free(job->segment);
+    if (job->pkts) {
+        for (int i = 0; i < job->pkt_capacity; i++) {
+            av_packet_free(&job->pkts[i]);
+        }
+        free(job->pkts);
+    }
+    memset(job, 0, sizeof(SEGMENT_JOB));
+}
+
+static ENM4A_ERROR init_job(int* ret, SEGMENT_STATE* s, SEGMENT_JOB* job) {
+    ENM4A_SEGMENTED* p = s->p;
+    enum AVSampleFormat fmt = p->audio_output->sample_fmt;
+    int planar = av_sample_fmt_is_planar(fmt), planes = planar ? s->channels : 1;
+    size_t offset = (size_t)s->max_overlap * av_get_bytes_per_sample(fmt) * (planar ? 1 : s->channels);
+    if ((*ret = av_samples_alloc_array_and_samples(&job->data, NULL, s->channels, s->max_overlap + s->segment_samples, fmt, 0)) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    if (!(job->segment = malloc(sizeof(uint8_t*) * planes))) {
+        return ENM4A_NO_MEMORY;
+    }
+    for (int i = 0; i < planes; i++) {
+        job->segment[i] = job->data[i] + offset;
+    }
+    return ENM4A_OK;
+}
+
+/// Get a unused packet from job.
+static AVPacket* job_packet(SEGMENT_JOB* job) {
+    if (job->nb_pkts == job->pkt_capacity) {
+        int capacity = job->pkt_capacity ? job->pkt_capacity * 2 : ENM4A_SEGMENT_FRAMES + ENM4A_SEGMENT_OVERLAP_FRAMES + 4;
+        AVPacket** pkts = realloc(job->pkts, sizeof(AVPacket*) * capacity);
+        if (!pkts) return NULL;
+        memset(pkts + job->pkt_capacity, 0, sizeof(AVPacket*) * (capacity - job->pkt_capacity));
+        job->pkts = pkts;
+        job->pkt_capacity = capacity;
+    }
+    if (!job->pkts[job->nb_pkts]) job->pkts[job->nb_pkts] = av_packet_alloc();
+    return job->pkts[job->nb_pkts];
+}
+
+static AVCodecContext* open_segment_encoder(int* ret, const AVCodecContext* base, ENM4A_ERROR* err) {
+    AVCodecContext* enc = avcodec_alloc_context3(base->codec);
+    if (!enc) {
+        *err = ENM4A_NO_MEMORY;
+        return NULL;
+    }
+#if NEW_CHANNEL_LAYOUT
+    if ((*ret = av_channel_layout_copy(&enc->ch_layout, &base->ch_layout)) < 0) {
+        *err = ENM4A_FFMPEG_ERR;
+        avcodec_free_context(&enc);
+        return NULL;
+    }
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+    DISABLE_DEPRECATION_WARNINGS
+    enc->channels = base->channels;
+    enc->channel_layout = base->channel_layout;
+    ENABLE_DEPRECATION_WARNINGS
+#endif
+    enc->sample_rate = base->sample_rate;
+    enc->sample_fmt = base->sample_fmt;
+    enc->bit_rate = base->bit_rate;
+    enc->profile = base->profile;
+    enc->flags = base->flags;
+    enc->time_base = base->time_base;
+    enc->thread_count = base->thread_count;
+    enc->thread_type = base->thread_type;
+    if ((*ret = avcodec_open2(enc, base->codec, NULL)) < 0) {
+        *err = ENM4A_FFMPEG_ERR;
+        avcodec_free_context(&enc);
+        return NULL;
+    }
+    return enc;
+}
+
+/// Receive packets from encoder and keep packets with pts in [from, to).
+static ENM4A_ERROR receive_segment_packets(int* ret, AVCodecContext* enc, SEGMENT_JOB* job, int64_t from, int64_t to) {
+    AVPacket* pkt = NULL;
+    while (1) {
+        if (!(pkt = job_packet(job))) return ENM4A_NO_MEMORY;
+        *ret = avcodec_receive_packet(enc, pkt);
+        if (*ret == AVERROR(EAGAIN) || *ret == AVERROR_EOF) {
+            *ret = 0;
+            return ENM4A_OK;
+        } else if (*ret < 0) {
+            return ENM4A_FFMPEG_ERR;
+        }
+        if (pkt->pts >= from && (job->last || pkt->pts < to)) {
+            job->nb_pkts++;
+        } else {
+            av_packet_unref(pkt);
+        }
+    }
+}
+
+static ENM4A_ERROR encode_segment(SEGMENT_WORKER* w, SEGMENT_JOB* job) {
+    SEGMENT_STATE* s = w->s;
+    AVCodecContext* base = s->p->audio_output, * enc = NULL;
+    ENM4A_ERROR re = ENM4A_OK;
+    int begin = s->max_overlap - job->overlap, end = s->max_overlap + job->nb_samples;
+    // Encoder output packet with pts - initial_padding for input samples with pts.
+    int64_t from = job->start - base->initial_padding, to = job->start + job->nb_samples - base->initial_padding;
+    int64_t start = stage_start(s->p->progress);
+    if (!(enc = open_segment_encoder(&job->ret, base, &re))) {
+        return re;
+    }
+    w->allocations++;
+    for (int offset = begin; offset < end; offset += enc->frame_size) {
+        AVFrame* frame = w->frame;
+        if (!av_frame_is_writable(frame)) {
+            if ((job->ret = av_frame_make_writable(frame)) < 0) {
+                re = ENM4A_NO_MEMORY;
+                goto end;
+            }
+            w->allocations++;
+        }
+        frame->nb_samples = FFMIN(enc->frame_size, end - offset);
+        av_samples_copy(frame->extended_data, job->data, 0, offset, frame->nb_samples, s->channels, enc->sample_fmt);
+        frame->pts = job->start - s->max_overlap + offset;
+        if ((job->ret = avcodec_send_frame(enc, frame)) < 0) {
+            re = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+        if ((re = receive_segment_packets(&job->ret, enc, job, from, to)) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if ((job->ret = avcodec_send_frame(enc, NULL)) < 0) {
+        re = ENM4A_FFMPEG_ERR;
+        goto end;
+    }
+    re = receive_segment_packets(&job->ret, enc, job, from, to);
+end:
+    avcodec_free_context(&enc);
+    stage_end(s->p->progress, ENM4A_STAGE_ENCODE, start);
+    return re;
+}
+
+static void* segment_worker(void* arg) {
+    SEGMENT_WORKER* w = (SEGMENT_WORKER*)arg;
+    SEGMENT_STATE* s = w->s;
+    SEGMENT_JOB* job = NULL;
+    while (enm4a_queue_pop(s->jobs, (void**)&job) == ENM4A_QUEUE_OK) {
+        ENM4A_ERROR re = encode_segment(w, job);
+        enm4a_mutex_lock(&s->lock);
+        job->err = re;
+        job->done = 1;
+        enm4a_cond_broadcast(&s->cond);
+        enm4a_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+/// Wait the oldest job and write its packets to output.
+static ENM4A_ERROR write_job(int* ret, SEGMENT_STATE* s, SEGMENT_JOB* job) {
+    ENM4A_SEGMENTED* p = s->p;
+    ENM4A_ERROR re = ENM4A_OK;
+    enm4a_mutex_lock(&s->lock);
+    while (!job->done) {
+        enm4a_cond_wait(&s->cond, &s->lock);
+    }
+    enm4a_mutex_unlock(&s->lock);
+    if (job->err != ENM4A_OK) {
+        *ret = job->ret;
+        return job->err;
+    }
+    int64_t start = stage_start(p->progress);
+    for (int i = 0; i < job->nb_pkts; i++) {
+        AVPacket* pkt = job->pkts[i];
+        pkt->stream_index = p->audio_dest_index;
+        if (log_packet_enabled(p->level)) {
+            log_packet(p->oc, pkt, "out");
+        }
+        if (re == ENM4A_OK && (*ret = av_write_frame(p->oc, pkt)) < 0) {
+            re = ENM4A_FFMPEG_ERR;
+        }
+        av_packet_unref(pkt);
+    }
+    stage_end(p->progress, ENM4A_STAGE_MUX, start);
+    job->nb_pkts = 0;
+    *(p->audio_pts) = job->start + job->nb_samples;
+    if (re == ENM4A_OK) {
+        update_progress(p->progress, p->oc, *(p->audio_pts), p->oc->streams[p->audio_dest_index]->time_base);
+    }
+    return re;
+}
+
+/**
+ * @brief Move samples in FIFO to a job and send it to workers.
+ * @param prev Previous job. Its tail is used as overlap.
+*/
+static ENM4A_ERROR submit_job(int* ret, SEGMENT_STATE* s, SEGMENT_JOB* job, SEGMENT_JOB* prev, int64_t* start, char last) {
+    ENM4A_SEGMENTED* p = s->p;
+    job->overlap = prev ? FFMIN(s->max_overlap, prev->overlap + prev->nb_samples) : 0;
+    if (job->overlap) {
+        av_samples_copy(job->data, prev->data, s->max_overlap - job->overlap, s->max_overlap + prev->nb_samples - job->overlap, job->overlap, s->channels, p->audio_output->sample_fmt);
+    }
+    job->nb_samples = FFMIN(av_audio_fifo_size(p->afifo), s->segment_samples);
+    if ((*ret = av_audio_fifo_read(p->afifo, (void**)job->segment, job->nb_samples)) < 0) {
+        return ENM4A_NO_MEMORY;
+    }
+    job->start = *start;
+    job->last = last;
+    job->done = 0;
+    job->err = ENM4A_OK;
+    job->ret = 0;
+    *start += job->nb_samples;
+    if (enm4a_queue_push(s->jobs, job) != ENM4A_QUEUE_OK) return ENM4A_NULL_POINTER;
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR enm4a_run_segmented(int* ret, ENM4A_SEGMENTED* p) {
+    if (!ret || !p || !p->audio_output || !p->audio_output->frame_size) return ENM4A_NULL_POINTER;
+    SEGMENT_STATE s;
+    SEGMENT_WORKER* workers = NULL;
+    unsigned int threads = p->threads ? p->threads : 1, started = 0, head = 0, pending = 0;
+    char lock_inited = 0, cond_inited = 0, finished = 0;
+    ENM4A_ERROR rev = ENM4A_OK;
+    SEGMENT_JOB* prev = NULL;
+    int64_t start = 0, allocations = 0;
+    AVPacket pkt;
+    memset(&s, 0, sizeof(SEGMENT_STATE));
+    memset(&pkt, 0, sizeof(AVPacket));
+    s.p = p;
+    s.channels = GET_AV_CODEC_CHANNELS(p->audio_output);
+    s.max_overlap = ENM4A_SEGMENT_OVERLAP_FRAMES * p->audio_output->frame_size;
+    s.segment_samples = ENM4A_SEGMENT_FRAMES * p->audio_output->frame_size;
+    // Keep workers busy while the oldest job is being written.
+    s.pool_size = threads + 2;
+    if (enm4a_mutex_init(&s.lock)) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    lock_inited = 1;
+    if (enm4a_cond_init(&s.cond)) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    cond_inited = 1;
+    if (!(s.jobs = enm4a_queue_alloc(s.pool_size))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if (!(s.pool = calloc(s.pool_size, sizeof(SEGMENT_JOB))) || !(workers = calloc(threads, sizeof(SEGMENT_WORKER)))) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    for (unsigned int i = 0; i < s.pool_size; i++) {
+        if ((rev = init_job(ret, &s, &s.pool[i])) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    allocations += s.pool_size;
+    for (unsigned int i = 0; i < threads; i++) {
+        AVFrame* f = NULL;
+        workers[i].s = &s;
+        if (!(f = workers[i].frame = av_frame_alloc())) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+#if NEW_CHANNEL_LAYOUT
+        if ((*ret = av_channel_layout_copy(&f->ch_layout, &p->audio_output->ch_layout)) < 0) {
+            rev = ENM4A_FFMPEG_ERR;
+            goto end;
+        }
+#endif
+#if OLD_CHANNEL_LAYOUT || FF_API_OLD_CHANNEL_LAYOUT
+        DISABLE_DEPRECATION_WARNINGS
+        f->channel_layout = p->audio_output->channel_layout;
+        ENABLE_DEPRECATION_WARNINGS
+#endif
+        f->format = p->audio_output->sample_fmt;
+        f->sample_rate = p->audio_output->sample_rate;
+        f->nb_samples = p->audio_output->frame_size;
+        if ((*ret = av_frame_get_buffer(f, 0)) < 0) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+        allocations++;
+    }
+    for (; started < threads; started++) {
+        if (enm4a_thread_create(&workers[started].thread, segment_worker, &workers[started])) {
+            rev = ENM4A_NO_MEMORY;
+            goto end;
+        }
+    }
+    while (!finished) {
+        int64_t demux_start = stage_start(p->progress);
+        *ret = av_read_frame(p->ic, &pkt);
+        stage_end(p->progress, ENM4A_STAGE_DEMUX, demux_start);
+        if (*ret >= 0) mark_first_packet(p->progress);
+        if (*ret < 0) {
+            if (*ret != AVERROR_EOF) {
+                rev = ENM4A_FFMPEG_ERR;
+                goto end;
+            }
+            finished = 1;
+        } else if (pkt.stream_index != p->audio_stream_index) {
+            av_packet_unref(&pkt);
+            continue;
+        } else if (trim_packet_after_end(p->trim, &pkt)) {
+            // Rest of input is not needed.
+            av_packet_unref(&pkt);
+            finished = 1;
+        } else if (log_packet_enabled(p->level)) {
+            log_packet(p->ic, &pkt, "in");
+        }
+        rev = decode_audio_packet(ret, p->audio_input, finished ? NULL : &pkt, p->audio_input_frame, p->audio_output, p->resample_context, p->afifo, p->convert_buffer, &allocations, p->meter, p->fingerprint, p->trim, p->progress);
+        if (!finished) av_packet_unref(&pkt);
+        if (rev != ENM4A_OK) goto end;
+        // Keep at least one sample in FIFO, so the last segment is always sent after input is finished.
+        while (av_audio_fifo_size(p->afifo) > s.segment_samples || finished) {
+            SEGMENT_JOB* job = &s.pool[(head + pending) % s.pool_size];
+            if (pending == s.pool_size) {
+                if ((rev = write_job(ret, &s, job)) != ENM4A_OK) {
+                    goto end;
+                }
+                head = (head + 1) % s.pool_size;
+                pending--;
+            }
+            char last = finished && av_audio_fifo_size(p->afifo) <= s.segment_samples;
+            if ((rev = submit_job(ret, &s, job, prev, &start, last)) != ENM4A_OK) {
+                goto end;
+            }
+            prev = job;
+            pending++;
+            if (last) break;
+        }
+    }
+    while (pending) {
+        if ((rev = write_job(ret, &s, &s.pool[head])) != ENM4A_OK) {
+            goto end;
+        }
+        head = (head + 1) % s.pool_size;
+        pending--;
+    }
+end:
+    if (s.jobs) {
+        if (rev == ENM4A_OK) {
+            enm4a_queue_close(s.jobs);
+        } else {
+            enm4a_queue_abort(s.jobs);
+        }
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        enm4a_thread_join(&workers[i].thread);
+    }
+    av_packet_unref(&pkt);
+    if (workers) {
+        for (unsigned int i = 0; i < threads; i++) {
+            allocations += workers[i].allocations;
+            if (workers[i].frame) av_frame_free(&workers[i].frame);
+        }
+        free(workers);
+    }
+    if (s.pool) {
+        for (unsigned int i = 0; i < s.pool_size; i++) {
+            free_job(&s.pool[i]);
+        }
+        free(s.pool);
+    }
+    enm4a_queue_free(&s.jobs);
+    if (cond_inited) enm4a_cond_destroy(&s.cond);
+    if (lock_inited) enm4a_mutex_destroy(&s.lock);
+    *(p->allocations) += allocations;
+    return rev;
+}
@@ -0,0 +1,54 @@
+#ifndef _ENM4A_ENM4A_SEGMENT_H
+#define _ENM4A_ENM4A_SEGMENT_H
+#include "enm4a_internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Encoder frames per segment
+#define ENM4A_SEGMENT_FRAMES 1024
+/// Encoder frames before segment which are encoded to warm up encoder. Packets of them are discarded.
+#define ENM4A_SEGMENT_OVERLAP_FRAMES 8
+
+/// Contexts used by segmented encoding. All contexts should be opened and output header should be written.
+typedef struct ENM4A_SEGMENTED {
+    AVFormatContext* ic;
+    unsigned int audio_stream_index;
+    AVCodecContext* audio_input;
+    AVFrame* audio_input_frame;
+    /// Measures decoded frames if not NULL
+    ENM4A_LOUDNESS* meter;
+    /// Fingerprints decoded frames if not NULL
+    ENM4A_FINGERPRINT* fingerprint;
+    SwrContext* resample_context;
+    AVAudioFifo* afifo;
+    ENM4A_CONVERT_BUFFER* convert_buffer;
+    AVFormatContext* oc;
+    /// Opened encoder. Every segment is encoded by a new encoder with the same parameters.
+    AVCodecContext* audio_output;
+    unsigned int audio_dest_index;
+    /// Next pts of encoder
+    int64_t* audio_pts;
+    int64_t* allocations;
+    ENM4A_LOG level;
+    /// May be NULL
+    ENM4A_PROGRESS_SINK* progress;
+    /// Range of input to convert. May be NULL.
+    ENM4A_TRIM* trim;
+    /// Number of encode threads
+    unsigned int threads;
+} ENM4A_SEGMENTED;
+
+/**
+ * @brief Read all audio packets from input, encode them in parallel and write encoded packets to output.
+ * Decoded samples are cut into segments. Every segment is encoded by its own encoder in worker threads,
+ * starting from some frames before the segment, so encoder state is close to encoding whole stream.
+ * Packets are selected by pts, so priming and padding are same as serial encoding.
+ * @param ret FFmpeg error code
+*/
+ENM4A_ERROR enm4a_run_segmented(int* ret, ENM4A_SEGMENTED* p);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,358 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_server.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if _WIN32
+#include <WinSock2.h>
+#include <afunix.h>
+#else
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+#if _WIN32
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#define SHUT_RD SD_RECEIVE
+#define SHUT_RDWR SD_BOTH
+#else
+typedef int socket_t;
+#define INVALID_SOCKET -1
+#define close_socket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/// Longest accepted request line
+#define MAX_LINE_SIZE 65536
+/// Queued jobs per worker thread before requests are no longer read
+#define QUEUE_SIZE_PER_THREAD 2
+
+class Connection {
+public:
+    Connection(socket_t fd) : fd(fd) {}
+    ~Connection() {
+        close_socket(this->fd);
+    }
+    /// Send a line. Errors are ignored, so jobs are still finished if client is gone.
+    void send_line(std::string line) {
+        line += '\n';
+        const char* p = line.c_str();
+        size_t left = line.length();
+        std::lock_guard<std::mutex> guard(this->lock);
+        while (!this->broken && left) {
+            int n = send(this->fd, p, (int)left, MSG_NOSIGNAL);
+            if (n <= 0) {
+                this->broken = true;
+                break;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+    socket_t fd;
+private:
+    std::mutex lock;
+    bool broken = false;
+};
+
+typedef struct ServerJob {
+    uint64_t id;
+    Enm4aJob job;
+    std::shared_ptr<Connection> conn;
+} ServerJob;
+
+typedef struct ProgressTarget {
+    Connection* conn;
+    uint64_t id;
+} ProgressTarget;
+
+class Server {
+public:
+    socket_t listener = INVALID_SOCKET;
+    Enm4aJob defaults;
+    std::deque<ServerJob> queue;
+    size_t capacity = 0;
+    bool stopping = false;
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::condition_variable readers_done;
+    /// Number of running reader threads
+    size_t readers = 0;
+    std::atomic<uint64_t> next_id{ 1 };
+    /// Connections which may still send requests
+    std::list<std::weak_ptr<Connection>> connections;
+    /// Stop accepting connections and jobs. Queued jobs are still finished.
+    void stop() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->stopping) return;
+        this->stopping = true;
+        this->not_empty.notify_all();
+        this->not_full.notify_all();
+        for (auto i = this->connections.begin(); i != this->connections.end(); i++) {
+            auto conn = i->lock();
+            if (conn) shutdown(conn->fd, SHUT_RD);
+        }
+        // Wake up accept.
+        shutdown(this->listener, SHUT_RDWR);
+#if _WIN32
+        closesocket(this->listener);
+        this->listener = INVALID_SOCKET;
+#endif
+    }
+    /// Wait until queue has space. @return false if server is stopping.
+    bool push(ServerJob& job) {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while (!this->stopping && this->queue.size() >= this->capacity) {
+            this->not_full.wait(guard);
+        }
+        if (this->stopping) return false;
+        this->queue.push_back(job);
+        this->not_empty.notify_one();
+        return true;
+    }
+    /// Wait a job. @return false if server is stopping and queue is empty.
+    bool pop(ServerJob& job) {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while (!this->stopping && this->queue.empty()) {
+            this->not_empty.wait(guard);
+        }
+        if (this->queue.empty()) return false;
+        job = this->queue.front();
+        this->queue.pop_front();
+        this->not_full.notify_one();
+        return true;
+    }
+};
+
+static void send_progress(void* opaque, const ENM4A_PROGRESS* progress) {
+    ProgressTarget* target = (ProgressTarget*)opaque;
+    char buf[160];
+    snprintf(buf, sizeof(buf), "progress\t%" PRIu64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64, target->id, progress->time, progress->duration, progress->input_size, progress->output_size);
+    target->conn->send_line(buf);
+}
+
+/// @return false if connection should be closed.
+static bool handle_request(Server* s, std::shared_ptr<Connection> conn, std::string line) {
+    if (!line.length() || line[0] == '#') return true;
+    if (line == "shutdown") {
+        s->stop();
+        return false;
+    }
+    ServerJob job;
+    std::string err;
+    if (!enm4a_parse_job_line(line, s->defaults, job.job, err)) {
+        conn->send_line("error\t" + err);
+        return true;
+    }
+    job.id = s->next_id++;
+    job.conn = conn;
+    // Accepted is sent before the job can be started, so it is always the first reply of the job.
+    conn->send_line("accepted\t" + std::to_string(job.id) + "\t" + job.job.input);
+    if (!s->push(job)) {
+        conn->send_line("done\t" + std::to_string(job.id) + "\tfailed\tServer is shutting down.");
+        return false;
+    }
+    return true;
+}
+
+static void read_connection(Server* s, std::shared_ptr<Connection> conn) {
+    std::string buf;
+    char tmp[4096];
+    while (1) {
+        int n = recv(conn->fd, tmp, sizeof(tmp), 0);
+        if (n <= 0) break;
+        buf.append(tmp, n);
+        size_t pos;
+        while ((pos = buf.find('\n')) != std::string::npos) {
+            std::string line = buf.substr(0, pos);
+            buf.erase(0, pos + 1);
+            if (line.length() && line[line.length() - 1] == '\r') line.erase(line.length() - 1);
+            if (!handle_request(s, conn, line)) return;
+        }
+        if (buf.length() > MAX_LINE_SIZE) {
+            conn->send_line("error\tRequest line is too long.");
+            return;
+        }
+    }
+}
+
+static void read_requests(Server* s, std::shared_ptr<Connection> conn) {
+    read_connection(s, conn);
+    conn.reset();
+    std::lock_guard<std::mutex> guard(s->lock);
+    s->readers--;
+    s->readers_done.notify_all();
+}
+
+static void run_jobs(Server* s, ENM4A_ARGS base, Enm4aIncremental* incremental) {
+    ServerJob job;
+    while (s->pop(job)) {
+        ENM4A_ARGS args = base;
+        ENM4A_STATS stats;
+        ProgressTarget target = { job.conn.get(), job.id };
+        memset(&stats, 0, sizeof(ENM4A_STATS));
+        args.stats = &stats;
+        args.quiet = 1;
+        args.progress = send_progress;
+        args.progress_opaque = &target;
+        auto job_start = std::chrono::steady_clock::now();
+        ENM4A_ERROR re = ENM4A_NO_MEMORY;
+        bool up_to_date = false;
+        Enm4aFileId input_id;
+        uint64_t args_hash = 0;
+        std::vector<std::string> previous_outputs;
+        std::vector<const char*> replaceable;
+        if (enm4a_fill_job_args(job.job, args)) {
+            if (incremental) {
+                args_hash = enm4a_hash_args(args);
+                ENM4A_INCREMENTAL_STATE state = incremental->check(job.job.input, args_hash, input_id, previous_outputs);
+                up_to_date = state == ENM4A_INCREMENTAL_UP_TO_DATE;
+                if (state == ENM4A_INCREMENTAL_OUTDATED) enm4a_set_replaceable_outputs(args, previous_outputs, replaceable);
+            }
+            if (!up_to_date) re = encode_m4a(job.job.input.c_str(), args);
+        }
+        enm4a_free_job_args(args);
+        if (re == ENM4A_OK && incremental && stats.output) {
+            incremental->update(job.job.input, input_id, args_hash, stats.output, enm4a_extra_outputs(base));
+            incremental->save();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - job_start).count();
+        std::string id = std::to_string(job.id);
+        if (up_to_date) {
+            job.conn->send_line("done\t" + id + "\tskipped\tUp to date");
+            printf("[%s] Up to date %s\n", id.c_str(), job.job.input.c_str());
+        } else if (re == ENM4A_OK) {
+            job.conn->send_line("done\t" + id + "\tok\t" + (stats.output ? stats.output : "") + (stats.fingerprint ? std::string("\t") + stats.fingerprint : ""));
+            printf("[%s] OK %s (%.2fs, %.2fx)\n", id.c_str(), job.job.input.c_str(), elapsed, elapsed > 0 ? stats.duration / 1000000.0 / elapsed : 0.0);
+        } else if (re == ENM4A_FILE_EXISTS) {
+            job.conn->send_line("done\t" + id + "\tskipped\t" + enm4a_error_msg(re));
+            printf("[%s] Skipped %s: %s\n", id.c_str(), job.job.input.c_str(), enm4a_error_msg(re));
+        } else {
+            job.conn->send_line("done\t" + id + "\tfailed\t" + enm4a_error_msg(re));
+            printf("[%s] Failed %s: %s\n", id.c_str(), job.job.input.c_str(), enm4a_error_msg(re));
+        }
+        fflush(stdout);
+        if (stats.output) free(stats.output);
+        if (stats.fingerprint) free(stats.fingerprint);
+        job.conn.reset();
+    }
+}
+
+bool enm4a_serve(std::string path, ENM4A_ARGS base, const Enm4aJob& defaults, unsigned int threads, Enm4aIncremental* incremental) {
+    struct sockaddr_un addr;
+    if (path.length() >= sizeof(addr.sun_path)) {
+        printf("Socket path is too long: %s\n", path.c_str());
+        return false;
+    }
+#if _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+        printf("%s\n", "Can not initialize Winsock.");
+        return false;
+    }
+    DeleteFileA(path.c_str());
+#else
+    // Client may be gone when a reply is sent.
+    signal(SIGPIPE, SIG_IGN);
+    struct stat st;
+    if (!stat(path.c_str(), &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            printf("%s is existed and is not a socket.\n", path.c_str());
+            return false;
+        }
+        unlink(path.c_str());
+    }
+#endif
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    Server s;
+    s.defaults = defaults;
+    s.capacity = (size_t)threads * QUEUE_SIZE_PER_THREAD;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.length());
+    s.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    int bound = -1;
+    if (s.listener != INVALID_SOCKET) {
+#if _WIN32
+        bound = bind(s.listener, (struct sockaddr*)&addr, sizeof(addr));
+#else
+        // Jobs can read and write any file of this user, so only the owner can connect.
+        mode_t mask = umask(0177);
+        bound = bind(s.listener, (struct sockaddr*)&addr, sizeof(addr));
+        umask(mask);
+#endif
+    }
+    if (s.listener == INVALID_SOCKET || bound || listen(s.listener, SOMAXCONN)) {
+        printf("Can not listen on %s\n", path.c_str());
+        if (s.listener != INVALID_SOCKET) close_socket(s.listener);
+#if _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+    printf("Listening on %s with %u threads.\n", path.c_str(), threads);
+    fflush(stdout);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.push_back(std::thread(run_jobs, &s, base, incremental));
+    }
+    while (1) {
+        socket_t fd = accept(s.listener, nullptr, nullptr);
+        if (fd == INVALID_SOCKET) {
+            std::lock_guard<std::mutex> guard(s.lock);
+            if (s.stopping) break;
+            continue;
+        }
+        auto conn = std::make_shared<Connection>(fd);
+        std::lock_guard<std::mutex> guard(s.lock);
+        if (s.stopping) break;
+        s.connections.remove_if([](const std::weak_ptr<Connection>& c) { return c.expired(); });
+        s.connections.push_back(conn);
+        s.readers++;
+        std::thread(read_requests, &s, conn).detach();
+    }
+    s.stop();
+    {
+        std::unique_lock<std::mutex> guard(s.lock);
+        while (s.readers) s.readers_done.wait(guard);
+    }
+    for (auto i = workers.begin(); i != workers.end(); i++) {
+        i->join();
+    }
+#if _WIN32
+    WSACleanup();
+    DeleteFileA(path.c_str());
+#else
+    close_socket(s.listener);
+    unlink(path.c_str());
+#endif
+    printf("%s\n", "Server stopped.");
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef _ENM4A_ENM4A_SERVER_H
+#define _ENM4A_ENM4A_SERVER_H
+#include <string>
+#include "enm4a.h"
+#include "enm4a_batch.h"
+#include "enm4a_incremental.h"
+
+/**
+ * @brief Accept conversion jobs from a local socket and run them on a bounded worker pool.
+ * Every request line is a job in the same form as a line of batch manifest file.
+ * A line "shutdown" stops accepting new jobs and returns after queued jobs are finished.
+ * Replies are lines with tab separated fields:
+ * accepted <id> <input>
+ * error <message>
+ * progress <id> <time> <duration> <bytes read> <bytes written>
+ * done <id> ok <output> | done <id> skipped <message> | done <id> failed <message>
+ * Times are in microseconds. duration is -1 if unknown.
+ * When the queue is full, requests are not read until a worker is free.
+ * @param path Unix domain socket path. Existing socket file is removed.
+ * @param base Shared arguments. Fields set by job will be overrided.
+ * @param defaults Default values of every job.
+ * @param threads Number of worker threads. 0 means the number of CPU cores.
+ * @param incremental If not NULL, jobs which are up to date are skipped and succeeded jobs are recorded.
+ * @return false if failed to listen.
+*/
+bool enm4a_serve(std::string path, ENM4A_ARGS base, const Enm4aJob& defaults, unsigned int threads, Enm4aIncremental* incremental = nullptr);
+#endif
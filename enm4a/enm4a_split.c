@@ -0,0 +1,362 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_split.h"
+#include "enm4a_cover.h"
+#include "enm4a_internal.h"
+#include "enm4a_readahead.h"
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/log.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+typedef struct SPLIT_CONTEXT {
+    const ENM4A_SPLIT_TRACK* tracks;
+    size_t count;
+    const ENM4A_ARGS* args;
+    AVFormatContext* ic;
+    AVCodecContext* audio_input;
+    /// Cover written to every track. buf is NULL if no cover.
+    ENM4A_COVER cover;
+    /// Index of current track
+    size_t index;
+    /// Output of current track. NULL if not opened.
+    AVFormatContext* oc;
+    AVCodecContext* audio_output;
+    AVAudioFifo* afifo;
+    AVFrame* frame;
+    AVPacket* pkt;
+    /// Next pts of current track
+    int64_t pts;
+    /// Samples written to all tracks
+    int64_t pos;
+    /// Position of the end of current track in samples. INT64_MAX for last track.
+    int64_t end;
+    /// Bytes written to closed tracks
+    int64_t output_size;
+    int64_t* allocations;
+    ENM4A_PROGRESS_SINK* progress;
+} SPLIT_CONTEXT;
+
+static void close_track(SPLIT_CONTEXT* s) {
+    if (s->audio_output) avcodec_free_context(&s->audio_output);
+    if (s->oc) {
+        if (!(s->oc->oformat->flags & AVFMT_NOFILE)) avio_closep(&s->oc->pb);
+        avformat_free_context(s->oc);
+        s->oc = NULL;
+    }
+}
+
+/// Open output and encoder of track s->index.
+static ENM4A_ERROR open_track(int* ret, SPLIT_CONTEXT* s) {
+    const ENM4A_SPLIT_TRACK* track = &s->tracks[s->index];
+    const ENM4A_ARGS* args = s->args;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVDictionary* mux_option = NULL;
+    AVStream* os = NULL;
+    if ((*ret = avformat_alloc_output_context2(&s->oc, NULL, "ipod", track->output)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    if (!(os = avformat_new_stream(s->oc, NULL))) {
+        return ENM4A_NO_MEMORY;
+    }
+    if ((rev = open_audio_encoder(ret, s->audio_input, s->oc, os, args->sample_rate ? *(args->sample_rate) : 0, args->bitrate, args, &s->audio_output)) != ENM4A_OK) {
+        return rev;
+    }
+    if (s->cover.buf && (rev = enm4a_add_cover_stream(s->oc, &s->cover)) != ENM4A_OK) {
+        return rev;
+    }
+    if (track->title) av_dict_set(&s->oc->metadata, "title", track->title, 0);
+    set_ctx_metadata(s->oc, s->ic, "artist", track->artist && strlen(track->artist) ? track->artist : args->artist);
+    set_ctx_metadata(s->oc, s->ic, "album", args->album);
+    set_ctx_metadata(s->oc, s->ic, "album_artist", args->album_artist);
+    set_ctx_metadata(s->oc, s->ic, "disc", args->disc);
+    set_ctx_metadata(s->oc, s->ic, "date", args->date);
+    if (track->track) av_dict_set(&s->oc->metadata, "track", track->track, 0);
+    if (track->genre) av_dict_set(&s->oc->metadata, "genre", track->genre, 0);
+    if (!args->quiet) av_dump_format(s->oc, (int)s->index, track->output, 1);
+    if (!(s->oc->oformat->flags & AVFMT_NOFILE)) {
+        if ((*ret = avio_open(&s->oc->pb, track->output, AVIO_FLAG_WRITE)) < 0) {
+            return ENM4A_ERR_OPEN_FILE;
+        }
+    }
+    // Tracks are usually short, so moov box is always moved after writing.
+    if (args->faststart != ENM4A_FASTSTART_NONE && (*ret = av_dict_set(&mux_option, "movflags", "+faststart", 0)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    *ret = avformat_write_header(s->oc, &mux_option);
+    av_dict_free(&mux_option);
+    if (*ret < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    if (s->cover.buf && (rev = enm4a_write_cover(ret, s->oc, 1, &s->cover, args->level)) != ENM4A_OK) {
+        return rev;
+    }
+    s->pts = 0;
+    s->end = s->index + 1 < s->count ? av_rescale(s->tracks[s->index + 1].start - s->tracks[0].start, s->audio_output->sample_rate, AV_TIME_BASE) : INT64_MAX;
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Flush encoder and close output of current track.
+ * @param last Report final progress.
+*/
+static ENM4A_ERROR finish_track(int* ret, SPLIT_CONTEXT* s, char last) {
+    ENM4A_ERROR rev = ENM4A_OK;
+    char write_data = 0;
+    while (1) {
+        if ((rev = encode_audio_frame(ret, NULL, s->oc, s->audio_output, s->pkt, &write_data, NULL, s->args->level, 0, s->progress)) != ENM4A_OK) {
+            return rev;
+        }
+        if (!write_data) break;
+    }
+    if ((*ret = av_write_trailer(s->oc)) < 0) {
+        return ENM4A_FFMPEG_ERR;
+    }
+    if (last) finish_progress(s->progress, s->oc, av_rescale(s->pos, AV_TIME_BASE, s->audio_output->sample_rate));
+    if (s->oc->pb) {
+        int64_t size = avio_size(s->oc->pb);
+        s->output_size += size > 0 ? size : avio_tell(s->oc->pb);
+    }
+    if (s->args->level >= ENM4A_LOG_VERBOSE) {
+        printf("Track %zu is written to %s.\n", s->index + 1, s->tracks[s->index].output);
+    }
+    close_track(s);
+    return ENM4A_OK;
+}
+
+/**
+ * @brief Encode samples in FIFO. Current track is finished and next track is opened when its start is reached.
+ * @param flush Encode all remaining samples.
+*/
+static ENM4A_ERROR drain_fifo(int* ret, SPLIT_CONTEXT* s, char flush) {
+    ENM4A_ERROR rev = ENM4A_OK;
+    char write_data = 0;
+    while (1) {
+        int size = av_audio_fifo_size(s->afifo);
+        if (s->pos >= s->end) {
+            // Next track is only opened when it has samples.
+            if (!size) break;
+            if ((rev = finish_track(ret, s, 0)) != ENM4A_OK) {
+                return rev;
+            }
+            s->index++;
+            if ((rev = open_track(ret, s)) != ENM4A_OK) {
+                return rev;
+            }
+        }
+        int nb_samples = (int)FFMIN(s->audio_output->frame_size, s->end - s->pos);
+        if (size < nb_samples) {
+            if (!flush || !size) break;
+            nb_samples = size;
+        }
+        if (!av_frame_is_writable(s->frame)) {
+            // Encoder still holds a reference of the buffer.
+            if ((*ret = av_frame_make_writable(s->frame)) < 0) {
+                return ENM4A_NO_MEMORY;
+            }
+            (*s->allocations)++;
+        }
+        // The last frame of a track may be shorter than frame size.
+        s->frame->nb_samples = nb_samples;
+        if ((*ret = av_audio_fifo_read(s->afifo, (void**)s->frame->data, nb_samples)) < 0) {
+            return ENM4A_NO_MEMORY;
+        }
+        if ((rev = encode_audio_frame(ret, s->frame, s->oc, s->audio_output, s->pkt, &write_data, &s->pts, s->args->level, 0, s->progress)) != ENM4A_OK) {
+            return rev;
+        }
+        s->pos += nb_samples;
+        if (log_packet_enabled(s->args->level)) {
+            log_fifo_size(av_audio_fifo_size(s->afifo));
+        }
+    }
+    return ENM4A_OK;
+}
+
+ENM4A_ERROR encode_m4a_split(const char* input, const ENM4A_SPLIT_TRACK* tracks, size_t count, ENM4A_ARGS args) {
+    if (!input || !tracks) return ENM4A_NULL_POINTER;
+    if (!count) return ENM4A_INVALID_TRACKS;
+    for (size_t i = 0; i < count; i++) {
+        if (!tracks[i].output) return ENM4A_NULL_POINTER;
+        if (tracks[i].start < 0 || (i && tracks[i].start <= tracks[i - 1].start)) return ENM4A_INVALID_TRACKS;
+    }
+    int ret = 0;
+    ENM4A_ERROR rev = ENM4A_OK;
+    AVFormatContext* ic = NULL;
+    ENM4A_INPUT in;
+    char has_audio = 0, finished = 0;
+    unsigned int audio_stream_index = 0;
+    AVPacket pkt;
+    AVFrame* audio_input_frame = NULL;
+    SwrContext* resample_context = NULL;
+    ENM4A_CONVERT_BUFFER convert_buffer = { NULL, 0 };
+    int64_t allocations = 0;
+    ENM4A_PROGRESS_SINK progress;
+    ENM4A_TRIM trim;
+    SPLIT_CONTEXT s;
+    memset(&s, 0, sizeof(SPLIT_CONTEXT));
+    memset(&pkt, 0, sizeof(AVPacket));
+    memset(&in, 0, sizeof(ENM4A_INPUT));
+    init_progress_sink(&progress, &args);
+    s.tracks = tracks;
+    s.count = count;
+    s.args = &args;
+    s.allocations = &allocations;
+    s.progress = &progress;
+    if ((rev = check_conversion_args(&args)) != ENM4A_OK) {
+        goto end;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if ((rev = check_output_file(tracks[i].output, get_output_overwrite(&args, tracks[i].output))) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if ((rev = open_input(&ret, input, NULL, &args, &in)) != ENM4A_OK) {
+        goto end;
+    }
+    ic = in.ic;
+    progress.ic = ic;
+    s.ic = ic;
+    if (!args.quiet) av_dump_format(ic, 0, input, 0);
+    for (unsigned int i = 0; i < ic->nb_streams; i++) {
+        AVStream* is = ic->streams[i];
+        if (is->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && !has_audio) {
+            if ((rev = open_audio_decoder(&ret, is, &args, &s.audio_input)) != ENM4A_OK) {
+                goto end;
+            }
+            has_audio = 1;
+            audio_stream_index = i;
+        } else if (is->codecpar->codec_id == AV_CODEC_ID_MJPEG && is->attached_pic.buf && !s.cover.buf) {
+            if (!(s.cover.buf = av_buffer_ref(is->attached_pic.buf))) {
+                rev = ENM4A_NO_MEMORY;
+                goto end;
+            }
+            s.cover.codec_id = AV_CODEC_ID_MJPEG;
+            s.cover.width = is->codecpar->width;
+            s.cover.height = is->codecpar->height;
+            s.cover.size = is->attached_pic.size;
+        }
+    }
+    if (!has_audio) {
+        rev = ENM4A_NO_AUDIO;
+        goto end;
+    }
+    // Embedded cover is already taken from attached picture.
+    discard_unused_streams(ic, audio_stream_index, -1, args.level);
+    if (in.readahead_pb && (rev = enm4a_readahead_skip_discarded(in.readahead_pb, ic)) != ENM4A_OK) {
+        goto end;
+    }
+    if (args.cover && strlen(args.cover)) {
+        // Cover file takes precedence over embedded one.
+        enm4a_free_cover(&s.cover);
+        if ((rev = enm4a_load_cover(&ret, args.cover, &args, &s.cover)) != ENM4A_OK) {
+            goto end;
+        }
+    }
+    if (!(audio_input_frame = av_frame_alloc())) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    if (!(s.pkt = av_packet_alloc())) {
+        rev = ENM4A_NO_MEMORY;
+        goto end;
+    }
+    allocations += 2;
+    if ((rev = open_track(&ret, &s)) != ENM4A_OK) {
+        goto end;
+    }
+    // All tracks have the same encoder parameters, so converter is shared.
+    if ((rev = init_audio_converter(&ret, s.audio_input, s.audio_output, args.resampler, args.level, &resample_context, &convert_buffer, &s.afifo, &allocations)) != ENM4A_OK) {
+        goto end;
+    }
+    if ((rev = alloc_encoder_frame(&ret, s.audio_output, &s.frame)) != ENM4A_OK) {
+        goto end;
+    }
+    AVStream* is = ic->streams[audio_stream_index];
+    int64_t origin = is->start_time != AV_NOPTS_VALUE ? is->start_time : 0;
+    trim.time_base = is->time_base;
+    trim.start = tracks[0].start > 0 ? origin + av_rescale_q(tracks[0].start, AV_TIME_BASE_Q, is->time_base) : INT64_MIN;
+    trim.end = INT64_MAX;
+    trim.next = INT64_MIN;
+    if (tracks[0].start > 0 && (ret = avformat_seek_file(ic, audio_stream_index, INT64_MIN, trim.start, trim.start, 0)) < 0) {
+        // Packets before start are still dropped after reading.
+        if (args.level >= ENM4A_LOG_VERBOSE) {
+            printf("Can not seek input, read it from the beginning.\n");
+        }
+        ret = 0;
+    }
+    if (ic->duration != AV_NOPTS_VALUE) {
+        progress.duration = FFMAX(ic->duration - tracks[0].start, 0);
+    }
+    while (!finished) {
+        int64_t start = stage_start(&progress);
+        ret = av_read_frame(ic, &pkt);
+        stage_end(&progress, ENM4A_STAGE_DEMUX, start);
+        if (ret >= 0) mark_first_packet(&progress);
+        if (ret < 0) {
+            if (ret != AVERROR_EOF) {
+                rev = ENM4A_FFMPEG_ERR;
+                goto end;
+            }
+            finished = 1;
+        } else if (pkt.stream_index != audio_stream_index) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        if (!finished && log_packet_enabled(args.level)) {
+            log_packet(ic, &pkt, "in");
+        }
+        rev = decode_audio_packet(&ret, s.audio_input, finished ? NULL : &pkt, audio_input_frame, s.audio_output, resample_context, s.afifo, &convert_buffer, &allocations, NULL, NULL, &trim, &progress);
+        if (!finished) av_packet_unref(&pkt);
+        if (rev != ENM4A_OK) {
+            goto end;
+        }
+        if ((rev = drain_fifo(&ret, &s, finished)) != ENM4A_OK) {
+            goto end;
+        }
+        update_progress(&progress, s.oc, s.pos, (AVRational){ 1, s.audio_output->sample_rate });
+    }
+    int64_t duration = av_rescale(s.pos, AV_TIME_BASE, s.audio_output->sample_rate);
+    if ((rev = finish_track(&ret, &s, 1)) != ENM4A_OK) {
+        goto end;
+    }
+    if (s.index + 1 < count) {
+        av_log(NULL, AV_LOG_WARNING, "Input ends before track %zu starts.\n", s.index + 2);
+        rev = ENM4A_INVALID_TRACKS;
+    }
+    if (args.stats) {
+        args.stats->input_size = ic->pb ? ic->pb->bytes_read : 0;
+        args.stats->output_size = s.output_size;
+        args.stats->duration = duration;
+        args.stats->allocations = allocations;
+        args.stats->first_packet = progress.first_packet;
+        if ((args.stats->output = malloc(strlen(tracks[0].output) + 1))) {
+            memcpy(args.stats->output, tracks[0].output, strlen(tracks[0].output) + 1);
+        }
+    }
+end:
+    free_progress_sink(&progress);
+    close_track(&s);
+    if (s.frame) av_frame_free(&s.frame);
+    if (s.pkt) av_packet_free(&s.pkt);
+    if (audio_input_frame) av_frame_free(&audio_input_frame);
+    free_convert_buffer(&convert_buffer);
+    if (s.afifo) av_audio_fifo_free(s.afifo);
+    if (resample_context) swr_free(&resample_context);
+    if (s.audio_input) avcodec_free_context(&s.audio_input);
+    enm4a_free_cover(&s.cover);
+    close_input(&in);
+    if (ret < 0 && ret != AVERROR_EOF) {
+        char err[AV_ERROR_MAX_STRING_SIZE];
+        printf("Error occurred: %s\n", av_make_error_string(err, AV_ERROR_MAX_STRING_SIZE, ret));
+    }
+    return rev;
+}
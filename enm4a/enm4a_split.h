@@ -0,0 +1,40 @@
+#ifndef _ENM4A_ENM4A_SPLIT_H
+#define _ENM4A_ENM4A_SPLIT_H
+#include "enm4a.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// A track of split conversion
+typedef struct ENM4A_SPLIT_TRACK {
+    /// Start of track in input in microseconds. Track ends at the start of next track or the end of input.
+    int64_t start;
+    char* output;
+    /// Tags of track. NULL means not set.
+    char* title;
+    /// If NULL, artist of ENM4A_ARGS or input is used.
+    char* artist;
+    char* track;
+    /// Genre of track. NULL means not set.
+    char* genre;
+} ENM4A_SPLIT_TRACK;
+
+/**
+ * @brief Decode input once and encode every track into its own output.
+ * Input is read sequentially. Output muxer and encoder are replaced when a track boundary is reached,
+ * so every track is cut at the exact sample. Audio is always encoded.
+ * album, album_artist, artist, date, disc and cover of args are written to every track.
+ * output, title, track, outputs, pipeline, segment_threads, loudness, fingerprint, fragment_duration, start_time and duration
+ * of args are ignored. output of stats is the output of the first track.
+ * @param tracks Tracks ordered by start
+ * @param count Number of tracks
+ * @return ENM4A_OK if all tracks are written.
+*/
+ENM4A_ERROR encode_m4a_split(const char* input, const ENM4A_SPLIT_TRACK* tracks, size_t count, ENM4A_ARGS args);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,186 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_telemetry.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if _WIN32
+#include <io.h>
+#define fdopen _fdopen
+#endif
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+static const char* stage_names[ENM4A_STAGE_COUNT] = { "demux", "decode", "resample", "encode", "mux" };
+
+static std::string json_string(const std::string& s) {
+    std::string re = "\"";
+    char buf[8];
+    for (auto i = s.begin(); i != s.end(); i++) {
+        unsigned char c = (unsigned char)*i;
+        if (c == '"' || c == '\\') {
+            re += '\\';
+            re += (char)c;
+        } else if (c == '\n') {
+            re += "\\n";
+        } else if (c == '\r') {
+            re += "\\r";
+        } else if (c == '\t') {
+            re += "\\t";
+        } else if (c < 0x20) {
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            re += buf;
+        } else {
+            re += (char)c;
+        }
+    }
+    return re + "\"";
+}
+
+static std::string json_seconds(int64_t us) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", us / 1000000.0);
+    return buf;
+}
+
+static std::string json_int(int64_t v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, v);
+    return buf;
+}
+
+/// Fields shared by progress and summary records
+static std::string progress_fields(const ENM4A_PROGRESS& p) {
+    char buf[32];
+    std::string re = ",\"time\":" + json_seconds(p.time);
+    re += ",\"duration\":" + (p.duration >= 0 ? json_seconds(p.duration) : std::string("null"));
+    re += ",\"bytes_read\":" + json_int(p.input_size);
+    re += ",\"bytes_written\":" + json_int(p.output_size);
+    re += ",\"elapsed\":" + json_seconds(p.elapsed);
+    snprintf(buf, sizeof(buf), "%.3f", p.elapsed > 0 ? (double)p.time / p.elapsed : 0.0);
+    re += ",\"speed\":";
+    re += buf;
+    re += ",\"first_packet\":" + (p.first_packet >= 0 ? json_seconds(p.first_packet) : std::string("null"));
+    re += ",\"stages\":{";
+    for (int i = 0; i < ENM4A_STAGE_COUNT; i++) {
+        if (i) re += ",";
+        re += "\"" + std::string(stage_names[i]) + "\":" + json_seconds(p.stage_time[i]);
+    }
+    return re + "}";
+}
+
+Enm4aTelemetry::~Enm4aTelemetry() {
+    if (this->file && this->owned) fclose(this->file);
+}
+
+bool Enm4aTelemetry::open(std::string dest) {
+    if (dest == "-") {
+        this->file = stdout;
+        this->owned = false;
+        return true;
+    }
+    if (dest.compare(0, 3, "fd:") == 0) {
+        char* end = nullptr;
+        long fd = strtol(dest.c_str() + 3, &end, 10);
+        if (dest.length() == 3 || *end || fd < 0) {
+            printf("Invalid file descriptor: %s\n", dest.c_str());
+            return false;
+        }
+        this->file = fdopen((int)fd, "w");
+    } else {
+        this->file = fopen(dest.c_str(), "w");
+    }
+    if (!this->file) {
+        printf("Can not open progress output: %s\n", dest.c_str());
+        return false;
+    }
+    this->owned = true;
+    return true;
+}
+
+void Enm4aTelemetry::attach(Enm4aTelemetryJob& job, std::string input, ENM4A_ARGS& args) {
+    job.telemetry = this;
+    job.input = input;
+    job.have_last = false;
+    args.progress = enm4a_telemetry_callback;
+    args.progress_opaque = &job;
+}
+
+void Enm4aTelemetry::write_line(const std::string& line) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (!this->file) return;
+    fputs(line.c_str(), this->file);
+    fputc('\n', this->file);
+    fflush(this->file);
+}
+
+void Enm4aTelemetry::write_progress(const Enm4aTelemetryJob& job, const ENM4A_PROGRESS& progress) {
+    this->write_line("{\"type\":\"progress\",\"input\":" + json_string(job.input) + progress_fields(progress) + "}");
+}
+
+void Enm4aTelemetry::write_summary(const Enm4aTelemetryJob& job, ENM4A_ERROR err, std::string output, bool up_to_date, const char* fingerprint) {
+    std::string line = "{\"type\":\"summary\",\"input\":" + json_string(job.input);
+    if (up_to_date) {
+        line += ",\"status\":\"skipped\",\"error\":\"Up to date\"";
+    } else if (err == ENM4A_OK) {
+        line += ",\"status\":\"ok\"";
+    } else {
+        line += std::string(",\"status\":") + (err == ENM4A_FILE_EXISTS ? "\"skipped\"" : "\"failed\"");
+        line += ",\"error\":" + json_string(enm4a_error_msg(err));
+    }
+    if (output.length()) line += ",\"output\":" + json_string(output);
+    if (fingerprint) line += ",\"fingerprint\":" + json_string(fingerprint);
+    if (job.have_last) line += progress_fields(job.last);
+    this->write_line(line + "}");
+}
+
+void Enm4aTelemetry::write_plan(std::string input, ENM4A_ERROR err, const ENM4A_PLAN& plan) {
+    std::string line = "{\"type\":\"plan\",\"input\":" + json_string(input);
+    if (err != ENM4A_OK) {
+        this->write_line(line + ",\"status\":\"failed\",\"error\":" + json_string(enm4a_error_msg(err)) + "}");
+        return;
+    }
+    char buf[32];
+    line += ",\"status\":\"ok\",\"mode\":";
+    line += plan.mode == ENM4A_PLAN_COPY ? "\"copy\"" : "\"encode\"";
+    line += ",\"stream\":" + json_int(plan.stream_index);
+    line += ",\"codec\":" + json_string(plan.codec);
+    line += ",\"encoder\":" + (plan.encoder[0] ? json_string(plan.encoder) : std::string("null"));
+    line += ",\"input_sample_rate\":" + json_int(plan.input_sample_rate);
+    line += ",\"channels\":" + json_int(plan.channels);
+    line += ",\"sample_rate\":" + json_int(plan.sample_rate);
+    line += ",\"bitrate\":" + (plan.bitrate > 0 ? json_int(plan.bitrate) : std::string("null"));
+    line += std::string(",\"resample\":") + (plan.resample ? "true" : "false");
+    line += ",\"outputs\":" + json_int((int64_t)plan.output_count);
+    line += ",\"duration\":" + (plan.duration >= 0 ? json_seconds(plan.duration) : std::string("null"));
+    line += ",\"input_size\":" + (plan.input_size >= 0 ? json_int(plan.input_size) : std::string("null"));
+    line += ",\"output_size\":" + (plan.output_size >= 0 ? json_int(plan.output_size) : std::string("null"));
+    line += ",\"cpu_time\":";
+    if (plan.cpu_time >= 0) {
+        snprintf(buf, sizeof(buf), "%.3f", plan.cpu_time);
+        line += buf;
+    } else {
+        line += "null";
+    }
+    this->write_line(line + "}");
+}
+
+void Enm4aTelemetry::write_batch(size_t jobs, size_t succeeded, size_t skipped, size_t failed, double elapsed, int64_t duration, int64_t input_size, int64_t output_size) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"type\":\"batch\",\"jobs\":%zu,\"succeeded\":%zu,\"skipped\":%zu,\"failed\":%zu,\"elapsed\":%.3f,\"time\":%.3f,\"bytes_read\":%" PRId64 ",\"bytes_written\":%" PRId64 ",\"speed\":%.3f}", jobs, succeeded, skipped, failed, elapsed, duration / 1000000.0, input_size, output_size, elapsed > 0 ? duration / 1000000.0 / elapsed : 0.0);
+    this->write_line(buf);
+}
+
+void enm4a_telemetry_callback(void* opaque, const ENM4A_PROGRESS* progress) {
+    Enm4aTelemetryJob* job = (Enm4aTelemetryJob*)opaque;
+    job->last = *progress;
+    job->have_last = true;
+    // Final progress is written in summary.
+    if (!progress->finished) job->telemetry->write_progress(*job, *progress);
+}
@@ -0,0 +1,58 @@
+#ifndef _ENM4A_ENM4A_TELEMETRY_H
+#define _ENM4A_ENM4A_TELEMETRY_H
+#include <stdint.h>
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include "enm4a.h"
+#include "enm4a_plan.h"
+
+/// Progress of a job written by Enm4aTelemetry. Pass it as ENM4A_ARGS::progress_opaque.
+typedef struct Enm4aTelemetryJob {
+    class Enm4aTelemetry* telemetry = nullptr;
+    std::string input;
+    /// The last reported progress
+    ENM4A_PROGRESS last;
+    bool have_last = false;
+} Enm4aTelemetryJob;
+
+/**
+ * @brief Write progress as JSON lines. Every line is an object with a type field:
+ * progress: periodic record of a job.
+ * summary: result of a job.
+ * batch: result of all jobs in batch mode.
+ * plan: planned conversion of a job in plan mode.
+ * Times are in seconds. Thread safe.
+*/
+class Enm4aTelemetry {
+public:
+    ~Enm4aTelemetry();
+    /**
+     * @brief Open destination.
+     * @param dest "-" means stdout. "fd:<n>" means file descriptor n. Other values are file paths.
+    */
+    bool open(std::string dest);
+    bool is_stdout() const { return this->file == stdout; }
+    /// Set callback and opaque of args to report to job.
+    void attach(Enm4aTelemetryJob& job, std::string input, ENM4A_ARGS& args);
+    void write_progress(const Enm4aTelemetryJob& job, const ENM4A_PROGRESS& progress);
+    /**
+     * @brief Write result of a job.
+     * @param output Output file. Can be empty.
+     * @param up_to_date true if job is skipped because output is up to date.
+     * @param fingerprint Fingerprint of audio. Can be NULL.
+    */
+    void write_summary(const Enm4aTelemetryJob& job, ENM4A_ERROR err, std::string output, bool up_to_date = false, const char* fingerprint = nullptr);
+    /// Write plan of a job. plan is not used if err is not ENM4A_OK.
+    void write_plan(std::string input, ENM4A_ERROR err, const ENM4A_PLAN& plan);
+    void write_batch(size_t jobs, size_t succeeded, size_t skipped, size_t failed, double elapsed, int64_t duration, int64_t input_size, int64_t output_size);
+private:
+    void write_line(const std::string& line);
+    FILE* file = nullptr;
+    bool owned = false;
+    std::mutex lock;
+};
+
+/// ENM4A_PROGRESS_CALLBACK which takes Enm4aTelemetryJob as opaque
+void enm4a_telemetry_callback(void* opaque, const ENM4A_PROGRESS* progress);
+#endif
@@ -0,0 +1,114 @@
+#include "enm4a_thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI thread_proc(LPVOID arg) {
+    ENM4A_THREAD* t = (ENM4A_THREAD*)arg;
+    t->result = t->func(t->arg);
+    return 0;
+}
+
+int enm4a_thread_create(ENM4A_THREAD* t, void* (*func)(void*), void* arg) {
+    if (!t || !func) return 1;
+    t->func = func;
+    t->arg = arg;
+    t->result = NULL;
+    t->handle = CreateThread(NULL, 0, thread_proc, t, 0, NULL);
+    return t->handle ? 0 : 1;
+}
+
+void* enm4a_thread_join(ENM4A_THREAD* t) {
+    if (!t || !t->handle) return NULL;
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    t->handle = NULL;
+    return t->result;
+}
+
+int enm4a_mutex_init(ENM4A_MUTEX* m) {
+    if (!m) return 1;
+    InitializeSRWLock(m);
+    return 0;
+}
+
+void enm4a_mutex_lock(ENM4A_MUTEX* m) {
+    AcquireSRWLockExclusive(m);
+}
+
+void enm4a_mutex_unlock(ENM4A_MUTEX* m) {
+    ReleaseSRWLockExclusive(m);
+}
+
+void enm4a_mutex_destroy(ENM4A_MUTEX* m) {
+}
+
+int enm4a_cond_init(ENM4A_COND* c) {
+    if (!c) return 1;
+    InitializeConditionVariable(c);
+    return 0;
+}
+
+void enm4a_cond_wait(ENM4A_COND* c, ENM4A_MUTEX* m) {
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+
+void enm4a_cond_signal(ENM4A_COND* c) {
+    WakeConditionVariable(c);
+}
+
+void enm4a_cond_broadcast(ENM4A_COND* c) {
+    WakeAllConditionVariable(c);
+}
+
+void enm4a_cond_destroy(ENM4A_COND* c) {
+}
+#else
+int enm4a_thread_create(ENM4A_THREAD* t, void* (*func)(void*), void* arg) {
+    if (!t || !func) return 1;
+    return pthread_create(&t->thread, NULL, func, arg);
+}
+
+void* enm4a_thread_join(ENM4A_THREAD* t) {
+    void* result = NULL;
+    if (!t) return NULL;
+    pthread_join(t->thread, &result);
+    return result;
+}
+
+int enm4a_mutex_init(ENM4A_MUTEX* m) {
+    if (!m) return 1;
+    return pthread_mutex_init(m, NULL);
+}
+
+void enm4a_mutex_lock(ENM4A_MUTEX* m) {
+    pthread_mutex_lock(m);
+}
+
+void enm4a_mutex_unlock(ENM4A_MUTEX* m) {
+    pthread_mutex_unlock(m);
+}
+
+void enm4a_mutex_destroy(ENM4A_MUTEX* m) {
+    pthread_mutex_destroy(m);
+}
+
+int enm4a_cond_init(ENM4A_COND* c) {
+    if (!c) return 1;
+    return pthread_cond_init(c, NULL);
+}
+
+void enm4a_cond_wait(ENM4A_COND* c, ENM4A_MUTEX* m) {
+    pthread_cond_wait(c, m);
+}
+
+void enm4a_cond_signal(ENM4A_COND* c) {
+    pthread_cond_signal(c);
+}
+
+void enm4a_cond_broadcast(ENM4A_COND* c) {
+    pthread_cond_broadcast(c);
+}
+
+void enm4a_cond_destroy(ENM4A_COND* c) {
+    pthread_cond_destroy(c);
+}
+#endif
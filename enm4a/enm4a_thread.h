@@ -0,0 +1,57 @@
+#ifndef _ENM4A_ENM4A_THREAD_H
+#define _ENM4A_ENM4A_THREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef _WIN32
+#include <Windows.h>
+typedef SRWLOCK ENM4A_MUTEX;
+/// Initializer of static mutex, which does not need enm4a_mutex_init and enm4a_mutex_destroy.
+#define ENM4A_MUTEX_INITIALIZER SRWLOCK_INIT
+typedef CONDITION_VARIABLE ENM4A_COND;
+typedef struct ENM4A_THREAD {
+    HANDLE handle;
+    void* (*func)(void*);
+    void* arg;
+    void* result;
+} ENM4A_THREAD;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t ENM4A_MUTEX;
+#define ENM4A_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+typedef pthread_cond_t ENM4A_COND;
+typedef struct ENM4A_THREAD {
+    pthread_t thread;
+} ENM4A_THREAD;
+#endif
+
+/**
+ * @brief Start a new thread
+ * @param t Thread. Should be kept until enm4a_thread_join is called.
+ * @param func Thread function
+ * @param arg Argument passed to thread function
+ * @return 0 if successed.
+*/
+int enm4a_thread_create(ENM4A_THREAD* t, void* (*func)(void*), void* arg);
+/**
+ * @brief Wait thread exit
+ * @return The return value of thread function
+*/
+void* enm4a_thread_join(ENM4A_THREAD* t);
+/// @return 0 if successed.
+int enm4a_mutex_init(ENM4A_MUTEX* m);
+void enm4a_mutex_lock(ENM4A_MUTEX* m);
+void enm4a_mutex_unlock(ENM4A_MUTEX* m);
+void enm4a_mutex_destroy(ENM4A_MUTEX* m);
+/// @return 0 if successed.
+int enm4a_cond_init(ENM4A_COND* c);
+void enm4a_cond_wait(ENM4A_COND* c, ENM4A_MUTEX* m);
+void enm4a_cond_signal(ENM4A_COND* c);
+void enm4a_cond_broadcast(ENM4A_COND* c);
+void enm4a_cond_destroy(ENM4A_COND* c);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,242 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "enm4a_trace.h"
+#include "enm4a_thread.h"
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <string.h>
+
+#include "libavutil/avutil.h"
+#include "libavutil/time.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+/// Time to sleep when buffer is empty
+#define WRITER_IDLE_US 2000
+
+#if _MSC_VER
+static int64_t load_acquire(volatile int64_t* p) {
+    return InterlockedCompareExchange64(p, 0, 0);
+}
+static void store_release(volatile int64_t* p, int64_t v) {
+    InterlockedExchange64(p, v);
+}
+/// @return 1 if *p was expected and is replaced with desired. Otherwise expected is set to *p.
+static int compare_exchange(volatile int64_t* p, int64_t* expected, int64_t desired) {
+    int64_t old = InterlockedCompareExchange64(p, desired, *expected);
+    if (old == *expected) return 1;
+    *expected = old;
+    return 0;
+}
+static void fetch_add(volatile int64_t* p, int64_t v) {
+    InterlockedExchangeAdd64(p, v);
+}
+#else
+static int64_t load_acquire(volatile int64_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static void store_release(volatile int64_t* p, int64_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+static int compare_exchange(volatile int64_t* p, int64_t* expected, int64_t desired) {
+    return __atomic_compare_exchange_n(p, expected, desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+static void fetch_add(volatile int64_t* p, int64_t v) {
+    __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+#endif
+
+/// Slot of ring buffer. seq equals position when slot is free, and position + 1 when record is ready.
+typedef struct TRACE_SLOT {
+    volatile int64_t seq;
+    ENM4A_TRACE_RECORD record;
+} TRACE_SLOT;
+
+typedef struct TRACE_WRITER {
+    TRACE_SLOT* slots;
+    /// Next position to be claimed by producers
+    volatile int64_t head;
+    /// Next position to be read by writer thread. Only used by writer thread.
+    int64_t tail;
+    volatile int64_t dropped;
+    volatile int64_t stop;
+    int64_t start;
+    /// Raw dump. NULL if records are printed as text.
+    FILE* dump;
+    ENM4A_THREAD thread;
+} TRACE_WRITER;
+
+static TRACE_WRITER writer;
+static volatile int64_t enabled = 0;
+
+/// @return Number of records written
+static size_t drain(int64_t* reported_dropped) {
+    char buf[256];
+    size_t count = 0;
+    ENM4A_TRACE_RECORD dropped;
+    int64_t d = load_acquire(&writer.dropped);
+    if (d != *reported_dropped) {
+        memset(&dropped, 0, sizeof(dropped));
+        dropped.time = av_gettime_relative() - writer.start;
+        dropped.type = ENM4A_TRACE_DROPPED;
+        dropped.value = d - *reported_dropped;
+        *reported_dropped = d;
+        if (writer.dump) {
+            fwrite(&dropped, sizeof(dropped), 1, writer.dump);
+        } else if (enm4a_trace_format(buf, sizeof(buf), &dropped) >= 0) {
+            printf("%s\n", buf);
+        }
+        count++;
+    }
+    while (1) {
+        TRACE_SLOT* slot = &writer.slots[writer.tail & (ENM4A_TRACE_CAPACITY - 1)];
+        if (load_acquire(&slot->seq) != writer.tail + 1) break;
+        if (writer.dump) {
+            fwrite(&slot->record, sizeof(ENM4A_TRACE_RECORD), 1, writer.dump);
+        } else if (enm4a_trace_format(buf, sizeof(buf), &slot->record) >= 0) {
+            printf("%s\n", buf);
+        }
+        store_release(&slot->seq, writer.tail + ENM4A_TRACE_CAPACITY);
+        writer.tail++;
+        count++;
+    }
+    return count;
+}
+
+static void* writer_thread(void* arg) {
+    int64_t reported_dropped = 0;
+    while (!load_acquire(&writer.stop)) {
+        if (!drain(&reported_dropped)) {
+            fflush(writer.dump ? writer.dump : stdout);
+            av_usleep(WRITER_IDLE_US);
+        }
+    }
+    drain(&reported_dropped);
+    fflush(writer.dump ? writer.dump : stdout);
+    return NULL;
+}
+
+ENM4A_ERROR enm4a_trace_start(const char* dump) {
+    if (load_acquire(&enabled)) return ENM4A_OK;
+    memset(&writer, 0, sizeof(TRACE_WRITER));
+    writer.slots = malloc(sizeof(TRACE_SLOT) * ENM4A_TRACE_CAPACITY);
+    if (!writer.slots) return ENM4A_NO_MEMORY;
+    for (int64_t i = 0; i < ENM4A_TRACE_CAPACITY; i++) {
+        writer.slots[i].seq = i;
+    }
+    if (dump) {
+        ENM4A_TRACE_HEADER header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ENM4A_TRACE_MAGIC, sizeof(header.magic));
+        header.version = ENM4A_TRACE_VERSION;
+        header.record_size = sizeof(ENM4A_TRACE_RECORD);
+        writer.dump = fopen(dump, "wb");
+        if (!writer.dump || fwrite(&header, sizeof(header), 1, writer.dump) != 1) {
+            if (writer.dump) fclose(writer.dump);
+            free(writer.slots);
+            writer.slots = NULL;
+            return ENM4A_ERR_OPEN_FILE;
+        }
+    }
+    writer.start = av_gettime_relative();
+    if (enm4a_thread_create(&writer.thread, writer_thread, NULL)) {
+        if (writer.dump) fclose(writer.dump);
+        free(writer.slots);
+        writer.slots = NULL;
+        return ENM4A_NO_MEMORY;
+    }
+    store_release(&enabled, 1);
+    return ENM4A_OK;
+}
+
+void enm4a_trace_stop(void) {
+    if (!load_acquire(&enabled)) return;
+    store_release(&enabled, 0);
+    store_release(&writer.stop, 1);
+    enm4a_thread_join(&writer.thread);
+    if (writer.dump) fclose(writer.dump);
+    free(writer.slots);
+    writer.slots = NULL;
+}
+
+int enm4a_trace_enabled(void) {
+    return load_acquire(&enabled) ? 1 : 0;
+}
+
+void enm4a_trace_push(const ENM4A_TRACE_RECORD* record) {
+    if (!record || !load_acquire(&enabled)) return;
+    int64_t pos = load_acquire(&writer.head);
+    TRACE_SLOT* slot;
+    while (1) {
+        slot = &writer.slots[pos & (ENM4A_TRACE_CAPACITY - 1)];
+        int64_t diff = load_acquire(&slot->seq) - pos;
+        if (diff == 0) {
+            if (compare_exchange(&writer.head, &pos, pos + 1)) break;
+        } else if (diff < 0) {
+            // Writer is behind. Drop instead of waiting.
+            fetch_add(&writer.dropped, 1);
+            return;
+        } else {
+            pos = load_acquire(&writer.head);
+        }
+    }
+    slot->record = *record;
+    slot->record.time = av_gettime_relative() - writer.start;
+    store_release(&slot->seq, pos + 1);
+}
+
+/// Format timestamp like av_ts2str and av_ts2timestr
+static void format_ts(char* buf, size_t size, int64_t ts, int32_t num, int32_t den, char time) {
+    if (ts == AV_NOPTS_VALUE) {
+        snprintf(buf, size, "NOPTS");
+    } else if (time) {
+        snprintf(buf, size, "%.6g", den ? (double)ts * num / den : 0.0);
+    } else {
+        snprintf(buf, size, "%" PRId64, ts);
+    }
+}
+
+int enm4a_trace_format(char* buf, size_t size, const ENM4A_TRACE_RECORD* r) {
+    if (!buf || !r) return -1;
+    double t = r->time / 1000000.0;
+    switch (r->type) {
+    case ENM4A_TRACE_PACKET_IN:
+    case ENM4A_TRACE_PACKET_OUT: {
+        char pts[32], pts_time[32], dts[32], dts_time[32], dur[32], dur_time[32];
+        format_ts(pts, sizeof(pts), r->pts, r->time_base_num, r->time_base_den, 0);
+        format_ts(pts_time, sizeof(pts_time), r->pts, r->time_base_num, r->time_base_den, 1);
+        format_ts(dts, sizeof(dts), r->dts, r->time_base_num, r->time_base_den, 0);
+        format_ts(dts_time, sizeof(dts_time), r->dts, r->time_base_num, r->time_base_den, 1);
+        format_ts(dur, sizeof(dur), r->duration, r->time_base_num, r->time_base_den, 0);
+        format_ts(dur_time, sizeof(dur_time), r->duration, r->time_base_num, r->time_base_den, 1);
+        return snprintf(buf, size, "[%.6f] %s: pts:%s pts_time:%s dts:%s dts_time:%s duration:%s duration_time:%s size:%" PRId32 " stream_index:%" PRId32,
+            t, r->type == ENM4A_TRACE_PACKET_IN ? "in" : "out", pts, pts_time, dts, dts_time, dur, dur_time, r->size, r->stream_index);
+    }
+    case ENM4A_TRACE_FIFO_SIZE:
+        return snprintf(buf, size, "[%.6f] the size of fifo: %" PRId64, t, r->value);
+    case ENM4A_TRACE_DROPPED:
+        return snprintf(buf, size, "[%.6f] dropped %" PRId64 " records", t, r->value);
+    default:
+        return snprintf(buf, size, "[%.6f] unknown event %" PRIu32, t, r->type);
+    }
+}
+
+ENM4A_ERROR enm4a_trace_read_header(FILE* f) {
+    ENM4A_TRACE_HEADER header;
+    if (!f) return ENM4A_NULL_POINTER;
+    if (fread(&header, sizeof(header), 1, f) != 1) return ENM4A_ERR_OPEN_FILE;
+    if (memcmp(header.magic, ENM4A_TRACE_MAGIC, sizeof(header.magic)) || header.version != ENM4A_TRACE_VERSION || header.record_size != sizeof(ENM4A_TRACE_RECORD)) {
+        return ENM4A_INVALID_TRACE;
+    }
+    return ENM4A_OK;
+}
+
+int enm4a_trace_read(FILE* f, ENM4A_TRACE_RECORD* record) {
+    if (!f || !record) return 0;
+    return fread(record, sizeof(ENM4A_TRACE_RECORD), 1, f) == 1;
+}
@@ -0,0 +1,78 @@
+#ifndef _ENM4A_ENM4A_TRACE_H
+#define _ENM4A_ENM4A_TRACE_H
+#include "enm4a.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/// Magic at the begin of raw trace dump
+#define ENM4A_TRACE_MAGIC "ENM4ATRC"
+#define ENM4A_TRACE_VERSION 1
+/// Number of records can be buffered before new records are dropped. Must be a power of 2.
+#define ENM4A_TRACE_CAPACITY 65536
+
+typedef enum ENM4A_TRACE_EVENT {
+    /// Packet read from input
+    ENM4A_TRACE_PACKET_IN,
+    /// Packet written to output
+    ENM4A_TRACE_PACKET_OUT,
+    /// value is the number of samples in FIFO of encoder
+    ENM4A_TRACE_FIFO_SIZE,
+    /// value is the number of records dropped because buffer is full
+    ENM4A_TRACE_DROPPED,
+} ENM4A_TRACE_EVENT;
+
+/// Fixed size record. Raw dumps use native byte order.
+typedef struct ENM4A_TRACE_RECORD {
+    /// Microseconds since tracing started
+    int64_t time;
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    int32_t stream_index;
+    int32_t size;
+    /// ENM4A_TRACE_EVENT
+    uint32_t type;
+    uint32_t reserved;
+    int64_t value;
+} ENM4A_TRACE_RECORD;
+
+/// Header of raw trace dump
+typedef struct ENM4A_TRACE_HEADER {
+    char magic[8];
+    uint32_t version;
+    /// sizeof(ENM4A_TRACE_RECORD)
+    uint32_t record_size;
+} ENM4A_TRACE_HEADER;
+
+/**
+ * @brief Start background trace writer. Packet events of all conversions are recorded
+ * into a lock-free ring buffer instead of being printed on the encode thread.
+ * @param dump Path of raw dump. If NULL, records are formatted and printed to stdout.
+*/
+ENM4A_ERROR enm4a_trace_start(const char* dump);
+/// Write remaining records and stop background writer. Should be called when no conversion is running.
+void enm4a_trace_stop(void);
+/// @return 1 if background trace writer is running.
+int enm4a_trace_enabled(void);
+/// Add a record. Never blocks. Record is dropped if buffer is full.
+void enm4a_trace_push(const ENM4A_TRACE_RECORD* record);
+/**
+ * @brief Format a record as a text line without line break.
+ * @return The same as snprintf.
+*/
+int enm4a_trace_format(char* buf, size_t size, const ENM4A_TRACE_RECORD* record);
+/// Read and check header of raw dump. @return ENM4A_OK if it is a supported dump.
+ENM4A_ERROR enm4a_trace_read_header(FILE* f);
+/// @return 1 if a record is read, 0 if end of file reached.
+int enm4a_trace_read(FILE* f, ENM4A_TRACE_RECORD* record);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,71 @@
+#if HAVE_ENM4A_CONFIG_H
+#include "enm4a_config.h"
+#endif
+
+#include "getopt.h"
+#include <stdio.h>
+#include <string.h>
+#include "enm4a.h"
+#include "enm4a_trace.h"
+
+#if HAVE_PRINTF_S
+#define printf printf_s
+#endif
+
+void print_help() {
+    printf("%s", "Usage: enm4a_trace_dump [options] FILE...\n\
+Print raw trace dumps written by enm4a --trace-dump as text.\n\
+\n\
+Options:\n\
+    -h, --help              Print help message.\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct option opts[] = {
+        {"help", 0, nullptr, 'h'},
+        nullptr,
+    };
+    int c;
+    const char* shortopts = "h";
+    while ((c = getopt_long(argc, argv, shortopts, opts, nullptr)) != -1) {
+        switch (c) {
+        case 'h':
+            print_help();
+            return 0;
+        case '?':
+        default:
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        printf("%s\n", "A trace dump is needed.");
+        return 1;
+    }
+    int re = 0;
+    char buf[256];
+    ENM4A_TRACE_RECORD record;
+    for (int i = optind; i < argc; i++) {
+        FILE* f = fopen(argv[i], "rb");
+        if (!f) {
+            printf("Can not open file: %s\n", argv[i]);
+            re = 1;
+            continue;
+        }
+        ENM4A_ERROR err = enm4a_trace_read_header(f);
+        if (err != ENM4A_OK) {
+            printf("%s: %s\n", argv[i], enm4a_error_msg(err));
+            fclose(f);
+            re = 1;
+            continue;
+        }
+        while (enm4a_trace_read(f, &record)) {
+            if (enm4a_trace_format(buf, sizeof(buf), &record) >= 0) printf("%s\n", buf);
+        }
+        if (ferror(f)) {
+            printf("Can not read file: %s\n", argv[i]);
+            re = 1;
+        }
+        fclose(f);
+    }
+    return re;
+}
@@ -9,7 +9,17 @@
 #include <string.h>
 #include <malloc.h>
 #include <list>
+#include <set>
+#include <vector>
+#include <thread>
 #include "enm4a.h"
+#include "enm4a_batch.h"
+#include "enm4a_cue.h"
+#include "enm4a_plan.h"
+#include "enm4a_server.h"
+#include "enm4a_split.h"
+#include "enm4a_telemetry.h"
+#include "enm4a_trace.h"
 #include "cpp2c.h"
 #include "fileop.h"
 
@@ -24,14 +34,82 @@
 #define sscanf sscanf_s
 #endif
 
+/**
+ * @brief Parse extra output in <bitrate>[,<sample_rate>]:<FILE> form.
+ * Sample rate is checked by check_sample_rate after encoder is known.
+ * @param path Output file. o.output is not set.
+*/
+bool parse_extra_output(std::string spec, std::string& path, ENM4A_OUTPUT& o) {
+    memset(&o, 0, sizeof(ENM4A_OUTPUT));
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos || colon == spec.length() - 1) {
+        printf("Extra output should be in <bitrate>[,<sample_rate>]:<FILE> form: %s\n", spec.c_str());
+        return false;
+    }
+    std::string bitrate = spec.substr(0, colon);
+    path = spec.substr(colon + 1);
+    size_t comma = bitrate.find(',');
+    if (comma != std::string::npos) {
+        int sample_rate;
+        if (sscanf(bitrate.c_str() + comma + 1, "%d", &sample_rate) != 1) {
+            printf("Sample rate should be a integer: %s\n", bitrate.c_str() + comma + 1);
+            return false;
+        }
+        o.sample_rate = sample_rate;
+        bitrate = bitrate.substr(0, comma);
+    }
+    size_t bits;
+    if (bitrate.length() && !fileop::parse_size(bitrate, bits, false)) {
+        printf("Can not parse size string.\n");
+        return false;
+    }
+    if (bitrate.length()) o.bitrate = bits;
+    return true;
+}
+
+/**
+ * @brief Check sample rate is supported by AAC encoder.
+ * @param encoder Encoder name. Empty means default encoder.
+*/
+bool check_sample_rate(const std::string& encoder, int sample_rate) {
+    int supported = 0;
+    ENM4A_ERROR err = enm4a_encoder_supports_sample_rate(encoder.length() ? encoder.c_str() : nullptr, sample_rate, &supported);
+    if (err != ENM4A_OK) {
+        printf("Can not check sample rate is supported by AAC encoder: %s\n", enm4a_error_msg(err));
+        return false;
+    }
+    if (!supported) {
+        printf("%i is not supported by AAC encoder.\n", sample_rate);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parse threads of codec.
+ * @param threads Result. auto means ENM4A_THREADS_AUTO.
+*/
+bool parse_codec_threads(const char* value, int& threads) {
+    if (!strcmp(value, "auto")) {
+        threads = ENM4A_THREADS_AUTO;
+        return true;
+    }
+    if (sscanf(value, "%d", &threads) != 1 || threads < 1) {
+        printf("Codec threads should be a positive integer or auto.\n");
+        return false;
+    }
+    return true;
+}
+
 void print_help() {
-    printf("%s", "Usage: enm4a [options] FILE\n\
+    printf("%s", "Usage: enm4a [options] FILE [FILE...]\n\
 Convert file to m4a file\n\
 \n\
 Options:\n\
     -h, --help              Print help message.\n\
     -o, --output <FILE>     Specifiy output file location. Default output location: <title>.m4a.\n\
                             If title is not found, will use input filename instead.\n\
+                            \"-\" means stdout. Fragmented mp4 will be written.\n\
     -v, --verbose           Enable verbose logging.\n\
         --debug             Enable debug logging.\n\
         --trace             Enable trace logging.\n\
@@ -53,10 +131,126 @@ Options:\n\
     -s, --sample_rate <value>   Specify output sample rate.\n\
     -b, --bitrate <size>    Specify output bitrate.\n\
         --print_level       Print log level.\n\
+    -j, --jobs <num>        Specify the number of conversions run at the same time in batch mode.\n\
+                            Default: the number of CPU cores.\n\
+        --batch <FILE>      Read conversion jobs from manifest file. \"-\" means stdin.\n\
+        --incremental <FILE>    Record finished conversions in FILE and skip conversions\n\
+                            whose input, options and output are unchanged. Outdated\n\
+                            outputs written by previous runs are overwritten.\n\
+        --pipeline          Demux, decode and encode in separate threads.\n\
+                            Only have effect when encoder is used.\n\
+        --extra-output <bitrate>[,<sample_rate>]:<FILE>\n\
+                            Also encode decoded audio with specified bitrate and sample\n\
+                            rate to FILE. Can be specified multiple times.\n\
+                            eg. --extra-output 128k:a_128k.m4a --extra-output 64k,22050:a_64k.m4a\n\
+        --segment-threads <num> Cut decoded audio into segments and encode them in\n\
+                            parallel. 0 means the number of CPU cores.\n\
+                            Only have effect when encoder is used.\n\
+        --resampler <profile>   Specify resampler profile. Available profiles: fast,\n\
+                            default, high. high will use soxr if available.\n\
+        --faststart <mode>  Place moov box at the begin of output. Available modes:\n\
+                            none, reserve: reserve estimated space before writing,\n\
+                            rewrite: move moov box after writing. Default: none.\n\
+        --fragment <seconds>    Write fragmented mp4 with fragments of specified duration.\n\
+                            Default: 2 if output is stdout, otherwise not fragmented.\n\
+        --loudness          Measure EBU R128 loudness and true peak, then write them and\n\
+                            ReplayGain track gain and peak as tags. Copied AAC stream is\n\
+                            decoded for measurement. Tags are not written to fragmented output.\n\
+        --start <seconds>   Start converting at specified time of input. Input is seeked to\n\
+                            the nearest preceding packet. Copied AAC stream is cut at packet\n\
+                            boundaries, encoded audio is cut at the exact sample.\n\
+        --duration <seconds>    Only convert specified duration of input. Input is not read\n\
+                            after the end is reached.\n\
+        --probesize <size>  Maximum bytes read to detect input format and streams.\n\
+                            eg. --probesize 32K\n\
+        --analyzeduration <seconds> Maximum duration of input analyzed to get stream\n\
+                            information.\n\
+        --input-format <name>   Specify input format instead of detecting it, eg. flac.\n\
+        --trust-headers     Skip analyzing packets if container headers already have complete\n\
+                            codec parameters. Reduce time to the first packet, especially for\n\
+                            HTTP input. Input duration may be less accurate.\n\
+        --readahead <size>  Read HTTP(S) input into a buffer of specified size in a background\n\
+                            thread, and resume dropped connections with Range requests.\n\
+                            eg. --readahead 8M\n\
+        --progress <format> Write machine readable progress. Available formats: json.\n\
+                            See PROGRESS.\n\
+        --progress-output <dest>    Destination of progress. \"-\" means stdout,\n\
+                            \"fd:<n>\" means file descriptor n, others are file paths.\n\
+                            Default: -\n\
+        --trace-dump <FILE> Record packet events into FILE in binary form. Events are buffered\n\
+                            and written by a background thread, so conversion is not slowed\n\
+                            down. Use enm4a_trace_dump to print it. At trace level without\n\
+                            this option, events are printed to stdout by the background thread.\n\
+        --serve <SOCKET>    Listen on a Unix domain socket and run conversion jobs sent by\n\
+                            clients on -j worker threads. Socket file is created with\n\
+                            mode 0600, so only its owner can connect. See SERVER MODE.\n\
+        --cue <FILE>        Split input into tracks described by CUE sheet. Input is decoded\n\
+                            once and every track is encoded to \"<number> - <title>.m4a\".\n\
+                            Input file defaults to the FILE of CUE sheet. -o specifies the\n\
+                            output directory, default is the directory of CUE sheet.\n\
+                            Album tags are read from CUE sheet if not specified. REM GENRE\n\
+                            is written as genre of every track.\n\
+        --retag             Change metadata of existing m4a files in place instead of\n\
+                            converting. Only title, artist, album, album_artist, disc,\n\
+                            track, date and cover are used. Empty value removes the tag.\n\
+                            Media data is not rewritten.\n\
+        --cover-max-size <px>   Downscale cover so that its longest edge is not larger than\n\
+                            px, then encode it as JPEG. Smaller covers are kept as is.\n\
+        --cover-quality <2-31>  JPEG quality scale of encoded cover. Lower is better.\n\
+                            Default: 3\n\
+        --cover-recompress  Always encode cover as JPEG even if it is small enough.\n\
+        --cover-cache <DIR> Store encoded covers in DIR, keyed by the hash of cover file and\n\
+                            encoding options. Encoded covers are always shared by jobs in\n\
+                            batch mode and server mode.\n\
+        --plan              Only probe inputs and write how they would be converted, without\n\
+                            writing outputs. See PLAN.\n\
+        --fingerprint       Compute a chroma fingerprint of the first 120 seconds of decoded\n\
+                            audio, then print it, add it to JSON summary and write it as\n\
+                            enm4a_fingerprint tag. Copied AAC stream is decoded for it.\n\
+                            Tag is not written to fragmented output.\n\
+        --encoder <name>    Specify AAC encoder, eg. native (aac), libfdk_aac, aac_at.\n\
+                            Default: the first available one of libfdk_aac, aac_at and aac.\n\
+        --decoder-threads <num> Threads of decoder. auto means the number of CPU cores.\n\
+                            Default: 1. Most audio decoders are single threaded.\n\
+        --encoder-threads <num> Threads of every encoder. Same as --decoder-threads.\n\
+        --thread-type <type>    Threading method of decoder and encoder. Available types:\n\
+                            auto, frame, slice. Default: auto.\n\
 \n\
 NOTES:\n\
     default_sample_rate, sample_rate, bitrate have no effect if encoder was not used.\n\
-    AAC stream will be copyed by default.\n");
+    AAC stream will be copyed by default.\n\
+    AAC stream will be encoded if extra output is specified.\n\
+\n\
+BATCH MODE:\n\
+    Batch mode is used when more than one input file is specified or --batch is used.\n\
+    Every line of manifest file is a job. Fields are separated by tab. The first field is\n\
+    input file, other fields are key=value overrides. Available keys: output, title,\n\
+    artist, album, album_artist, cover, disc, track, date, sample_rate, bitrate.\n\
+    Options in command line are used as default values of every job.\n\
+    Existing output files are skipped unless -y is specified.\n\
+\n\
+SERVER MODE:\n\
+    Every line sent to the socket is a job in the same form as a line of manifest file.\n\
+    \"shutdown\" stops the server after queued jobs are finished. Replies are tab separated:\n\
+    accepted <id> <input>, error <message>,\n\
+    progress <id> <time_us> <duration_us> <bytes_read> <bytes_written>,\n\
+    done <id> ok <output> [<fingerprint>] | skipped <message> | failed <message>.\n\
+\n\
+PROGRESS:\n\
+    --progress json writes one JSON object per line. Times are in seconds.\n\
+    progress: input, time, duration, bytes_read, bytes_written, elapsed, speed (realtime\n\
+    factor), stages (time spent in demux, decode, resample, encode and mux) and first_packet\n\
+    (time from start to the first packet read from input, null if unknown).\n\
+    summary: result of a conversion with status (ok, skipped or failed), error, output,\n\
+    fingerprint (with --fingerprint) and the final numbers of progress.\n\
+    batch: totals of all jobs in batch mode.\n\
+\n\
+PLAN:\n\
+    --plan writes one JSON object per input to progress output, in the order of inputs.\n\
+    Fields: input, status (ok or failed), error, mode (copy or encode), stream, codec, encoder,\n\
+    input_sample_rate, channels, sample_rate, bitrate, resample, outputs, duration (seconds),\n\
+    input_size, output_size (estimated bytes of all outputs) and cpu_time (estimated seconds).\n\
+    Unknown values are null.\n");
 }
 
 void print_version(bool verbose) {
@@ -75,6 +269,23 @@ under certain conditions.\n", ENM4A_VERSION);
     }
 }
 
+/// Stop background trace writer when main returns
+class Enm4aTraceWriter {
+public:
+    ~Enm4aTraceWriter() {
+        enm4a_trace_stop();
+    }
+};
+
+/// Own cover cache shared by all jobs
+class Enm4aCoverCache {
+public:
+    ENM4A_COVER_CACHE* cache = nullptr;
+    ~Enm4aCoverCache() {
+        enm4a_cover_cache_free(&this->cache);
+    }
+};
+
 class Enm4aHTTPHeaderList : public std::list<ENM4A_HTTP_HEADER*> {
 public:
     ~Enm4aHTTPHeaderList() {
@@ -90,6 +301,38 @@ public:
 #define ENM4A_DEBUG 131
 #define ENM4A_DEFAULT_SAMPLE_RATE 132
 #define ENM4A_PRINT_LEVEL 133
+#define ENM4A_BATCH 134
+#define ENM4A_PIPELINE 135
+#define ENM4A_RESAMPLER_OPT 136
+#define ENM4A_FASTSTART_OPT 137
+#define ENM4A_FRAGMENT 138
+#define ENM4A_SEGMENT_THREADS 139
+#define ENM4A_EXTRA_OUTPUT 140
+#define ENM4A_LOUDNESS_OPT 141
+#define ENM4A_RETAG 142
+#define ENM4A_INCREMENTAL 143
+#define ENM4A_SERVE 144
+#define ENM4A_READAHEAD 145
+#define ENM4A_PROGRESS_OPT 146
+#define ENM4A_PROGRESS_OUTPUT 147
+#define ENM4A_TRACE_DUMP 148
+#define ENM4A_PROBESIZE 149
+#define ENM4A_ANALYZEDURATION 150
+#define ENM4A_INPUT_FORMAT 151
+#define ENM4A_TRUST_HEADERS 152
+#define ENM4A_START 153
+#define ENM4A_DURATION 154
+#define ENM4A_CUE 155
+#define ENM4A_COVER_MAX_SIZE 156
+#define ENM4A_COVER_QUALITY 157
+#define ENM4A_COVER_RECOMPRESS 158
+#define ENM4A_COVER_CACHE_OPT 159
+#define ENM4A_PLAN_OPT 160
+#define ENM4A_FINGERPRINT_OPT 161
+#define ENM4A_ENCODER 162
+#define ENM4A_DECODER_THREADS 163
+#define ENM4A_ENCODER_THREADS 164
+#define ENM4A_THREAD_TYPE_OPT 165
 
 int main(int argc, char* argv[]) {
 #if _WIN32
@@ -136,12 +379,68 @@ int main(int argc, char* argv[]) {
         {"bitrate", 1, nullptr, 'b'},
         {"print_level", 0, nullptr, ENM4A_PRINT_LEVEL},
         {"print-level", 0, nullptr, ENM4A_PRINT_LEVEL},
+        {"jobs", 1, nullptr, 'j'},
+        {"batch", 1, nullptr, ENM4A_BATCH},
+        {"pipeline", 0, nullptr, ENM4A_PIPELINE},
+        {"loudness", 0, nullptr, ENM4A_LOUDNESS_OPT},
+        {"retag", 0, nullptr, ENM4A_RETAG},
+        {"incremental", 1, nullptr, ENM4A_INCREMENTAL},
+        {"serve", 1, nullptr, ENM4A_SERVE},
+        {"readahead", 1, nullptr, ENM4A_READAHEAD},
+        {"progress", 1, nullptr, ENM4A_PROGRESS_OPT},
+        {"progress-output", 1, nullptr, ENM4A_PROGRESS_OUTPUT},
+        {"trace-dump", 1, nullptr, ENM4A_TRACE_DUMP},
+        {"resampler", 1, nullptr, ENM4A_RESAMPLER_OPT},
+        {"faststart", 1, nullptr, ENM4A_FASTSTART_OPT},
+        {"fragment", 1, nullptr, ENM4A_FRAGMENT},
+        {"segment-threads", 1, nullptr, ENM4A_SEGMENT_THREADS},
+        {"extra-output", 1, nullptr, ENM4A_EXTRA_OUTPUT},
+        {"probesize", 1, nullptr, ENM4A_PROBESIZE},
+        {"analyzeduration", 1, nullptr, ENM4A_ANALYZEDURATION},
+        {"input-format", 1, nullptr, ENM4A_INPUT_FORMAT},
+        {"trust-headers", 0, nullptr, ENM4A_TRUST_HEADERS},
+        {"start", 1, nullptr, ENM4A_START},
+        {"duration", 1, nullptr, ENM4A_DURATION},
+        {"cue", 1, nullptr, ENM4A_CUE},
+        {"cover-max-size", 1, nullptr, ENM4A_COVER_MAX_SIZE},
+        {"cover-quality", 1, nullptr, ENM4A_COVER_QUALITY},
+        {"cover-recompress", 0, nullptr, ENM4A_COVER_RECOMPRESS},
+        {"cover-cache", 1, nullptr, ENM4A_COVER_CACHE_OPT},
+        {"plan", 0, nullptr, ENM4A_PLAN_OPT},
+        {"fingerprint", 0, nullptr, ENM4A_FINGERPRINT_OPT},
+        {"encoder", 1, nullptr, ENM4A_ENCODER},
+        {"decoder-threads", 1, nullptr, ENM4A_DECODER_THREADS},
+        {"encoder-threads", 1, nullptr, ENM4A_ENCODER_THREADS},
+        {"thread-type", 1, nullptr, ENM4A_THREAD_TYPE_OPT},
         nullptr,
     };
     int c;
-    const char* shortopts = "-ho:vd:t:c:a:A:T:D:ynVH:s:b:";
+    const char* shortopts = "-ho:vd:t:c:a:A:T:D:ynVH:s:b:j:";
     std::string output = "";
-    std::string input = "";
+    std::list<std::string> inputs;
+    std::list<std::string> manifests;
+    std::string incremental_manifest;
+    std::string serve_path;
+    bool json_progress = false;
+    std::string progress_output = "-";
+    std::string trace_dump;
+    std::string input_format;
+    size_t probesize = 0;
+    double analyzeduration = 0;
+    bool trust_headers = false;
+    double start_time = 0;
+    double duration = 0;
+    std::string cue_path;
+    int cover_max_size = 0;
+    int cover_quality = ENM4A_DEFAULT_COVER_QUALITY;
+    bool cover_recompress = false;
+    std::string cover_cache_dir;
+    bool plan = false;
+    bool fingerprint = false;
+    std::string encoder;
+    int decoder_threads = 0;
+    int encoder_threads = 0;
+    ENM4A_THREAD_TYPE thread_type = ENM4A_THREAD_TYPE_DEFAULT;
     ENM4A_LOG level = ENM4A_LOG_INFO;
     std::string title = "";
     std::string cover = "";
@@ -151,6 +450,8 @@ int main(int argc, char* argv[]) {
     std::string disc = "";
     std::string track = "";
     std::string date = "";
+    /// Tag options which are given, even if empty. Empty value removes tag in retag mode.
+    std::set<int> given_tags;
     ENM4A_OVERWRITE overwrite = ENM4A_OVERWRITE_ASK;
     bool printv = false;
     Enm4aHTTPHeaderList headers;
@@ -160,6 +461,17 @@ int main(int argc, char* argv[]) {
     int sample_rate = -1;
     int64_t bitrate = -1;
     bool print_level = false;
+    int jobs = 0;
+    bool pipeline = false;
+    bool loudness = false;
+    bool retag = false;
+    ENM4A_RESAMPLER resampler = ENM4A_RESAMPLER_DEFAULT;
+    ENM4A_FASTSTART faststart = ENM4A_FASTSTART_NONE;
+    double fragment = -1;
+    int segment_threads = -1;
+    size_t readahead = 0;
+    std::list<std::string> extra_output_paths;
+    std::vector<ENM4A_OUTPUT> extra_outputs;
     while ((c = getopt_long(argc, argv, shortopts, opts, nullptr)) != -1) {
         switch (c) {
         case 'h':
@@ -182,27 +494,35 @@ int main(int argc, char* argv[]) {
             break;
         case 't':
             title = optarg;
+            given_tags.insert(c);
             break;
         case 'c':
             cover = optarg;
+            given_tags.insert(c);
             break;
         case 'a':
             artist = optarg;
+            given_tags.insert(c);
             break;
         case 'A':
             album = optarg;
+            given_tags.insert(c);
             break;
         case ENM4A_ALBUM_ARTIST:
             album_artist = optarg;
+            given_tags.insert(c);
             break;
         case 'd':
             disc = optarg;
+            given_tags.insert(c);
             break;
         case 'T':
             track = optarg;
+            given_tags.insert(c);
             break;
         case 'D':
             date = optarg;
+            given_tags.insert(c);
             break;
         case 'y':
             overwrite = ENM4A_OVERWRITE_YES;
@@ -226,24 +546,7 @@ int main(int argc, char* argv[]) {
             }
             break;
         case ENM4A_DEFAULT_SAMPLE_RATE:
-            if (sscanf(optarg, "%d", &default_sample_rate) == 1) {
-                int re = 0;
-                err = enm4a_is_supported_sample_rates(default_sample_rate, &re);
-                if (err != ENM4A_OK) {
-                    printf("Can not check defualt sample rate is supported by AAC encoder: %s\n", enm4a_error_msg(err));
-#if _WIN32
-                    if (have_wargv) wchar_util::freeArgv(wargv, wargc);
-#endif
-                    return 1;
-                }
-                if (!re) {
-                    printf("%i is not supported by AAC encoder.", default_sample_rate);
-#if _WIN32
-                    if (have_wargv) wchar_util::freeArgv(wargv, wargc);
-#endif
-                    return 1;
-                }
-            } else {
+            if (sscanf(optarg, "%d", &default_sample_rate) != 1) {
                 printf("defualt_sample_rate should be a integer.\n");
 #if _WIN32
                 if (have_wargv) wchar_util::freeArgv(wargv, wargc);
@@ -252,24 +555,7 @@ int main(int argc, char* argv[]) {
             }
             break;
         case 's':
-            if (sscanf(optarg, "%d", &sample_rate) == 1) {
-                int re = 0;
-                err = enm4a_is_supported_sample_rates(sample_rate, &re);
-                if (err != ENM4A_OK) {
-                    printf("Can not check sample rate is supported by AAC encoder: %s\n", enm4a_error_msg(err));
-#if _WIN32
-                    if (have_wargv) wchar_util::freeArgv(wargv, wargc);
-#endif
-                    return 1;
-                }
-                if (!re) {
-                    printf("%i is not supported by AAC encoder.", sample_rate);
-#if _WIN32
-                    if (have_wargv) wchar_util::freeArgv(wargv, wargc);
-#endif
-                    return 1;
-                }
-            } else {
+            if (sscanf(optarg, "%d", &sample_rate) != 1) {
                 printf("Sample rate should be a integer.\n");
 #if _WIN32
                 if (have_wargv) wchar_util::freeArgv(wargv, wargc);
@@ -288,20 +574,243 @@ int main(int argc, char* argv[]) {
             }
             bitrate = bits;
             break;
+        case ENM4A_READAHEAD:
+            if (!fileop::parse_size(optarg, readahead, true)) {
+                printf("Can not parse size string.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
         case ENM4A_PRINT_LEVEL:
             print_level = true;
             break;
-        case 1:
-            if (!input.length()) {
-                input = optarg;
+        case 'j':
+            if (sscanf(optarg, "%d", &jobs) != 1 || jobs < 0) {
+                printf("Jobs should be a non-negative integer.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_INCREMENTAL:
+            incremental_manifest = optarg;
+            break;
+        case ENM4A_BATCH:
+            manifests.push_back(optarg);
+            break;
+        case ENM4A_SERVE:
+            serve_path = optarg;
+            break;
+        case ENM4A_PROGRESS_OPT:
+            if (strcmp(optarg, "json")) {
+                printf("Unknown progress format: %s\n", optarg);
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            json_progress = true;
+            break;
+        case ENM4A_PROGRESS_OUTPUT:
+            progress_output = optarg;
+            break;
+        case ENM4A_TRACE_DUMP:
+            trace_dump = optarg;
+            break;
+        case ENM4A_PIPELINE:
+            pipeline = true;
+            break;
+        case ENM4A_LOUDNESS_OPT:
+            loudness = true;
+            break;
+        case ENM4A_RETAG:
+            retag = true;
+            break;
+        case ENM4A_RESAMPLER_OPT:
+            if (!strcmp(optarg, "fast")) {
+                resampler = ENM4A_RESAMPLER_FAST;
+            } else if (!strcmp(optarg, "default")) {
+                resampler = ENM4A_RESAMPLER_DEFAULT;
+            } else if (!strcmp(optarg, "high")) {
+                resampler = ENM4A_RESAMPLER_HIGH;
             } else {
-                printf("%s\n", "Too much input files.");
+                printf("Unknown resampler profile: %s\n", optarg);
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_EXTRA_OUTPUT: {
+            ENM4A_OUTPUT o;
+            std::string path;
+            if (!parse_extra_output(optarg, path, o)) {
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            extra_output_paths.push_back(path);
+            extra_outputs.push_back(o);
+            break;
+        }
+        case ENM4A_SEGMENT_THREADS:
+            if (sscanf(optarg, "%d", &segment_threads) != 1 || segment_threads < 0) {
+                printf("Segment threads should be a non-negative integer.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            if (!segment_threads) segment_threads = std::thread::hardware_concurrency();
+            if (!segment_threads) segment_threads = 1;
+            break;
+        case ENM4A_PROBESIZE:
+            if (!fileop::parse_size(optarg, probesize, true) || probesize < 32) {
+                printf("Probe size should be a size not less than 32 bytes.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_ANALYZEDURATION:
+            if (sscanf(optarg, "%lf", &analyzeduration) != 1 || analyzeduration <= 0) {
+                printf("Analyze duration should be a positive number.\n");
 #if _WIN32
                 if (have_wargv) wchar_util::freeArgv(wargv, wargc);
 #endif
                 return 1;
             }
             break;
+        case ENM4A_INPUT_FORMAT:
+            input_format = optarg;
+            break;
+        case ENM4A_TRUST_HEADERS:
+            trust_headers = true;
+            break;
+        case ENM4A_START:
+            if (sscanf(optarg, "%lf", &start_time) != 1 || start_time < 0) {
+                printf("Start time should be a non-negative number.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_DURATION:
+            if (sscanf(optarg, "%lf", &duration) != 1 || duration <= 0) {
+                printf("Duration should be a positive number.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_CUE:
+            cue_path = optarg;
+            break;
+        case ENM4A_COVER_MAX_SIZE:
+            if (sscanf(optarg, "%d", &cover_max_size) != 1 || cover_max_size <= 0) {
+                printf("Cover max size should be a positive integer.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_COVER_QUALITY:
+            if (sscanf(optarg, "%d", &cover_quality) != 1 || cover_quality < 2 || cover_quality > 31) {
+                printf("Cover quality should be an integer between 2 and 31.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_COVER_RECOMPRESS:
+            cover_recompress = true;
+            break;
+        case ENM4A_COVER_CACHE_OPT:
+            cover_cache_dir = optarg;
+            break;
+        case ENM4A_PLAN_OPT:
+            plan = true;
+            break;
+        case ENM4A_FINGERPRINT_OPT:
+            fingerprint = true;
+            break;
+        case ENM4A_ENCODER:
+            encoder = optarg;
+            if (!enm4a_aac_encoder_name(optarg)) {
+                printf("AAC encoder is not available: %s\n", optarg);
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_DECODER_THREADS:
+            if (!parse_codec_threads(optarg, decoder_threads)) {
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_ENCODER_THREADS:
+            if (!parse_codec_threads(optarg, encoder_threads)) {
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_THREAD_TYPE_OPT:
+            if (!strcmp(optarg, "auto")) {
+                thread_type = ENM4A_THREAD_TYPE_DEFAULT;
+            } else if (!strcmp(optarg, "frame")) {
+                thread_type = ENM4A_THREAD_TYPE_FRAME;
+            } else if (!strcmp(optarg, "slice")) {
+                thread_type = ENM4A_THREAD_TYPE_SLICE;
+            } else {
+                printf("Unknown thread type: %s\n", optarg);
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_FRAGMENT:
+            if (sscanf(optarg, "%lf", &fragment) != 1 || fragment <= 0) {
+                printf("Fragment duration should be a positive number.\n");
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case ENM4A_FASTSTART_OPT:
+            if (!strcmp(optarg, "none")) {
+                faststart = ENM4A_FASTSTART_NONE;
+            } else if (!strcmp(optarg, "reserve")) {
+                faststart = ENM4A_FASTSTART_RESERVE;
+            } else if (!strcmp(optarg, "rewrite")) {
+                faststart = ENM4A_FASTSTART_REWRITE;
+            } else {
+                printf("Unknown faststart mode: %s\n", optarg);
+#if _WIN32
+                if (have_wargv) wchar_util::freeArgv(wargv, wargc);
+#endif
+                return 1;
+            }
+            break;
+        case 1:
+            inputs.push_back(optarg);
+            break;
         case '?':
         default:
 #if _WIN32
@@ -317,17 +826,220 @@ int main(int argc, char* argv[]) {
         print_version(level >= ENM4A_LOG_VERBOSE);
         return 0;
     }
-    if (!input.length()) {
+    if (!inputs.size() && !manifests.size() && !serve_path.length() && !cue_path.length()) {
         printf("%s\n", "An input file is needed.");
         return 1;
     }
-    if (level >= ENM4A_LOG_VERBOSE) {
-        printf("Get input file name: %s\n", input.c_str());
+    // Checked after all options are parsed, so --encoder can be given after sample rate options.
+    if (!retag) {
+        if (default_sample_rate > -1 && !check_sample_rate(encoder, default_sample_rate)) return 1;
+        if (sample_rate > -1 && !check_sample_rate(encoder, sample_rate)) return 1;
+        for (auto i = extra_outputs.begin(); i != extra_outputs.end(); i++) {
+            if (i->sample_rate && !check_sample_rate(encoder, i->sample_rate)) return 1;
+        }
+    }
+    Enm4aCueSheet sheet;
+    std::vector<std::string> track_outputs;
+    std::vector<std::string> track_numbers;
+    std::vector<ENM4A_SPLIT_TRACK> split_tracks;
+    if (cue_path.length()) {
+        if (retag || inputs.size() > 1 || manifests.size() || serve_path.length() || extra_outputs.size() || incremental_manifest.length()) {
+            printf("%s\n", "CUE sheet can only be used with a single input, and can not be used with retag, batch, server, extra output and incremental mode.");
+            return 1;
+        }
+        if (loudness || fingerprint || fragment > 0 || start_time > 0 || duration > 0) {
+            printf("%s\n", "CUE sheet can not be used with loudness, fingerprint, fragment, start time and duration.");
+            return 1;
+        }
+        if (!enm4a_read_cue_sheet(cue_path, sheet)) return 1;
+        std::string dir = fileop::dirname(cue_path);
+        if (!inputs.size()) {
+            if (!sheet.file.length()) {
+                printf("%s\n", "CUE sheet does not have a FILE.");
+                return 1;
+            }
+            inputs.push_back(dir.length() && !fileop::isabs(sheet.file) ? fileop::join(dir, sheet.file) : sheet.file);
+        }
+        std::string out_dir = output.length() ? output : dir;
+        output.clear();
+        for (auto i = sheet.tracks.begin(); i != sheet.tracks.end(); i++) {
+            std::string name = enm4a_cue_track_filename(*i);
+            track_outputs.push_back(out_dir.length() ? fileop::join(out_dir, name) : name);
+            track_numbers.push_back(std::to_string(i->number) + "/" + std::to_string(sheet.tracks.size()));
+        }
+        split_tracks.resize(sheet.tracks.size());
+        for (size_t i = 0; i < sheet.tracks.size(); i++) {
+            Enm4aCueTrack& t = sheet.tracks[i];
+            split_tracks[i].start = t.start;
+            split_tracks[i].output = (char*)track_outputs[i].c_str();
+            split_tracks[i].title = t.title.length() ? (char*)t.title.c_str() : nullptr;
+            split_tracks[i].artist = t.performer.length() ? (char*)t.performer.c_str() : nullptr;
+            split_tracks[i].track = (char*)track_numbers[i].c_str();
+            split_tracks[i].genre = sheet.genre.length() ? (char*)sheet.genre.c_str() : nullptr;
+        }
+        if (!album.length()) album = sheet.title;
+        if (!album_artist.length()) album_artist = sheet.performer;
+        if (!artist.length()) artist = sheet.performer;
+        if (!date.length()) date = sheet.date;
     }
     ENM4A_ARGS arg;
     init_enm4a_args(&arg);
     arg.level = level;
     arg.overwrite = overwrite;
+    if (pipeline) arg.pipeline = 1;
+    if (loudness) arg.loudness = 1;
+    if (fingerprint) arg.fingerprint = 1;
+    if (encoder.length()) arg.encoder = encoder.c_str();
+    arg.decoder_threads = decoder_threads;
+    arg.encoder_threads = encoder_threads;
+    arg.thread_type = thread_type;
+    arg.resampler = resampler;
+    arg.faststart = faststart;
+    if (fragment > 0) arg.fragment_duration = (int64_t)(fragment * 1000000);
+    if (segment_threads > 0) arg.segment_threads = segment_threads;
+    arg.readahead = readahead;
+    arg.probesize = (int64_t)probesize;
+    if (analyzeduration > 0) arg.analyzeduration = (int64_t)(analyzeduration * 1000000);
+    if (input_format.length()) arg.input_format = input_format.c_str();
+    if (trust_headers) arg.trust_headers = 1;
+    arg.start_time = (int64_t)(start_time * 1000000);
+    arg.duration = (int64_t)(duration * 1000000);
+    arg.cover_max_size = cover_max_size;
+    arg.cover_quality = cover_quality;
+    if (cover_recompress) arg.cover_recompress = 1;
+    Enm4aCoverCache cover_cache;
+    if (!(cover_cache.cache = enm4a_cover_cache_alloc(cover_cache_dir.length() ? cover_cache_dir.c_str() : nullptr))) {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    arg.cover_cache = cover_cache.cache;
+    Enm4aIncremental incremental;
+    if (incremental_manifest.length() && !incremental.load(incremental_manifest)) return 1;
+    if (plan && (retag || serve_path.length() || cue_path.length())) {
+        printf("%s\n", "Plan can not be used in retag mode, server mode and CUE split mode.");
+        return 1;
+    }
+    if (json_progress && (retag || serve_path.length())) {
+        printf("%s\n", "Progress can not be used in retag mode and server mode.");
+        return 1;
+    }
+    Enm4aTelemetry telemetry;
+    if (json_progress || plan) {
+        if (!telemetry.open(progress_output)) return 1;
+        if (telemetry.is_stdout()) arg.quiet = 1;
+    }
+    Enm4aTraceWriter trace_writer;
+    if (level >= ENM4A_LOG_TRACE || trace_dump.length()) {
+        ENM4A_ERROR te = enm4a_trace_start(trace_dump.length() ? trace_dump.c_str() : nullptr);
+        if (te != ENM4A_OK) {
+            printf("Can not start trace writer: %s\n", enm4a_error_msg(te));
+            return 1;
+        }
+    }
+    if (retag) {
+        if (output.length() || manifests.size() || extra_outputs.size() || serve_path.length()) {
+            printf("%s\n", "Output file, manifest file, extra output and server can not be used in retag mode.");
+            return 1;
+        }
+        // Empty value is passed, so the tag is removed.
+        if (given_tags.count('t') && !cpp2c::string2char(title, arg.title)) return 1;
+        if (given_tags.count('c') && !cpp2c::string2char(cover, arg.cover)) return 1;
+        if (given_tags.count('a') && !cpp2c::string2char(artist, arg.artist)) return 1;
+        if (given_tags.count('A') && !cpp2c::string2char(album, arg.album)) return 1;
+        if (given_tags.count(ENM4A_ALBUM_ARTIST) && !cpp2c::string2char(album_artist, arg.album_artist)) return 1;
+        if (given_tags.count('d') && !cpp2c::string2char(disc, arg.disc)) return 1;
+        if (given_tags.count('T') && !cpp2c::string2char(track, arg.track)) return 1;
+        if (given_tags.count('D') && !cpp2c::string2char(date, arg.date)) return 1;
+        size_t failed = 0;
+        for (auto i = inputs.begin(); i != inputs.end(); i++) {
+            ENM4A_ERROR re = retag_m4a(i->c_str(), arg);
+            if (re != ENM4A_OK) {
+                printf("Failed to retag %s: %s\n", i->c_str(), enm4a_error_msg(re));
+                failed++;
+            } else if (level >= ENM4A_LOG_VERBOSE) {
+                printf("Retagged %s\n", i->c_str());
+            }
+        }
+        enm4a_free_job_args(arg);
+        return failed ? 1 : 0;
+    }
+    if (inputs.size() > 1 || manifests.size() || serve_path.length()) {
+        if (output.length()) {
+            printf("%s\n", "Output file can not be specified in batch mode. Use output field in manifest file instead.");
+            return 1;
+        }
+        if (extra_outputs.size()) {
+            printf("%s\n", "Extra output can not be specified in batch mode.");
+            return 1;
+        }
+        Enm4aJob defaults;
+        defaults.title = title;
+        defaults.cover = cover;
+        defaults.artist = artist;
+        defaults.album = album;
+        defaults.album_artist = album_artist;
+        defaults.disc = disc;
+        defaults.track = track;
+        defaults.date = date;
+        defaults.sample_rate = sample_rate;
+        defaults.bitrate = bitrate;
+        std::list<Enm4aJob> job_list;
+        for (auto i = inputs.begin(); i != inputs.end(); i++) {
+            Enm4aJob job = defaults;
+            job.input = *i;
+            job_list.push_back(job);
+        }
+        for (auto i = manifests.begin(); i != manifests.end(); i++) {
+            if (!enm4a_read_batch_manifest(*i, defaults, job_list)) return 1;
+        }
+        for (auto i = job_list.begin(); i != job_list.end(); i++) {
+            if (i->sample_rate > -1 && i->sample_rate != sample_rate && !check_sample_rate(encoder, i->sample_rate)) return 1;
+        }
+        if (serve_path.length() && job_list.size()) {
+            printf("%s\n", "Input file and manifest file can not be used in server mode.");
+            return 1;
+        }
+        if (!job_list.size() && !serve_path.length()) {
+            printf("%s\n", "No jobs found.");
+            return 1;
+        }
+        if (overwrite == ENM4A_OVERWRITE_ASK) arg.overwrite = ENM4A_OVERWRITE_NO;
+        if (headers.size()) {
+            arg.http_header_size = headers.size();
+            arg.http_headers = (ENM4A_HTTP_HEADER**)malloc(arg.http_header_size * sizeof(void*));
+            if (!arg.http_headers) {
+                printf("Out of memory!\n");
+                return 1;
+            }
+            size_t j = 0;
+            for (auto i = headers.begin(); i != headers.end(); i++) {
+                arg.http_headers[j++] = *i;
+            }
+        }
+        if (default_sample_rate > -1) {
+            arg.default_sample_rate = default_sample_rate;
+        }
+        if (print_level) arg.print_level = 1;
+        if (plan) {
+            size_t failed = enm4a_plan_batch(job_list, arg, (unsigned int)jobs, telemetry);
+            if (arg.http_headers) free(arg.http_headers);
+            return failed ? 1 : 0;
+        }
+        if (serve_path.length()) {
+            bool ok = enm4a_serve(serve_path, arg, defaults, (unsigned int)jobs, incremental_manifest.length() ? &incremental : nullptr);
+            if (arg.http_headers) free(arg.http_headers);
+            if (incremental_manifest.length() && !incremental.save()) return 1;
+            return ok ? 0 : 1;
+        }
+        size_t failed = enm4a_run_batch(job_list, arg, (unsigned int)jobs, incremental_manifest.length() ? &incremental : nullptr, json_progress ? &telemetry : nullptr);
+        if (arg.http_headers) free(arg.http_headers);
+        if (incremental_manifest.length() && !incremental.save()) return 1;
+        return failed ? 1 : 0;
+    }
+    std::string input = inputs.front();
+    if (level >= ENM4A_LOG_VERBOSE) {
+        printf("Get input file name: %s\n", input.c_str());
+    }
     if (output.length()) {
         if (!cpp2c::string2char(output, arg.output)) return 1;
     }
@@ -363,7 +1075,49 @@ int main(int argc, char* argv[]) {
         arg.bitrate = bitrate;
     }
     if (print_level) arg.print_level = 1;
-    ENM4A_ERROR re = encode_m4a(input.c_str(), arg);
+    if (extra_outputs.size()) {
+        auto path = extra_output_paths.begin();
+        for (auto i = extra_outputs.begin(); i != extra_outputs.end(); i++, path++) {
+            i->output = (char*)path->c_str();
+        }
+        arg.outputs = extra_outputs.data();
+        arg.output_count = extra_outputs.size();
+    }
+    ENM4A_ERROR re = ENM4A_OK;
+    ENM4A_STATS stats;
+    Enm4aFileId input_id;
+    uint64_t args_hash = 0;
+    ENM4A_INCREMENTAL_STATE state = ENM4A_INCREMENTAL_UNKNOWN;
+    std::vector<std::string> previous_outputs;
+    std::vector<const char*> replaceable;
+    Enm4aTelemetryJob telemetry_job;
+    memset(&stats, 0, sizeof(ENM4A_STATS));
+    if (json_progress && !plan) {
+        arg.stats = &stats;
+        telemetry.attach(telemetry_job, input, arg);
+    }
+    if (incremental_manifest.length() && !plan) {
+        arg.stats = &stats;
+        args_hash = enm4a_hash_args(arg);
+        state = incremental.check(input, args_hash, input_id, previous_outputs);
+        if (state == ENM4A_INCREMENTAL_OUTDATED) enm4a_set_replaceable_outputs(arg, previous_outputs, replaceable);
+    }
+    if (plan) {
+        ENM4A_PLAN p;
+        re = enm4a_plan(input.c_str(), arg, &p);
+        telemetry.write_plan(input, re, p);
+    } else if (state == ENM4A_INCREMENTAL_UP_TO_DATE) {
+        if (!json_progress || !telemetry.is_stdout()) printf("%s is up to date.\n", input.c_str());
+    } else {
+        re = cue_path.length() ? encode_m4a_split(input.c_str(), split_tracks.data(), split_tracks.size(), arg) : encode_m4a(input.c_str(), arg);
+    }
+    if (json_progress && !plan) telemetry.write_summary(telemetry_job, re, stats.output ? stats.output : "", state == ENM4A_INCREMENTAL_UP_TO_DATE, stats.fingerprint);
+    if (re == ENM4A_OK && stats.output && incremental_manifest.length()) {
+        incremental.update(input, input_id, args_hash, stats.output, enm4a_extra_outputs(arg));
+    }
+    if (stats.output) free(stats.output);
+    if (stats.fingerprint) free(stats.fingerprint);
+    if (incremental_manifest.length() && !incremental.save()) re = ENM4A_ERR_OPEN_FILE;
     if (arg.output) {
         free(arg.output);
     }